@@ -250,7 +250,10 @@ struct plm_sigact plm_sig[] = {
 	{ SIGQUIT, plm_sig_handler, 1, 0 },
 	{ SIGINT, plm_sig_handler, 1, 0 },
 	{ SIGTERM, plm_sig_handler, 1, 0 },
-	{ SIGHUP, plm_sig_handler, 1, 1 }
+	{ SIGHUP, plm_sig_handler, 1, 1 },
+
+	/* splice to a reset peer raises it, there is no MSG_NOSIGNAL */
+	{ SIGPIPE, SIG_IGN, 0, 0 }
 };
 
 int plm_step_signal()
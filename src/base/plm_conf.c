@@ -597,7 +597,8 @@ plm_conf_parse_ins(void **ctx, struct plm_mempool *p, char *line, int len)
 		}
 	}
 
-	if (plm_conf_set_cmd(&cl, *ctx)) {
+	/* a '}' or blank line carries no command */
+	if (cl.cl_stat && plm_conf_set_cmd(&cl, *ctx)) {
 		err_msg = "parameter parse failed";
 		goto PARSE_FAILED;
 	}
@@ -617,7 +618,7 @@ plm_conf_parse_line(plm_stack_node_t **n, struct plm_mempool *p,
 					char *line, int len)
 {
 	plm_conf_parse_state_t rc;
-	struct plm_block_ctx *curr_ctx;
+	struct plm_block_ctx *curr_ctx = NULL;
 
 	if (*n) {
 		curr_ctx = (struct plm_block_ctx *)
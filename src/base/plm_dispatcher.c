@@ -33,6 +33,9 @@
 #include "plm_plugin_base.h"
 #include "plm_threads.h"
 #include "plm_event.h"
+#include "plm_task.h"
+#include "plm_timer.h"
+#include "plm_clock.h"
 #include "plm_sync_mech.h"
 #include "plm_conf.h"
 #include "plm_atomic.h"
@@ -48,6 +51,12 @@ static plm_lock_t disp_lock;
 static volatile int disp_status;
 static int disp_thrdn;
 
+/* set by other threads when global poller needs one more poll */
+static int disp_global_pending;
+
+/* set by the nested global poller event of this thread */
+static __thread int disp_global_ready;
+
 pid_t gettid()
 {
 	return syscall(SYS_gettid);
@@ -80,7 +89,12 @@ int plm_disp_start()
  */
 void plm_disp_shutdown()
 {
+	int i;
+
 	disp_status = PLM_DISP_SHUTDOWN;
+	for (i = 0; i < disp_thrdn; i++)
+		plm_task_wakeup(i);
+
 	plm_threads_end();
 	if (disp_thrdn > 1)
 		plm_lock_destroy(&disp_lock);
@@ -112,6 +126,56 @@ static int plm_disp_open_log()
 	return (0);
 }
 
+static void plm_disp_run(struct plm_event_io_handler *events, int n)
+{
+	int i;
+
+	/* a handler may close the fd of a later event */
+	plm_event_io_running(events, n);
+	for (i = 0; i < n; i++) {
+		int fd = events[i].eih_fd;
+		if (events[i].eih_onread)
+			events[i].eih_onread(events[i].eih_rddata, fd);
+		if (events[i].eih_onwrite)
+			events[i].eih_onwrite(events[i].eih_wrdata, fd);
+	}
+	plm_event_io_running(NULL, 0);
+}
+
+/* the global poller is nested in every thread local poller, it is
+ * edge triggered, a thread fails to get the lock leaves the pending
+ * flag so that the lock holder polls again and no edge is lost
+ */
+static void plm_disp_proc_global()
+{
+	struct plm_event_io_handler events[MAX_EVENTS];
+	int max = sizeof(events) / sizeof(events[0]);
+
+	for (;;) {
+		int n;
+
+		plm_atomic_xchg(&disp_global_pending, 1);
+		if (plm_lock_trylock(&disp_lock))
+			return;
+
+		do {
+			plm_atomic_xchg(&disp_global_pending, 0);
+			n = plm_event_io_poll2(events, max, 0);
+			if (n > 0)
+				plm_disp_run(events, n);
+		} while (n == max || plm_atomic_int_get(&disp_global_pending));
+
+		plm_lock_unlock(&disp_lock);
+		if (!plm_atomic_int_get(&disp_global_pending))
+			return;
+	}
+}
+
+static void plm_disp_on_global(void *data, int fd)
+{
+	disp_global_ready = 1;
+}
+
 /* process, main loop
  * never return until shutdown
  */
@@ -122,6 +186,24 @@ void plm_disp_proc()
 
 	if (plm_disp_open_log())
 		return;
+
+	if (plm_task_thrd_init()) {
+		plm_log_write(PLM_LOG_FATAL, "task queue init failed");
+		return;
+	}
+
+	/* with reuseport every thread owns its listen socket and
+	 * the global poller is never used
+	 */
+	if (!main_ctx.mc_reuseport) {
+		if (plm_event_io_nest(NULL, plm_disp_on_global)) {
+			plm_log_write(PLM_LOG_FATAL, "nest global poller failed");
+			return;
+		}
+
+		/* events came before nest */
+		disp_global_ready = 1;
+	}
 	
 	if (plm_plugin_work_thrd_init()) {
 		plm_log_write(PLM_LOG_FATAL, "work thread init hook failed");
@@ -130,50 +212,58 @@ void plm_disp_proc()
 	
 	plm_log_write(PLM_LOG_TRACE, "run in thread: %d", gettid());
 	plm_atomic_test_and_set(&disp_status, PLM_DISP_SHUTDOWN, PLM_DISP_RUNNING);
+	plm_clock_update();
 	for (;;) {
-		int i, n = 0;
-		int timeout = 0;
+		int n, timeout, busy;
 
 		/* work thread read status here */
 		if (plm_atomic_int_get(&disp_status) != PLM_DISP_RUNNING)
 			break;
 
 		/* process global */
-		if (!plm_lock_trylock(&disp_lock)) {
-			n = plm_event_io_poll2(events, max, timeout);
-			for (i = 0; i < n; i++) {
-				int fd = events[i].eih_fd;
-				if (events[i].eih_onread)
-					events[i].eih_onread(events[i].eih_rddata, fd);
-				if (events[i].eih_onwrite)
-					events[i].eih_onwrite(events[i].eih_wrdata, fd);
-			}
-			plm_lock_unlock(&disp_lock);
+		if (disp_global_ready) {
+			disp_global_ready = 0;
+			plm_disp_proc_global();
 		}
 
-		/* check and run timer */
+		/* tasks posted by other threads, before timer so a timer
+		 * added by a task is counted in timeout
+		 */
+		busy = plm_task_run();
+
+		/* check and run timer, sleep until the next timer expire,
+		 * tasks and shutdown wake us up by eventfd
+		 */
 		timeout = plm_timer_run();
-		if (n == 0 && timeout == 0)
-			timeout = 100;
+		if (busy)
+			timeout = 0;
 
 		/* thread local */
 		n = plm_event_io_poll(events, max, timeout);
-		for (i = 0; i < n; i++) {
-			int fd = events[i].eih_fd;
-			if (events[i].eih_onread)
-				events[i].eih_onread(events[i].eih_rddata, fd);
-			if (events[i].eih_onwrite)
-				events[i].eih_onwrite(events[i].eih_wrdata, fd);
-		}
+
+		/* the only update of the thread clock per loop, after the
+		 * sleep so events, tasks and timers see the wake up time
+		 */
+		plm_clock_update();
+		if (n > 0)
+			plm_disp_run(events, n);
 	}
 
 	plm_log_close();
 	plm_plugin_work_thrd_destroy();
+	plm_task_thrd_destroy();
 }
 
 /* notify threads to exit and return immediately */
 void plm_disp_notify_exit()
 {
+	int i;
+
 	plm_atomic_test_and_set(&disp_status, PLM_DISP_RUNNING, PLM_DISP_SHUTDOWN);
+
+	/* threads may sleep in poller without timeout */
+	for (i = 0; i < disp_thrdn; i++)
+		plm_task_wakeup(i);
+
 	plm_log_write(PLM_LOG_TRACE, "current status: %d", disp_status);
 }
@@ -35,6 +35,9 @@
 #include "plm_comm.h"
 #include "plm_threads.h"
 #include "plm_timer.h"
+#include "plm_event.h"
+#include "plm_task.h"
+#include "plm_buffer.h"
 #include "plm_plugin_base.h"
 
 static int plm_logpath_set(void *, plm_dlist_t *);
@@ -45,6 +48,10 @@ static int plm_work_thread_cpu_affinity_set(void *, plm_dlist_t *);
 static int plm_memtag_set(void *, plm_dlist_t *);
 static int plm_tagcheck_set(void *, plm_dlist_t *);
 static int plm_zeromem_set(void *, plm_dlist_t *);
+static int plm_reuseport_set(void *, plm_dlist_t *);
+static int plm_event_io_set(void *, plm_dlist_t *);
+static int plm_log_async_set(void *, plm_dlist_t *);
+static int plm_log_format_set(void *, plm_dlist_t *);
 
 static void *plm_main_ctx_create(void *unused);
 static void plm_main_ctx_destroy(void *ctx);
@@ -125,6 +132,38 @@ static struct plm_cmd main_cmd[] = {
 		NULL,
 		NULL
 	},
+	{
+		&main_plugin,
+		plm_string("reuseport"),
+		PLM_INSTRUCTION,
+		plm_reuseport_set,
+		NULL,
+		NULL
+	},
+	{
+		&main_plugin,
+		plm_string("event_io"),
+		PLM_INSTRUCTION,
+		plm_event_io_set,
+		NULL,
+		NULL
+	},
+	{
+		&main_plugin,
+		plm_string("log_async"),
+		PLM_INSTRUCTION,
+		plm_log_async_set,
+		NULL,
+		NULL
+	},
+	{
+		&main_plugin,
+		plm_string("log_format"),
+		PLM_INSTRUCTION,
+		plm_log_format_set,
+		NULL,
+		NULL
+	},
 	{0}
 };
 
@@ -178,6 +217,7 @@ int plm_plugin_init()
 	sp.sp_tagcheck = main_ctx.mc_tagcheck;
 	sp.sp_zeromem = main_ctx.mc_zeromem;
 	sp.sp_tag = main_ctx.mc_tag;
+	sp.sp_reuseport = main_ctx.mc_reuseport;
 
 	/* init core plugins */
 	for (i = 0; i < sizeof(core_plg) / sizeof(core_plg[0]); i++) {
@@ -216,6 +256,11 @@ void plm_plugin_destroy()
 	int i;
 	plm_list_t *list;
 
+	/* wait for work threads done before the pollers and the task
+	 * queues they sleep on are destroyed
+	 */
+	plm_disp_shutdown();
+
 	list = &main_ctx.mc_ctxs;
 	PLM_LIST_FOREACH(list, plm_plugin_work_proc_destroy_eachone, NULL);
 
@@ -223,8 +268,6 @@ void plm_plugin_destroy()
 		if (core_plg[i]->plg_on_work_proc_exit)
 			core_plg[i]->plg_on_work_proc_exit(NULL);
 	}
-	
-	plm_disp_shutdown();
 }
 
 struct plm_cmd_search {
@@ -475,6 +518,94 @@ int plm_zeromem_set(void *ctx, plm_dlist_t *params)
 	return (0);
 }
 
+int plm_reuseport_set(void *ctx, plm_dlist_t *params)
+{
+	struct plm_cmd_param *param;
+	plm_string_t on = plm_string("on");
+
+	if (PLM_DLIST_LEN(params) != 1)
+		return (-1);
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(params);
+	if (0 == plm_strcmp(&param->cp_data, &on))
+		main_ctx.mc_reuseport = 1;
+	else
+		main_ctx.mc_reuseport = 0;
+
+	return (0);
+}
+
+int plm_log_async_set(void *ctx, plm_dlist_t *params)
+{
+	struct plm_cmd_param *param;
+	plm_string_t on = plm_string("on");
+
+	if (PLM_DLIST_LEN(params) != 1)
+		return (-1);
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(params);
+	if (0 == plm_strcmp(&param->cp_data, &on))
+		main_ctx.mc_log_async = 1;
+	else
+		main_ctx.mc_log_async = 0;
+
+	return (0);
+}
+
+/* log_format text|binary */
+int plm_log_format_set(void *ctx, plm_dlist_t *params)
+{
+	struct plm_cmd_param *param;
+	plm_string_t text = plm_string("text");
+	plm_string_t binary = plm_string("binary");
+
+	if (PLM_DLIST_LEN(params) != 1)
+		return (-1);
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(params);
+	if (0 == plm_strcmp(&param->cp_data, &binary))
+		main_ctx.mc_log_binary = 1;
+	else if (0 == plm_strcmp(&param->cp_data, &text))
+		main_ctx.mc_log_binary = 0;
+	else
+		return (-1);
+
+	return (0);
+}
+
+/* event_io epoll [oneshot|persistent] or event_io io_uring */
+int plm_event_io_set(void *ctx, plm_dlist_t *params)
+{
+	struct plm_cmd_param *param;
+	plm_string_t epoll = plm_string("epoll");
+	plm_string_t io_uring = plm_string("io_uring");
+	plm_string_t oneshot = plm_string("oneshot");
+	plm_string_t persistent = plm_string("persistent");
+
+	if (PLM_DLIST_LEN(params) < 1 || PLM_DLIST_LEN(params) > 2)
+		return (-1);
+
+	main_ctx.mc_event_io_flags = 0;
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(params);
+	if (0 == plm_strcmp(&param->cp_data, &io_uring)) {
+		main_ctx.mc_event_io_flags = PLM_EVENT_IO_URING;
+		return (PLM_DLIST_LEN(params) == 1 ? 0 : -1);
+	}
+
+	if (plm_strcmp(&param->cp_data, &epoll))
+		return (-1);
+
+	param = (struct plm_cmd_param *)PLM_DLIST_NEXT(&param->cp_node);
+	if (param) {
+		if (0 == plm_strcmp(&param->cp_data, &persistent))
+			main_ctx.mc_event_io_flags |= PLM_EVENT_IO_PERSIST;
+		else if (plm_strcmp(&param->cp_data, &oneshot))
+			return (-1);
+	}
+
+	return (0);
+}
+
 void *plm_main_ctx_create(void *unused)
 {
 	extern plm_string_t plm_prefix;
@@ -487,6 +618,10 @@ void *plm_main_ctx_create(void *unused)
 	main_ctx.mc_cpu_affinity_id_num = 0;
 	main_ctx.mc_zeromem = 1;
 	main_ctx.mc_tagcheck = 1;
+	main_ctx.mc_reuseport = 0;
+	main_ctx.mc_log_async = 1;
+	main_ctx.mc_log_binary = 0;
+	main_ctx.mc_event_io_flags = 0;
 	main_ctx.mc_tag = -1;
 	plm_strcat2(&main_ctx.mc_log_path, &plm_prefix, &logs);
 	
@@ -506,29 +641,47 @@ int plm_main_on_work_proc_start(struct plm_ctx_list *ctx)
 {
 	int maxfd = main_ctx.mc_maxfd;
 	int thrdn = main_ctx.mc_work_thread_num;
-	int thrdsafe = thrdn > 1;
 
-	plm_buffer_init(thrdsafe);
-	if (plm_timer_init(thrdn))
+	/* before the work threads open their log files */
+	plm_log_set_format(main_ctx.mc_log_binary ? PLM_LOG_BINARY : PLM_LOG_TEXT);
+	if (main_ctx.mc_log_async && plm_log_async_start())
+		return (-1);
+
+	if (plm_buffer_init(thrdn, main_ctx.mc_zeromem)) {
+		plm_log_async_stop();
 		return (-1);
+	}
+
+	if (plm_timer_init(thrdn)) {
+		plm_buffer_destroy();
+		return (-1);
+	}
 	
 	if (!plm_comm_init(maxfd)) {
-		if (!plm_event_io_init(maxfd, thrdn))
-			return (0);
+		if (!plm_event_io_init(maxfd, thrdn, main_ctx.mc_event_io_flags)) {
+			if (!plm_task_init(thrdn))
+				return (0);
+			plm_event_io_shutdown();
+		}
 
 		plm_comm_destroy();
 	}
 	
 	plm_timer_destroy();
 	plm_buffer_destroy();
+	plm_log_async_stop();
 	return (-1);
 }
 
 void plm_main_on_work_proc_exit(struct plm_ctx_list *ctx)
 {
+	plm_task_destroy();
 	plm_event_io_shutdown();
 	plm_comm_destroy();
 	plm_buffer_destroy();
+
+	/* the work threads have closed their log files */
+	plm_log_async_stop();
 }
 
 static void plm_plugin_work_thrd_init_eachone(void *n, void *data)
@@ -49,6 +49,18 @@ struct plm_main_ctx {
 	/* on/off */
 	uint8_t mc_zeromem : 1;
 	uint8_t mc_tagcheck : 1;
+
+	/* one SO_REUSEPORT listen socket per work thread */
+	uint8_t mc_reuseport : 1;
+
+	/* queue log messages and write them in a background thread */
+	uint8_t mc_log_async : 1;
+
+	/* write log records in binary, see plm_logdump */
+	uint8_t mc_log_binary : 1;
+
+	/* flags pass to plm_event_io_init */
+	int mc_event_io_flags;
 	
 	/* mem node tag */
 	unsigned int mc_tag;
@@ -40,6 +40,18 @@ extern "C" {
 #define plm_atomic_test_and_set(p, f, v) \
 	__sync_val_compare_and_swap((p), (f), (v))
 
+/* store v in *p and return the old value, full barrier */
+#define plm_atomic_xchg(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+
+#define plm_atomic_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define plm_atomic_store_release(p, v) \
+	__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+/* counters need no order with other memory */
+#define plm_atomic_add_relaxed(p, v) \
+	__atomic_add_fetch((p), (v), __ATOMIC_RELAXED)
+#define plm_atomic_load_relaxed(p) __atomic_load_n((p), __ATOMIC_RELAXED)
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,10 +25,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include "plm_lookaside_list.h"
+#include "plm_slab.h"
 #include "plm_buffer.h"
 
-static struct plm_lookaside_list mem_list[MEM_END];
 static size_t mem_size[MEM_END] = {
 	SIZE_8K,
 	SIZE_4K,
@@ -36,16 +35,14 @@ static size_t mem_size[MEM_END] = {
 	SIZE_1K
 };
 
-/* init buffers */
-void plm_buffer_init(int thrdsafe, int tagchk, int zeromem)
+/* init buffers, they are allocated from slab with per-thread cache
+ * @thrdn -- number of thread
+ * @zeromem -- set memory to zero when allocated
+ * return 0 -- success, else error
+ */
+int plm_buffer_init(int thrdn, int zeromem)
 {
-	int i;
-	
-	for (i = 0; i < MEM_END; i++) {
-		plm_lookaside_list_init(&mem_list[i], -1, mem_size[i],
-								-1, malloc, free);
-		plm_lookaside_list_enable(&mem_list[i], zeromem, tagchk, thrdsafe);
-	}
+	return plm_slab_init(thrdn, zeromem);
 }
 
 /* alloc memory buffer 8k, 4k, 2k, 1k
@@ -54,43 +51,20 @@ void plm_buffer_init(int thrdsafe, int tagchk, int zeromem)
  */
 char *plm_buffer_alloc(int type)
 {
-	size_t size = 0;
-
-	switch (type) {
-	case MEM_8K:
-		size = SIZE_8K;
-		break;
-
-	case MEM_4K:
-		size = SIZE_4K;
-		break;
-
-	case MEM_2K:
-		size = SIZE_2K;
-		break;
-
-	case MEM_1K:
-		size = SIZE_1K;
-		break;
-
-	default:
+	if (type < 0 || type >= MEM_END)
 		return (NULL);
-	}
-	
-	return plm_lookaside_list_alloc(&mem_list[type], NULL);
+
+	return (char *)plm_slab_alloc(mem_size[type]);
 }
 
 /* free memory */
 void plm_buffer_free(int type, char *buf)
 {
-	plm_lookaside_list_free(&mem_list[type], buf, NULL);
+	plm_slab_free(buf, mem_size[type]);
 }
 
 /* destroy pool and free all memory */
 void plm_buffer_destroy()
 {
-	int i;
-
-	for (i = 0; i < MEM_END; i++)
-		plm_lookaside_list_destroy(&mem_list[i]);
+	plm_slab_destroy();
 }
@@ -45,8 +45,12 @@ enum {
 	SIZE_1K = 1024,
 };
 
-/* init buffers */
-void plm_buffer_init(int thrdsafe, int tagchk, int zeromem);
+/* init buffers, they are allocated from slab with per-thread cache
+ * @thrdn -- number of thread
+ * @zeromem -- set memory to zero when allocated
+ * return 0 -- success, else error
+ */
+int plm_buffer_init(int thrdn, int zeromem);
 
 /* alloc memory buffer 8k, 4k, 2k, 1k
  * @type -- buffer type
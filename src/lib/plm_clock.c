@@ -0,0 +1,140 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "plm_clock.h"
+
+struct plm_clock {
+	uint64_t ck_mono_ms;
+	uint64_t ck_real_ms;
+
+	/* second of the date strings */
+	time_t ck_sec;
+	int ck_log_len;
+	int ck_http_len;
+	char ck_log_date[32];
+	char ck_http_date[32];
+};
+
+static __thread struct plm_clock clock_cache;
+
+static const char *plm_clock_days[] = {
+	"Sun", "Mon", "Tue", "Wed", "Thu", "Fri", "Sat"
+};
+
+static const char *plm_clock_months[] = {
+	"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+	"Jul", "Aug", "Sep", "Oct", "Nov", "Dec"
+};
+
+static void plm_clock_format(struct plm_clock *ck, time_t sec);
+
+/* refresh the clock of the current thread, the date strings are
+ * rebuilt only when the second changes
+ */
+void plm_clock_update()
+{
+	struct timespec ts;
+	struct plm_clock *ck = &clock_cache;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	ck->ck_mono_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+	clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+	ck->ck_real_ms = (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+	if (ts.tv_sec != ck->ck_sec || ck->ck_log_len == 0)
+		plm_clock_format(ck, ts.tv_sec);
+}
+
+/* monotonic time in ms, for timers and timeouts */
+uint64_t plm_clock_mono_ms()
+{
+	if (clock_cache.ck_mono_ms == 0)
+		plm_clock_update();
+	return (clock_cache.ck_mono_ms);
+}
+
+/* wall clock time in ms since the epoch */
+uint64_t plm_clock_real_ms()
+{
+	if (clock_cache.ck_real_ms == 0)
+		plm_clock_update();
+	return (clock_cache.ck_real_ms);
+}
+
+/* local time as "YYYY/mm/dd HH:MM:SS" for log lines
+ * @len -- output the length if not NULL
+ * return the string, valid until the next update of this thread
+ */
+const char *plm_clock_log_date(int *len)
+{
+	if (clock_cache.ck_real_ms == 0)
+		plm_clock_update();
+	if (len)
+		*len = clock_cache.ck_log_len;
+	return (clock_cache.ck_log_date);
+}
+
+/* GMT time in RFC 7231 IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+ * @len -- output the length if not NULL
+ * return the string, valid until the next update of this thread
+ */
+const char *plm_clock_http_date(int *len)
+{
+	if (clock_cache.ck_real_ms == 0)
+		plm_clock_update();
+	if (len)
+		*len = clock_cache.ck_http_len;
+	return (clock_cache.ck_http_date);
+}
+
+void plm_clock_format(struct plm_clock *ck, time_t sec)
+{
+	struct tm t;
+	int n;
+
+	ck->ck_sec = sec;
+
+	n = 0;
+	if (localtime_r(&sec, &t))
+		n = strftime(ck->ck_log_date, sizeof(ck->ck_log_date),
+					 "%Y/%m/%d %X", &t);
+	ck->ck_log_date[n] = '\0';
+	ck->ck_log_len = n;
+
+	/* not strftime, the day and month names must not follow locale */
+	n = 0;
+	if (gmtime_r(&sec, &t))
+		n = snprintf(ck->ck_http_date, sizeof(ck->ck_http_date),
+					 "%s, %02d %s %04d %02d:%02d:%02d GMT",
+					 plm_clock_days[t.tm_wday], t.tm_mday,
+					 plm_clock_months[t.tm_mon], t.tm_year + 1900,
+					 t.tm_hour, t.tm_min, t.tm_sec);
+	ck->ck_http_date[n] = '\0';
+	ck->ck_http_len = n;
+}
@@ -0,0 +1,67 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_CLOCK_H
+#define _PLM_CLOCK_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* per thread cached clock, read from the coarse clocks by
+ * plm_clock_update, the dispatcher updates it once per loop
+ * a thread never updated reads the clocks at the first access
+ */
+
+/* refresh the clock of the current thread, the date strings are
+ * rebuilt only when the second changes
+ */
+void plm_clock_update();
+
+/* monotonic time in ms, for timers and timeouts */
+uint64_t plm_clock_mono_ms();
+
+/* wall clock time in ms since the epoch */
+uint64_t plm_clock_real_ms();
+
+/* local time as "YYYY/mm/dd HH:MM:SS" for log lines
+ * @len -- output the length if not NULL
+ * return the string, valid until the next update of this thread
+ */
+const char *plm_clock_log_date(int *len);
+
+/* GMT time in RFC 7231 IMF-fixdate, e.g. "Sun, 06 Nov 1994 08:49:37 GMT"
+ * @len -- output the length if not NULL
+ * return the string, valid until the next update of this thread
+ */
+const char *plm_clock_http_date(int *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
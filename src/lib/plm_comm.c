@@ -24,11 +24,14 @@
  */
 
 #include "plm_sync_mech.h"
+#include "plm_event.h"
 #include "plm_comm.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <sys/sendfile.h>
 
 struct plm_comm_fd {
 	struct plm_comm_close_handler *cf_handler;
@@ -53,7 +56,7 @@ plm_comm_open_socket(int type, int port, const char *addr,
 int plm_comm_init(int maxfd)
 {
 	size_t sz = sizeof(struct plm_comm_fd);
-	commfd_array = (struct plm_comm_fd *)malloc(maxfd * sz);
+	commfd_array = (struct plm_comm_fd *)calloc(maxfd, sz);
 	return (commfd_array ? 0 : -1);
 }
 
@@ -76,7 +79,9 @@ void plm_comm_destroy()
  * @addr -- bind socket with addr if we want, NULL indicate ignore
  * @backlog -- pass to listen
  * @nonblocking -- create a nonblocking fd if set nonblocking to nonzero
- * @reuseaddr -- set SO_REUSEADDR for socket 
+ * @reuseaddr -- PLM_COMM_REUSEADDR set SO_REUSEADDR for socket,
+ *               PLM_COMM_REUSEPORT set SO_REUSEPORT, so that every
+ *               work thread could bind its own listen socket on one port
  * return a correct fd
  */
 int plm_comm_open(int type, const char *path, int flags, int mode,
@@ -121,27 +126,21 @@ int plm_comm_open(int type, const char *path, int flags, int mode,
 int plm_comm_close(int fd)
 {
 	struct plm_comm_fd *commfd = NULL;
+	struct plm_comm_close_handler *ch, *next;
 
 	commfd = &commfd_array[fd];
 	assert(commfd->cf_open == 1);
-	if (commfd && commfd->cf_handler) {
-		do {
-			struct plm_comm_close_handler *ch;
-			void (*handler)(void *);
-			void *data;
-
-			ch = commfd->cf_handler;
-			handler = ch->cch_handler;
-			data = ch->cch_data;
-			ch = ch->cch_next;
-
-			handler(data);
-
-			if (!ch)
-				break;
-		} while (1);
+
+	/* a handler may free the memory its node lives in */
+	ch = commfd->cf_handler;
+	commfd->cf_handler = NULL;
+	while (ch) {
+		next = ch->cch_next;
+		ch->cch_handler(ch->cch_data);
+		ch = next;
 	}
 
+	plm_event_io_close(fd);
 	commfd->cf_open = 0;
 	commfd->cf_associate = 0;
 	return close(fd);
@@ -178,6 +177,9 @@ int plm_comm_accept(int fd, struct sockaddr_in *addr, int nonblocking)
 		assert(commfd_array[cfd].cf_open == 0);
 		commfd_array[cfd].cf_type = PLM_COMM_TCP;
 		commfd_array[cfd].cf_open = 1;
+		commfd_array[cfd].cf_associate = 0;
+	} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+		plm_event_io_clear_ready(fd, PLM_READ);
 	}
 
 	return (cfd);
@@ -208,6 +210,8 @@ TRY:
 	if (nr < 0) {
 		if (EINTR == errno)
 			goto TRY;
+		if (EAGAIN == errno || EWOULDBLOCK == errno)
+			plm_event_io_clear_ready(fd, PLM_READ);
 	}
 
 	return (nr);
@@ -227,6 +231,62 @@ TRY:
 	if (nw < 0) {
 		if (EINTR == errno)
 			goto TRY;
+		if (EAGAIN == errno || EWOULDBLOCK == errno)
+			plm_event_io_clear_ready(fd, PLM_WRITE);
+	}
+
+	return (nw);
+}
+
+/* write the data of buffers to fd, a socket is written by sendmsg with
+ * MSG_NOSIGNAL so a reset peer returns EPIPE instead of raising SIGPIPE
+ * @fd -- a correct fd
+ * @iov -- the buffers
+ * @n -- the number of buffers, no more than IOV_MAX
+ * return bytes success write or error code
+ */
+ssize_t plm_comm_writev(int fd, const struct iovec *iov, int n)
+{
+	ssize_t nw;
+	struct msghdr msg;
+	int sock = commfd_array[fd].cf_type == PLM_COMM_TCP;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = (struct iovec *)iov;
+	msg.msg_iovlen = n;
+TRY:
+	if (sock)
+		nw = sendmsg(fd, &msg, MSG_NOSIGNAL);
+	else
+		nw = writev(fd, iov, n);
+	if (nw < 0) {
+		if (EINTR == errno)
+			goto TRY;
+		if (EAGAIN == errno || EWOULDBLOCK == errno)
+			plm_event_io_clear_ready(fd, PLM_WRITE);
+	}
+
+	return (nw);
+}
+
+/* write n bytes of a file from *off to fd without copying them to
+ * user space, *off is advanced by the bytes written
+ * @fd -- a correct socket fd
+ * @in -- a file fd
+ * @off -- offset in the file
+ * @n -- bytes to write
+ * return bytes success write or error code
+ */
+ssize_t plm_comm_sendfile(int fd, int in, off_t *off, size_t n)
+{
+	ssize_t nw;
+TRY:
+	nw = sendfile(fd, in, off, n);
+	if (nw < 0) {
+		if (EINTR == errno)
+			goto TRY;
+		if (EAGAIN == errno || EWOULDBLOCK == errno)
+			plm_event_io_clear_ready(fd, PLM_WRITE);
 	}
 
 	return (nw);
@@ -262,7 +322,7 @@ int plm_comm_open_socket(int type, int port, const char *addr,
 	if (fd < 0)
 		return (-1);
 
-	if (reuseaddr) {
+	if (reuseaddr & PLM_COMM_REUSEADDR) {
 		int on = 1;
 		if (setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) < 0) {
 			close(fd);
@@ -270,6 +330,19 @@ int plm_comm_open_socket(int type, int port, const char *addr,
 		}
 	}
 
+	if (reuseaddr & PLM_COMM_REUSEPORT) {
+#ifdef SO_REUSEPORT
+		int on = 1;
+		if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0) {
+			close(fd);
+			return (-1);
+		}
+#else
+		close(fd);
+		return (-1);
+#endif
+	}
+
 	if (port > 0) {
 		addrin.sin_family = AF_INET;
 		addrin.sin_port = htons(port);
@@ -331,6 +404,7 @@ int plm_comm_ignore(int err)
 	case EALREADY:
 	case EINPROGRESS:
 		n = 1;
+		break;
 
 	default:
 		n = 0;
@@ -28,6 +28,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
@@ -43,6 +44,12 @@ enum {
 	PLM_COMM_UDP
 };
 
+/* socket options for plm_comm_open */
+enum {
+	PLM_COMM_REUSEADDR = 1,
+	PLM_COMM_REUSEPORT = 2
+};
+
 struct plm_comm_close_handler {
 	struct plm_comm_close_handler *cch_next;
 	void (*cch_handler)(void *);
@@ -67,7 +74,9 @@ void plm_comm_destroy();
  * @addr -- bind socket with addr if we want, NULL indicate ignore
  * @backlog -- pass to listen
  * @nonblocking -- create a nonblocking fd if set nonblocking to nonzero
- * @reuseaddr -- set SO_REUSEADDR for socket
+ * @reuseaddr -- PLM_COMM_REUSEADDR set SO_REUSEADDR for socket,
+ *               PLM_COMM_REUSEPORT set SO_REUSEPORT, so that every
+ *               work thread could bind its own listen socket on one port
  * return a correct fd
  */
 int plm_comm_open(int type, const char *path, int flags, int mode,
@@ -111,6 +120,25 @@ int plm_comm_read(int fd, char *buf, int n);
  */
 int plm_comm_write(int fd, const char *buf, int n);
 
+/* write the data of buffers to fd, a socket is written by sendmsg with
+ * MSG_NOSIGNAL so a reset peer returns EPIPE instead of raising SIGPIPE
+ * @fd -- a correct fd
+ * @iov -- the buffers
+ * @n -- the number of buffers, no more than IOV_MAX
+ * return bytes success write or error code
+ */
+ssize_t plm_comm_writev(int fd, const struct iovec *iov, int n);
+
+/* write n bytes of a file from *off to fd without copying them to
+ * user space, *off is advanced by the bytes written
+ * @fd -- a correct socket fd
+ * @in -- a file fd
+ * @off -- offset in the file
+ * @n -- bytes to write
+ * return bytes success write or error code
+ */
+ssize_t plm_comm_sendfile(int fd, int in, off_t *off, size_t n);
+
 /* register a close handler
  * @fd -- a correct fd
  * @handler -- close handler
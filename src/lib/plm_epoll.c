@@ -32,14 +32,32 @@
 
 #define PLM_STRUCT_OFFSET(s, m)	(size_t)&(((s *)0)->m)
 
+#define PLM_EPOLL_READ_EVENTS (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)
+#define PLM_EPOLL_WRITE_EVENTS (EPOLLOUT | EPOLLHUP | EPOLLERR)
+
+/* data.fd of the global epoll fd nested in a thread epoll */
+#define PLM_EPOLL_NEST_FD -1
+
 extern __thread int curr_slot;
 
+static int plm_epoll_io_pending_init(struct plm_epoll_io *ee, int maxfd);
+static void plm_epoll_io_pending_add(struct plm_epoll_io *ee, int fd, int l);
+static void plm_epoll_io_pending_del(struct plm_epoll_io *ee, int fd);
+static int plm_epoll_io_poll_persist(struct plm_event_io_handler *events,
+									 int n, struct plm_epoll_io *ee,
+									 int timeout, plm_poller_t t);
+
 /* init epoll */
 int plm_epoll_io_init(struct plm_event_io *e, int maxfd, int thrdn)
 {
 	struct plm_epoll_io *ee = (struct plm_epoll_io *)
 		((char *)e - PLM_STRUCT_OFFSET(struct plm_epoll_io, ei_event_base));
 
+	if (e->ei_flags & PLM_EVENT_IO_PERSIST) {
+		if (plm_epoll_io_pending_init(ee, maxfd))
+			return (-1);
+	}
+
 	ee->ei_efd_global = epoll_create(maxfd);
 	if (ee->ei_efd_global > 0) {
 		int i;
@@ -91,6 +109,11 @@ int plm_epoll_io_shutdown(struct plm_event_io *e)
 		}
 	}
 
+	free(ee->ei_pending);
+	ee->ei_pending = NULL;
+	free(ee->ei_pending_list);
+	ee->ei_pending_list = NULL;
+
 	ee->ei_efd_local_num = 0;
 	return (0);
 }
@@ -104,6 +127,9 @@ int plm_epoll_io_poll(struct plm_event_io_handler *events, int n,
 	struct plm_epoll_io *ee = (struct plm_epoll_io *)
 		((char *)e - PLM_STRUCT_OFFSET(struct plm_epoll_io, ei_event_base));
 
+	if (e->ei_flags & PLM_EVENT_IO_PERSIST)
+		return plm_epoll_io_poll_persist(events, n, ee, timeout, t);
+
 	if (t == PLM_THREAD_LOCAL)
 		efd = ee->ei_efd_local[curr_slot];
 	else if (t == PLM_PROCESS_GLOBAL)
@@ -126,6 +152,13 @@ int plm_epoll_io_poll(struct plm_event_io_handler *events, int n,
 
 		fd = epevts[i].data.fd;	
 		epoll_evt = epevts[i].events;	
+		if (fd == PLM_EPOLL_NEST_FD) {
+			events[i].eih_fd = fd;
+			events[i].eih_onread = e->ei_nest_handler;
+			events[i].eih_rddata = e->ei_nest_data;
+			continue;
+		}
+
 		eih = &e->ei_events_arr[fd];
 
 		if (epoll_evt & ~EPOLLOUT && eih->eih_onread) {
@@ -143,6 +176,12 @@ int plm_epoll_io_poll(struct plm_event_io_handler *events, int n,
 			events[i].eih_wrdata = eih->eih_wrdata;
 			eih->eih_wrdata = NULL;
 		}
+
+		/* the one shot fired for the other direction, wait again */
+		if (eih->eih_onread)
+			plm_epoll_io_ctl(e, fd, PLM_READ, t);
+		else if (eih->eih_onwrite)
+			plm_epoll_io_ctl(e, fd, PLM_WRITE, t);
 	}
 
 	return (nevs);
@@ -159,13 +198,18 @@ int plm_epoll_io_ctl(struct plm_event_io *e, int fd, int flag, plm_poller_t t)
 	ev.events = 0;
 	ev.data.fd = fd;
 
-	if (flag & PLM_READ)
-		ev.events = EPOLLIN | EPOLLONESHOT | EPOLLET;
-	else if (flag & PLM_WRITE)
-		ev.events = EPOLLOUT | EPOLLONESHOT | EPOLLET;
-	else
+	if (!(flag & (PLM_READ | PLM_WRITE)))
 		abort();
 
+	/* one shot interest is set for the fd as a whole, keep the other
+	 * direction if its handler is waiting
+	 */
+	ev.events = EPOLLONESHOT | EPOLLET;
+	if (flag & PLM_READ || e->ei_events_arr[fd].eih_onread)
+		ev.events |= EPOLLIN;
+	if (flag & PLM_WRITE || e->ei_events_arr[fd].eih_onwrite)
+		ev.events |= EPOLLOUT;
+
 	if (t == PLM_THREAD_LOCAL)
 		efd = ee->ei_efd_local[curr_slot];
 	else if (t == PLM_PROCESS_GLOBAL)
@@ -173,6 +217,25 @@ int plm_epoll_io_ctl(struct plm_event_io *e, int fd, int flag, plm_poller_t t)
 	else
 		abort();
 
+	if (e->ei_flags & PLM_EVENT_IO_PERSIST) {
+		struct plm_event_io_handler *eih = &e->ei_events_arr[fd];
+
+		/* registered already, the kernel would not report a new
+		 * edge if fd is ready now, so queue it by ourself
+		 */
+		if (plm_comm_get_flag_added(fd)) {
+			if (eih->eih_ready & flag) {
+				int l = t == PLM_THREAD_LOCAL ?
+					curr_slot : ee->ei_efd_local_num;
+				plm_epoll_io_pending_add(ee, fd, l);
+			}
+			return (0);
+		}
+
+		eih->eih_ready = 0;
+		ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	}
+
 	if (!plm_comm_get_flag_added(fd)) {
 		plm_comm_set_flag_added(fd, 1);
 		err = epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev);
@@ -184,3 +247,212 @@ int plm_epoll_io_ctl(struct plm_event_io *e, int fd, int flag, plm_poller_t t)
 
 	return (err);
 }
+
+/* forget fd before close */
+int plm_epoll_io_close(struct plm_event_io *e, int fd)
+{
+	struct plm_epoll_io *ee = (struct plm_epoll_io *)
+		((char *)e - PLM_STRUCT_OFFSET(struct plm_epoll_io, ei_event_base));
+
+	if (e->ei_flags & PLM_EVENT_IO_PERSIST)
+		plm_epoll_io_pending_del(ee, fd);
+
+	memset(&e->ei_events_arr[fd], 0, sizeof(e->ei_events_arr[fd]));
+	return (0);
+}
+
+/* remove fd from the current thread epoll */
+int plm_epoll_io_detach(struct plm_event_io *e, int fd)
+{
+	int err = 0;
+	struct epoll_event ev;
+	struct plm_epoll_io *ee = (struct plm_epoll_io *)
+		((char *)e - PLM_STRUCT_OFFSET(struct plm_epoll_io, ei_event_base));
+
+	if (plm_comm_get_flag_added(fd)) {
+		err = epoll_ctl(ee->ei_efd_local[curr_slot], EPOLL_CTL_DEL, fd, &ev);
+		plm_comm_set_flag_added(fd, 0);
+	}
+
+	plm_epoll_io_close(e, fd);
+	return (err);
+}
+
+/* add the global epoll fd in the current thread epoll */
+int plm_epoll_io_nest(struct plm_event_io *e)
+{
+	struct epoll_event ev;
+	struct plm_epoll_io *ee = (struct plm_epoll_io *)
+		((char *)e - PLM_STRUCT_OFFSET(struct plm_epoll_io, ei_event_base));
+
+	/* edge triggered, every new event on global epoll wakes all
+	 * threads once, the one gets the lock drains it
+	 */
+	ev.events = EPOLLIN | EPOLLET;
+	ev.data.u64 = 0;
+	ev.data.fd = PLM_EPOLL_NEST_FD;
+	return epoll_ctl(ee->ei_efd_local[curr_slot], EPOLL_CTL_ADD,
+					 ee->ei_efd_global, &ev);
+}
+
+int plm_epoll_io_pending_init(struct plm_epoll_io *ee, int maxfd)
+{
+	int i, n = ee->ei_efd_local_num + 1;
+
+	ee->ei_pending = (struct plm_epoll_pending *)
+		malloc(maxfd * sizeof(struct plm_epoll_pending));
+	ee->ei_pending_list = (struct plm_epoll_pending_list *)
+		malloc(n * sizeof(struct plm_epoll_pending_list));
+	if (!ee->ei_pending || !ee->ei_pending_list) {
+		free(ee->ei_pending);
+		ee->ei_pending = NULL;
+		free(ee->ei_pending_list);
+		ee->ei_pending_list = NULL;
+		return (-1);
+	}
+
+	for (i = 0; i < maxfd; i++)
+		ee->ei_pending[i].ep_list = -1;
+
+	for (i = 0; i < n; i++) {
+		ee->ei_pending_list[i].epl_head = -1;
+		ee->ei_pending_list[i].epl_tail = -1;
+	}
+
+	return (0);
+}
+
+void plm_epoll_io_pending_add(struct plm_epoll_io *ee, int fd, int l)
+{
+	struct plm_epoll_pending *ep = &ee->ei_pending[fd];
+	struct plm_epoll_pending_list *epl = &ee->ei_pending_list[l];
+
+	if (ep->ep_list >= 0)
+		return;
+
+	ep->ep_list = l;
+	ep->ep_next = -1;
+	ep->ep_prev = epl->epl_tail;
+	if (epl->epl_tail >= 0)
+		ee->ei_pending[epl->epl_tail].ep_next = fd;
+	else
+		epl->epl_head = fd;
+	epl->epl_tail = fd;
+}
+
+void plm_epoll_io_pending_del(struct plm_epoll_io *ee, int fd)
+{
+	struct plm_epoll_pending *ep = &ee->ei_pending[fd];
+	struct plm_epoll_pending_list *epl;
+
+	if (ep->ep_list < 0)
+		return;
+
+	epl = &ee->ei_pending_list[ep->ep_list];
+	if (ep->ep_prev >= 0)
+		ee->ei_pending[ep->ep_prev].ep_next = ep->ep_next;
+	else
+		epl->epl_head = ep->ep_next;
+
+	if (ep->ep_next >= 0)
+		ee->ei_pending[ep->ep_next].ep_prev = ep->ep_prev;
+	else
+		epl->epl_tail = ep->ep_prev;
+
+	ep->ep_list = -1;
+}
+
+/* move the armed handlers of a ready fd to evt
+ * return 1 if any handler moved, else 0
+ */
+static int plm_epoll_io_fire(struct plm_event_io *e, int fd,
+							 struct plm_event_io_handler *evt)
+{
+	int fired = 0;
+	struct plm_event_io_handler *eih = &e->ei_events_arr[fd];
+
+	memset(evt, 0, sizeof(*evt));
+	if ((eih->eih_ready & PLM_READ) && eih->eih_onread) {
+		evt->eih_onread = eih->eih_onread;
+		evt->eih_rddata = eih->eih_rddata;
+		eih->eih_onread = NULL;
+		eih->eih_rddata = NULL;
+		fired = 1;
+	}
+
+	if ((eih->eih_ready & PLM_WRITE) && eih->eih_onwrite) {
+		evt->eih_onwrite = eih->eih_onwrite;
+		evt->eih_wrdata = eih->eih_wrdata;
+		eih->eih_onwrite = NULL;
+		eih->eih_wrdata = NULL;
+		fired = 1;
+	}
+
+	evt->eih_fd = fd;
+	return (fired);
+}
+
+int plm_epoll_io_poll_persist(struct plm_event_io_handler *events, int n,
+							  struct plm_epoll_io *ee, int timeout,
+							  plm_poller_t t)
+{
+	int i, nr, efd, nevs = 0;
+	struct epoll_event epevts[MAX_EVENTS];
+	struct plm_epoll_pending_list *epl;
+	struct plm_event_io *e = &ee->ei_event_base;
+
+	if (t == PLM_THREAD_LOCAL) {
+		efd = ee->ei_efd_local[curr_slot];
+		epl = &ee->ei_pending_list[curr_slot];
+	} else if (t == PLM_PROCESS_GLOBAL) {
+		efd = ee->ei_efd_global;
+		epl = &ee->ei_pending_list[ee->ei_efd_local_num];
+	} else {
+		abort();
+	}
+
+	/* fd armed while it is ready */
+	while (epl->epl_head >= 0 && nevs < n) {
+		int fd = epl->epl_head;
+
+		plm_epoll_io_pending_del(ee, fd);
+		nevs += plm_epoll_io_fire(e, fd, &events[nevs]);
+	}
+
+	if (nevs >= n)
+		return (nevs);
+
+	/* do not block if we have something to do */
+	if (nevs > 0)
+		timeout = 0;
+
+	nr = n - nevs > MAX_EVENTS ? MAX_EVENTS : n - nevs;
+	nr = epoll_wait(efd, epevts, nr, timeout);
+	if (nr < 0)
+		return (nevs > 0 ? nevs : -1);
+
+	for (i = 0; i < nr; i++) {
+		int fd = epevts[i].data.fd;
+		int epoll_evt = epevts[i].events;
+		struct plm_event_io_handler *eih;
+
+		if (fd == PLM_EPOLL_NEST_FD) {
+			memset(&events[nevs], 0, sizeof(events[nevs]));
+			events[nevs].eih_fd = fd;
+			events[nevs].eih_onread = e->ei_nest_handler;
+			events[nevs].eih_rddata = e->ei_nest_data;
+			nevs++;
+			continue;
+		}
+
+		eih = &e->ei_events_arr[fd];
+		if (epoll_evt & PLM_EPOLL_READ_EVENTS)
+			eih->eih_ready |= PLM_READ;
+		if (epoll_evt & PLM_EPOLL_WRITE_EVENTS)
+			eih->eih_ready |= PLM_WRITE;
+
+		nevs += plm_epoll_io_fire(e, fd, &events[nevs]);
+	}
+
+	return (nevs);
+}
@@ -34,8 +34,31 @@
 extern "C" {
 #endif
 
+/* link of fd armed while it is already ready, such fd gets no new
+ * edge from kernel so it is delivered from a pending list instead
+ */
+struct plm_epoll_pending {
+	int ep_prev;
+	int ep_next;
+
+	/* index of pending list, -1 if not linked */
+	int ep_list;
+};
+
+struct plm_epoll_pending_list {
+	int epl_head;
+	int epl_tail;
+};
+
 struct plm_epoll_io {
 	struct plm_event_io ei_event_base;
+
+	/* PLM_EVENT_IO_PERSIST only, indexed by fd */
+	struct plm_epoll_pending *ei_pending;
+
+	/* one list per thread and the last one for global poller */
+	struct plm_epoll_pending_list *ei_pending_list;
+
 	int ei_efd_global;
 	int ei_efd_local_num;
 	int ei_efd_local[0];
@@ -54,6 +77,15 @@ int plm_epoll_io_poll(struct plm_event_io_handler *io, int n,
 /* epoll contrl */
 int plm_epoll_io_ctl(struct plm_event_io *e, int fd, int flag, plm_poller_t t);
 
+/* forget fd before close */
+int plm_epoll_io_close(struct plm_event_io *e, int fd);
+
+/* remove fd from the current thread epoll */
+int plm_epoll_io_detach(struct plm_event_io *e, int fd);
+
+/* add the global epoll fd in the current thread epoll */
+int plm_epoll_io_nest(struct plm_event_io *e);
+
 #ifdef __cplusplus
 }
 #endif
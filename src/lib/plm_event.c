@@ -30,22 +30,34 @@
 #include "plm_log.h"
 #include "plm_event.h"
 #include "plm_epoll.h"
+#include "plm_uring.h"
 
 static struct plm_event_io *e;
-static int plm_platform_event_io_init(struct plm_event_io **pp, int thrdn);
+
+/* set by plm_event_io_running */
+static __thread struct plm_event_io_handler *running_evts;
+static __thread int running_num;
+static int plm_platform_event_io_init(struct plm_event_io **pp,
+									  int thrdn, int flags);
 static int plm_platform_event_io_destroy(struct plm_event_io *p);
 
 /* init event driven io
  * @maxfd -- the max number of fd
  * @thrdn -- the number of thread
+ * @flags -- 0, PLM_EVENT_IO_PERSIST or PLM_EVENT_IO_URING
  * return 0 -- success, else error
  */
-int plm_event_io_init(int maxfd, int thrdn)
+int plm_event_io_init(int maxfd, int thrdn, int flags)
 {
 	size_t sz = sizeof(struct plm_event_io_handler);
+
+	if ((flags & PLM_EVENT_IO_URING) && plm_uring_io_probe()) {
+		plm_log_write(PLM_LOG_WARNING, "io_uring not supported, use epoll");
+		flags &= ~PLM_EVENT_IO_URING;
+	}
 	
 	/* platform implemetion for init of plm_event structure */
-	if (plm_platform_event_io_init(&e, thrdn)) {
+	if (plm_platform_event_io_init(&e, thrdn, flags)) {
 		plm_log_write(PLM_LOG_TRACE, "platform event init failed");
 		return (-1);
 	}
@@ -56,6 +68,7 @@ int plm_event_io_init(int maxfd, int thrdn)
 		return (-1);
 	}
 
+	e->ei_flags = flags;
 	return e->ei_init(e, maxfd, thrdn);
 }
 
@@ -69,7 +82,7 @@ int plm_event_io_shutdown()
 	plm_log_write(PLM_LOG_TRACE, "event shutdown");
 
 	err = e->ei_shutdown(e);
-	if (err) {
+	if (!err) {
 		if (e->ei_events_arr) {
 			free(e->ei_events_arr);
 			e->ei_events_arr = NULL;
@@ -173,14 +186,111 @@ int plm_event_io_poll2(struct plm_event_io_handler *evts, int n, int timeout)
 	return (nevs);
 }
 
+/* watch the global poller in the current thread poller, so a thread
+ * sleeps in its own poller only and still knows the global events
+ * @data -- the first argument for handler
+ * @handler -- called in thread local poll when global poller has
+ *             events, the second argument is -1, after this call
+ *             plm_event_io_poll2 would not block, handler stays armed
+ * return 0 -- success, else error
+ */
+int plm_event_io_nest(void *data, void (*handler)(void *, int))
+{
+	e->ei_nest_handler = handler;
+	e->ei_nest_data = data;
+	return e->ei_nest(e);
+}
+
+/* fd is going to be closed, drop the handlers and readiness of it
+ * @fd -- file descriptor
+ * return void
+ */
+void plm_event_io_close(int fd)
+{
+	int i;
+
+	for (i = 0; i < running_num; i++) {
+		if (running_evts[i].eih_fd == fd) {
+			running_evts[i].eih_onread = NULL;
+			running_evts[i].eih_onwrite = NULL;
+		}
+	}
+
+	if (e)
+		e->ei_close(e, fd);
+}
+
+/* the events being run by the current thread, plm_event_io_close
+ * drops the handlers of the closed fd from them, so a handler which
+ * closes other fds never leaves a stale handler to be run
+ * @evts -- the events returned by poll, NULL when they are done
+ * @n -- the number of events
+ * return void
+ */
+void plm_event_io_running(struct plm_event_io_handler *evts, int n)
+{
+	running_evts = evts;
+	running_num = evts ? n : 0;
+}
+
+/* remove fd from the current thread poller, so that it could be
+ * posted on other thread poller, e.g. move a connection to other thread
+ * @fd -- file descriptor
+ * return 0 -- success, else error
+ */
+int plm_event_io_detach(int fd)
+{
+	return e->ei_detach(e, fd);
+}
+
+/* the last io on fd got EAGAIN, forget the readiness we seen
+ * @fd -- file descriptor
+ * @flag -- PLM_READ or PLM_WRITE
+ * return void
+ */
+void plm_event_io_clear_ready(int fd, int flag)
+{
+	if (e)
+		e->ei_events_arr[fd].eih_ready &= ~flag;
+}
+
 #define PLM_STRUCT_OFFSET(s, m)	(size_t)&(((s *)0)->m)
 
-int plm_platform_event_io_init(struct plm_event_io **pp, int thrdn)
+int plm_platform_event_io_init(struct plm_event_io **pp, int thrdn, int flags)
 {
-	struct plm_epoll_io *p = (struct plm_epoll_io *)
+	struct plm_epoll_io *p;
+
+	if (flags & PLM_EVENT_IO_URING) {
+		struct plm_uring_io *ui = (struct plm_uring_io *)
+			malloc(sizeof(struct plm_uring_io));
+
+		if (!ui)
+			return (-1);
+
+		ui->ui_fds = NULL;
+		ui->ui_rings = NULL;
+		ui->ui_ring_local_num = thrdn;
+
+		*pp = &ui->ui_event_base;
+		(*pp)->ei_init = plm_uring_io_init;
+		(*pp)->ei_shutdown = plm_uring_io_shutdown;
+		(*pp)->ei_poll = plm_uring_io_poll;
+		(*pp)->ei_ctl = plm_uring_io_ctl;
+		(*pp)->ei_close = plm_uring_io_close;
+		(*pp)->ei_detach = plm_uring_io_close;
+		(*pp)->ei_nest = plm_uring_io_nest;
+		return (0);
+	}
+
+	p = (struct plm_epoll_io *)
 		malloc(sizeof(struct plm_epoll_io) + sizeof(int) * thrdn);
 
+	if (!p)
+		return (-1);
+
 	p->ei_efd_global = -1;
+	p->ei_pending = NULL;
+	p->ei_pending_list = NULL;
 	p->ei_efd_local_num = thrdn;
 	memset(p->ei_efd_local, -1, thrdn * sizeof(int));
 	
@@ -189,14 +299,23 @@ int plm_platform_event_io_init(struct plm_event_io **pp, int thrdn)
 	(*pp)->ei_shutdown = plm_epoll_io_shutdown;
 	(*pp)->ei_poll = plm_epoll_io_poll;
 	(*pp)->ei_ctl = plm_epoll_io_ctl;
+	(*pp)->ei_close = plm_epoll_io_close;
+	(*pp)->ei_detach = plm_epoll_io_detach;
+	(*pp)->ei_nest = plm_epoll_io_nest;
 
 	return (0);
 }
 
 int plm_platform_event_io_destroy(struct plm_event_io *p)
 {
-	struct plm_epoll_io *ep = (struct plm_epoll_io *)
-		((char *)p - PLM_STRUCT_OFFSET(struct plm_epoll_io, ei_event_base));
-	free(ep);
+	if (p->ei_flags & PLM_EVENT_IO_URING) {
+		struct plm_uring_io *ui = (struct plm_uring_io *)
+			((char *)p - PLM_STRUCT_OFFSET(struct plm_uring_io, ui_event_base));
+		free(ui);
+	} else {
+		struct plm_epoll_io *ep = (struct plm_epoll_io *)
+			((char *)p - PLM_STRUCT_OFFSET(struct plm_epoll_io, ei_event_base));
+		free(ep);
+	}
 	return (0);
 }
@@ -39,6 +39,18 @@ enum {
 	PLM_WRITE = 2,
 };
 
+/* flags for plm_event_io_init */
+enum {
+	/* register fd once with persistent edge triggered interest and
+	 * track readiness in user space, arming a handler on a fd which
+	 * is known ready costs no syscall
+	 */
+	PLM_EVENT_IO_PERSIST = 1,
+
+	/* io_uring backend, fall back to epoll if the kernel lacks it */
+	PLM_EVENT_IO_URING = 2
+};
+
 typedef enum {
 	PLM_THREAD_LOCAL,
 	PLM_PROCESS_GLOBAL
@@ -50,6 +62,11 @@ struct plm_event_io_handler {
 	void (*eih_onwrite)(void *, int);
 	void *eih_wrdata;
 	int eih_fd;
+
+	/* PLM_READ/PLM_WRITE seen ready and not drained yet,
+	 * only used with PLM_EVENT_IO_PERSIST
+	 */
+	int eih_ready;
 };	
 
 struct plm_event_io {
@@ -58,15 +75,24 @@ struct plm_event_io {
 	int (*ei_poll)(struct plm_event_io_handler *events, int n, 
 				   struct plm_event_io *e, int timeout, plm_poller_t t);
 	int (*ei_ctl)(struct plm_event_io *e, int fd, int flag, plm_poller_t t);
+	int (*ei_close)(struct plm_event_io *e, int fd);
+	int (*ei_detach)(struct plm_event_io *e, int fd);
+	int (*ei_nest)(struct plm_event_io *e);
 	struct plm_event_io_handler *ei_events_arr;
+	int ei_flags;
+
+	/* called from thread local poll when global poller has events */
+	void (*ei_nest_handler)(void *, int);
+	void *ei_nest_data;
 };
 
 /* init event driven io
  * @maxfd -- the max number of fd
  * @thrdn -- the number of work thread
+ * @flags -- 0, PLM_EVENT_IO_PERSIST or PLM_EVENT_IO_URING
  * return 0 -- success, else error
  */
-int plm_event_io_init(int maxfd, int thrdn);
+int plm_event_io_init(int maxfd, int thrdn, int flags);
 
 /* shutdown the driven io
  * return 0 -- success, else error
@@ -121,6 +147,45 @@ int plm_event_io_poll(struct plm_event_io_handler *evts, int n, int timeout);
  */	
 int plm_event_io_poll2(struct plm_event_io_handler *evts, int n, int timeout);	
 
+/* watch the global poller in the current thread poller, so a thread
+ * sleeps in its own poller only and still knows the global events
+ * @data -- the first argument for handler
+ * @handler -- called in thread local poll when global poller has
+ *             events, the second argument is -1, after this call
+ *             plm_event_io_poll2 would not block, handler stays armed
+ * return 0 -- success, else error
+ */
+int plm_event_io_nest(void *data, void (*handler)(void *, int));
+
+/* fd is going to be closed, drop the handlers and readiness of it
+ * @fd -- file descriptor
+ * return void
+ */
+void plm_event_io_close(int fd);
+
+/* the events being run by the current thread, plm_event_io_close
+ * drops the handlers of the closed fd from them, so a handler which
+ * closes other fds never leaves a stale handler to be run
+ * @evts -- the events returned by poll, NULL when they are done
+ * @n -- the number of events
+ * return void
+ */
+void plm_event_io_running(struct plm_event_io_handler *evts, int n);
+
+/* remove fd from the current thread poller, so that it could be
+ * posted on other thread poller, e.g. move a connection to other thread
+ * @fd -- file descriptor
+ * return 0 -- success, else error
+ */
+int plm_event_io_detach(int fd);
+
+/* the last io on fd got EAGAIN, forget the readiness we seen
+ * @fd -- file descriptor
+ * @flag -- PLM_READ or PLM_WRITE
+ * return void
+ */
+void plm_event_io_clear_ready(int fd, int flag);
+
 #ifdef __cplusplus
 }
 #endif
@@ -27,17 +27,108 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <time.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/uio.h>
 
+#include "plm_atomic.h"
+#include "plm_clock.h"
 #include "plm_log.h"
 
+/* bytes of the ring of every thread, power of 2 */
+#define PLM_LOG_RING_SIZE (256 * 1024)
+
+/* the longest line, longer ones are truncated */
+#define PLM_LOG_LINE_MAX 2048
+
+/* the writer sleeps at most this long between two flushes */
+#define PLM_LOG_FLUSH_MS 20
+
+/* call sites of PLM_LOG_FMT in the process */
+#define PLM_LOG_FMT_MAX 4096
+
+/* the longest string argument stored in a binary record */
+#define PLM_LOG_STR_MAX 512
+
+/* single producer single consumer ring of complete lines, the owner
+ * thread appends at lr_tail, the writer thread consumes at lr_head
+ */
+struct plm_log_ring {
+	struct plm_log_ring *lr_next;
+	int lr_fd;
+	int lr_format;
+
+	char *lr_buf;
+	uint64_t lr_mask;
+
+	/* written by the writer only */
+	uint64_t lr_head __attribute__((aligned(64)));
+	uint64_t lr_reported;
+
+	/* written by the owner only */
+	uint64_t lr_tail __attribute__((aligned(64)));
+	uint64_t lr_dropped;
+};
+
 struct plm_log {
-	FILE *l_fp;
+	int l_fd;
 	int l_level;
+	int l_format;
+
+	/* NULL if the log is synchronous */
+	struct plm_log_ring *l_ring;
+
+	/* date string of l_ms */
+	uint64_t l_ms;
+	int l_datelen;
+	char l_date[32];
+
+	/* formats whose PLM_LOG_REC_DEF is in the file, binary only */
+	uint8_t l_defined[PLM_LOG_FMT_MAX / 8];
+};
+
+struct plm_log_writer {
+	pthread_t lw_thrd;
+	pthread_mutex_t lw_lock;
+	pthread_cond_t lw_cond;
+
+	/* rings of all threads, protected by lw_lock */
+	struct plm_log_ring *lw_rings;
+
+	int lw_running;
+	int lw_kick;
 };
 
-static __thread struct plm_log log;
+static __thread struct plm_log log = { -1, PLM_LOG_UNKNOWN, PLM_LOG_TEXT };
+static struct plm_log_writer writer;
+static int log_format = PLM_LOG_TEXT;
+
+/* registered call sites, indexed by lf_id */
+static struct plm_log_fmt *log_fmts[PLM_LOG_FMT_MAX];
+static int log_fmt_num;
+static pthread_mutex_t log_fmt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *plm_log_tags[] = {
+	"[FATAL]",
+	"[WARNING]",
+	"[TRACE]",
+	"[DEBUG]",
+};
+
+static const char *plm_log_date(struct plm_log *l);
+static int plm_log_fmt_register(struct plm_log_fmt *f);
+static int plm_log_emit(const char *s, size_t n);
+static int plm_log_text(int level, const char *fmt, va_list ap);
+static int plm_log_binary(struct plm_log_fmt *f, va_list ap);
+static int plm_log_writev(int fd, struct iovec *iov, int n);
+static void plm_log_ring_flush(struct plm_log_ring *r);
+static int plm_log_ring_put(struct plm_log_ring *r, const char *s,
+							size_t n);
+static void *plm_log_writer_proc(void *data);
 
 /* open log file
  * @level -- log level, PLM_LOG_TRACE etc
@@ -46,18 +137,49 @@ static __thread struct plm_log log;
  */
 int plm_log_open(int level, const char *filepath)
 {
-	FILE *fp;
+	int fd;
+	struct plm_log_ring *r;
 
 	/* close the previous log file if opened */
 	plm_log_close();
 	
-	fp = fopen(filepath, "w");
-	if (fp) {
-		log.l_fp = fp;
-		log.l_level = level;
+	fd = open(filepath, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (fd < 0)
+		return (-1);
+
+	if (log_format == PLM_LOG_BINARY
+		&& write(fd, PLM_LOG_MAGIC, PLM_LOG_MAGIC_LEN) != PLM_LOG_MAGIC_LEN) {
+		close(fd);
+		return (-1);
 	}
-	
-	return (log.l_fp ? 0 : -1);
+
+	if (plm_atomic_load_acquire(&writer.lw_running)) {
+		r = (struct plm_log_ring *)calloc(1, sizeof(*r));
+		if (r)
+			r->lr_buf = (char *)malloc(PLM_LOG_RING_SIZE);
+		if (!r || !r->lr_buf) {
+			free(r);
+			close(fd);
+			return (-1);
+		}
+
+		r->lr_fd = fd;
+		r->lr_format = log_format;
+		r->lr_mask = PLM_LOG_RING_SIZE - 1;
+
+		pthread_mutex_lock(&writer.lw_lock);
+		r->lr_next = writer.lw_rings;
+		writer.lw_rings = r;
+		pthread_mutex_unlock(&writer.lw_lock);
+
+		log.l_ring = r;
+	}
+
+	log.l_fd = fd;
+	log.l_level = level;
+	log.l_format = log_format;
+	memset(log.l_defined, 0, sizeof(log.l_defined));
+	return (0);
 }
 
 /* close the log file 
@@ -65,69 +187,254 @@ int plm_log_open(int level, const char *filepath)
  */
 int plm_log_close()
 {
-	int err = 0;
-	FILE *fp = log.l_fp;
-	
-	if (fp) {
-		err = fclose(fp);
-		if (err) {
-			log.l_fp = NULL;
-			log.l_level = PLM_LOG_UNKNOWN;
+	int err;
+	struct plm_log_ring *r, **pp;
+
+	if (log.l_fd < 0)
+		return (0);
+
+	r = log.l_ring;
+	if (r) {
+		/* once unlinked the writer never sees the ring again, the
+		 * rest of it is flushed by the owner
+		 */
+		pthread_mutex_lock(&writer.lw_lock);
+		for (pp = &writer.lw_rings; *pp; pp = &(*pp)->lr_next) {
+			if (*pp == r) {
+				*pp = r->lr_next;
+				break;
+			}
 		}
+		pthread_mutex_unlock(&writer.lw_lock);
+
+		plm_log_ring_flush(r);
+		free(r->lr_buf);
+		free(r);
+		log.l_ring = NULL;
 	}
 
+	err = close(log.l_fd);
+	log.l_fd = -1;
+	log.l_level = PLM_LOG_UNKNOWN;
 	return (err ? -1 : 0);
 }
 
+/* set the format of the log files opened after this call
+ * @format -- PLM_LOG_TEXT or PLM_LOG_BINARY
+ */
+void plm_log_set_format(int format)
+{
+	log_format = format;
+}
+
 /* write log message
  * @fmt -- message
- * return bytes written
+ * return bytes written, 0 if filtered or dropped
  */
 int plm_log_write(int level, const char *fmt, ...)
 {
 	int n;
 	va_list ap;
-	time_t now;
-	struct tm t;
-	char date_str[128];
-	const char *msg;
 
-	if (!log.l_fp || log.l_level == PLM_LOG_UNKNOWN || level > log.l_level)
+	if (log.l_fd < 0 || level > log.l_level || level < 0
+		|| level >= PLM_LOG_UNKNOWN)
 		return (0);
 
-	switch (level) {
-	case PLM_LOG_TRACE:
-		msg = "[TRACE]";
-		break;
-	case PLM_LOG_DEBUG:
-		msg = "[DEBUG]";
-		break;
-	case PLM_LOG_FATAL:
-		msg = "[FATAL]";
-		break;
-	case PLM_LOG_WARNING:
-		msg = "[WARNING]";
-		break;
-	}
-
-	now = time(NULL);
-	if (localtime_r(&now, &t))
-		strftime(date_str, sizeof(date_str), "%Y/%m/%d %X", &t);
-	else
-		date_str[0] = 0;
-
-	n = fprintf(log.l_fp, "%s %s: ", date_str, msg);
-	
 	va_start(ap, fmt);
-	n += vfprintf(log.l_fp, fmt, ap);
-	n += fprintf(log.l_fp, "\n");
+	n = plm_log_text(level, fmt, ap);
+	va_end(ap);
+
+	return (n);
+}
+
+/* write log message of a call site, use PLM_LOG_FMT instead
+ * @f -- call site
+ * return bytes written, 0 if filtered or dropped
+ */
+int plm_log_writef(struct plm_log_fmt *f, ...)
+{
+	int n;
+	va_list ap;
+
+	if (log.l_fd < 0 || f->lf_level > log.l_level || f->lf_level < 0
+		|| f->lf_level >= PLM_LOG_UNKNOWN)
+		return (0);
+
+	va_start(ap, f);
+	if (log.l_format == PLM_LOG_BINARY && plm_log_fmt_register(f) > 0)
+		n = plm_log_binary(f, ap);
+	else
+		n = plm_log_text(f->lf_level, f->lf_fmt, ap);
 	va_end(ap);
 
-	fflush(log.l_fp);
+	return (n);
+}
+
+/* return the tag of a level, e.g. "[TRACE]" */
+const char *plm_log_tag(int level)
+{
+	if (level < 0 || level >= PLM_LOG_UNKNOWN)
+		return ("[UNKNOWN]");
+	return (plm_log_tags[level]);
+}
+
+/* parse the conversions of a printf format string
+ * @fmt -- format string
+ * @types -- PLM_LOG_ARG_* of every argument
+ * @precs -- precision of every string argument, PLM_LOG_PREC_*
+ *   otherwise, may be NULL
+ * @max -- size of types and precs
+ * return the number of arguments, -1 if a conversion is not supported
+ */
+int plm_log_fmt_args(const char *fmt, uint8_t *types, int16_t *precs,
+					 int max)
+{
+	int n = 0, len, prec, dot;
+	const char *p;
+
+	for (p = fmt; *p; p++) {
+		if (*p != '%')
+			continue;
+
+		if (*++p == '%')
+			continue;
+
+		/* flags, width and precision, '*' takes an int */
+		prec = PLM_LOG_PREC_NONE;
+		dot = 0;
+		for (; *p && strchr("-+ #0123456789.*", *p); p++) {
+			if (*p == '*') {
+				if (n == max)
+					return (-1);
+				if (precs)
+					precs[n] = PLM_LOG_PREC_NONE;
+				types[n++] = PLM_LOG_ARG_INT;
+				if (dot)
+					prec = PLM_LOG_PREC_STAR;
+			} else if (*p == '.') {
+				dot = 1;
+				prec = 0;
+			} else if (dot && *p >= '0' && *p <= '9') {
+				if (prec < INT16_MAX / 10)
+					prec = prec * 10 + *p - '0';
+			}
+		}
+
+		/* length, 1 for l, 2 for ll, 3 for z, j, t */
+		len = 0;
+		for (; *p && strchr("hlzjtL", *p); p++) {
+			if (*p == 'l')
+				len++;
+			else if (*p == 'z' || *p == 'j' || *p == 't')
+				len = 3;
+		}
+
+		if (n == max)
+			return (-1);
+
+		if (precs)
+			precs[n] = *p == 's' ? prec : PLM_LOG_PREC_NONE;
+
+		switch (*p) {
+		case 'd':
+		case 'i':
+		case 'u':
+		case 'x':
+		case 'X':
+		case 'o':
+		case 'c':
+			if (len == 0)
+				types[n++] = PLM_LOG_ARG_INT;
+			else if (len == 1)
+				types[n++] = PLM_LOG_ARG_LONG;
+			else if (len == 2)
+				types[n++] = PLM_LOG_ARG_LLONG;
+			else
+				types[n++] = PLM_LOG_ARG_SIZE;
+			break;
+
+		case 'f':
+		case 'F':
+		case 'e':
+		case 'E':
+		case 'g':
+		case 'G':
+		case 'a':
+		case 'A':
+			types[n++] = PLM_LOG_ARG_DOUBLE;
+			break;
+
+		case 'p':
+			types[n++] = PLM_LOG_ARG_PTR;
+			break;
+
+		case 's':
+			types[n++] = PLM_LOG_ARG_STR;
+			break;
+
+		default:
+			/* %n, %m, wide chars and the end of string */
+			return (-1);
+		}
+	}
 
 	return (n);
 }
 
+/* start the writer thread, the log files opened after it queue the
+ * messages in a ring of the thread and the writer writes them out
+ * return 0 : success, -1 : error
+ */
+int plm_log_async_start()
+{
+	if (writer.lw_running)
+		return (0);
+
+	if (pthread_mutex_init(&writer.lw_lock, NULL))
+		return (-1);
+
+	if (pthread_cond_init(&writer.lw_cond, NULL)) {
+		pthread_mutex_destroy(&writer.lw_lock);
+		return (-1);
+	}
+
+	writer.lw_rings = NULL;
+	writer.lw_kick = 0;
+	plm_atomic_store_release(&writer.lw_running, 1);
+	if (pthread_create(&writer.lw_thrd, NULL, plm_log_writer_proc, NULL)) {
+		writer.lw_running = 0;
+		pthread_cond_destroy(&writer.lw_cond);
+		pthread_mutex_destroy(&writer.lw_lock);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* stop the writer thread after the rings are flushed, the log files
+ * should have been closed
+ */
+void plm_log_async_stop()
+{
+	if (!writer.lw_running)
+		return;
+
+	pthread_mutex_lock(&writer.lw_lock);
+	plm_atomic_store_release(&writer.lw_running, 0);
+	pthread_cond_signal(&writer.lw_cond);
+	pthread_mutex_unlock(&writer.lw_lock);
+
+	pthread_join(writer.lw_thrd, NULL);
+	pthread_cond_destroy(&writer.lw_cond);
+	pthread_mutex_destroy(&writer.lw_lock);
+}
+
+/* number of messages of the current thread dropped since open */
+uint64_t plm_log_dropped()
+{
+	return (log.l_ring ? log.l_ring->lr_dropped : 0);
+}
+
 void plm_log_syslog(const char *fmt, ...)
 {
 	va_list ap;
@@ -136,3 +443,371 @@ void plm_log_syslog(const char *fmt, ...)
 	vsyslog(LOG_USER | LOG_ERR, fmt, ap);
 	va_end(ap);
 }
+
+/* the date string is rebuilt when the cached clock of the thread
+ * moves, the date part is formatted by plm_clock once per second
+ */
+static const char *plm_log_date(struct plm_log *l)
+{
+	const char *date;
+	uint64_t ms;
+	int n, v;
+
+	ms = plm_clock_real_ms();
+	if (ms == l->l_ms && l->l_datelen > 0)
+		return (l->l_date);
+
+	date = plm_clock_log_date(&n);
+	memcpy(l->l_date, date, n);
+	l->l_datelen = n;
+	l->l_ms = ms;
+
+	v = ms % 1000;
+	l->l_date[n] = '.';
+	l->l_date[n + 1] = '0' + v / 100;
+	l->l_date[n + 2] = '0' + v / 10 % 10;
+	l->l_date[n + 3] = '0' + v % 10;
+	l->l_date[n + 4] = '\0';
+	return (l->l_date);
+}
+
+/* give the call site an id, the format string is parsed once
+ * return the id, -1 if the format can't be stored in binary
+ */
+static int plm_log_fmt_register(struct plm_log_fmt *f)
+{
+	int id, n;
+
+	id = plm_atomic_load_acquire(&f->lf_id);
+	if (id)
+		return (id);
+
+	pthread_mutex_lock(&log_fmt_lock);
+	id = f->lf_id;
+	if (!id) {
+		n = plm_log_fmt_args(f->lf_fmt, f->lf_types, f->lf_precs,
+							 PLM_LOG_ARG_MAX);
+		if (n < 0 || log_fmt_num + 1 >= PLM_LOG_FMT_MAX) {
+			id = -1;
+		} else {
+			id = ++log_fmt_num;
+			f->lf_nargs = n;
+			log_fmts[id] = f;
+		}
+
+		plm_atomic_store_release(&f->lf_id, id);
+	}
+	pthread_mutex_unlock(&log_fmt_lock);
+
+	return (id);
+}
+
+/* append to the ring or write the file
+ * return n, 0 if dropped or failed
+ */
+static int plm_log_emit(const char *s, size_t n)
+{
+	if (log.l_ring)
+		return (plm_log_ring_put(log.l_ring, s, n) ? 0 : n);
+	return (write(log.l_fd, s, n) == n ? n : 0);
+}
+
+static int plm_log_text(int level, const char *fmt, va_list ap)
+{
+	int n, len;
+	char line[PLM_LOG_LINE_MAX] __attribute__((aligned(8)));
+	struct plm_log_rec *rec;
+
+	if (log.l_format == PLM_LOG_BINARY) {
+		rec = (struct plm_log_rec *)line;
+		n = sizeof(*rec);
+	} else {
+		n = snprintf(line, sizeof(line), "%s %s: ", plm_log_date(&log),
+					 plm_log_tags[level]);
+	}
+
+	len = vsnprintf(line + n, sizeof(line) - n, fmt, ap);
+
+	/* truncated, keep room for the new line */
+	if (len < 0)
+		len = 0;
+	n += len;
+	if ((size_t)n > sizeof(line) - 1)
+		n = sizeof(line) - 1;
+
+	if (log.l_format == PLM_LOG_BINARY) {
+		rec->lr_len = n;
+		rec->lr_type = PLM_LOG_REC_TEXT;
+		rec->lr_level = level;
+		rec->lr_fmt = 0;
+		rec->lr_nargs = 0;
+		rec->lr_ms = plm_clock_real_ms();
+	} else {
+		line[n++] = '\n';
+	}
+
+	return (plm_log_emit(line, n));
+}
+
+/* the arguments are copied as they are, no formatting at all */
+static int plm_log_binary(struct plm_log_fmt *f, va_list ap)
+{
+	int i, id = f->lf_id;
+	size_t n, len, flen;
+	char buf[PLM_LOG_LINE_MAX] __attribute__((aligned(8)));
+	struct plm_log_rec *rec;
+	const char *str;
+	uint64_t v = 0;
+	uint16_t slen;
+	int prec;
+
+	rec = (struct plm_log_rec *)buf;
+	rec->lr_level = f->lf_level;
+	rec->lr_fmt = id;
+	rec->lr_ms = plm_clock_real_ms();
+
+	/* the format string goes to the file before its first message */
+	if (!(log.l_defined[id >> 3] & (1 << (id & 7)))) {
+		flen = strlen(f->lf_fmt);
+		if (flen > sizeof(buf) - sizeof(*rec))
+			flen = sizeof(buf) - sizeof(*rec);
+
+		rec->lr_type = PLM_LOG_REC_DEF;
+		rec->lr_nargs = f->lf_nargs;
+		rec->lr_len = sizeof(*rec) + flen;
+		memcpy(buf + sizeof(*rec), f->lf_fmt, flen);
+		if (!plm_log_emit(buf, rec->lr_len))
+			return (0);
+
+		log.l_defined[id >> 3] |= 1 << (id & 7);
+	}
+
+	rec->lr_type = PLM_LOG_REC_MSG;
+	rec->lr_nargs = f->lf_nargs;
+	n = sizeof(*rec);
+	for (i = 0; i < f->lf_nargs; i++) {
+		switch (f->lf_types[i]) {
+		case PLM_LOG_ARG_INT:
+			v = (uint64_t)(int64_t)va_arg(ap, int);
+			break;
+		case PLM_LOG_ARG_LONG:
+			v = (uint64_t)va_arg(ap, long);
+			break;
+		case PLM_LOG_ARG_LLONG:
+			v = (uint64_t)va_arg(ap, long long);
+			break;
+		case PLM_LOG_ARG_SIZE:
+			v = (uint64_t)va_arg(ap, size_t);
+			break;
+		case PLM_LOG_ARG_DOUBLE: {
+			double d = va_arg(ap, double);
+			memcpy(&v, &d, sizeof(v));
+			break;
+		}
+		case PLM_LOG_ARG_PTR:
+			v = (uint64_t)(uintptr_t)va_arg(ap, void *);
+			break;
+		case PLM_LOG_ARG_STR:
+			str = va_arg(ap, const char *);
+			if (!str)
+				str = "(null)";
+
+			/* a string with precision needs no NUL, v is the int
+			 * before it for '*'
+			 */
+			prec = f->lf_precs[i];
+			if (prec == PLM_LOG_PREC_STAR)
+				prec = (int)v;
+			len = PLM_LOG_STR_MAX;
+			if (prec >= 0 && prec < PLM_LOG_STR_MAX)
+				len = prec;
+			len = strnlen(str, len);
+
+			if (n + sizeof(slen) > sizeof(buf))
+				return (0);
+			if (n + sizeof(slen) + len > sizeof(buf))
+				len = sizeof(buf) - n - sizeof(slen);
+			slen = len;
+			memcpy(buf + n, &slen, sizeof(slen));
+			memcpy(buf + n + sizeof(slen), str, len);
+			n += sizeof(slen) + len;
+			continue;
+
+		default:
+			return (0);
+		}
+
+		if (n + sizeof(v) > sizeof(buf))
+			return (0);
+		memcpy(buf + n, &v, sizeof(v));
+		n += sizeof(v);
+	}
+
+	rec->lr_len = n;
+	return (plm_log_emit(buf, n));
+}
+
+/* the message is dropped if the ring is full, never wait for writer
+ * return 0 if queued, -1 if dropped
+ */
+static int
+plm_log_ring_put(struct plm_log_ring *r, const char *s, size_t n)
+{
+	int rc = 0;
+	uint64_t head, tail, off, first, used;
+
+	tail = r->lr_tail;
+	head = plm_atomic_load_acquire(&r->lr_head);
+	used = tail - head;
+	if (used + n > PLM_LOG_RING_SIZE) {
+		plm_atomic_store_release(&r->lr_dropped, r->lr_dropped + 1);
+		used = PLM_LOG_RING_SIZE;
+		rc = -1;
+	} else {
+		off = tail & r->lr_mask;
+		first = PLM_LOG_RING_SIZE - off;
+		if (first >= n) {
+			memcpy(r->lr_buf + off, s, n);
+		} else {
+			memcpy(r->lr_buf + off, s, first);
+			memcpy(r->lr_buf, s + first, n - first);
+		}
+
+		plm_atomic_store_release(&r->lr_tail, tail + n);
+		used += n;
+	}
+
+	/* wake the writer early when half full, lw_lock is held by the
+	 * writer while it writes, so it is not taken here, a wakeup lost
+	 * between its check of lw_kick and its wait costs a flush period
+	 */
+	if (used >= PLM_LOG_RING_SIZE / 2 && !plm_atomic_xchg(&writer.lw_kick, 1))
+		pthread_cond_signal(&writer.lw_cond);
+
+	return (rc);
+}
+
+/* write all iov, the file is not nonblocking */
+static int plm_log_writev(int fd, struct iovec *iov, int n)
+{
+	ssize_t w;
+
+	while (n > 0) {
+		w = writev(fd, iov, n);
+		if (w < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+
+		while (n > 0 && w >= (ssize_t)iov->iov_len) {
+			w -= iov->iov_len;
+			iov++;
+			n--;
+		}
+
+		if (n > 0) {
+			iov->iov_base = (char *)iov->iov_base + w;
+			iov->iov_len -= w;
+		}
+	}
+
+	return (0);
+}
+
+/* called by the writer or by the owner after the ring is unlinked */
+static void plm_log_ring_flush(struct plm_log_ring *r)
+{
+	int n = 0;
+	struct iovec iov[3];
+	uint64_t head, tail, off, len, dropped;
+	char note[128] __attribute__((aligned(8)));
+	struct plm_log l;
+
+	head = r->lr_head;
+	tail = plm_atomic_load_acquire(&r->lr_tail);
+	if (tail != head) {
+		off = head & r->lr_mask;
+		len = tail - head;
+		iov[n].iov_base = r->lr_buf + off;
+		iov[n].iov_len = len;
+		if (off + len > PLM_LOG_RING_SIZE) {
+			iov[n].iov_len = PLM_LOG_RING_SIZE - off;
+			n++;
+			iov[n].iov_base = r->lr_buf;
+			iov[n].iov_len = len - (PLM_LOG_RING_SIZE - off);
+		}
+		n++;
+	}
+
+	dropped = plm_atomic_load_acquire(&r->lr_dropped);
+	if (dropped != r->lr_reported && r->lr_format == PLM_LOG_BINARY) {
+		struct plm_log_rec *rec = (struct plm_log_rec *)note;
+
+		rec->lr_len = sizeof(*rec) + sizeof(dropped);
+		rec->lr_type = PLM_LOG_REC_DROP;
+		rec->lr_level = PLM_LOG_WARNING;
+		rec->lr_fmt = 0;
+		rec->lr_nargs = 0;
+		rec->lr_ms = plm_clock_real_ms();
+		dropped -= r->lr_reported;
+		memcpy(note + sizeof(*rec), &dropped, sizeof(dropped));
+		iov[n].iov_base = note;
+		iov[n].iov_len = rec->lr_len;
+		n++;
+		r->lr_reported += dropped;
+	} else if (dropped != r->lr_reported) {
+		memset(&l, 0, sizeof(l));
+		iov[n].iov_base = note;
+		iov[n].iov_len = snprintf(note, sizeof(note),
+								  "%s %s: %llu log messages dropped\n",
+								  plm_log_date(&l),
+								  plm_log_tags[PLM_LOG_WARNING],
+								  (unsigned long long)
+								  (dropped - r->lr_reported));
+		n++;
+		r->lr_reported = dropped;
+	}
+
+	if (n > 0) {
+		plm_log_writev(r->lr_fd, iov, n);
+		plm_atomic_store_release(&r->lr_head, tail);
+	}
+}
+
+static void *plm_log_writer_proc(void *data)
+{
+	struct plm_log_ring *r;
+	struct timespec ts;
+	int running;
+
+	pthread_mutex_lock(&writer.lw_lock);
+	for (;;) {
+		running = plm_atomic_load_acquire(&writer.lw_running);
+		plm_atomic_xchg(&writer.lw_kick, 0);
+		plm_clock_update();
+
+		/* the lock is held while writing so a ring can't be freed
+		 * under the writer
+		 */
+		for (r = writer.lw_rings; r; r = r->lr_next)
+			plm_log_ring_flush(r);
+
+		if (!running)
+			break;
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += PLM_LOG_FLUSH_MS * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+
+		if (plm_atomic_load_acquire(&writer.lw_running)
+			&& !plm_atomic_load_acquire(&writer.lw_kick))
+			pthread_cond_timedwait(&writer.lw_cond, &writer.lw_lock, &ts);
+	}
+	pthread_mutex_unlock(&writer.lw_lock);
+
+	return (NULL);
+}
@@ -26,6 +26,7 @@
 #ifndef _PLM_LOG_H
 #define _PLM_LOG_H
 
+#include <stdint.h>
 #include <syslog.h>
 
 #ifdef __cplusplus
@@ -40,6 +41,89 @@ enum {
 	PLM_LOG_UNKNOWN
 };
 
+/* file format, set by plm_log_set_format before the files are opened */
+enum {
+	PLM_LOG_TEXT,
+	PLM_LOG_BINARY
+};
+
+/* the binary file starts with the magic and is followed by records,
+ * integers are in host byte order, plm_logdump renders it as text
+ */
+#define PLM_LOG_MAGIC "PLMBLOG1"
+#define PLM_LOG_MAGIC_LEN 8
+
+enum {
+	/* the payload is the format string of lr_fmt */
+	PLM_LOG_REC_DEF,
+
+	/* the payload is the arguments of format lr_fmt, integers,
+	 * doubles and pointers take 8 bytes, a string is a 16 bits
+	 * length followed by the bytes
+	 */
+	PLM_LOG_REC_MSG,
+
+	/* the payload is a message formatted by plm_log_write */
+	PLM_LOG_REC_TEXT,
+
+	/* the payload is a 64 bits number of dropped messages */
+	PLM_LOG_REC_DROP
+};
+
+struct plm_log_rec {
+	uint16_t lr_len;
+	uint8_t lr_type;
+	uint8_t lr_level;
+	uint16_t lr_fmt;
+	uint16_t lr_nargs;
+
+	/* milliseconds since epoch */
+	uint64_t lr_ms;
+};
+
+/* argument types of a format string */
+enum {
+	PLM_LOG_ARG_INT,
+	PLM_LOG_ARG_LONG,
+	PLM_LOG_ARG_LLONG,
+	PLM_LOG_ARG_SIZE,
+	PLM_LOG_ARG_DOUBLE,
+	PLM_LOG_ARG_PTR,
+	PLM_LOG_ARG_STR
+};
+
+#define PLM_LOG_ARG_MAX 16
+
+/* precision of a string argument, else the bytes it takes at most */
+#define PLM_LOG_PREC_NONE (-1)
+
+/* the int argument before the string is the precision */
+#define PLM_LOG_PREC_STAR (-2)
+
+/* a call site of PLM_LOG_FMT, lf_id is given at the first call */
+struct plm_log_fmt {
+	int lf_level;
+	const char *lf_fmt;
+	int lf_id;
+	int lf_nargs;
+	uint8_t lf_types[PLM_LOG_ARG_MAX];
+	int16_t lf_precs[PLM_LOG_ARG_MAX];
+};
+
+/* write a message, in binary format the arguments are stored as they
+ * are and the format string is written once per file
+ */
+#define PLM_LOG_FMT(level, fmt, args...)								\
+	do {																\
+		static struct plm_log_fmt _plm_log_fmt = { (level), (fmt) };	\
+		plm_log_writef(&_plm_log_fmt, ##args);							\
+	} while (0)
+
+/* set the format of the log files opened after this call
+ * @format -- PLM_LOG_TEXT or PLM_LOG_BINARY
+ */
+void plm_log_set_format(int format);
+
 /* open log file
  * @level -- log level, PLM_LOG_TRACE etc
  * @filepath -- log filepath
@@ -55,10 +139,44 @@ int plm_log_close();
 /* write log message
  * @level -- message level
  * @fmt -- message
- * return bytes written
+ * return bytes written, 0 if filtered or dropped
  */
 int plm_log_write(int level, const char *fmt, ...);
 
+/* write log message of a call site, use PLM_LOG_FMT instead
+ * @f -- call site
+ * return bytes written, 0 if filtered or dropped
+ */
+int plm_log_writef(struct plm_log_fmt *f, ...);
+
+/* parse the conversions of a printf format string
+ * @fmt -- format string
+ * @types -- PLM_LOG_ARG_* of every argument
+ * @precs -- precision of every string argument, PLM_LOG_PREC_*
+ *   otherwise, may be NULL
+ * @max -- size of types and precs
+ * return the number of arguments, -1 if a conversion is not supported
+ */
+int plm_log_fmt_args(const char *fmt, uint8_t *types, int16_t *precs,
+					 int max);
+
+/* return the tag of a level, e.g. "[TRACE]" */
+const char *plm_log_tag(int level);
+
+/* start the writer thread, the log files opened after it queue the
+ * messages in a ring of the thread and the writer writes them out
+ * return 0 : success, -1 : error
+ */
+int plm_log_async_start();
+
+/* stop the writer thread after the rings are flushed, the log files
+ * should have been closed
+ */
+void plm_log_async_stop();
+
+/* number of messages of the current thread dropped since open */
+uint64_t plm_log_dropped();
+
 /* native log */
 void plm_log_syslog(const char *fmt, ...);	
 
@@ -38,6 +38,18 @@ struct plm_lookaside_list_node {
 
 #define PLM_STRUCT_OFFSET(s, m)	(size_t)&(((s *)0)->m)
 
+#ifdef HAVE_CAS128
+union plm_lookaside_top {
+	struct plm_lookaside_stack lt_stack;
+	unsigned __int128 lt_value;
+};
+#endif
+
+static void *plm_lookaside_list_alloc_lockfree(struct plm_lookaside_list *,
+											   void inlock_handler(void *));
+static void plm_lookaside_list_free_lockfree(struct plm_lookaside_list *,
+											 void *, void inlock_handler(void *));
+
 /* init a lookaside list, a lookaside list is just like 
  * a memory pool with object which has the same size
  * @list -- list to init
@@ -60,6 +72,8 @@ void plm_lookaside_list_init(struct plm_lookaside_list *list, int high_level,
 	list->ll_tag = tag;
 	memset(&list->ll_misc, 0, sizeof(list->ll_misc));
 	memset(&list->ll_onoff, 0, sizeof(list->ll_onoff));
+	memset(&list->ll_stack, 0, sizeof(list->ll_stack));
+	list->ll_stack_len = 0;
 	plm_lock_init(&list->ll_lock);
 
 	PLM_LIST_INIT(&list->ll_list);
@@ -80,6 +94,24 @@ void plm_lookaside_list_enable(struct plm_lookaside_list *list,
 	list->ll_onoff.ll_thrdsafe = thrdsafe;
 }
 
+/* use a lock free stack instead of the mutex, counters are kept
+ * with relaxed atomics, call it after plm_lookaside_list_enable
+ * @list -- list to enable, thrdsafe should be enabled
+ * return 0 -- lock free is on, else the list keeps the mutex
+ */
+int plm_lookaside_list_enable_lockfree(struct plm_lookaside_list *list)
+{
+#ifdef HAVE_CAS128
+	/* objects cached already stay in ll_list and are freed
+	 * when destroy
+	 */
+	list->ll_onoff.ll_lockfree = 1;
+	return (0);
+#else
+	return (-1);
+#endif
+}
+
 /* destroy a list, this just free the objects in list 
  * @list -- list to destroy
  * return void
@@ -88,6 +120,14 @@ void plm_lookaside_list_destroy(struct plm_lookaside_list *list)
 {
 	struct plm_lookaside_list_node *obj_hdr;
 
+	/* no one uses the list now, move the stack to list */
+	while (list->ll_stack.ls_top) {
+		plm_list_node_t *n = list->ll_stack.ls_top;
+		list->ll_stack.ls_top = n->ln_next;
+		PLM_LIST_ADD_FRONT(&list->ll_list, n);
+	}
+	list->ll_stack_len = 0;
+
 	if (list->ll_onoff.ll_thrdsafe)
 		plm_lock_lock(&list->ll_lock);
 	
@@ -123,6 +163,9 @@ void *plm_lookaside_list_alloc(struct plm_lookaside_list *list,
 {
 	char *obj_hdr;
 
+	if (list->ll_onoff.ll_lockfree)
+		return plm_lookaside_list_alloc_lockfree(list, inlock_handler);
+
 	if (list->ll_onoff.ll_thrdsafe)
 		plm_lock_lock(&list->ll_lock);
 
@@ -181,6 +224,11 @@ void plm_lookaside_list_free(struct plm_lookaside_list *list, void *obj,
 			abort();
 	}
 
+	if (list->ll_onoff.ll_lockfree) {
+		plm_lookaside_list_free_lockfree(list, obj, inlock_handler);
+		return;
+	}
+
 	if (list->ll_onoff.ll_thrdsafe)
 		plm_lock_lock(&list->ll_lock);
 
@@ -200,3 +248,121 @@ void plm_lookaside_list_free(struct plm_lookaside_list *list, void *obj,
 		plm_lock_unlock(&list->ll_lock);
 }
 
+#ifdef HAVE_CAS128
+/* pop reads the next pointer of a node which may be taken and freed
+ * to system by another thread at the same time, the compare and swap
+ * fails then, it is safe while ll_free never unmaps small objects
+ */
+static plm_list_node_t *plm_lookaside_stack_pop(struct plm_lookaside_list *list)
+{
+	union plm_lookaside_top old, new, cur;
+	unsigned __int128 *top = (unsigned __int128 *)&list->ll_stack;
+
+	old.lt_stack.ls_tag = list->ll_stack.ls_tag;
+	old.lt_stack.ls_top = list->ll_stack.ls_top;
+	for (;;) {
+		if (!old.lt_stack.ls_top)
+			return (NULL);
+
+		new.lt_stack.ls_top = old.lt_stack.ls_top->ln_next;
+		new.lt_stack.ls_tag = old.lt_stack.ls_tag + 1;
+		cur.lt_value = __sync_val_compare_and_swap(top, old.lt_value,
+												   new.lt_value);
+		if (cur.lt_value == old.lt_value)
+			break;
+		old = cur;
+	}
+
+	return (old.lt_stack.ls_top);
+}
+
+static void plm_lookaside_stack_push(struct plm_lookaside_list *list,
+									 plm_list_node_t *node)
+{
+	union plm_lookaside_top old, new, cur;
+	unsigned __int128 *top = (unsigned __int128 *)&list->ll_stack;
+
+	old.lt_stack.ls_tag = list->ll_stack.ls_tag;
+	old.lt_stack.ls_top = list->ll_stack.ls_top;
+	for (;;) {
+		node->ln_next = old.lt_stack.ls_top;
+		new.lt_stack.ls_top = node;
+		new.lt_stack.ls_tag = old.lt_stack.ls_tag;
+		cur.lt_value = __sync_val_compare_and_swap(top, old.lt_value,
+												   new.lt_value);
+		if (cur.lt_value == old.lt_value)
+			break;
+		old = cur;
+	}
+}
+#endif
+
+void *plm_lookaside_list_alloc_lockfree(struct plm_lookaside_list *list,
+										void inlock_handler(void *))
+{
+	char *obj_hdr = NULL;
+#ifdef HAVE_CAS128
+	plm_list_node_t *n;
+
+	n = plm_lookaside_stack_pop(list);
+	if (n) {
+		plm_atomic_add_relaxed(&list->ll_stack_len, -1);
+		plm_atomic_add_relaxed(&list->ll_misc.ll_alloc_times_from_list, 1);
+
+		obj_hdr = (char *)n
+			- PLM_STRUCT_OFFSET(struct plm_lookaside_list_node, lln_node);
+		if (list->ll_onoff.ll_tag_check) {
+			if (((struct plm_lookaside_list_node *)obj_hdr)->lln_tag
+				!= list->ll_tag)
+				abort();
+		}
+	} else {
+		obj_hdr = (char *)list->ll_alloc
+			(list->ll_obj_sz + sizeof(struct plm_lookaside_list_node));
+		if (obj_hdr)
+			((struct plm_lookaside_list_node *)obj_hdr)->lln_tag = list->ll_tag;
+	}
+
+	plm_atomic_add_relaxed(&list->ll_misc.ll_alloc_times, 1);
+	if (!obj_hdr) {
+		plm_atomic_add_relaxed(&list->ll_misc.ll_alloc_failed_times, 1);
+		return (NULL);
+	}
+
+	/* there is no lock, the handler runs before the object returned */
+	if (inlock_handler)
+		inlock_handler(obj_hdr + sizeof(struct plm_lookaside_list_node));
+
+	if (list->ll_onoff.ll_zero_memory)
+		memset(obj_hdr + sizeof(struct plm_lookaside_list_node),
+			   0, list->ll_obj_sz);
+#endif
+
+	return (obj_hdr ? obj_hdr + sizeof(struct plm_lookaside_list_node) : NULL);
+}
+
+void plm_lookaside_list_free_lockfree(struct plm_lookaside_list *list,
+									  void *obj, void inlock_handler(void *))
+{
+#ifdef HAVE_CAS128
+	struct plm_lookaside_list_node *obj_hdr;
+
+	obj_hdr = (struct plm_lookaside_list_node *)
+		((char *)obj - sizeof(struct plm_lookaside_list_node));
+
+	if (inlock_handler)
+		inlock_handler(obj);
+
+	/* take a place in stack first, so the high level holds */
+	if (plm_atomic_add_relaxed(&list->ll_stack_len, 1) - 1
+		> list->ll_high_level) {
+		plm_atomic_add_relaxed(&list->ll_stack_len, -1);
+		list->ll_free(obj_hdr);
+	} else {
+		plm_lookaside_stack_push(list, &obj_hdr->lln_node);
+		plm_atomic_add_relaxed(&list->ll_misc.ll_free_times_to_list, 1);
+	}
+
+	plm_atomic_add_relaxed(&list->ll_misc.ll_free_times, 1);
+#endif
+}
@@ -26,13 +26,24 @@
 #ifndef _PLM_LOOKASIDE_LIST_H
 #define _PLM_LOOKASIDE_LIST_H
 
+#include <stdint.h>
 #include "plm_list.h"
 #include "plm_sync_mech.h"
+#include "plm_atomic.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* top of the lock free stack, pop bumps the tag so that a node
+ * popped and pushed back between our read and compare and swap
+ * fails the swap, both fields are swapped together
+ */
+struct plm_lookaside_stack {
+	plm_list_node_t *ls_top;
+	uintptr_t ls_tag;
+} __attribute__((aligned(16)));
+
 struct plm_lookaside_list {
 	/* use to allocate or free memory from or to system */
 	void *(*ll_alloc)(size_t);
@@ -69,13 +80,20 @@ struct plm_lookaside_list {
 	} ll_misc;
 
 	/* on/off */
-	union {
+	struct {
 		unsigned char ll_zero_memory:1;
 		unsigned char ll_tag_check:1;
 		unsigned char ll_thrdsafe:1;
+		unsigned char ll_lockfree:1;
 	} ll_onoff;
 
 	plm_lock_t ll_lock;
+
+	/* object stack and its length used instead of ll_list and
+	 * ll_lock in lock free mode
+	 */
+	struct plm_lookaside_stack ll_stack;
+	int ll_stack_len;
 };
 
 /* init a lookaside list, a lookaside list is just like 
@@ -104,6 +122,13 @@ void plm_lookaside_list_init(struct plm_lookaside_list *list, int high_level,
 void plm_lookaside_list_enable(struct plm_lookaside_list *list,
 							   int zero_memory, int tag_check, int thrdsafe);
 
+/* use a lock free stack instead of the mutex, counters are kept
+ * with relaxed atomics, call it after plm_lookaside_list_enable
+ * @list -- list to enable, thrdsafe should be enabled
+ * return 0 -- lock free is on, else the list keeps the mutex
+ */
+int plm_lookaside_list_enable_lockfree(struct plm_lookaside_list *list);
+
 /* destroy a list, this just free the objects in list 
  * @list -- list to destroy
  * return void
@@ -129,9 +154,16 @@ void *plm_lookaside_list_alloc(struct plm_lookaside_list *list,
 void plm_lookaside_list_free(struct plm_lookaside_list *list, void *obj,
 							 void inlock_handler(void *));
 
+#define plm_lookaside_list_locked(l) \
+	((l)->ll_onoff.ll_thrdsafe && !(l)->ll_onoff.ll_lockfree)
+
 /* get the number of free objects */
 #define plm_lookaside_list_free_objects(l, n) \
 	do { \
+		if ((l)->ll_onoff.ll_lockfree) { \
+			*n = plm_atomic_load_relaxed(&(l)->ll_stack_len); \
+			break; \
+		} \
 		if ((l)->ll_onoff.ll_thrdsafe) \
 			plm_lock_lock(&((l)->ll_lock)); \
 		*n = PLM_LIST_LEN(&((l)->ll_list)); \
@@ -139,16 +171,17 @@ void plm_lookaside_list_free(struct plm_lookaside_list *list, void *obj,
 			plm_lock_unlock(&((l)->ll_lock)); \
 	} while (0)
 
+/* counters are not a snapshot in lock free mode */
 #define plm_lookaside_list_dump_misc(l, a, b, c, d, e) \
 	do { \
-		if ((l)->ll_onoff.ll_thrdsafe)	\
+		if (plm_lookaside_list_locked(l)) \
 			plm_lock_lock(&((l)->ll_lock)); \
-		*a = (l)->ll_misc.ll_alloc_times; \
-		*b = (l)->ll_misc.ll_free_times; \
-		*c = (l)->ll_misc.ll_alloc_times_from_list; \
-		*d = (l)->ll_misc.ll_free_times_to_list; \
-		*e = (l)->ll_misc.ll_alloc_failed_times; \
-		if ((l)->ll_onoff.ll_thrdsafe) \
+		*a = plm_atomic_load_relaxed(&(l)->ll_misc.ll_alloc_times); \
+		*b = plm_atomic_load_relaxed(&(l)->ll_misc.ll_free_times); \
+		*c = plm_atomic_load_relaxed(&(l)->ll_misc.ll_alloc_times_from_list); \
+		*d = plm_atomic_load_relaxed(&(l)->ll_misc.ll_free_times_to_list); \
+		*e = plm_atomic_load_relaxed(&(l)->ll_misc.ll_alloc_failed_times); \
+		if (plm_lookaside_list_locked(l)) \
 			plm_lock_unlock(&((l)->ll_lock)); \
 	} while (0)
 
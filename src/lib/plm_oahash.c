@@ -0,0 +1,448 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "plm_oahash.h"
+
+#define PLM_OAHASH_GROUP 16
+#define PLM_OAHASH_EMPTY ((uint8_t)0x80)
+#define PLM_OAHASH_DELETED ((uint8_t)0xfe)
+
+/* h1 selects the group, h2 is kept in control byte */
+#define PLM_OAHASH_H1(h) ((h) >> 7)
+#define PLM_OAHASH_H2(h) ((uint8_t)((h) & 0x7f))
+
+/* resize when 7/8 slots are full or deleted */
+#define PLM_OAHASH_MAX_USED(t) (((t)->ot_mask + 1) - (((t)->ot_mask + 1) >> 3))
+
+#define PLM_OAHASH_LOWER(c) ((c) >= 'A' && (c) <= 'Z' ? (c) + 32 : (c))
+
+static uint32_t plm_oahash_hash(int flags, const char *key, size_t len);
+static void *plm_oahash_alloc(struct plm_oahash *hash, size_t n);
+static void plm_oahash_free(struct plm_oahash *hash, void *p);
+static int plm_oahash_table_init(struct plm_oahash *hash,
+								 struct plm_oahash_table *t, uint32_t cap);
+static void plm_oahash_table_destroy(struct plm_oahash *hash,
+									 struct plm_oahash_table *t, int entries);
+static int plm_oahash_table_find(struct plm_oahash *hash,
+								 struct plm_oahash_table *t, uint32_t h,
+								 const char *key, size_t len);
+static void plm_oahash_table_insert(struct plm_oahash_table *t,
+									struct plm_oahash_entry *e);
+static void plm_oahash_table_erase(struct plm_oahash_table *t, uint32_t pos);
+static void plm_oahash_migrate(struct plm_oahash *hash, uint32_t n);
+
+/* init hash
+ * @hash -- the hash
+ * @cap -- init capacity, rounded up to power of two
+ * @flags -- PLM_OAHASH_NOCASE or 0
+ * @pool -- allocate from pool if not NULL, the memory is released
+ *          with the pool
+ * return 0 -- success, else error
+ */
+int plm_oahash_init(struct plm_oahash *hash, uint32_t cap, int flags,
+					struct plm_mempool *pool)
+{
+	memset(hash, 0, sizeof(*hash));
+	hash->oh_pool = pool;
+	hash->oh_flags = flags;
+
+	/* keep the load under 7/8 */
+	return plm_oahash_table_init(hash, &hash->oh_cur, cap + (cap >> 3));
+}
+
+/* destroy hash and all entries */
+void plm_oahash_destroy(struct plm_oahash *hash)
+{
+	plm_oahash_table_destroy(hash, &hash->oh_cur, 1);
+	plm_oahash_table_destroy(hash, &hash->oh_old, 1);
+	hash->oh_len = 0;
+}
+
+/* insert key, the same key could be inserted more than once
+ * @hash -- the hash
+ * @key -- key, copied into the entry
+ * @len -- key length
+ * @value -- value
+ * return the entry or NULL if out of memory
+ */
+struct plm_oahash_entry *
+plm_oahash_insert(struct plm_oahash *hash, const char *key, size_t len,
+				  void *value)
+{
+	struct plm_oahash_entry *e;
+	struct plm_oahash_table *t = &hash->oh_cur;
+
+	if (t->ot_used >= PLM_OAHASH_MAX_USED(t)) {
+		struct plm_oahash_table nt;
+		uint32_t cap = t->ot_mask + 1;
+
+		/* a resize is running, complete it before next one */
+		if (hash->oh_old.ot_ctrl)
+			plm_oahash_migrate(hash, hash->oh_old.ot_mask + 1);
+
+		/* rehash to the same size if most are deleted */
+		if (hash->oh_len >= cap / 2)
+			cap *= 2;
+		if (plm_oahash_table_init(hash, &nt, cap))
+			return (NULL);
+
+		hash->oh_old = *t;
+		hash->oh_cur = nt;
+		hash->oh_migrate = 0;
+	}
+
+	e = (struct plm_oahash_entry *)
+		plm_oahash_alloc(hash, sizeof(*e) + len + 1);
+	if (!e)
+		return (NULL);
+
+	e->oe_value = value;
+	e->oe_hash = plm_oahash_hash(hash->oh_flags, key, len);
+	e->oe_len = (uint32_t)len;
+	memcpy(e->oe_key, key, len);
+	e->oe_key[len] = '\0';
+
+	plm_oahash_table_insert(&hash->oh_cur, e);
+	hash->oh_len++;
+
+	if (hash->oh_old.ot_ctrl)
+		plm_oahash_migrate(hash, PLM_OAHASH_GROUP);
+
+	return (e);
+}
+
+/* find the first entry of key
+ * @hash -- the hash
+ * @key -- key
+ * @len -- key length
+ * return the entry or NULL if not found
+ */
+struct plm_oahash_entry *
+plm_oahash_find(struct plm_oahash *hash, const char *key, size_t len)
+{
+	int pos;
+	uint32_t h = plm_oahash_hash(hash->oh_flags, key, len);
+
+	pos = plm_oahash_table_find(hash, &hash->oh_cur, h, key, len);
+	if (pos >= 0)
+		return (hash->oh_cur.ot_slots[pos]);
+
+	if (hash->oh_old.ot_ctrl) {
+		pos = plm_oahash_table_find(hash, &hash->oh_old, h, key, len);
+		if (pos >= 0)
+			return (hash->oh_old.ot_slots[pos]);
+	}
+
+	return (NULL);
+}
+
+/* delete all entries of key
+ * @hash -- the hash
+ * @key -- key
+ * @len -- key length
+ * return the number of entries deleted
+ */
+int plm_oahash_delete(struct plm_oahash *hash, const char *key, size_t len)
+{
+	int i, pos, n = 0;
+	uint32_t h = plm_oahash_hash(hash->oh_flags, key, len);
+	struct plm_oahash_table *tables[2];
+
+	tables[0] = &hash->oh_cur;
+	tables[1] = &hash->oh_old;
+
+	for (i = 0; i < 2; i++) {
+		struct plm_oahash_table *t = tables[i];
+
+		if (!t->ot_ctrl)
+			continue;
+
+		while ((pos = plm_oahash_table_find(hash, t, h, key, len)) >= 0) {
+			plm_oahash_free(hash, t->ot_slots[pos]);
+			plm_oahash_table_erase(t, pos);
+			n++;
+		}
+	}
+
+	hash->oh_len -= n;
+	if (hash->oh_old.ot_ctrl)
+		plm_oahash_migrate(hash, PLM_OAHASH_GROUP);
+
+	return (n);
+}
+
+/* call fn for every entry, fn must not modify the hash */
+void plm_oahash_foreach(struct plm_oahash *hash, void *data,
+						void (*fn)(struct plm_oahash_entry *, void *))
+{
+	uint32_t i;
+	struct plm_oahash_table *t;
+
+	t = &hash->oh_cur;
+	for (i = 0; t->ot_ctrl && i <= t->ot_mask; i++) {
+		if (!(t->ot_ctrl[i] & 0x80))
+			fn(t->ot_slots[i], data);
+	}
+
+	t = &hash->oh_old;
+	for (i = 0; t->ot_ctrl && i <= t->ot_mask; i++) {
+		if (!(t->ot_ctrl[i] & 0x80))
+			fn(t->ot_slots[i], data);
+	}
+}
+
+/* bit i set if the control byte i of group equals h2 */
+static inline uint32_t plm_oahash_match(const uint8_t *ctrl, uint8_t h2)
+{
+#ifdef __SSE2__
+	__m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(g, _mm_set1_epi8(h2)));
+#else
+	int i;
+	uint32_t m = 0;
+
+	for (i = 0; i < PLM_OAHASH_GROUP; i++)
+		m |= (uint32_t)(ctrl[i] == h2) << i;
+	return (m);
+#endif
+}
+
+/* bit i set if slot i of group is empty or deleted, the high bit of
+ * the control byte is set for both
+ */
+static inline uint32_t plm_oahash_match_free(const uint8_t *ctrl)
+{
+#ifdef __SSE2__
+	__m128i g = _mm_loadu_si128((const __m128i *)ctrl);
+	return _mm_movemask_epi8(g);
+#else
+	int i;
+	uint32_t m = 0;
+
+	for (i = 0; i < PLM_OAHASH_GROUP; i++)
+		m |= (uint32_t)(ctrl[i] >> 7) << i;
+	return (m);
+#endif
+}
+
+uint32_t plm_oahash_hash(int flags, const char *key, size_t len)
+{
+	size_t i;
+	uint32_t h = 2166136261u;
+
+	/* fnv-1a with a final mix, h2 takes the low bits */
+	if (flags & PLM_OAHASH_NOCASE) {
+		for (i = 0; i < len; i++) {
+			h ^= (uint8_t)PLM_OAHASH_LOWER(key[i]);
+			h *= 16777619u;
+		}
+	} else {
+		for (i = 0; i < len; i++) {
+			h ^= (uint8_t)key[i];
+			h *= 16777619u;
+		}
+	}
+
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return (h);
+}
+
+/* the pool does not align, entries and slots need pointer alignment */
+void *plm_oahash_alloc(struct plm_oahash *hash, size_t n)
+{
+	uintptr_t p;
+
+	if (!hash->oh_pool)
+		return malloc(n);
+
+	p = (uintptr_t)plm_mempool_alloc(hash->oh_pool, n + sizeof(void *) - 1);
+	if (!p)
+		return (NULL);
+
+	return (void *)((p + sizeof(void *) - 1) & ~(uintptr_t)(sizeof(void *) - 1));
+}
+
+void plm_oahash_free(struct plm_oahash *hash, void *p)
+{
+	if (!hash->oh_pool)
+		free(p);
+}
+
+int plm_oahash_table_init(struct plm_oahash *hash,
+						  struct plm_oahash_table *t, uint32_t cap)
+{
+	uint32_t n = PLM_OAHASH_GROUP;
+
+	while (n < cap)
+		n <<= 1;
+
+	t->ot_slots = (struct plm_oahash_entry **)
+		plm_oahash_alloc(hash, n * sizeof(t->ot_slots[0]));
+	if (!t->ot_slots)
+		return (-1);
+
+	t->ot_ctrl = (uint8_t *)plm_oahash_alloc(hash, n);
+	if (!t->ot_ctrl) {
+		plm_oahash_free(hash, t->ot_slots);
+		t->ot_slots = NULL;
+		return (-1);
+	}
+
+	memset(t->ot_ctrl, PLM_OAHASH_EMPTY, n);
+	t->ot_mask = n - 1;
+	t->ot_used = 0;
+	return (0);
+}
+
+void plm_oahash_table_destroy(struct plm_oahash *hash,
+							  struct plm_oahash_table *t, int entries)
+{
+	uint32_t i;
+
+	if (!t->ot_ctrl)
+		return;
+
+	for (i = 0; entries && i <= t->ot_mask; i++) {
+		if (!(t->ot_ctrl[i] & 0x80))
+			plm_oahash_free(hash, t->ot_slots[i]);
+	}
+
+	plm_oahash_free(hash, t->ot_ctrl);
+	plm_oahash_free(hash, t->ot_slots);
+	memset(t, 0, sizeof(*t));
+}
+
+/* probe groups in triangular sequence, it visits every group once
+ * since the number of groups is power of two
+ * return slot index, or -1 if not found
+ */
+int plm_oahash_table_find(struct plm_oahash *hash,
+						  struct plm_oahash_table *t, uint32_t h,
+						  const char *key, size_t len)
+{
+	uint32_t gmask = t->ot_mask / PLM_OAHASH_GROUP;
+	uint32_t g = PLM_OAHASH_H1(h) & gmask;
+	uint32_t step = 0;
+	uint8_t h2 = PLM_OAHASH_H2(h);
+
+	for (;;) {
+		const uint8_t *ctrl = t->ot_ctrl + g * PLM_OAHASH_GROUP;
+		uint32_t m = plm_oahash_match(ctrl, h2);
+
+		while (m) {
+			uint32_t pos = g * PLM_OAHASH_GROUP + __builtin_ctz(m);
+			struct plm_oahash_entry *e = t->ot_slots[pos];
+
+			m &= m - 1;
+			if (e->oe_hash != h || e->oe_len != len)
+				continue;
+
+			if (hash->oh_flags & PLM_OAHASH_NOCASE) {
+				if (strncasecmp(e->oe_key, key, len) == 0)
+					return (pos);
+			} else if (memcmp(e->oe_key, key, len) == 0) {
+				return (pos);
+			}
+		}
+
+		/* an empty slot ends the probe */
+		if (plm_oahash_match(ctrl, PLM_OAHASH_EMPTY) || step == gmask)
+			return (-1);
+
+		g = (g + ++step) & gmask;
+	}
+}
+
+void plm_oahash_table_insert(struct plm_oahash_table *t,
+							 struct plm_oahash_entry *e)
+{
+	uint32_t gmask = t->ot_mask / PLM_OAHASH_GROUP;
+	uint32_t g = PLM_OAHASH_H1(e->oe_hash) & gmask;
+	uint32_t step = 0;
+
+	/* the load is under 7/8, there is always a free slot */
+	for (;;) {
+		uint8_t *ctrl = t->ot_ctrl + g * PLM_OAHASH_GROUP;
+		uint32_t m = plm_oahash_match_free(ctrl);
+
+		if (m) {
+			uint32_t i = __builtin_ctz(m);
+
+			if (ctrl[i] == PLM_OAHASH_EMPTY)
+				t->ot_used++;
+			ctrl[i] = PLM_OAHASH_H2(e->oe_hash);
+			t->ot_slots[g * PLM_OAHASH_GROUP + i] = e;
+			return;
+		}
+
+		g = (g + ++step) & gmask;
+	}
+}
+
+/* a group with an empty slot never makes a probe go on, so its slot
+ * could be empty again, else it must be a tombstone
+ */
+void plm_oahash_table_erase(struct plm_oahash_table *t, uint32_t pos)
+{
+	uint8_t *ctrl = t->ot_ctrl + (pos & ~(uint32_t)(PLM_OAHASH_GROUP - 1));
+
+	if (plm_oahash_match(ctrl, PLM_OAHASH_EMPTY)) {
+		t->ot_ctrl[pos] = PLM_OAHASH_EMPTY;
+		t->ot_used--;
+	} else {
+		t->ot_ctrl[pos] = PLM_OAHASH_DELETED;
+	}
+}
+
+/* move n slots of the old table to current, moved slots become
+ * tombstones so that probes in old table still work
+ */
+void plm_oahash_migrate(struct plm_oahash *hash, uint32_t n)
+{
+	struct plm_oahash_table *old = &hash->oh_old;
+
+	while (n-- > 0 && hash->oh_migrate <= old->ot_mask) {
+		uint32_t i = hash->oh_migrate++;
+
+		if (!(old->ot_ctrl[i] & 0x80)) {
+			plm_oahash_table_insert(&hash->oh_cur, old->ot_slots[i]);
+			old->ot_ctrl[i] = PLM_OAHASH_DELETED;
+		}
+	}
+
+	if (hash->oh_migrate > old->ot_mask)
+		plm_oahash_table_destroy(hash, old, 0);
+}
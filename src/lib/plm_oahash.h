@@ -0,0 +1,125 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_OAHASH_H
+#define _PLM_OAHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "plm_mempool.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* compare and hash keys case insensitive */
+#define PLM_OAHASH_NOCASE 1
+
+/* key is stored inline behind the entry */
+struct plm_oahash_entry {
+	void *oe_value;
+	uint32_t oe_hash;
+	uint32_t oe_len;
+	char oe_key[0];
+};
+
+/* open addressing table, a control byte per slot holds 7 bits of
+ * the hash or empty/deleted, slots are probed 16 in a group
+ */
+struct plm_oahash_table {
+	uint8_t *ot_ctrl;
+	struct plm_oahash_entry **ot_slots;
+	uint32_t ot_mask;
+	uint32_t ot_used;
+};
+
+struct plm_oahash {
+	/* entries and tables come from pool if set, else malloc */
+	struct plm_mempool *oh_pool;
+	int oh_flags;
+	uint32_t oh_len;
+
+	/* the current table, and the old one while resizing, entries
+	 * of the old table move to current a group per modification
+	 */
+	struct plm_oahash_table oh_cur;
+	struct plm_oahash_table oh_old;
+	uint32_t oh_migrate;
+};
+
+/* init hash
+ * @hash -- the hash
+ * @cap -- init capacity, rounded up to power of two
+ * @flags -- PLM_OAHASH_NOCASE or 0
+ * @pool -- allocate from pool if not NULL, the memory is released
+ *          with the pool
+ * return 0 -- success, else error
+ */
+int plm_oahash_init(struct plm_oahash *hash, uint32_t cap, int flags,
+					struct plm_mempool *pool);
+
+/* destroy hash and all entries */
+void plm_oahash_destroy(struct plm_oahash *hash);
+
+/* insert key, the same key could be inserted more than once
+ * @hash -- the hash
+ * @key -- key, copied into the entry
+ * @len -- key length
+ * @value -- value
+ * return the entry or NULL if out of memory
+ */
+struct plm_oahash_entry *
+plm_oahash_insert(struct plm_oahash *hash, const char *key, size_t len,
+				  void *value);
+
+/* find the first entry of key
+ * @hash -- the hash
+ * @key -- key
+ * @len -- key length
+ * return the entry or NULL if not found
+ */
+struct plm_oahash_entry *
+plm_oahash_find(struct plm_oahash *hash, const char *key, size_t len);
+
+/* delete all entries of key
+ * @hash -- the hash
+ * @key -- key
+ * @len -- key length
+ * return the number of entries deleted
+ */
+int plm_oahash_delete(struct plm_oahash *hash, const char *key, size_t len);
+
+/* call fn for every entry, fn must not modify the hash */
+void plm_oahash_foreach(struct plm_oahash *hash, void *data,
+						void (*fn)(struct plm_oahash_entry *, void *));
+
+#define plm_oahash_len(hash) (hash)->oh_len
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
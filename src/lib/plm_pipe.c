@@ -0,0 +1,162 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include "plm_event.h"
+#include "plm_pipe.h"
+
+/* pipes kept per thread, and the size asked for */
+#define PLM_PIPE_IDLE_MAX 16
+#define PLM_PIPE_SIZE (256 * 1024)
+
+static __thread struct plm_pipe *idle_pipes;
+static __thread int idle_num;
+
+static void plm_pipe_close(struct plm_pipe *p);
+
+/* get an empty pipe from the pool of the current thread, or a new one
+ * return the pipe or NULL if pipes are not available
+ */
+struct plm_pipe *plm_pipe_get()
+{
+	int n;
+	struct plm_pipe *p;
+
+	p = idle_pipes;
+	if (p) {
+		idle_pipes = p->pp_next;
+		idle_num--;
+		return (p);
+	}
+
+	p = (struct plm_pipe *)malloc(sizeof(*p));
+	if (!p)
+		return (NULL);
+
+	if (pipe2(p->pp_fd, O_NONBLOCK | O_CLOEXEC) < 0) {
+		free(p);
+		return (NULL);
+	}
+
+	/* a larger pipe moves more per splice, the default is kept if the
+	 * limit of the system is lower
+	 */
+	fcntl(p->pp_fd[1], F_SETPIPE_SZ, PLM_PIPE_SIZE);
+	n = fcntl(p->pp_fd[1], F_GETPIPE_SZ);
+
+	p->pp_next = NULL;
+	p->pp_size = n > 0 ? n : 65536;
+	p->pp_len = 0;
+	return (p);
+}
+
+/* return a pipe to the pool of the current thread, a pipe still holding
+ * data or beyond the idle limit is closed
+ */
+void plm_pipe_put(struct plm_pipe *p)
+{
+	if (p->pp_len > 0 || idle_num >= PLM_PIPE_IDLE_MAX) {
+		plm_pipe_close(p);
+		return;
+	}
+
+	p->pp_next = idle_pipes;
+	idle_pipes = p;
+	idle_num++;
+}
+
+/* close the idle pipes of the current thread */
+void plm_pipe_pool_clear()
+{
+	struct plm_pipe *p;
+
+	while ((p = idle_pipes) != NULL) {
+		idle_pipes = p->pp_next;
+		plm_pipe_close(p);
+	}
+
+	idle_num = 0;
+}
+
+/* splice from a socket into the pipe
+ * @p -- the pipe
+ * @fd -- socket to read
+ * @len -- at most len bytes, limited to the room of the pipe
+ * return bytes moved, 0 at eof, -1 on error and errno is set
+ */
+ssize_t plm_pipe_fill(struct plm_pipe *p, int fd, size_t len)
+{
+	ssize_t n;
+
+	if (len > p->pp_size - p->pp_len)
+		len = p->pp_size - p->pp_len;
+
+	do {
+		n = splice(fd, NULL, p->pp_fd[1], NULL, len,
+				   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	} while (n < 0 && errno == EINTR);
+
+	if (n > 0)
+		p->pp_len += n;
+	else if (n < 0 && errno == EAGAIN)
+		plm_event_io_clear_ready(fd, PLM_READ);
+
+	return (n);
+}
+
+/* splice from the pipe to a socket
+ * @p -- the pipe
+ * @fd -- socket to write
+ * return bytes moved, -1 on error and errno is set
+ */
+ssize_t plm_pipe_drain(struct plm_pipe *p, int fd)
+{
+	ssize_t n;
+
+	do {
+		n = splice(p->pp_fd[0], NULL, fd, NULL, p->pp_len,
+				   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+	} while (n < 0 && errno == EINTR);
+
+	if (n > 0)
+		p->pp_len -= n;
+	else if (n < 0 && errno == EAGAIN)
+		plm_event_io_clear_ready(fd, PLM_WRITE);
+
+	return (n);
+}
+
+void plm_pipe_close(struct plm_pipe *p)
+{
+	close(p->pp_fd[0]);
+	close(p->pp_fd[1]);
+	free(p);
+}
@@ -0,0 +1,80 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_PIPE_H
+#define _PLM_PIPE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a nonblocking pipe to splice socket data through, the bytes stay in
+ * the kernel
+ */
+struct plm_pipe {
+	struct plm_pipe *pp_next;
+	int pp_fd[2];
+
+	/* capacity and bytes buffered */
+	size_t pp_size;
+	size_t pp_len;
+};
+
+/* get an empty pipe from the pool of the current thread, or a new one
+ * return the pipe or NULL if pipes are not available
+ */
+struct plm_pipe *plm_pipe_get();
+
+/* return a pipe to the pool of the current thread, a pipe still holding
+ * data or beyond the idle limit is closed
+ */
+void plm_pipe_put(struct plm_pipe *p);
+
+/* close the idle pipes of the current thread */
+void plm_pipe_pool_clear();
+
+/* splice from a socket into the pipe
+ * @p -- the pipe
+ * @fd -- socket to read
+ * @len -- at most len bytes, limited to the room of the pipe
+ * return bytes moved, 0 at eof, -1 on error and errno is set
+ */
+ssize_t plm_pipe_fill(struct plm_pipe *p, int fd, size_t len);
+
+/* splice from the pipe to a socket
+ * @p -- the pipe
+ * @fd -- socket to write
+ * return bytes moved, -1 on error and errno is set
+ */
+ssize_t plm_pipe_drain(struct plm_pipe *p, int fd);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -78,6 +78,7 @@ struct plm_share_param {
 	unsigned int sp_tag;	
 	uint8_t sp_tagcheck : 1;
 	uint8_t sp_zeromem : 1;
+	uint8_t sp_reuseport : 1;
 };
 	
 /* directive structure */	
@@ -0,0 +1,366 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "plm_sync_mech.h"
+#include "plm_slab.h"
+
+#define PLM_CACHE_LINE 64
+
+/* bytes of objects per magazine, a magazine holds 2 to 64 objects */
+#define PLM_SLAB_MAG_BYTES (64 * 1024)
+#define PLM_SLAB_MAG_MIN 2
+#define PLM_SLAB_MAG_MAX 64
+
+/* free object, the first object of a full magazine in depot links
+ * the next magazine
+ */
+struct plm_slab_obj {
+	struct plm_slab_obj *so_next;
+	struct plm_slab_obj *so_mag;
+};
+
+/* memory from system, one magazine of objects follow the header */
+struct plm_slab_block {
+	struct plm_slab_block *sb_next;
+} __attribute__((aligned(PLM_CACHE_LINE)));
+
+struct plm_slab_mag {
+	struct plm_slab_obj *sm_head;
+	int sm_count;
+};
+
+/* the loaded magazine is where objects go and come, the previous
+ * one is either full or empty
+ */
+struct plm_slab_cache {
+	struct plm_slab_mag sc_loaded;
+	struct plm_slab_mag sc_prev;
+
+	long long sc_alloc_times;
+	long long sc_free_times;
+	long long sc_depot_get_times;
+	long long sc_depot_put_times;
+};
+
+struct plm_slab_thrd {
+	struct plm_slab_cache st_cache[PLM_SLAB_CLASS_NUM];
+} __attribute__((aligned(PLM_CACHE_LINE)));
+
+struct plm_slab_depot {
+	plm_lock_t sd_lock;
+
+	/* full magazines */
+	struct plm_slab_obj *sd_mags;
+	int sd_nmags;
+
+	struct plm_slab_block *sd_slabs;
+	int sd_nslabs;
+
+	size_t sd_size;
+	int sd_mag_size;
+} __attribute__((aligned(PLM_CACHE_LINE)));
+
+struct plm_slab {
+	int s_thrdn;
+	int s_zeromem;
+	struct plm_slab_thrd *s_thrd;
+	struct plm_slab_depot s_depot[PLM_SLAB_CLASS_NUM];
+};
+
+static struct plm_slab slab;
+extern __thread int curr_slot;
+
+static int plm_slab_class(size_t size);
+static int plm_slab_depot_get(struct plm_slab_depot *sd,
+							  struct plm_slab_mag *mag);
+static void plm_slab_depot_put(struct plm_slab_depot *sd,
+							   struct plm_slab_mag *mag);
+
+/* init slab allocator, every work thread has a cache of two
+ * magazines per size class, the magazines go to and come from a
+ * locked global depot in batch
+ * @thrdn -- number of thread
+ * @zeromem -- set memory to zero when allocated
+ * return 0 -- success, else error
+ */
+int plm_slab_init(int thrdn, int zeromem)
+{
+	int i;
+	void *p;
+	size_t size = thrdn * sizeof(struct plm_slab_thrd);
+
+	if (posix_memalign(&p, PLM_CACHE_LINE, size))
+		return (-1);
+
+	memset(p, 0, size);
+	slab.s_thrd = (struct plm_slab_thrd *)p;
+	slab.s_thrdn = thrdn;
+	slab.s_zeromem = zeromem;
+
+	for (i = 0; i < PLM_SLAB_CLASS_NUM; i++) {
+		struct plm_slab_depot *sd = &slab.s_depot[i];
+		int n;
+
+		sd->sd_size = (size_t)1 << (i + PLM_SLAB_MIN_SHIFT);
+		n = PLM_SLAB_MAG_BYTES / sd->sd_size;
+		if (n < PLM_SLAB_MAG_MIN)
+			n = PLM_SLAB_MAG_MIN;
+		if (n > PLM_SLAB_MAG_MAX)
+			n = PLM_SLAB_MAG_MAX;
+		sd->sd_mag_size = n;
+		sd->sd_mags = NULL;
+		sd->sd_nmags = 0;
+		sd->sd_slabs = NULL;
+		sd->sd_nslabs = 0;
+
+		if (plm_lock_init(&sd->sd_lock)) {
+			while (--i >= 0)
+				plm_lock_destroy(&slab.s_depot[i].sd_lock);
+			free(slab.s_thrd);
+			slab.s_thrd = NULL;
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/* destroy allocator and free all slabs to system */
+void plm_slab_destroy()
+{
+	int i;
+
+	if (!slab.s_thrd)
+		return;
+
+	for (i = 0; i < PLM_SLAB_CLASS_NUM; i++) {
+		struct plm_slab_depot *sd = &slab.s_depot[i];
+
+		while (sd->sd_slabs) {
+			struct plm_slab_block *sb = sd->sd_slabs;
+			sd->sd_slabs = sb->sb_next;
+			free(sb);
+		}
+
+		plm_lock_destroy(&sd->sd_lock);
+	}
+
+	free(slab.s_thrd);
+	slab.s_thrd = NULL;
+	slab.s_thrdn = 0;
+}
+
+/* allocate from the current thread cache
+ * @size -- bytes, larger than 64k is allocated from system
+ * return NULL if failed, else the memory address
+ */
+void *plm_slab_alloc(size_t size)
+{
+	int cls;
+	struct plm_slab_cache *sc;
+	struct plm_slab_obj *obj;
+
+	cls = plm_slab_class(size);
+	if (cls < 0)
+		return slab.s_zeromem ? calloc(1, size) : malloc(size);
+
+	sc = &slab.s_thrd[curr_slot].st_cache[cls];
+	if (sc->sc_loaded.sm_count == 0) {
+		if (sc->sc_prev.sm_count > 0) {
+			struct plm_slab_mag tmp = sc->sc_loaded;
+			sc->sc_loaded = sc->sc_prev;
+			sc->sc_prev = tmp;
+		} else {
+			if (plm_slab_depot_get(&slab.s_depot[cls], &sc->sc_loaded))
+				return (NULL);
+			sc->sc_depot_get_times++;
+		}
+	}
+
+	obj = sc->sc_loaded.sm_head;
+	sc->sc_loaded.sm_head = obj->so_next;
+	sc->sc_loaded.sm_count--;
+	sc->sc_alloc_times++;
+
+	if (slab.s_zeromem)
+		memset(obj, 0, slab.s_depot[cls].sd_size);
+
+	return (obj);
+}
+
+/* free object into the current thread cache, it could be freed by
+ * a thread which is not the allocator
+ * @obj -- object allocated by plm_slab_alloc
+ * @size -- the size passed to plm_slab_alloc
+ * return void
+ */
+void plm_slab_free(void *obj, size_t size)
+{
+	int cls;
+	struct plm_slab_cache *sc;
+	struct plm_slab_obj *so = (struct plm_slab_obj *)obj;
+
+	if (!obj)
+		return;
+
+	cls = plm_slab_class(size);
+	if (cls < 0) {
+		free(obj);
+		return;
+	}
+
+	sc = &slab.s_thrd[curr_slot].st_cache[cls];
+	if (sc->sc_loaded.sm_count == slab.s_depot[cls].sd_mag_size) {
+		if (sc->sc_prev.sm_count > 0) {
+			plm_slab_depot_put(&slab.s_depot[cls], &sc->sc_prev);
+			sc->sc_depot_put_times++;
+		}
+
+		/* the previous one is empty now */
+		sc->sc_prev = sc->sc_loaded;
+		sc->sc_loaded.sm_head = NULL;
+		sc->sc_loaded.sm_count = 0;
+	}
+
+	so->so_next = sc->sc_loaded.sm_head;
+	sc->sc_loaded.sm_head = so;
+	sc->sc_loaded.sm_count++;
+	sc->sc_free_times++;
+}
+
+/* get statistics of a size class
+ * @cls -- class index, 0 to PLM_SLAB_CLASS_NUM - 1
+ * @stat -- statistics
+ * return 0 -- success, else error
+ */
+int plm_slab_stat(int cls, struct plm_slab_stat *stat)
+{
+	int i;
+	struct plm_slab_depot *sd;
+
+	if (cls < 0 || cls >= PLM_SLAB_CLASS_NUM || !slab.s_thrd)
+		return (-1);
+
+	sd = &slab.s_depot[cls];
+	memset(stat, 0, sizeof(*stat));
+	stat->ss_size = sd->sd_size;
+	stat->ss_mag_size = sd->sd_mag_size;
+
+	/* counters of other threads are read without lock, they are
+	 * not exact while threads are running
+	 */
+	for (i = 0; i < slab.s_thrdn; i++) {
+		struct plm_slab_cache *sc = &slab.s_thrd[i].st_cache[cls];
+
+		stat->ss_alloc_times += sc->sc_alloc_times;
+		stat->ss_free_times += sc->sc_free_times;
+		stat->ss_depot_get_times += sc->sc_depot_get_times;
+		stat->ss_depot_put_times += sc->sc_depot_put_times;
+	}
+
+	plm_lock_lock(&sd->sd_lock);
+	stat->ss_depot_mags = sd->sd_nmags;
+	stat->ss_slabs = sd->sd_nslabs;
+	plm_lock_unlock(&sd->sd_lock);
+
+	stat->ss_bytes = (size_t)stat->ss_slabs * sd->sd_mag_size * sd->sd_size;
+	return (0);
+}
+
+/* return class index of size, or -1 if it is too large */
+int plm_slab_class(size_t size)
+{
+	int cls = 0;
+	size_t n = (size_t)1 << PLM_SLAB_MIN_SHIFT;
+
+	while (n < size) {
+		n <<= 1;
+		cls++;
+	}
+
+	return (cls < PLM_SLAB_CLASS_NUM ? cls : -1);
+}
+
+/* take a full magazine from depot, or carve a new slab into one
+ * return 0 -- success, else error
+ */
+int plm_slab_depot_get(struct plm_slab_depot *sd, struct plm_slab_mag *mag)
+{
+	int i;
+	char *p;
+	struct plm_slab_block *sb;
+	struct plm_slab_obj *head = NULL;
+
+	plm_lock_lock(&sd->sd_lock);
+	if (sd->sd_mags) {
+		mag->sm_head = sd->sd_mags;
+		mag->sm_count = sd->sd_mag_size;
+		sd->sd_mags = sd->sd_mags->so_mag;
+		sd->sd_nmags--;
+		plm_lock_unlock(&sd->sd_lock);
+		return (0);
+	}
+	plm_lock_unlock(&sd->sd_lock);
+
+	if (posix_memalign((void **)&sb, PLM_CACHE_LINE,
+					   sizeof(*sb) + sd->sd_mag_size * sd->sd_size))
+		return (-1);
+
+	p = (char *)(sb + 1);
+	for (i = sd->sd_mag_size - 1; i >= 0; i--) {
+		struct plm_slab_obj *so;
+
+		so = (struct plm_slab_obj *)(p + i * sd->sd_size);
+		so->so_next = head;
+		head = so;
+	}
+
+	mag->sm_head = head;
+	mag->sm_count = sd->sd_mag_size;
+
+	plm_lock_lock(&sd->sd_lock);
+	sb->sb_next = sd->sd_slabs;
+	sd->sd_slabs = sb;
+	sd->sd_nslabs++;
+	plm_lock_unlock(&sd->sd_lock);
+
+	return (0);
+}
+
+/* return a full magazine to depot, mag is empty after call */
+void plm_slab_depot_put(struct plm_slab_depot *sd, struct plm_slab_mag *mag)
+{
+	plm_lock_lock(&sd->sd_lock);
+	mag->sm_head->so_mag = sd->sd_mags;
+	sd->sd_mags = mag->sm_head;
+	sd->sd_nmags++;
+	plm_lock_unlock(&sd->sd_lock);
+
+	mag->sm_head = NULL;
+	mag->sm_count = 0;
+}
@@ -0,0 +1,101 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_SLAB_H
+#define _PLM_SLAB_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* size classes are power of two from 64 bytes to 64k */
+#define PLM_SLAB_MIN_SHIFT 6
+#define PLM_SLAB_MAX_SHIFT 16
+#define PLM_SLAB_CLASS_NUM (PLM_SLAB_MAX_SHIFT - PLM_SLAB_MIN_SHIFT + 1)
+
+/* statistics of a size class, summed over all threads */
+struct plm_slab_stat {
+	/* object size in bytes */
+	size_t ss_size;
+
+	/* objects per magazine */
+	int ss_mag_size;
+
+	/* how many times allocate and free */
+	long long ss_alloc_times;
+	long long ss_free_times;
+
+	/* how many full magazines taken from and returned to depot */
+	long long ss_depot_get_times;
+	long long ss_depot_put_times;
+
+	/* number of full magazines in depot now */
+	int ss_depot_mags;
+
+	/* slabs allocated from system and bytes they hold */
+	int ss_slabs;
+	size_t ss_bytes;
+};
+
+/* init slab allocator, every work thread has a cache of two
+ * magazines per size class, the magazines go to and come from a
+ * locked global depot in batch
+ * @thrdn -- number of thread
+ * @zeromem -- set memory to zero when allocated
+ * return 0 -- success, else error
+ */
+int plm_slab_init(int thrdn, int zeromem);
+
+/* destroy allocator and free all slabs to system */
+void plm_slab_destroy();
+
+/* allocate from the current thread cache
+ * @size -- bytes, larger than 64k is allocated from system
+ * return NULL if failed, else the memory address
+ */
+void *plm_slab_alloc(size_t size);
+
+/* free object into the current thread cache, it could be freed by
+ * a thread which is not the allocator
+ * @obj -- object allocated by plm_slab_alloc
+ * @size -- the size passed to plm_slab_alloc
+ * return void
+ */
+void plm_slab_free(void *obj, size_t size);
+
+/* get statistics of a size class
+ * @cls -- class index, 0 to PLM_SLAB_CLASS_NUM - 1
+ * @stat -- statistics
+ * return 0 -- success, else error
+ */
+int plm_slab_stat(int cls, struct plm_slab_stat *stat);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
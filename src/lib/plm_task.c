@@ -0,0 +1,267 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "plm_atomic.h"
+#include "plm_comm.h"
+#include "plm_event.h"
+#include "plm_log.h"
+#include "plm_task.h"
+
+#ifndef PLM_TASK_BATCH
+#define PLM_TASK_BATCH 256
+#endif
+
+#define PLM_CACHE_LINE 64
+
+/* intrusive multi producers single consumer queue, producers xchg
+ * the head and the consumer walks from the tail, no lock at all
+ */
+struct plm_task_queue {
+	struct plm_task *tq_head __attribute__((aligned(PLM_CACHE_LINE)));
+
+	/* consumer side */
+	struct plm_task *tq_tail __attribute__((aligned(PLM_CACHE_LINE)));
+	struct plm_task tq_stub;
+	int tq_efd;
+
+	/* set by the producer which writes the eventfd, the others
+	 * need not wake the consumer again
+	 */
+	int tq_signaled __attribute__((aligned(PLM_CACHE_LINE)));
+} __attribute__((aligned(PLM_CACHE_LINE)));
+
+struct plm_task_list {
+	int tl_num;
+	struct plm_task_queue *tl_queue;
+};
+
+static struct plm_task_list tasklist;
+extern __thread int curr_slot;
+
+static void plm_task_push(struct plm_task_queue *q, struct plm_task *t);
+static struct plm_task *plm_task_pop(struct plm_task_queue *q);
+static void plm_task_on_wakeup(void *data, int fd);
+
+/* init task queue of each work thread
+ * @thrdn -- number of thread
+ * return 0 -- success, else error
+ */
+int plm_task_init(int thrdn)
+{
+	int i;
+	void *p;
+	size_t size = thrdn * sizeof(struct plm_task_queue);
+
+	if (posix_memalign(&p, PLM_CACHE_LINE, size))
+		return (-1);
+
+	memset(p, 0, size);
+	tasklist.tl_num = thrdn;
+	tasklist.tl_queue = (struct plm_task_queue *)p;
+
+	for (i = 0; i < thrdn; i++) {
+		struct plm_task_queue *q = &tasklist.tl_queue[i];
+
+		q->tq_head = &q->tq_stub;
+		q->tq_tail = &q->tq_stub;
+		q->tq_efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (q->tq_efd < 0) {
+			plm_task_destroy();
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/* destroy task queues */
+void plm_task_destroy()
+{
+	int i;
+
+	if (!tasklist.tl_queue)
+		return;
+
+	for (i = 0; i < tasklist.tl_num; i++) {
+		if (tasklist.tl_queue[i].tq_efd > 0)
+			close(tasklist.tl_queue[i].tq_efd);
+	}
+
+	free(tasklist.tl_queue);
+	tasklist.tl_queue = NULL;
+	tasklist.tl_num = 0;
+}
+
+/* register the wakeup fd on the current thread poller, called in
+ * the work thread before enter the loop
+ * return 0 -- success, else error
+ */
+int plm_task_thrd_init()
+{
+	struct plm_task_queue *q = &tasklist.tl_queue[curr_slot];
+
+	return plm_event_io_read(q->tq_efd, q, plm_task_on_wakeup);
+}
+
+/* unregister the wakeup fd of the current thread */
+void plm_task_thrd_destroy()
+{
+	struct plm_task_queue *q = &tasklist.tl_queue[curr_slot];
+
+	plm_event_io_detach(q->tq_efd);
+}
+
+/* post a task to a work thread, could be called from any thread
+ * @slot -- the target thread slot
+ * @task -- task with handler and data set
+ * return 0 -- success, else error
+ */
+int plm_task_post(int slot, struct plm_task *task)
+{
+	uint64_t one = 1;
+	struct plm_task_queue *q;
+
+	if (slot < 0 || slot >= tasklist.tl_num)
+		return (-1);
+
+	q = &tasklist.tl_queue[slot];
+	plm_task_push(q, task);
+
+	/* the task is visible before we test the flag, consumer clears
+	 * the flag before it drains the queue so nothing is lost
+	 */
+	if (plm_atomic_xchg(&q->tq_signaled, 1) == 0) {
+		if (write(q->tq_efd, &one, sizeof(one)) != sizeof(one) &&
+			errno != EAGAIN)
+			return (-1);
+	}
+
+	return (0);
+}
+
+/* wake up a work thread sleeping in its poller without a task,
+ * it is async signal safe
+ * @slot -- the target thread slot
+ * return void
+ */
+void plm_task_wakeup(int slot)
+{
+	uint64_t one = 1;
+	struct plm_task_queue *q;
+
+	if (slot < 0 || slot >= tasklist.tl_num)
+		return;
+
+	q = &tasklist.tl_queue[slot];
+	if (plm_atomic_xchg(&q->tq_signaled, 1) == 0)
+		write(q->tq_efd, &one, sizeof(one));
+}
+
+/* run tasks queued on the current thread
+ * return nonzero if tasks left and caller should not block
+ */
+int plm_task_run()
+{
+	int n;
+	struct plm_task *t;
+	struct plm_task_queue *q = &tasklist.tl_queue[curr_slot];
+
+	for (n = 0; n < PLM_TASK_BATCH; n++) {
+		t = plm_task_pop(q);
+		if (!t)
+			return (0);
+
+		t->t_handler(t->t_data);
+	}
+
+	return (1);
+}
+
+void plm_task_push(struct plm_task_queue *q, struct plm_task *t)
+{
+	struct plm_task *prev;
+
+	t->t_next = NULL;
+	prev = plm_atomic_xchg(&q->tq_head, t);
+	plm_atomic_store_release(&prev->t_next, t);
+}
+
+/* return NULL if empty or a producer is in the middle of push,
+ * that producer would wake us up after the push is done
+ */
+struct plm_task *plm_task_pop(struct plm_task_queue *q)
+{
+	struct plm_task *tail = q->tq_tail;
+	struct plm_task *next = plm_atomic_load_acquire(&tail->t_next);
+
+	if (tail == &q->tq_stub) {
+		if (!next)
+			return (NULL);
+
+		q->tq_tail = next;
+		tail = next;
+		next = plm_atomic_load_acquire(&tail->t_next);
+	}
+
+	if (next) {
+		q->tq_tail = next;
+		return (tail);
+	}
+
+	if (tail != plm_atomic_load_acquire(&q->tq_head))
+		return (NULL);
+
+	plm_task_push(q, &q->tq_stub);
+	next = plm_atomic_load_acquire(&tail->t_next);
+	if (next) {
+		q->tq_tail = next;
+		return (tail);
+	}
+
+	return (NULL);
+}
+
+void plm_task_on_wakeup(void *data, int fd)
+{
+	uint64_t v;
+	struct plm_task_queue *q = (struct plm_task_queue *)data;
+
+	while (plm_comm_read(fd, (char *)&v, sizeof(v)) > 0)
+		;
+
+	plm_atomic_xchg(&q->tq_signaled, 0);
+	plm_task_run();
+
+	if (plm_event_io_read(fd, data, plm_task_on_wakeup))
+		plm_log_write(PLM_LOG_FATAL, "plm_task_on_wakeup: %s",
+					  strerror(errno));
+}
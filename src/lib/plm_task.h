@@ -0,0 +1,83 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_TASK_H
+#define _PLM_TASK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a task posted to a work thread, the memory is owned by the caller
+ * and must stay valid until the handler is called, handler may free it
+ */
+struct plm_task {
+	struct plm_task *t_next;
+	void (*t_handler)(void *);
+	void *t_data;
+};
+
+/* init task queue of each work thread
+ * @thrdn -- number of thread
+ * return 0 -- success, else error
+ */
+int plm_task_init(int thrdn);
+
+/* destroy task queues */
+void plm_task_destroy();
+
+/* register the wakeup fd on the current thread poller, called in
+ * the work thread before enter the loop
+ * return 0 -- success, else error
+ */
+int plm_task_thrd_init();
+
+/* unregister the wakeup fd of the current thread */
+void plm_task_thrd_destroy();
+
+/* post a task to a work thread, could be called from any thread
+ * @slot -- the target thread slot
+ * @task -- task with handler and data set
+ * return 0 -- success, else error
+ */
+int plm_task_post(int slot, struct plm_task *task);
+
+/* wake up a work thread sleeping in its poller without a task,
+ * it is async signal safe
+ * @slot -- the target thread slot
+ * return void
+ */
+void plm_task_wakeup(int slot);
+
+/* run tasks queued on the current thread
+ * return nonzero if tasks left and caller should not block
+ */
+int plm_task_run();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
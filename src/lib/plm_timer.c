@@ -24,19 +24,46 @@
  */
 
 #include <stdlib.h>
-#include <time.h>
+#include <string.h>
 
-#include "plm_dlist.h"
-#include "plm_lookaside_list.h"
+#include "plm_clock.h"
 #include "plm_timer.h"
 
 #ifndef MAX_TIMERS
 #define MAX_TIMERS 128
 #endif
 
+/* 4-ary min heap, shallower than a binary heap and the four
+ * children of a node share one or two cache lines
+ */
+#define PLM_TIMER_ARY 4
+#define PLM_TIMER_NIL ((uint32_t)-1)
+
+#define PLM_TIMER_HANDLE(gen, idx) (((uint64_t)(gen) << 32) | (idx))
+#define PLM_TIMER_GEN(h) ((uint32_t)((h) >> 32))
+#define PLM_TIMER_IDX(h) ((uint32_t)((h) & 0xffffffff))
+
+struct plm_timer_obj {
+	int (*to_handler)(void *);
+	void *to_data;
+	uint64_t to_expire;
+
+	/* bumped on every release, a stale handle never matches */
+	uint32_t to_gen;
+
+	/* position in heap when in use, next free slot when released */
+	uint32_t to_pos;
+};
+
 struct plm_thread_timer_list {
-	struct plm_lookaside_list tl_pool;
-	plm_dlist_t tl_tmlist;
+	/* slot array, the handle index refers to it */
+	struct plm_timer_obj *tl_objs;
+
+	/* heap of slot indices ordered by to_expire */
+	uint32_t *tl_heap;
+	uint32_t tl_num;
+	uint32_t tl_cap;
+	uint32_t tl_free;
 };
 
 struct plm_timer_list {
@@ -44,21 +71,13 @@ struct plm_timer_list {
 	struct plm_thread_timer_list ttl_tml[0];
 };
 
-struct plm_timer_obj {
-	plm_dlist_node_t to_node;
-	int (*to_handler)(void *);
-	void *to_data;
-	time_t to_expire;
-};
-
 static struct plm_timer_list *tmlist;
-time_t current_time_ms;
-struct timeval current_timeval;
 extern __thread int curr_slot;
 
-static int plm_timer_bigger(void *, void *);
-static int plm_timer_equal(void *, void *);
-static void plm_timer_update_current();
+static int plm_timer_grow(struct plm_thread_timer_list *);
+static void plm_timer_sift_up(struct plm_thread_timer_list *, uint32_t);
+static void plm_timer_sift_down(struct plm_thread_timer_list *, uint32_t);
+static void plm_timer_remove(struct plm_thread_timer_list *, uint32_t);
 
 /* init timer list
  * @thrdn -- number of thread
@@ -74,17 +93,20 @@ int plm_timer_init(int thrdn)
 	tl = (struct plm_timer_list *)malloc(size);
 	if (tl) {
 		int i;
-		size_t timer_obj_sz = sizeof(struct plm_timer_obj);
-		
+
+		memset(tl, 0, size);
 		tl->ttl_tml_num = thrdn;
 		for (i = 0; i < thrdn; i++) {
-			PLM_DLIST_INIT(&tl->ttl_tml[i].tl_tmlist);
-			plm_lookaside_list_init(&tl->ttl_tml[i].tl_pool, MAX_TIMERS,
-									timer_obj_sz, -1, malloc, free);
-			plm_lookaside_list_enable(&tl->ttl_tml[i].tl_pool, 0, 0, 0);
+			tl->ttl_tml[i].tl_free = PLM_TIMER_NIL;
+			if (plm_timer_grow(&tl->ttl_tml[i]))
+				break;
 		}
 
 		tmlist = tl;
+		if (i < thrdn) {
+			plm_timer_destroy();
+			tl = NULL;
+		}
 	}
 
 	return (tl ? 0 : -1);
@@ -98,8 +120,10 @@ void plm_timer_destroy()
 	if (!tmlist)
 		return;
 
-	for (i = 0; i < tmlist->ttl_tml_num; i++)
-		plm_lookaside_list_destroy(&tmlist->ttl_tml[i].tl_pool);
+	for (i = 0; i < tmlist->ttl_tml_num; i++) {
+		free(tmlist->ttl_tml[i].tl_objs);
+		free(tmlist->ttl_tml[i].tl_heap);
+	}
 
 	free(tmlist);
 	tmlist = NULL;
@@ -111,111 +135,204 @@ void plm_timer_destroy()
  *             when the handler is time consuming
  * @data -- pass to handler
  * @delta -- delta time in ms
- * return zero on success, else -1
+ * return the timer handle on success, else 0
  */
-int plm_timer_add(int (*handler)(void *), void *data, int delta)
+plm_timer_t plm_timer_add(int (*handler)(void *), void *data, int delta)
 {
+	uint32_t idx;
 	struct plm_timer_obj *obj;
+	struct plm_thread_timer_list *tl;
 
-	obj = (struct plm_timer_obj *)
-		plm_lookaside_list_alloc(&tmlist->ttl_tml[curr_slot].tl_pool, NULL);
-	if (obj) {
-		plm_dlist_node_t *ptr = NULL;
-		plm_dlist_t *list;
-		
-		obj->to_handler = handler;
-		obj->to_data = data;
-		obj->to_expire = current_time_ms + delta;
-
-		list = &tmlist->ttl_tml[curr_slot].tl_tmlist;
-		PLM_DLIST_SEARCH(&ptr, list, plm_timer_bigger, obj);
-		if (ptr)
-			PLM_DLIST_INSERT_FRONT(list, ptr, &obj->to_node);
-		else
-			PLM_DLIST_ADD_BACK(list, &obj->to_node);
-	}
+	tl = &tmlist->ttl_tml[curr_slot];
+	if (tl->tl_free == PLM_TIMER_NIL && plm_timer_grow(tl))
+		return (0);
 
-	return (obj ? 0 : -1);
+	idx = tl->tl_free;
+	obj = &tl->tl_objs[idx];
+	tl->tl_free = obj->to_pos;
+
+	obj->to_handler = handler;
+	obj->to_data = data;
+	obj->to_expire = plm_clock_mono_ms() + delta;
+	obj->to_pos = tl->tl_num;
+	tl->tl_heap[tl->tl_num++] = idx;
+	plm_timer_sift_up(tl, obj->to_pos);
+
+	return PLM_TIMER_HANDLE(obj->to_gen, idx);
 }
 
-/* delete a timer from the current thread timer list */
-void plm_timer_del(int (*handler)(void *), void *data)
+/* delete a timer from the current thread timer list
+ * @timer -- the handle returned by plm_timer_add
+ * return zero on success, -1 if the timer already expired or deleted
+ * note: must be called in the thread which added the timer
+ */
+int plm_timer_del(plm_timer_t timer)
 {
+	uint32_t idx;
 	struct plm_timer_obj *obj;
-	struct plm_lookaside_list *pool;
-	plm_dlist_node_t *node;
-	plm_dlist_t *list;
-
-	list = &tmlist->ttl_tml[curr_slot].tl_tmlist;
-	pool = &tmlist->ttl_tml[curr_slot].tl_pool;
-	PLM_DLIST_SEARCH(&node, list, plm_timer_equal, obj);
-	if (node) {
-		PLM_DLIST_REMOVE(list, node);
-		obj = (struct plm_timer_obj *)node;
-		plm_lookaside_list_free(pool, obj, NULL);
-	}
+	struct plm_thread_timer_list *tl;
+
+	tl = &tmlist->ttl_tml[curr_slot];
+	idx = PLM_TIMER_IDX(timer);
+	if (idx >= tl->tl_cap)
+		return (-1);
+
+	obj = &tl->tl_objs[idx];
+	if (obj->to_gen != PLM_TIMER_GEN(timer) || obj->to_handler == NULL)
+		return (-1);
+
+	plm_timer_remove(tl, obj->to_pos);
+	return (0);
 }
 
 /* check thread timer list
  * return immediately if no timer expire
- * the return value is delta value in ms when the  next timer expire
+ * the return value is delta value in ms when the  next timer expire,
+ * -1 if no timer, so caller could sleep until other event comes
  */
 int plm_timer_run()
 {
-	plm_dlist_t *list;
 	struct plm_timer_obj *obj;
-	struct plm_lookaside_list *pool;
+	struct plm_thread_timer_list *tl;
+	uint64_t now;
+
+	/* the dispatcher updates the clock once per loop */
+	now = plm_clock_mono_ms();
+
+	tl = &tmlist->ttl_tml[curr_slot];
+	while (tl->tl_num > 0) {
+		int (*handler)(void *);
+		void *data;
+
+		obj = &tl->tl_objs[tl->tl_heap[0]];
+		if (obj->to_expire > now)
+			return (obj->to_expire - now);
+
+		/* release before calling, the handler may add timers and
+		 * grow the slot array under us
+		 */
+		handler = obj->to_handler;
+		data = obj->to_data;
+		plm_timer_remove(tl, 0);
+		handler(data);
+	}
+	
+	return (-1);
+}
 
-	plm_timer_update_current();
+/* double the slot array and heap of a thread, the new slots are
+ * pushed on the free list
+ */
+int plm_timer_grow(struct plm_thread_timer_list *tl)
+{
+	uint32_t i, cap;
+	uint32_t *heap;
+	struct plm_timer_obj *objs;
+
+	cap = tl->tl_cap ? tl->tl_cap * 2 : MAX_TIMERS;
+	objs = (struct plm_timer_obj *)
+		realloc(tl->tl_objs, cap * sizeof(struct plm_timer_obj));
+	if (!objs)
+		return (-1);
+	tl->tl_objs = objs;
+
+	heap = (uint32_t *)realloc(tl->tl_heap, cap * sizeof(uint32_t));
+	if (!heap)
+		return (-1);
+	tl->tl_heap = heap;
+
+	for (i = cap; i > tl->tl_cap; i--) {
+		struct plm_timer_obj *obj = &objs[i - 1];
+
+		obj->to_handler = NULL;
+		obj->to_gen = 1;
+		obj->to_pos = tl->tl_free;
+		tl->tl_free = i - 1;
+	}
 
-	list = &tmlist->ttl_tml[curr_slot].tl_tmlist;
-	pool = &tmlist->ttl_tml[curr_slot].tl_pool;
-	if (PLM_DLIST_LEN(list) == 0)
-		return (0);
+	tl->tl_cap = cap;
+	return (0);
+}
 
-	for (;;) {
-		obj = (struct plm_timer_obj *)PLM_DLIST_FRONT(list);
-		if (obj->to_expire > current_time_ms)
-			break;
-		
-		PLM_DLIST_DEL_FRONT(list);
-		obj->to_handler(obj->to_data);
-		plm_lookaside_list_free(pool, obj, NULL);
+void plm_timer_sift_up(struct plm_thread_timer_list *tl, uint32_t pos)
+{
+	uint32_t idx = tl->tl_heap[pos];
+	uint64_t expire = tl->tl_objs[idx].to_expire;
 
-		if (PLM_DLIST_LEN(list) == 0)
+	while (pos > 0) {
+		uint32_t parent = (pos - 1) / PLM_TIMER_ARY;
+		uint32_t pidx = tl->tl_heap[parent];
+
+		if (tl->tl_objs[pidx].to_expire <= expire)
 			break;
+
+		tl->tl_heap[pos] = pidx;
+		tl->tl_objs[pidx].to_pos = pos;
+		pos = parent;
 	}
-	
-	if (PLM_DLIST_LEN(list) == 0)
-		return (0);
 
-	obj = (struct plm_timer_obj *)PLM_DLIST_FRONT(list);
-	return (obj->to_expire - current_time_ms);
+	tl->tl_heap[pos] = idx;
+	tl->tl_objs[idx].to_pos = pos;
 }
 
-int plm_timer_bigger(void *node, void *data)
+void plm_timer_sift_down(struct plm_thread_timer_list *tl, uint32_t pos)
 {
-	struct plm_timer_obj *obj1, *obj2;
+	uint32_t idx = tl->tl_heap[pos];
+	uint64_t expire = tl->tl_objs[idx].to_expire;
 
-	obj1 = (struct plm_timer_obj *)node;
-	obj2 = (struct plm_timer_obj *)data;
+	for (;;) {
+		uint32_t i, first, last, min;
+		uint64_t min_expire;
 
-	return (obj1->to_expire > obj2->to_expire);
-}
+		first = pos * PLM_TIMER_ARY + 1;
+		if (first >= tl->tl_num)
+			break;
 
-int plm_timer_equal(void *node, void *data)
-{
-	struct plm_timer_obj *obj1, *obj2;
+		last = first + PLM_TIMER_ARY;
+		if (last > tl->tl_num)
+			last = tl->tl_num;
+
+		min = first;
+		min_expire = tl->tl_objs[tl->tl_heap[first]].to_expire;
+		for (i = first + 1; i < last; i++) {
+			uint64_t e = tl->tl_objs[tl->tl_heap[i]].to_expire;
+			if (e < min_expire) {
+				min = i;
+				min_expire = e;
+			}
+		}
 
-	obj1 = (struct plm_timer_obj *)node;
-	obj2 = (struct plm_timer_obj *)data;
+		if (min_expire >= expire)
+			break;
 
-	return (obj1->to_expire == obj2->to_expire);
+		tl->tl_heap[pos] = tl->tl_heap[min];
+		tl->tl_objs[tl->tl_heap[pos]].to_pos = pos;
+		pos = min;
+	}
+
+	tl->tl_heap[pos] = idx;
+	tl->tl_objs[idx].to_pos = pos;
 }
 
-void plm_timer_update_current()
+/* remove the timer at heap position pos and release its slot */
+void plm_timer_remove(struct plm_thread_timer_list *tl, uint32_t pos)
 {
-	gettimeofday(&current_timeval, NULL);
-	current_time_ms = current_timeval.tv_sec * 1000 +
-		current_timeval.tv_usec / 1000;
+	uint32_t idx, last;
+	struct plm_timer_obj *obj;
+
+	idx = tl->tl_heap[pos];
+	last = --tl->tl_num;
+	if (pos != last) {
+		tl->tl_heap[pos] = tl->tl_heap[last];
+		tl->tl_objs[tl->tl_heap[pos]].to_pos = pos;
+		plm_timer_sift_down(tl, pos);
+		plm_timer_sift_up(tl, pos);
+	}
+
+	obj = &tl->tl_objs[idx];
+	obj->to_handler = NULL;
+	if (++obj->to_gen == 0)
+		obj->to_gen = 1;
+	obj->to_pos = tl->tl_free;
+	tl->tl_free = idx;
 }
@@ -26,10 +26,15 @@
 #ifndef _PLM_TIMER_H
 #define _PLM_TIMER_H
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+/* timer handle returned by plm_timer_add, zero is never a valid handle */
+typedef uint64_t plm_timer_t;
+
 /* init timer list
  * @thrdn -- number of thread
  * return zero on success, else -1
@@ -44,17 +49,22 @@ void plm_timer_destroy();
  *             a handler must be return nonzero value
  *             when the handler is time consuming
  * @data -- pass to handler
- * @delta -- delta time in ms
- * return zero on success, else -1
+ * @delta -- delta time in ms, on the monotonic clock cached by plm_clock
+ * return the timer handle on success, else 0
  */
-int plm_timer_add(int (*handler)(void *), void *data, int delta);
+plm_timer_t plm_timer_add(int (*handler)(void *), void *data, int delta);
 
-/* delete a timer from the current thread timer list */
-void plm_timer_del(int (*handler)(void *), void *data);
+/* delete a timer from the current thread timer list
+ * @timer -- the handle returned by plm_timer_add
+ * return zero on success, -1 if the timer already expired or deleted
+ * note: must be called in the thread which added the timer
+ */
+int plm_timer_del(plm_timer_t timer);
 
 /* check thread timer list
  * return immediately if no timer expire
- * the return value is delta value in ms when the  next timer expire
+ * the return value is delta value in ms when the  next timer expire,
+ * -1 if no timer, so caller could sleep until other event comes
  */
 int plm_timer_run();
 
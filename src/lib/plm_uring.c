@@ -0,0 +1,563 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "plm_uring.h"
+
+#ifdef HAVE_LINUX_IO_URING_H
+
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#ifndef PLM_URING_ENTRIES
+#define PLM_URING_ENTRIES 1024
+#endif
+
+/* user_data: | gen 30 bits | flag 2 bits | fd 32 bits |
+ * zero is used by cancel requests whose completion is ignored
+ */
+#define PLM_URING_GEN_MASK 0x3fffffff
+#define PLM_URING_DATA(fd, flag, gen) \
+	(((uint64_t)(gen) << 34) | ((uint64_t)(flag) << 32) | (uint32_t)(fd))
+#define PLM_URING_DATA_FD(d) ((int)((d) & 0xffffffff))
+#define PLM_URING_DATA_FLAG(d) ((int)(((d) >> 32) & 0x3))
+#define PLM_URING_DATA_GEN(d) ((uint32_t)((d) >> 34))
+
+/* user_data of the poll request on global ring fd */
+#define PLM_URING_NEST ((uint64_t)-1)
+
+#define PLM_STRUCT_OFFSET(s, m)	(size_t)&(((s *)0)->m)
+
+struct plm_uring {
+	int ur_fd;
+
+	/* submission queue */
+	unsigned *ur_sq_head;
+	unsigned *ur_sq_tail;
+	unsigned *ur_sq_mask;
+	unsigned *ur_sq_array;
+	unsigned ur_sq_entries;
+	unsigned ur_sq_queued;
+	unsigned ur_sq_unsubmitted;
+	struct io_uring_sqe *ur_sqes;
+
+	/* completion queue */
+	unsigned *ur_cq_head;
+	unsigned *ur_cq_tail;
+	unsigned *ur_cq_mask;
+	struct io_uring_cqe *ur_cqes;
+
+	void *ur_sq_ptr;
+	size_t ur_sq_sz;
+	void *ur_cq_ptr;
+	size_t ur_cq_sz;
+	size_t ur_sqes_sz;
+};
+
+extern __thread int curr_slot;
+
+static int plm_uring_setup(struct plm_uring *r, unsigned entries);
+static void plm_uring_teardown(struct plm_uring *r);
+static int plm_uring_enter(struct plm_uring *r, unsigned wait, int timeout);
+static struct io_uring_sqe *plm_uring_get_sqe(struct plm_uring *r);
+static int plm_uring_nest_sqe(struct plm_uring_io *ui, struct plm_uring *r,
+							  int multi);
+
+/* check the kernel support io_uring with the features we need
+ * return 0 -- supported, else -1
+ */
+int plm_uring_io_probe()
+{
+	int fd;
+	struct io_uring_params p;
+	unsigned need = IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+
+	memset(&p, 0, sizeof(p));
+	fd = syscall(__NR_io_uring_setup, 2, &p);
+	if (fd < 0)
+		return (-1);
+
+	close(fd);
+	return ((p.features & need) == need ? 0 : -1);
+}
+
+/* init io_uring */
+int plm_uring_io_init(struct plm_event_io *e, int maxfd, int thrdn)
+{
+	int i;
+	struct plm_uring_io *ui = (struct plm_uring_io *)
+		((char *)e - PLM_STRUCT_OFFSET(struct plm_uring_io, ui_event_base));
+
+	if (plm_uring_io_probe())
+		return (-1);
+
+	ui->ui_fds = (struct plm_uring_fd *)
+		calloc(maxfd, sizeof(struct plm_uring_fd));
+	ui->ui_rings = (struct plm_uring *)
+		calloc(thrdn + 1, sizeof(struct plm_uring));
+	if (!ui->ui_fds || !ui->ui_rings) {
+		plm_uring_io_shutdown(e);
+		return (-1);
+	}
+
+	for (i = 0; i <= thrdn; i++) {
+		ui->ui_rings[i].ur_fd = -1;
+		if (plm_uring_setup(&ui->ui_rings[i], PLM_URING_ENTRIES)) {
+			plm_uring_io_shutdown(e);
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/* destroy io_uring */
+int plm_uring_io_shutdown(struct plm_event_io *e)
+{
+	int i;
+	struct plm_uring_io *ui = (struct plm_uring_io *)
+		((char *)e - PLM_STRUCT_OFFSET(struct plm_uring_io, ui_event_base));
+
+	if (ui->ui_rings) {
+		for (i = 0; i <= ui->ui_ring_local_num; i++)
+			plm_uring_teardown(&ui->ui_rings[i]);
+		free(ui->ui_rings);
+		ui->ui_rings = NULL;
+	}
+
+	free(ui->ui_fds);
+	ui->ui_fds = NULL;
+	return (0);
+}
+
+/* submit queued requests and reap completions */
+int plm_uring_io_poll(struct plm_event_io_handler *events, int n,
+					  struct plm_event_io *e, int timeout, plm_poller_t t)
+{
+	int nevs = 0;
+	unsigned head, tail;
+	struct plm_uring *r;
+	struct plm_uring_io *ui = (struct plm_uring_io *)
+		((char *)e - PLM_STRUCT_OFFSET(struct plm_uring_io, ui_event_base));
+
+	if (t == PLM_THREAD_LOCAL)
+		r = &ui->ui_rings[curr_slot];
+	else if (t == PLM_PROCESS_GLOBAL)
+		r = &ui->ui_rings[ui->ui_ring_local_num];
+	else
+		abort();
+
+	/* one syscall submits everything queued since last poll
+	 * and waits for completions if none are ready
+	 */
+	head = *r->ur_cq_head;
+	tail = __atomic_load_n(r->ur_cq_tail, __ATOMIC_ACQUIRE);
+	if (r->ur_sq_unsubmitted > 0 || (head == tail && timeout != 0)) {
+		if (plm_uring_enter(r, head == tail && timeout != 0, timeout)) {
+			if (errno != ETIME && errno != EBUSY)
+				return (-1);
+		}
+		tail = __atomic_load_n(r->ur_cq_tail, __ATOMIC_ACQUIRE);
+	}
+
+	for (; head != tail && nevs < n; head++) {
+		struct io_uring_cqe *cqe;
+		struct plm_event_io_handler *eih, *evt;
+		struct plm_uring_fd *uf;
+		uint64_t data;
+		int fd, flag;
+
+		cqe = &r->ur_cqes[head & *r->ur_cq_mask];
+		data = cqe->user_data;
+		if (data == 0)
+			continue;
+
+		if (data == PLM_URING_NEST) {
+			/* multishot poll ends on error, the kernel before 5.13
+			 * has no multishot poll and gets a oneshot one
+			 */
+			if (!(cqe->flags & IORING_CQE_F_MORE))
+				plm_uring_nest_sqe(ui, r, cqe->res != -EINVAL);
+
+			evt = &events[nevs++];
+			memset(evt, 0, sizeof(*evt));
+			evt->eih_fd = -1;
+			evt->eih_onread = e->ei_nest_handler;
+			evt->eih_rddata = e->ei_nest_data;
+			continue;
+		}
+
+		fd = PLM_URING_DATA_FD(data);
+		flag = PLM_URING_DATA_FLAG(data);
+		uf = &ui->ui_fds[fd];
+		if (uf->uf_gen != PLM_URING_DATA_GEN(data) || !(uf->uf_pending & flag))
+			continue;
+
+		uf->uf_pending &= ~flag;
+		eih = &e->ei_events_arr[fd];
+		evt = &events[nevs];
+		memset(evt, 0, sizeof(*evt));
+		evt->eih_fd = fd;
+		if (flag & PLM_READ) {
+			evt->eih_onread = eih->eih_onread;
+			evt->eih_rddata = eih->eih_rddata;
+			eih->eih_onread = NULL;
+			eih->eih_rddata = NULL;
+		} else {
+			evt->eih_onwrite = eih->eih_onwrite;
+			evt->eih_wrdata = eih->eih_wrdata;
+			eih->eih_onwrite = NULL;
+			eih->eih_wrdata = NULL;
+		}
+
+		if (evt->eih_onread || evt->eih_onwrite)
+			nevs++;
+	}
+
+	__atomic_store_n(r->ur_cq_head, head, __ATOMIC_RELEASE);
+	return (nevs);
+}
+
+/* queue a oneshot poll request */
+int plm_uring_io_ctl(struct plm_event_io *e, int fd, int flag, plm_poller_t t)
+{
+	int global;
+	uint32_t events;
+	struct plm_uring *r;
+	struct plm_uring_fd *uf;
+	struct io_uring_sqe *sqe;
+	struct plm_uring_io *ui = (struct plm_uring_io *)
+		((char *)e - PLM_STRUCT_OFFSET(struct plm_uring_io, ui_event_base));
+
+	if (flag != PLM_READ && flag != PLM_WRITE)
+		abort();
+
+	if (t == PLM_THREAD_LOCAL) {
+		global = 0;
+		r = &ui->ui_rings[curr_slot];
+	} else if (t == PLM_PROCESS_GLOBAL) {
+		global = 1;
+		r = &ui->ui_rings[ui->ui_ring_local_num];
+	} else {
+		abort();
+	}
+
+	/* the request in flight would deliver the new handler */
+	uf = &ui->ui_fds[fd];
+	if (uf->uf_pending & flag)
+		return (0);
+
+	sqe = plm_uring_get_sqe(r);
+	if (!sqe)
+		return (-1);
+
+	/* kernel swaps the half words of poll32_events on big endian */
+	events = flag & PLM_READ ? POLLIN : POLLOUT;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	events = (events << 16) | (events >> 16);
+#endif
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = fd;
+	sqe->poll32_events = events;
+	sqe->user_data = PLM_URING_DATA(fd, flag, uf->uf_gen);
+
+	uf->uf_pending |= flag;
+	uf->uf_global = global;
+
+	/* threads sleep in their own ring, nobody would submit for
+	 * global ring until it has completions
+	 */
+	if (global)
+		return plm_uring_enter(r, 0, 0);
+
+	return (0);
+}
+
+/* cancel requests of fd before close or detach */
+int plm_uring_io_close(struct plm_event_io *e, int fd)
+{
+	int flag;
+	struct plm_uring *r;
+	struct plm_uring_fd *uf;
+	struct plm_uring_io *ui = (struct plm_uring_io *)
+		((char *)e - PLM_STRUCT_OFFSET(struct plm_uring_io, ui_event_base));
+
+	uf = &ui->ui_fds[fd];
+	if (uf->uf_global)
+		r = &ui->ui_rings[ui->ui_ring_local_num];
+	else
+		r = &ui->ui_rings[curr_slot];
+
+	/* a poll request holds a reference of the file, the socket is
+	 * not really closed until the request is gone
+	 */
+	for (flag = PLM_READ; flag <= PLM_WRITE; flag <<= 1) {
+		struct io_uring_sqe *sqe;
+
+		if (!(uf->uf_pending & flag))
+			continue;
+
+		sqe = plm_uring_get_sqe(r);
+		if (!sqe)
+			break;
+
+		sqe->opcode = IORING_OP_POLL_REMOVE;
+		sqe->fd = -1;
+		sqe->addr = PLM_URING_DATA(fd, flag, uf->uf_gen);
+		sqe->user_data = 0;
+	}
+
+	if (uf->uf_global && r->ur_sq_unsubmitted > 0)
+		plm_uring_enter(r, 0, 0);
+
+	uf->uf_gen = (uf->uf_gen + 1) & PLM_URING_GEN_MASK;
+	uf->uf_pending = 0;
+	uf->uf_global = 0;
+	memset(&e->ei_events_arr[fd], 0, sizeof(e->ei_events_arr[fd]));
+	return (0);
+}
+
+/* poll the global ring fd from the current thread ring */
+int plm_uring_io_nest(struct plm_event_io *e)
+{
+	struct plm_uring_io *ui = (struct plm_uring_io *)
+		((char *)e - PLM_STRUCT_OFFSET(struct plm_uring_io, ui_event_base));
+
+	return plm_uring_nest_sqe(ui, &ui->ui_rings[curr_slot], 1);
+}
+
+/* multishot, a completion is posted every time the global ring gets
+ * new completions, it works like edge triggered
+ */
+int plm_uring_nest_sqe(struct plm_uring_io *ui, struct plm_uring *r, int multi)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = plm_uring_get_sqe(r);
+	if (!sqe)
+		return (-1);
+
+	sqe->opcode = IORING_OP_POLL_ADD;
+	sqe->fd = ui->ui_rings[ui->ui_ring_local_num].ur_fd;
+#if __BYTE_ORDER == __BIG_ENDIAN
+	sqe->poll32_events = POLLIN << 16;
+#else
+	sqe->poll32_events = POLLIN;
+#endif
+	sqe->len = multi ? IORING_POLL_ADD_MULTI : 0;
+	sqe->user_data = PLM_URING_NEST;
+	return (0);
+}
+
+int plm_uring_setup(struct plm_uring *r, unsigned entries)
+{
+	unsigned i;
+	char *sq, *cq;
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+	r->ur_fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (r->ur_fd < 0)
+		return (-1);
+
+	r->ur_sq_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->ur_cq_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->ur_cq_sz > r->ur_sq_sz)
+			r->ur_sq_sz = r->ur_cq_sz;
+		r->ur_cq_sz = r->ur_sq_sz;
+	}
+
+	sq = mmap(NULL, r->ur_sq_sz, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, r->ur_fd, IORING_OFF_SQ_RING);
+	if (sq == MAP_FAILED)
+		goto ERR;
+	r->ur_sq_ptr = sq;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		cq = sq;
+	} else {
+		cq = mmap(NULL, r->ur_cq_sz, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, r->ur_fd, IORING_OFF_CQ_RING);
+		if (cq == MAP_FAILED)
+			goto ERR;
+		r->ur_cq_ptr = cq;
+	}
+
+	r->ur_sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+	r->ur_sqes = mmap(NULL, r->ur_sqes_sz, PROT_READ | PROT_WRITE,
+					  MAP_SHARED | MAP_POPULATE, r->ur_fd, IORING_OFF_SQES);
+	if (r->ur_sqes == MAP_FAILED) {
+		r->ur_sqes = NULL;
+		goto ERR;
+	}
+
+	r->ur_sq_head = (unsigned *)(sq + p.sq_off.head);
+	r->ur_sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->ur_sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->ur_sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->ur_sq_entries = p.sq_entries;
+	r->ur_sq_queued = *r->ur_sq_tail;
+	r->ur_sq_unsubmitted = 0;
+
+	r->ur_cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->ur_cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->ur_cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->ur_cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	/* sqe index i always sits in slot i */
+	for (i = 0; i < p.sq_entries; i++)
+		r->ur_sq_array[i] = i;
+
+	return (0);
+
+ERR:
+	plm_uring_teardown(r);
+	return (-1);
+}
+
+void plm_uring_teardown(struct plm_uring *r)
+{
+	if (r->ur_sqes)
+		munmap(r->ur_sqes, r->ur_sqes_sz);
+	if (r->ur_cq_ptr)
+		munmap(r->ur_cq_ptr, r->ur_cq_sz);
+	if (r->ur_sq_ptr)
+		munmap(r->ur_sq_ptr, r->ur_sq_sz);
+	if (r->ur_fd >= 0)
+		close(r->ur_fd);
+
+	memset(r, 0, sizeof(*r));
+	r->ur_fd = -1;
+}
+
+/* publish queued sqes, submit them and wait for a completion
+ * if wait is set, timeout in ms and -1 means forever
+ */
+int plm_uring_enter(struct plm_uring *r, unsigned wait, int timeout)
+{
+	int rc;
+	unsigned flags = 0;
+	void *argp = NULL;
+	size_t argsz = 0;
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+
+	__atomic_store_n(r->ur_sq_tail, r->ur_sq_queued, __ATOMIC_RELEASE);
+
+	if (wait) {
+		flags |= IORING_ENTER_GETEVENTS;
+		if (timeout >= 0) {
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (timeout % 1000) * 1000000;
+			memset(&arg, 0, sizeof(arg));
+			arg.ts = (uint64_t)(uintptr_t)&ts;
+			flags |= IORING_ENTER_EXT_ARG;
+			argp = &arg;
+			argsz = sizeof(arg);
+		}
+	}
+
+	rc = syscall(__NR_io_uring_enter, r->ur_fd, r->ur_sq_unsubmitted,
+				 wait ? 1 : 0, flags, argp, argsz);
+	if (rc < 0)
+		return (-1);
+
+	r->ur_sq_unsubmitted -= rc;
+	return (0);
+}
+
+struct io_uring_sqe *plm_uring_get_sqe(struct plm_uring *r)
+{
+	unsigned head;
+	struct io_uring_sqe *sqe;
+
+	head = __atomic_load_n(r->ur_sq_head, __ATOMIC_ACQUIRE);
+	if (r->ur_sq_queued - head >= r->ur_sq_entries) {
+		/* ring is full, push it to kernel now */
+		if (plm_uring_enter(r, 0, 0))
+			return (NULL);
+
+		head = __atomic_load_n(r->ur_sq_head, __ATOMIC_ACQUIRE);
+		if (r->ur_sq_queued - head >= r->ur_sq_entries)
+			return (NULL);
+	}
+
+	sqe = &r->ur_sqes[r->ur_sq_queued & *r->ur_sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	r->ur_sq_queued++;
+	r->ur_sq_unsubmitted++;
+	return (sqe);
+}
+
+#else
+
+int plm_uring_io_probe()
+{
+	return (-1);
+}
+
+int plm_uring_io_init(struct plm_event_io *e, int maxfd, int thrdn)
+{
+	return (-1);
+}
+
+int plm_uring_io_shutdown(struct plm_event_io *e)
+{
+	return (0);
+}
+
+int plm_uring_io_poll(struct plm_event_io_handler *io, int n,
+					  struct plm_event_io *e, int timeout, plm_poller_t t)
+{
+	errno = ENOSYS;
+	return (-1);
+}
+
+int plm_uring_io_ctl(struct plm_event_io *e, int fd, int flag, plm_poller_t t)
+{
+	errno = ENOSYS;
+	return (-1);
+}
+
+int plm_uring_io_close(struct plm_event_io *e, int fd)
+{
+	return (0);
+}
+
+int plm_uring_io_nest(struct plm_event_io *e)
+{
+	return (-1);
+}
+
+#endif
@@ -0,0 +1,89 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_URING_H
+#define _PLM_URING_H
+
+#include <stdint.h>
+
+#include "plm_event.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct plm_uring;
+
+/* per fd state, user_data of a poll request carries the generation
+ * so completions which belong to a closed fd are dropped
+ */
+struct plm_uring_fd {
+	uint32_t uf_gen;
+
+	/* PLM_READ/PLM_WRITE poll request in flight */
+	uint8_t uf_pending;
+
+	/* requests are on the global ring */
+	uint8_t uf_global;
+};
+
+struct plm_uring_io {
+	struct plm_event_io ui_event_base;
+	struct plm_uring_fd *ui_fds;
+
+	/* one ring per thread and the last one for global poller */
+	struct plm_uring *ui_rings;
+	int ui_ring_local_num;
+};
+
+/* check the kernel support io_uring with the features we need
+ * return 0 -- supported, else -1
+ */
+int plm_uring_io_probe();
+
+/* init io_uring */
+int plm_uring_io_init(struct plm_event_io *e, int maxfd, int thrdn);
+
+/* destroy io_uring */
+int plm_uring_io_shutdown(struct plm_event_io *e);
+
+/* submit queued requests and reap completions */
+int plm_uring_io_poll(struct plm_event_io_handler *io, int n,
+					  struct plm_event_io *e, int timeout, plm_poller_t t);
+
+/* queue a oneshot poll request */
+int plm_uring_io_ctl(struct plm_event_io *e, int fd, int flag, plm_poller_t t);
+
+/* cancel requests of fd before close or detach */
+int plm_uring_io_close(struct plm_event_io *e, int fd);
+
+/* poll the global ring fd from the current thread ring */
+int plm_uring_io_nest(struct plm_event_io *e);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
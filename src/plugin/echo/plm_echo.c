@@ -31,6 +31,7 @@
 #include <errno.h>
 
 #include "plm_comm.h"
+#include "plm_event.h"
 #include "plm_log.h"
 #include "plm_lookaside_list.h"
 #include "plm_mempool.h"
@@ -73,17 +74,22 @@ static struct plm_cmd echo_cmds[] = {
 static void plm_echo_set_main_conf(struct plm_share_param *);
 static int plm_echo_on_work_proc_start(struct plm_ctx_list *);
 static void plm_echo_on_work_proc_exit(struct plm_ctx_list *);
+static int plm_echo_on_work_thrd_start(struct plm_ctx_list *);
+static void plm_echo_on_work_thrd_exit(struct plm_ctx_list *);
 
 struct plm_plugin echo_plugin = {
 	plm_echo_set_main_conf,
 	plm_echo_on_work_proc_start,
 	plm_echo_on_work_proc_exit,
-	NULL,
-	NULL,
+	plm_echo_on_work_thrd_start,
+	plm_echo_on_work_thrd_exit,
 	echo_cmds
 };
 
-static int echo_server_fd;
+static int echo_server_fd = -1;
+
+/* listen fd of the current thread when reuseport on */
+static __thread int echo_thrd_server_fd = -1;
 
 struct plm_echo_conf {
 	plm_string_t ec_echostr;
@@ -157,6 +163,7 @@ struct plm_echo_client {
 
 static struct plm_echo_ctx ctx;
 static struct plm_lookaside_list blk_list;
+static struct plm_share_param sp;
 
 static void *plm_echo_alloc_client()
 {
@@ -347,7 +354,10 @@ static void plm_echo_accept(void *data, int fd)
 		}
 	}
 
-	plm_event_io_read2(fd, data, plm_echo_accept);
+	if (sp.sp_reuseport)
+		plm_event_io_read(fd, data, plm_echo_accept);
+	else
+		plm_event_io_read2(fd, data, plm_echo_accept);
 	plm_log_write(PLM_LOG_WARNING, "plm_echo_accept: accept failed");
 }
 
@@ -381,8 +391,6 @@ static void plm_echo_accept2(void *data, int fd)
 	plm_log_write(PLM_LOG_WARNING, "plm_echo_accept: accept failed");
 }
 
-static struct plm_share_param sp;
-
 void plm_echo_set_main_conf(struct plm_share_param *param)
 {
 	memcpy(&sp, param, sizeof(sp));
@@ -400,14 +408,25 @@ int plm_echo_on_work_proc_start(struct plm_ctx_list *cl)
 							sp.sp_tag, malloc, free);
 	plm_lookaside_list_enable(&blk_list, sp.sp_zeromem, sp.sp_tagcheck,
 							  sp.sp_thrdn > 1);
+
+	/* clients come and go on every thread, keeps the mutex if
+	 * the platform has no 128 bits compare and swap
+	 */
+	if (sp.sp_thrdn > 1)
+		plm_lookaside_list_enable_lockfree(&blk_list);
+	ctx.ec_conf = conf;
+
+	/* every work thread opens its own listen fd */
+	if (sp.sp_reuseport)
+		return (0);
+
 	echo_server_fd = plm_comm_open(PLM_COMM_TCP, NULL, 0, 0, conf->ec_port,
-								   NULL, 100, 1, 1);
+								   NULL, 100, 1, PLM_COMM_REUSEADDR);
 	if (echo_server_fd < 0) {
 		plm_log_syslog("can't open echo plugin listen fd");
 		return (-1);
 	}
-	
-	ctx.ec_conf = conf;
+
 	rc = plm_event_io_read2(echo_server_fd, &ctx, plm_echo_accept);
 	if (rc < 0) {
 		plm_log_syslog("plm_echo_on_work_proc_start"
@@ -420,8 +439,48 @@ int plm_echo_on_work_proc_start(struct plm_ctx_list *cl)
 
 void plm_echo_on_work_proc_exit(struct plm_ctx_list *cl)
 {
-	plm_comm_close(echo_server_fd);
+	if (echo_server_fd > 0) {
+		plm_comm_close(echo_server_fd);
+		echo_server_fd = -1;
+	}
 	plm_lookaside_list_destroy(&blk_list);
 }
 
+int plm_echo_on_work_thrd_start(struct plm_ctx_list *cl)
+{
+	int rc, fd;
+	struct plm_echo_conf *conf;
+
+	if (!sp.sp_reuseport)
+		return (0);
+
+	conf = (struct plm_echo_conf *)PLM_CTX_LIST_GET_POINTER(cl);
+	fd = plm_comm_open(PLM_COMM_TCP, NULL, 0, 0, conf->ec_port, NULL, 100, 1,
+					   PLM_COMM_REUSEADDR | PLM_COMM_REUSEPORT);
+	if (fd < 0) {
+		plm_log_write(PLM_LOG_FATAL, "can't open echo plugin listen fd: %s",
+					  strerror(errno));
+		return (-1);
+	}
+
+	rc = plm_event_io_read(fd, &ctx, plm_echo_accept);
+	if (rc < 0) {
+		plm_comm_close(fd);
+		plm_log_write(PLM_LOG_FATAL, "plm_echo_on_work_thrd_start"
+					  ": plm_event_io_read failed=%d", rc);
+		return (-1);
+	}
+
+	echo_thrd_server_fd = fd;
+	return (0);
+}
+
+void plm_echo_on_work_thrd_exit(struct plm_ctx_list *cl)
+{
+	if (echo_thrd_server_fd > 0) {
+		plm_comm_close(echo_thrd_server_fd);
+		echo_thrd_server_fd = -1;
+	}
+}
+
 
@@ -28,27 +28,167 @@
 
 #include <stdint.h>
 
-#include "plm_hash.h"
+#include "plm_oahash.h"
 #include "plm_string.h"
 #include "plm_mempool.h"
 #include "plm_list.h"
+#include "plm_dlist.h"
+#include "plm_timer.h"
 #include "plm_comm.h"
 #include "plm_http_event_io.h"
 #include "plm_http_parser.h"
+#include "plm_http_chunked.h"
 #include "plm_http_plugin.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-struct plm_http_body {
-	void *hb_data;
-	void (*hb_callback)(void *, plm_string_t *);
-};		
+/* reasons of a locally generated reply */
+enum plm_http_err {
+	PLM_ERR_NONE,
+	PLM_ERR_BADREQ,
+	PLM_ERR_LENGTH,
+	PLM_ERR_BACKEND_SELECT,
+	PLM_ERR_BACKEND_FWD
+};
+
+#define PLM_HTTP_FIELD_BLK 16
+
+struct plm_http_field {
+	int hf_id;
+	plm_string_t hf_key;
+	plm_string_t hf_value;
+};
+
+struct plm_http_field_blk {
+	struct plm_http_field_blk *fb_next;
+	int fb_num;
+	struct plm_http_field fb_fields[PLM_HTTP_FIELD_BLK];
+};
+
+/* header fields of a message, the strings point into the input buffer
+ * of the connection unless the connection copies headers
+ */
+struct plm_http_hdrs {
+	/* well known fields indexed by enum plm_http_hdr */
+	plm_string_t hh_known[PLM_HDR_NUM];
+
+	/* the others and repeated well known ones in arrival order, the
+	 * first block is inline, the rest come from the connection pool
+	 */
+	struct plm_http_field_blk hh_other;
+	struct plm_http_field_blk *hh_tail;
+};
+
+#define plm_http_hdrs_get(h, id) \
+	((h)->hh_known[id].s_str ? &(h)->hh_known[id] : NULL)
+
+/* nonzero if the field is present, for tests of presence only */
+#define plm_http_hdrs_has(h, id) ((h)->hh_known[id].s_str != NULL)
+
+/* output beyond this is not read from the other side until drained */
+#define PLM_HTTP_OUT_HIGH (64 * 1024)
+
+/* requests parsed on a connection before the pipeline drains, so the
+ * pool is reset
+ */
+#define PLM_HTTP_POOL_REQS 64
+
+/* heads each input buffer of a connection, the data follows it */
+struct plm_http_inbuf {
+	struct plm_http_inbuf *hb_next;
+	int hb_type;
+};
+
+#define plm_http_inbuf(data) (((struct plm_http_inbuf *)(data)) - 1)
+
+/* hu_rest of a body which ends when the backend closes */
+#define PLM_HTTP_UNTIL_EOF ((uint64_t)-1)
+
+struct plm_http_conn;
+struct plm_http_req;
+struct plm_http_resp;
+struct plm_http_centry;
+struct plm_http_flight;
+struct plm_http_waiter;
+
+/* a backend connection relaying a request of a connection */
+struct plm_http_upstream {
+	int hu_fd;
+	struct plm_http_ctx *hu_ctx;
+
+	/* index of the backend connected, for the idle pool */
+	int hu_backend;
+	struct plm_http_conn *hu_conn;
+	struct plm_http_req *hu_req;
+	struct plm_http_resp *hu_resp;
+	struct plm_comm_close_handler hu_cch;
+
+	/* the request header and body to the backend */
+	struct plm_http_wrevt hu_wrevt;
+
+	/* the response header is read in hu_in and parsed in place, the
+	 * body bytes behind it go to the client with the segment
+	 */
+	plm_http_parser_t hu_parser;
+	struct plm_http_seg *hu_in;
+	size_t hu_pos;
+
+	/* response body bytes to relay, or PLM_HTTP_UNTIL_EOF, for a
+	 * chunked body the fewest bytes it still has
+	 */
+	uint64_t hu_rest;
+
+	/* decodes a chunked response, or frames one without length */
+	struct plm_http_chunked hu_chunked;
+
+	/* large bodies with a known length are spliced, the request body
+	 * from the client and the response body from the backend, a relay
+	 * is active while it holds a pipe
+	 */
+	struct plm_http_relay hu_body_rl;
+	struct plm_http_relay hu_resp_rl;
+
+	/* the response stored in the cache while it is relayed */
+	struct plm_http_centry *hu_fill;
+
+	/* in the idle pool of this thread, expired by hu_timer */
+	plm_dlist_node_t hu_idle_node;
+	plm_timer_t hu_timer;
+
+	struct {
+		/* waiting for the client output to drain */
+		uint8_t hu_rd_paused : 1;
+
+		/* taken from the idle pool, may be closed by the backend */
+		uint8_t hu_reused : 1;
+
+		/* in the idle pool */
+		uint8_t hu_idle : 1;
+
+		/* the response allows to reuse the connection */
+		uint8_t hu_keep : 1;
+
+		/* the response is chunked, or framed in chunks to the client */
+		uint8_t hu_dechunk : 1;
+		uint8_t hu_enchunk : 1;
+
+		/* the chunks are taken off for an HTTP/1.0 client */
+		uint8_t hu_unchunk : 1;
+	} hu_flags;
+};
 
 struct plm_http_conn {
+	/* the requests parsed in arrival order, the one in front writes to
+	 * the client, the last one may be reading its body
+	 */
 	plm_list_t hc_reqs;
+	struct plm_http_req *hc_last;
 	plm_list_t hc_resps;
+
+	/* requests parsed since the pool was reset */
+	int hc_served;
 	
 	struct plm_mempool hc_pool;
 	struct plm_comm_close_handler hc_cch;
@@ -57,12 +197,40 @@ struct plm_http_conn {
 	int hc_fd;
 	struct sockaddr_in hc_addr;
 
-	struct plm_http_body hc_body;
-	
+	/* a bad request behind the ones in flight, replied once they are
+	 * written
+	 */
+	int hc_err;
+
+	/* calls in progress which may close the connection, it is freed
+	 * once the last returns
+	 */
+	int hc_hold;
+
+	/* request body bytes not read from the client, for a chunked body
+	 * the fewest bytes it still has
+	 */
+	uint64_t hc_body_rest;
+
+	/* decodes a chunked request body */
+	struct plm_http_chunked hc_chunked;
+
 	struct {
 		char *hc_data;
 		size_t hc_size;
 		size_t hc_offset;
+
+		/* bytes before it are parsed */
+		size_t hc_pos;
+
+		/* where the request being parsed starts */
+		size_t hc_start;
+
+		/* bytes of the request being parsed in hc_full */
+		size_t hc_prev;
+
+		/* buffers filled, the requests in flight point into them */
+		struct plm_http_inbuf *hc_full;
 	} hc_in;
 
 	struct plm_http_wrevt hc_wrevt;
@@ -71,8 +239,26 @@ struct plm_http_conn {
 	plm_list_t hc_free_resps;
 
 	struct {
+		/* the client closed its side, the requests read are answered */
 		uint8_t hc_eof : 1;
 		uint8_t hc_badreq : 1;
+		uint8_t hc_nobackend : 1;
+		uint8_t hc_errfwd : 1;
+
+		/* copy header fields out of hc_in instead of indexing them */
+		uint8_t hc_hdr_copy : 1;
+
+		/* close once the output is drained */
+		uint8_t hc_close : 1;
+
+		/* body read waits for the backend output to drain */
+		uint8_t hc_rd_paused : 1;
+
+		/* the requests in hc_in are being parsed */
+		uint8_t hc_parsing : 1;
+
+		/* closed while held */
+		uint8_t hc_dead : 1;
 	} hc_flags;
 
 	struct plm_http_ctx *hc_ctx;
@@ -84,7 +270,10 @@ struct plm_http_req {
 	enum plm_http_mthd hr_mthd;
 	enum plm_http_ver hr_ver;
 	plm_string_t hr_url;
-	struct plm_hash hr_fields;
+	struct plm_http_hdrs hr_hdrs;
+
+	/* name index, only built when the connection copies headers */
+	struct plm_oahash hr_fields;
 
 	uint64_t hr_cntlen;
 	plm_string_t hr_host;
@@ -93,10 +282,33 @@ struct plm_http_req {
 	struct plm_http_conn *hr_conn;
 	struct sockaddr_in *hr_backend;
 
+	/* relays the request and its response */
+	struct plm_http_upstream *hr_up;
+
+	/* the response queued until the requests in front are written */
+	struct plm_http_wrevt hr_out;
+
+	/* the fetch of a cache miss it leads until the response header
+	 * comes, or the one it waits on
+	 */
+	struct plm_http_flight *hr_flight;
+	struct plm_http_waiter *hr_wait;
+
 	struct {
 		uint8_t hr_keepalive : 1;
 		uint8_t hr_pipeline : 1;
 		uint8_t hr_hdr_kpalv_on : 1;
+		uint8_t hr_hdr_close : 1;
+
+		/* the body is in a transfer coding, chunked is the last one */
+		uint8_t hr_te : 1;
+		uint8_t hr_chunked : 1;
+
+		/* the response header is queued to the client */
+		uint8_t hr_head_sent : 1;
+
+		/* the whole response is queued to the client */
+		uint8_t hr_done : 1;
 	} hr_flags;
 };
 
@@ -106,7 +318,8 @@ struct plm_http_resp {
 	enum plm_http_ver hr_ver;
 	int hr_status;
 	plm_string_t hr_desc;
-	struct plm_hash hr_fields;
+	struct plm_http_hdrs hr_hdrs;
+	struct plm_oahash hr_fields;
 
 	struct plm_http_conn *hr_conn;
 	struct plm_http_req *hr_req;
@@ -23,12 +23,56 @@
  * SUCH DAMAGE.
  */
 
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#include "plm_comm.h"
+#include "plm_log.h"
 #include "plm_http_errlog.h"
+#include "plm_http_header.h"
+#include "plm_http_request.h"
+#include "plm_http_lb.h"
+#include "plm_http_cache.h"
 #include "plm_http_backend.h"
 
-static int curr;
 static int num;
 struct sockaddr_in *backend_addr;
+static int *backend_weight;
+
+/* idle connections of every backend in this thread, most recently used
+ * first, allocated when the first connection is kept
+ */
+static __thread plm_dlist_t *idle_pools;
+
+#define plm_http_idle_upstream(n) ((struct plm_http_upstream *) \
+	((char *)(n) - offsetof(struct plm_http_upstream, hu_idle_node)))
+
+static void plm_http_upstream_free(void *);
+static void plm_http_upstream_on_output(void *, int);
+static void plm_http_upstream_read(void *, int);
+static void plm_http_upstream_read_body(struct plm_http_upstream *, int);
+static void plm_http_upstream_relay(struct plm_http_upstream *);
+static void plm_http_relay_resp(void *, int);
+static void plm_http_upstream_fail(struct plm_http_upstream *);
+static void plm_http_upstream_done(struct plm_http_upstream *);
+static int plm_http_upstream_head(struct plm_http_upstream *);
+static struct plm_http_seg *plm_http_backend_req_head(struct plm_http_req *);
+static struct plm_http_upstream *
+plm_http_upstream_open(struct plm_http_ctx *, int);
+static struct plm_http_upstream *plm_http_upstream_get(int);
+static int plm_http_upstream_keep(struct plm_http_upstream *);
+static void plm_http_upstream_idle_read(void *, int);
+static int plm_http_upstream_expire(void *);
+static void plm_http_backend_evict(int);
+static void plm_http_upstream_store(struct plm_http_upstream *,
+									const char *, size_t);
+static ssize_t plm_http_upstream_count(struct plm_http_upstream *,
+									   char *, size_t, size_t *);
+static int plm_http_upstream_out(struct plm_http_upstream *,
+								 struct plm_http_seg *, int);
+static int plm_http_mthd_idempotent(int);
 
 int plm_http_backend_init(struct plm_http_ctx *c)
 {
@@ -40,43 +84,1016 @@ int plm_http_backend_init(struct plm_http_ctx *c)
 		return (-1);
 	}
 	
-	curr = 0;
 	backend_addr = (struct sockaddr_in *)malloc(n * sizeof(*backend_addr));
-	if (backend_addr) {
+	backend_weight = (int *)malloc(n * sizeof(int));
+	if (backend_addr && backend_weight) {
 		struct plm_http_backend *bk;
 
 		bk = (struct plm_http_backend *)PLM_LIST_FRONT(&c->hc_backends);
 		for (i = 0; i < n; i++) {
 			memcpy(backend_addr + i, &bk->hb_addr, sizeof(*backend_addr));
+			backend_weight[i] = bk->hb_weight;
 			bk = (struct plm_http_backend *)PLM_LIST_NEXT(&bk->hb_node);
 		}
 
 		num = n;
+		if (!plm_http_lb_init(c->hc_lb, c->hc_lb_key, n, backend_addr,
+							  backend_weight))
+			return (0);
 	}
 
-	return (backend_addr ? 0 : -1);
+	plm_http_backend_destroy();
+	return (-1);
 }
 
 int plm_http_backend_destroy()
 {
-	curr = 0;
+	plm_http_lb_destroy();
 	free(backend_addr);
 	backend_addr = NULL;
+	free(backend_weight);
+	backend_weight = NULL;
+	num = 0;
+	return (0);
 }
 
+/* pick a backend with the strategy of http_balance
+ * @r -- the request, r->hr_backend is set on success
+ * return 0 on success, else -1
+ */
 int plm_http_backend_select(struct plm_http_req *r)
 {
-	int n, m;
+	int m;
 
-	n = plm_atomic_int_get(&curr);
-	m = n % num;
-	plm_atomic_int_inc(&curr);
+	m = plm_http_lb_select(r);
+	if (m < 0)
+		return (-1);
 
 	r->hr_backend = &backend_addr[m];
 	return (0);
 }
 
+static int
+plm_http_on_status_line(enum plm_http_ver ver, int status,
+						plm_string_t *desc, void *data)
+{
+	struct plm_http_upstream *u;
+	struct plm_http_resp *resp;
+
+	u = (struct plm_http_upstream *)data;
+	resp = u->hu_resp;
+	if (!resp) {
+		resp = (struct plm_http_resp *)
+			plm_mempool_alloc(&u->hu_conn->hc_pool, sizeof(*resp));
+		if (!resp)
+			return (-1);
+		u->hu_resp = resp;
+	}
+
+	memset(resp, 0, sizeof(*resp));
+	plm_http_hdrs_init(&resp->hr_hdrs);
+	resp->hr_ver = ver;
+	resp->hr_status = status;
+	resp->hr_desc = *desc;
+	resp->hr_conn = u->hu_conn;
+	resp->hr_req = u->hu_req;
+	return (0);
+}
+
+static int
+plm_http_on_resp_field(int id, const plm_string_t *k, const plm_string_t *v,
+					   void *data)
+{
+	struct plm_http_upstream *u;
+	uint64_t len;
+	int rc;
+
+	u = (struct plm_http_upstream *)data;
+
+	/* the client gets one length, the backend would split the
+	 * connection at another if they differ
+	 */
+	if (id == PLM_HDR_CONTENT_LENGTH) {
+		rc = plm_http_hdrs_cntlen(&u->hu_resp->hr_hdrs, v, &len);
+		if (rc < 0) {
+			PLM_TRACE("bad Content-Length from backend");
+			return (-1);
+		}
+
+		if (rc > 0)
+			return (0);
+	}
+
+	return (plm_http_hdrs_add(&u->hu_resp->hr_hdrs, id, k, v,
+							  &u->hu_conn->hc_pool));
+}
+
+/* connect to the backend selected and queue the request header, the
+ * caller queues the body and writes
+ * @r -- the request, r->hr_up is set on success
+ * return 0 on success, else -1
+ */
 int plm_http_backend_forward(struct plm_http_req *r)
 {
+	int backend;
+	struct plm_http_conn *c;
+	struct plm_http_upstream *u;
+	struct plm_http_seg *head;
+
+	c = r->hr_conn;
+	backend = r->hr_backend - backend_addr;
+	u = plm_http_upstream_get(backend);
+	if (!u) {
+		u = plm_http_upstream_open(c->hc_ctx, backend);
+		if (!u) {
+			plm_http_backend_evict(backend);
+			return (-1);
+		}
+	}
+
+	u->hu_conn = c;
+	u->hu_req = r;
+	u->hu_resp = NULL;
+	plm_http_lb_start(backend);
+	u->hu_pos = 0;
+	u->hu_rest = 0;
+	u->hu_flags.hu_rd_paused = 0;
+	u->hu_flags.hu_keep = 0;
+	u->hu_flags.hu_dechunk = 0;
+	u->hu_flags.hu_enchunk = 0;
+	u->hu_flags.hu_unchunk = 0;
+	u->hu_fill = NULL;
+	plm_http_wrevt_init(&u->hu_wrevt, plm_http_upstream_on_output, u);
+
+	u->hu_parser.hp_on_req_line = NULL;
+	u->hu_parser.hp_on_status_line = plm_http_on_status_line;
+	u->hu_parser.hp_on_field = plm_http_on_resp_field;
+	u->hu_parser.hp_on_hdr_done = NULL;
+	plm_http_parser_init(&u->hu_parser, u);
+
+	head = plm_http_backend_req_head(r);
+	if (!head) {
+		plm_comm_close(u->hu_fd);
+		return (-1);
+	}
+
+	plm_http_wrevt_append(&u->hu_wrevt, head);
+	r->hr_up = u;
+	PLM_EVT_DRV_READ(u->hu_fd, u, plm_http_upstream_read);
+	return (0);
+}
+
+/* open a connection to a backend, the header is written once connected
+ * and a refused connect fails the write
+ */
+struct plm_http_upstream *
+plm_http_upstream_open(struct plm_http_ctx *ctx, int backend)
+{
+	int fd;
+	struct plm_http_upstream *u;
+
+	u = (struct plm_http_upstream *)
+		plm_lookaside_list_alloc(&ctx->hc_up_pool, NULL);
+	if (!u)
+		return (NULL);
+
+	memset(u, 0, sizeof(*u));
+	fd = plm_comm_open(PLM_COMM_TCP, NULL, 0, 0, -1, NULL, 0, 1, 0);
+	if (fd < 0) {
+		PLM_FATAL("open backend socket failed: %s", strerror(errno));
+		plm_lookaside_list_free(&ctx->hc_up_pool, u, NULL);
+		return (NULL);
+	}
+
+	u->hu_fd = fd;
+	u->hu_ctx = ctx;
+	u->hu_backend = backend;
+	u->hu_cch.cch_handler = plm_http_upstream_free;
+	u->hu_cch.cch_data = u;
+	plm_comm_add_close_handler(fd, &u->hu_cch);
+
+	if (plm_comm_connect(fd, &backend_addr[backend])
+		&& errno != EINPROGRESS) {
+		PLM_TRACE("connect backend failed: %s", strerror(errno));
+		plm_comm_close(fd);
+		return (NULL);
+	}
+
+	return (u);
+}
+
+/* take the most recently used idle connection to a backend
+ * return the connection or NULL if none
+ */
+struct plm_http_upstream *plm_http_upstream_get(int backend)
+{
+	plm_dlist_t *pool;
+	struct plm_http_upstream *u;
+
+	if (!idle_pools)
+		return (NULL);
+
+	pool = &idle_pools[backend];
+	if (PLM_DLIST_LEN(pool) == 0)
+		return (NULL);
+
+	u = plm_http_idle_upstream(PLM_DLIST_FRONT(pool));
+	PLM_DLIST_DEL_FRONT(pool);
+	plm_timer_del(u->hu_timer);
+	u->hu_timer = 0;
+	u->hu_flags.hu_idle = 0;
+	u->hu_flags.hu_reused = 1;
+	return (u);
+}
+
+/* put a connection the response is done on into the idle pool, the
+ * least recently used one is closed if the pool is full
+ * return 0 on success, else -1 and the caller closes it
+ */
+int plm_http_upstream_keep(struct plm_http_upstream *u)
+{
+	plm_dlist_t *pool;
+	struct plm_http_upstream *old;
+
+	if (!idle_pools) {
+		idle_pools = (plm_dlist_t *)calloc(num, sizeof(plm_dlist_t));
+		if (!idle_pools)
+			return (-1);
+	}
+
+	u->hu_timer = plm_timer_add(plm_http_upstream_expire, u,
+								u->hu_ctx->hc_keepalive_timeout);
+	if (!u->hu_timer)
+		return (-1);
+
+	plm_http_lb_done(u->hu_backend);
+
+	/* the response came from the pool of the client connection */
+	u->hu_req->hr_up = NULL;
+	u->hu_conn = NULL;
+	u->hu_req = NULL;
+	u->hu_resp = NULL;
+	u->hu_flags.hu_idle = 1;
+
+	pool = &idle_pools[u->hu_backend];
+	PLM_DLIST_ADD_FRONT(pool, &u->hu_idle_node);
+
+	/* anything readable on an idle connection is a close or garbage */
+	PLM_EVT_DRV_READ(u->hu_fd, u, plm_http_upstream_idle_read);
+
+	if (PLM_DLIST_LEN(pool) > u->hu_ctx->hc_keepalive_max) {
+		old = plm_http_idle_upstream(PLM_DLIST_TAIL(pool));
+		plm_comm_close(old->hu_fd);
+	}
+
+	return (0);
+}
+
+/* close the idle connections to a backend, called when a connection to
+ * it failed, the others are likely to fail too
+ */
+void plm_http_backend_evict(int backend)
+{
+	plm_dlist_t *pool;
+	struct plm_http_upstream *u;
+
+	if (!idle_pools)
+		return;
+
+	pool = &idle_pools[backend];
+	while (PLM_DLIST_LEN(pool) > 0) {
+		u = plm_http_idle_upstream(PLM_DLIST_FRONT(pool));
+		plm_comm_close(u->hu_fd);
+	}
+}
+
+/* close the idle backend connections and release the balancing state
+ * of the current thread
+ */
+void plm_http_backend_thrd_destroy()
+{
+	int i;
+
+	plm_http_lb_thrd_destroy();
+	if (!idle_pools)
+		return;
+
+	for (i = 0; i < num; i++)
+		plm_http_backend_evict(i);
+
+	free(idle_pools);
+	idle_pools = NULL;
+}
+
+/* an idle connection is readable, the backend closed it */
+void plm_http_upstream_idle_read(void *data, int fd)
+{
+	struct plm_http_upstream *u;
+
+	/* taken in the same loop after the event was polled */
+	u = (struct plm_http_upstream *)data;
+	if (!u->hu_flags.hu_idle)
+		return;
+
+	PLM_TRACE("idle backend connection closed");
+	plm_comm_close(fd);
+}
+
+/* an idle connection is not used for hc_keepalive_timeout */
+int plm_http_upstream_expire(void *data)
+{
+	struct plm_http_upstream *u;
+
+	u = (struct plm_http_upstream *)data;
+	u->hu_timer = 0;
+	plm_comm_close(u->hu_fd);
+	return (0);
+}
+
+/* the client output is drained, go on reading the response */
+void plm_http_backend_resume(struct plm_http_upstream *u)
+{
+	if (u->hu_flags.hu_rd_paused) {
+		u->hu_flags.hu_rd_paused = 0;
+		if (u->hu_resp_rl.hl_pipe)
+			plm_http_upstream_relay(u);
+		else
+			PLM_EVT_DRV_READ(u->hu_fd, u, plm_http_upstream_read);
+	}
+}
+
+/* the request header to the backend, keep-alive if connections are
+ * pooled, else the backend closes after the response
+ */
+struct plm_http_seg *plm_http_backend_req_head(struct plm_http_req *r)
+{
+	static const char ver[] = " HTTP/1.1\r\n";
+	static const char kpalv[] = "Connection: keep-alive\r\n\r\n";
+	static const char close[] = "Connection: close\r\n\r\n";
+	const plm_string_t *mthd;
+	struct plm_http_seg *s;
+	const char *conn;
+	size_t n, verlen, connlen;
+	char *p;
+
+	/* a response of unknown length comes in chunks and is decoded to
+	 * find its end, so the pooled connection outlives it, one with a
+	 * Content-Length is still spliced and cached
+	 */
+	verlen = sizeof(ver) - 1;
+	if (r->hr_conn->hc_ctx->hc_keepalive_max > 0) {
+		conn = kpalv;
+		connlen = sizeof(kpalv) - 1;
+	} else {
+		conn = close;
+		connlen = sizeof(close) - 1;
+	}
+
+	mthd = plm_http_mthd_name(r->hr_mthd);
+	n = mthd->s_len + 1 + r->hr_url.s_len + verlen
+		+ plm_http_hdrs_size(&r->hr_hdrs) + connlen;
+	if (n > PLM_HTTP_SEG_MAX) {
+		PLM_TRACE("request header too large to forward");
+		return (NULL);
+	}
+
+	s = plm_http_seg_alloc(n);
+	if (!s)
+		return (NULL);
+
+	p = s->hs_buf;
+	memcpy(p, mthd->s_str, mthd->s_len);
+	p += mthd->s_len;
+	*p++ = ' ';
+	memcpy(p, r->hr_url.s_str, r->hr_url.s_len);
+	p += r->hr_url.s_len;
+	memcpy(p, ver, verlen);
+	p += verlen;
+	p = plm_http_hdrs_write(&r->hr_hdrs, p);
+	memcpy(p, conn, connlen);
+	p += connlen;
+
+	s->hs_len = p - s->hs_buf;
+	return (s);
+}
+
+/* the response header to the client, the connection header follows
+ * the client, an interim response has none
+ * @resp -- the parsed response header
+ * @keepalive -- the client keeps the connection
+ * @chunked -- the body is framed in chunks to the client
+ */
+static struct plm_http_seg *
+plm_http_backend_resp_head(struct plm_http_resp *resp, int keepalive,
+						   int chunked)
+{
+	static const char kpalv[] = "Connection: keep-alive\r\n";
+	static const char close[] = "Connection: close\r\n";
+	static const char te[] = "Transfer-Encoding: chunked\r\n";
+	const char *conn;
+	size_t n, connlen, telen;
+	struct plm_http_seg *s;
+	char *p;
+
+	if (resp->hr_status / 100 == 1) {
+		conn = "";
+		connlen = 0;
+	} else if (keepalive) {
+		conn = kpalv;
+		connlen = sizeof(kpalv) - 1;
+	} else {
+		conn = close;
+		connlen = sizeof(close) - 1;
+	}
+
+	/* "HTTP/1.1 200 " desc "\r\n" fields te conn "\r\n" */
+	telen = chunked ? sizeof(te) - 1 : 0;
+	n = 13 + resp->hr_desc.s_len + 2 + plm_http_hdrs_size(&resp->hr_hdrs)
+		+ telen + connlen + 2;
+	if (n > PLM_HTTP_SEG_MAX)
+		return (NULL);
+
+	s = plm_http_seg_alloc(n);
+	if (!s)
+		return (NULL);
+
+	p = s->hs_buf;
+	memcpy(p, "HTTP/1.1 ", 9);
+	p[9] = '0' + resp->hr_status / 100;
+	p[10] = '0' + resp->hr_status / 10 % 10;
+	p[11] = '0' + resp->hr_status % 10;
+	p[12] = ' ';
+	p += 13;
+	memcpy(p, resp->hr_desc.s_str, resp->hr_desc.s_len);
+	p += resp->hr_desc.s_len;
+	*p++ = '\r';
+	*p++ = '\n';
+	p = plm_http_hdrs_write(&resp->hr_hdrs, p);
+	memcpy(p, te, telen);
+	p += telen;
+	memcpy(p, conn, connlen);
+	p += connlen;
+	*p++ = '\r';
+	*p++ = '\n';
+
+	s->hs_len = p - s->hs_buf;
+	return (s);
+}
+
+/* the backend keeps the connection after the response */
+static int plm_http_resp_keepalive(struct plm_http_resp *resp)
+{
+	const plm_string_t *v;
+
+	v = plm_http_hdrs_get(&resp->hr_hdrs, PLM_HDR_CONNECTION);
+	if (v && plm_http_hdr_has_token(v, "close", 5))
+		return (0);
+	if (v && plm_http_hdr_has_token(v, "keep-alive", 10))
+		return (1);
+
+	return (resp->hr_ver == PLM_HTTP_11);
+}
+
+/* queue the parsed response header to the client and find where the
+ * body ends
+ * return 0 on success, 1 if it was an interim response, else -1
+ */
+int plm_http_upstream_head(struct plm_http_upstream *u)
+{
+	struct plm_http_req *r;
+	struct plm_http_resp *resp;
+	struct plm_http_seg *s;
+	const plm_string_t *v;
+	int framed = 1;
+
+	r = u->hu_req;
+	resp = u->hu_resp;
+
+	/* 101 is never seen, Upgrade is not forwarded, an HTTP/1.0 client
+	 * gets no interim response
+	 */
+	if (resp->hr_status / 100 == 1) {
+		if (r->hr_ver == PLM_HTTP_11) {
+			s = plm_http_backend_resp_head(resp, 0, 0);
+			if (!s)
+				return (-1);
+
+			plm_http_wrevt_append(plm_http_req_out(r), s);
+		}
+
+		plm_http_parser_init(&u->hu_parser, u);
+		return (1);
+	}
+
+	if (r->hr_mthd == PLM_MTHD_HEAD || resp->hr_status == 204
+		|| resp->hr_status == 304) {
+		u->hu_rest = 0;
+	} else if ((v = plm_http_hdrs_get(&resp->hr_hdrs,
+									  PLM_HDR_TRANSFER_ENCODING))) {
+		/* the chunks are relayed as they are and decoded to find the
+		 * end, another coding ends when the backend closes, an
+		 * HTTP/1.0 client gets no Transfer-Encoding, RFC 7230 3.3.1,
+		 * the chunks are taken off and the close ends the body
+		 */
+		if (plm_http_chunked_last(v)) {
+			u->hu_flags.hu_dechunk = 1;
+			plm_http_chunked_init(&u->hu_chunked);
+			u->hu_rest = plm_http_chunked_rest(&u->hu_chunked);
+		} else {
+			u->hu_rest = PLM_HTTP_UNTIL_EOF;
+			framed = 0;
+		}
+
+		if (r->hr_ver != PLM_HTTP_11) {
+			resp->hr_hdrs.hh_known[PLM_HDR_TRANSFER_ENCODING].s_str = NULL;
+			u->hu_flags.hu_unchunk = u->hu_flags.hu_dechunk;
+			framed = 0;
+		}
+	} else if ((v = plm_http_hdrs_get(&resp->hr_hdrs,
+									  PLM_HDR_CONTENT_LENGTH))) {
+		if (plm_http_cntlen(v, &u->hu_rest))
+			return (-1);
+	} else {
+		/* framed in chunks for a client keeping the connection, the
+		 * body ends when the backend closes
+		 */
+		u->hu_rest = PLM_HTTP_UNTIL_EOF;
+		if (r->hr_ver == PLM_HTTP_11 && r->hr_flags.hr_keepalive) {
+			u->hu_flags.hu_enchunk = 1;
+			plm_http_chunked_init(&u->hu_chunked);
+		} else {
+			framed = 0;
+		}
+	}
+
+	/* the client knows where the body ends only if it is framed */
+	if (!framed)
+		r->hr_flags.hr_keepalive = 0;
+
+	u->hu_flags.hu_keep = u->hu_ctx->hc_keepalive_max > 0
+		&& u->hu_rest != PLM_HTTP_UNTIL_EOF
+		&& plm_http_resp_keepalive(resp);
+
+	u->hu_fill = plm_http_cache_fill_start(r, resp, u->hu_flags.hu_dechunk ?
+										   PLM_HTTP_UNTIL_EOF : u->hu_rest);
+
+	s = plm_http_backend_resp_head(resp, r->hr_flags.hr_keepalive,
+								   u->hu_flags.hu_enchunk);
+	if (!s)
+		return (-1);
+
+	plm_http_wrevt_append(plm_http_req_out(r), s);
+	r->hr_flags.hr_head_sent = 1;
+	return (0);
+}
+
+/* read and parse the response header, then relay the body */
+void plm_http_upstream_read(void *data, int fd)
+{
+	int n, rc;
+	struct plm_http_upstream *u;
+	struct plm_http_conn *c;
+	struct plm_http_seg *s;
+	size_t left, out;
+	ssize_t m;
+	plm_string_t str;
+
+	u = (struct plm_http_upstream *)data;
+	c = u->hu_conn;
+	if (u->hu_req->hr_flags.hr_head_sent) {
+		if (u->hu_resp_rl.hl_pipe)
+			plm_http_upstream_relay(u);
+		else
+			plm_http_upstream_read_body(u, fd);
+		return;
+	}
+
+	if (!u->hu_in) {
+		u->hu_in = plm_http_seg_alloc(PLM_HTTP_SEG_MAX);
+		if (!u->hu_in) {
+			plm_http_upstream_fail(u);
+			return;
+		}
+	}
+
+	s = u->hu_in;
+	if (s->hs_len == s->hs_cap) {
+		PLM_TRACE("response header too large");
+		plm_http_upstream_fail(u);
+		return;
+	}
+
+	n = plm_comm_read(fd, s->hs_buf + s->hs_len, s->hs_cap - s->hs_len);
+	if (n < 0 && plm_comm_ignore(errno)) {
+		PLM_EVT_DRV_READ(fd, u, plm_http_upstream_read);
+		return;
+	}
+
+	if (n <= 0) {
+		PLM_TRACE("backend closed before response header: %s",
+				  n < 0 ? strerror(errno) : "eof");
+		plm_http_upstream_fail(u);
+		return;
+	}
+
+	s->hs_len += n;
+	for (;;) {
+		str.s_str = s->hs_buf + u->hu_pos;
+		str.s_len = s->hs_len - u->hu_pos;
+		rc = PLM_HTTP_PARSE_AGAIN;
+		if (str.s_len > 0) {
+			/* str is consumed by the parser */
+			rc = plm_http_parser_resp(&u->hu_parser, &str);
+			u->hu_pos += u->hu_parser.hp_parsed;
+		}
+
+		if (rc == PLM_HTTP_PARSE_ERROR || rc == PLM_HTTP_PARSE_BREAK) {
+			PLM_TRACE("bad response");
+			plm_http_upstream_fail(u);
+			return;
+		}
+
+		if (rc == PLM_HTTP_PARSE_AGAIN) {
+			/* an interim response may be queued */
+			plm_http_req_flush(u->hu_req);
+			PLM_EVT_DRV_READ(fd, u, plm_http_upstream_read);
+			return;
+		}
+
+		rc = plm_http_upstream_head(u);
+		if (rc < 0) {
+			plm_http_upstream_fail(u);
+			return;
+		}
+
+		if (rc == 0)
+			break;
+	}
+
+	/* the body bytes behind the header go with the segment */
+	left = s->hs_len - u->hu_pos;
+	m = plm_http_upstream_count(u, s->hs_buf + u->hu_pos, left, &out);
+	if (m < 0) {
+		PLM_TRACE("bad chunked response");
+		plm_http_upstream_fail(u);
+		return;
+	}
+
+	/* more than the response, the connection is out of step */
+	if ((size_t)m < left)
+		u->hu_flags.hu_keep = 0;
+
+	u->hu_in = NULL;
+	if (out > 0) {
+		s->hs_off = u->hu_pos;
+		s->hs_len = u->hu_pos + out;
+		plm_http_upstream_store(u, s->hs_buf + s->hs_off, out);
+		if (plm_http_upstream_out(u, s, 0)) {
+			plm_http_upstream_fail(u);
+			return;
+		}
+	} else {
+		plm_http_seg_free(s);
+	}
+
+	/* a large body is spliced once the header and the bytes read with
+	 * it are written, plm_http_backend_resume starts it, a body being
+	 * cached or decoded has to pass through user space, and one queued
+	 * behind another response too
+	 */
+	if (u->hu_ctx->hc_splice_min && !u->hu_fill && !u->hu_flags.hu_dechunk
+		&& u->hu_rest != PLM_HTTP_UNTIL_EOF
+		&& u->hu_rest >= u->hu_ctx->hc_splice_min
+		&& plm_http_req_front(u->hu_req)
+		&& !plm_http_relay_init(&u->hu_resp_rl, fd, c->hc_fd, u->hu_rest)) {
+		u->hu_flags.hu_rd_paused = 1;
+		plm_http_event_write(c->hc_fd, &c->hc_wrevt);
+		return;
+	}
+
+	plm_http_upstream_read_body(u, fd);
+}
+
+/* splice the response body from the backend to the client */
+void plm_http_upstream_relay(struct plm_http_upstream *u)
+{
+	struct plm_http_conn *c;
+
+	c = u->hu_conn;
+	switch (plm_http_relay(&u->hu_resp_rl)) {
+	case PLM_HTTP_RELAY_DONE:
+		u->hu_rest = 0;
+		plm_http_upstream_done(u);
+		break;
+
+	case PLM_HTTP_RELAY_RD:
+		PLM_EVT_DRV_READ(u->hu_fd, u, plm_http_upstream_read);
+		break;
+
+	case PLM_HTTP_RELAY_WR:
+		PLM_EVT_DRV_WRITE(c->hc_fd, c, plm_http_relay_resp);
+		break;
+
+	case PLM_HTTP_RELAY_ERR_IN:
+		PLM_TRACE("backend closed in response body");
+		plm_http_upstream_fail(u);
+		break;
+
+	default:
+		PLM_TRACE("write client failed: %s", strerror(errno));
+		plm_comm_close(c->hc_fd);
+		break;
+	}
+}
+
+/* the client of a spliced response is writable, the event is on the
+ * conn as the upstream may be gone
+ */
+void plm_http_relay_resp(void *data, int fd)
+{
+	struct plm_http_conn *c;
+	struct plm_http_req *r;
+
+	c = (struct plm_http_conn *)data;
+	r = (struct plm_http_req *)PLM_LIST_FRONT(&c->hc_reqs);
+	if (r && r->hr_up && r->hr_up->hu_resp_rl.hl_pipe)
+		plm_http_upstream_relay(r->hr_up);
+}
+
+/* relay the response body to the client output until hu_rest is done
+ * or the output is too much
+ */
+void plm_http_upstream_read_body(struct plm_http_upstream *u, int fd)
+{
+	int n;
+	size_t want, head, out;
+	struct plm_http_wrevt *w;
+	struct plm_http_seg *s;
+
+	w = plm_http_req_out(u->hu_req);
+
+	/* room for the size line of a chunk in front of the data */
+	head = u->hu_flags.hu_enchunk ? PLM_HTTP_CHUNKED_HEAD : 0;
+	while (u->hu_rest > 0) {
+		if (w->hw_bytes >= PLM_HTTP_OUT_HIGH) {
+			u->hu_flags.hu_rd_paused = 1;
+			break;
+		}
+
+		s = plm_http_seg_alloc(PLM_HTTP_SEG_MAX);
+		if (!s) {
+			plm_http_upstream_fail(u);
+			return;
+		}
+
+		want = s->hs_cap - head;
+		if (want > u->hu_rest)
+			want = u->hu_rest;
+
+		n = plm_comm_read(fd, s->hs_buf + head, want);
+		if (n < 0 && plm_comm_ignore(errno)) {
+			plm_http_seg_free(s);
+			PLM_EVT_DRV_READ(fd, u, plm_http_upstream_read);
+			break;
+		}
+
+		if (n <= 0) {
+			plm_http_seg_free(s);
+			if (n == 0 && u->hu_rest == PLM_HTTP_UNTIL_EOF) {
+				u->hu_rest = 0;
+				if (u->hu_flags.hu_enchunk
+					&& plm_http_chunked_end(&u->hu_chunked, w)) {
+					plm_http_upstream_fail(u);
+					return;
+				}
+				break;
+			}
+
+			PLM_TRACE("backend closed in response body");
+			plm_http_upstream_fail(u);
+			return;
+		}
+
+		/* the reads never go past the end of the response */
+		if (plm_http_upstream_count(u, s->hs_buf + head, n, &out) != n) {
+			PLM_TRACE("bad chunked response");
+			plm_http_seg_free(s);
+			plm_http_upstream_fail(u);
+			return;
+		}
+
+		/* only chunk framing for a client which can't take chunks */
+		if (out == 0) {
+			plm_http_seg_free(s);
+		} else {
+			s->hs_off = head;
+			s->hs_len = head + out;
+			plm_http_upstream_store(u, s->hs_buf + head, out);
+			if (plm_http_upstream_out(u, s, 1)) {
+				plm_http_upstream_fail(u);
+				return;
+			}
+		}
+
+		/* the socket is drained most likely, save a read */
+		if ((size_t)n < want) {
+			PLM_EVT_DRV_READ(fd, u, plm_http_upstream_read);
+			break;
+		}
+	}
+
+	if (u->hu_rest == 0) {
+		plm_http_upstream_done(u);
+		return;
+	}
+
+	plm_http_req_flush(u->hu_req);
+}
+
+/* the response is relayed, the backend connection is not needed */
+void plm_http_upstream_done(struct plm_http_upstream *u)
+{
+	struct plm_http_req *r;
+	struct plm_http_conn *c;
+
+	r = u->hu_req;
+	c = u->hu_conn;
+
+	if (u->hu_fill) {
+		plm_http_cache_fill_end(u->hu_fill);
+		u->hu_fill = NULL;
+	}
+
+	/* reused only when the backend has read the whole request too */
+	if (!u->hu_flags.hu_keep || (r == c->hc_last && c->hc_body_rest > 0)
+		|| u->hu_wrevt.hw_head
+		|| u->hu_body_rl.hl_pipe || plm_http_upstream_keep(u))
+		plm_comm_close(u->hu_fd);
+
+	plm_http_req_done(r);
+}
+
+/* copy response body bytes into the entry being filled, the entry is
+ * dropped if memory runs out
+ */
+void plm_http_upstream_store(struct plm_http_upstream *u, const char *buf,
+							 size_t n)
+{
+	if (u->hu_fill && plm_http_cache_fill(u->hu_fill, buf, n)) {
+		plm_http_cache_fill_end(u->hu_fill);
+		u->hu_fill = NULL;
+	}
+}
+
+/* account response body bytes read, a chunked body is decoded to find
+ * its end, the bytes past the end of the response are not counted
+ * @u -- the upstream
+ * @buf -- the bytes read, the chunks are taken off in place for a
+ *         client which can't take them
+ * @n -- length of buf
+ * @out -- gets the bytes at the front of buf to relay
+ * return the bytes of buf in the response, or -1 if the coding is broken
+ */
+ssize_t plm_http_upstream_count(struct plm_http_upstream *u, char *buf,
+								size_t n, size_t *out)
+{
+	ssize_t m;
+
+	if (u->hu_flags.hu_dechunk) {
+		if (u->hu_flags.hu_unchunk) {
+			m = plm_http_chunked_strip(&u->hu_chunked, buf, n, out);
+		} else {
+			m = plm_http_chunked_decode(&u->hu_chunked, buf, n);
+			*out = m;
+		}
+
+		if (m >= 0)
+			u->hu_rest = plm_http_chunked_done(&u->hu_chunked) ?
+				0 : plm_http_chunked_rest(&u->hu_chunked);
+		return (m);
+	}
+
+	if (u->hu_rest != PLM_HTTP_UNTIL_EOF) {
+		if (n > u->hu_rest)
+			n = u->hu_rest;
+		u->hu_rest -= n;
+	}
+
+	*out = n;
+	return (n);
+}
+
+/* queue response body bytes to the client, framed in chunks if the
+ * backend gave no length
+ * @u -- the upstream
+ * @s -- the body bytes from s->hs_off
+ * @room -- the size line of a chunk fits in front of s->hs_off
+ * return 0 on success, else -1 and s is freed
+ */
+int plm_http_upstream_out(struct plm_http_upstream *u,
+						  struct plm_http_seg *s, int room)
+{
+	struct plm_http_wrevt *w;
+
+	w = plm_http_req_out(u->hu_req);
+	if (u->hu_flags.hu_enchunk)
+		return (plm_http_chunked_append(&u->hu_chunked, w, s, room));
+
+	plm_http_wrevt_append(w, s);
+	return (0);
+}
+
+/* the backend failed the request */
+void plm_http_upstream_fail(struct plm_http_upstream *u)
+{
+	int retry, backend;
+	struct plm_http_req *r;
+
+	r = u->hu_req;
+	backend = u->hu_backend;
+
+	/* the backend may close an idle connection just as it is reused,
+	 * an idempotent request without body is sent again if no response
+	 * came, RFC 7230 6.3.1
+	 */
+	retry = u->hu_flags.hu_reused && !u->hu_resp && r->hr_cntlen == 0
+		&& plm_http_mthd_idempotent(r->hr_mthd)
+		&& !r->hr_flags.hr_te
+		&& (!u->hu_in || u->hu_in->hs_len == 0);
+
+	plm_comm_close(u->hu_fd);
+
+	/* the other idle connections to the backend are suspect */
+	plm_http_backend_evict(backend);
+
+	if (retry && !plm_http_backend_forward(r)) {
+		u = r->hr_up;
+		plm_http_event_write(u->hu_fd, &u->hu_wrevt);
+		return;
+	}
+
+	plm_http_req_error(r, PLM_ERR_BACKEND_FWD);
 }
 
+/* nonzero if a request of the method may be sent again */
+int plm_http_mthd_idempotent(int mthd)
+{
+	switch (mthd) {
+	case PLM_MTHD_GET:
+	case PLM_MTHD_HEAD:
+	case PLM_MTHD_OPTIONS:
+	case PLM_MTHD_TRACE:
+	case PLM_MTHD_PUT:
+	case PLM_MTHD_DELETE:
+		return (1);
+	}
+
+	return (0);
+}
+
+/* the request output is drained or failed */
+void plm_http_upstream_on_output(void *data, int state)
+{
+	struct plm_http_upstream *u;
+
+	u = (struct plm_http_upstream *)data;
+	if (state < 0) {
+		PLM_TRACE("write backend failed: %s", strerror(errno));
+		plm_http_upstream_fail(u);
+		return;
+	}
+
+	plm_http_req_body_resume(u->hu_req);
+}
+
+/* close handler of the backend fd */
+void plm_http_upstream_free(void *data)
+{
+	struct plm_http_upstream *u;
+
+	u = (struct plm_http_upstream *)data;
+	if (u->hu_flags.hu_idle) {
+		PLM_DLIST_REMOVE(&idle_pools[u->hu_backend], &u->hu_idle_node);
+		plm_timer_del(u->hu_timer);
+	}
+
+	/* closed with a request in flight */
+	if (u->hu_req)
+		plm_http_lb_done(u->hu_backend);
+
+	/* the body is not complete, so the entry is dropped */
+	if (u->hu_fill)
+		plm_http_cache_fill_end(u->hu_fill);
+
+	plm_http_wrevt_drop(&u->hu_wrevt);
+	plm_http_relay_release(&u->hu_body_rl);
+	plm_http_relay_release(&u->hu_resp_rl);
+	if (u->hu_in)
+		plm_http_seg_free(u->hu_in);
+
+	/* hu_conn is cleared if the client goes first */
+	if (u->hu_conn)
+		u->hu_req->hr_up = NULL;
+
+	plm_lookaside_list_free(&u->hu_ctx->hc_up_pool, u, NULL);
+}
@@ -37,10 +37,27 @@ int plm_http_backend_init(struct plm_http_ctx *c);
 
 int plm_http_backend_destroy();	
 
+/* close the idle backend connections and release the balancing state
+ * of the current thread
+ */
+void plm_http_backend_thrd_destroy();
+
+/* pick a backend with the strategy of http_balance
+ * @r -- the request, r->hr_backend is set on success
+ * return 0 on success, else -1
+ */
 int plm_http_backend_select(struct plm_http_req *r);
 
+/* connect to the backend selected and queue the request header, the
+ * caller queues the body and writes
+ * @r -- the request, r->hr_conn->hc_up is set on success
+ * return 0 on success, else -1
+ */
 int plm_http_backend_forward(struct plm_http_req *r);
 
+/* the client output is drained, go on reading the response */
+void plm_http_backend_resume(struct plm_http_upstream *u);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,1411 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "plm_atomic.h"
+#include "plm_clock.h"
+#include "plm_dlist.h"
+#include "plm_oahash.h"
+#include "plm_sync_mech.h"
+#include "plm_task.h"
+#include "plm_threads.h"
+#include "plm_http_errlog.h"
+#include "plm_http_header.h"
+#include "plm_http_request.h"
+#include "plm_http_disk.h"
+#include "plm_http_cache.h"
+
+/* lists of a shard, an entry starts on probation and is protected
+ * once it is hit
+ */
+enum {
+	PLM_CACHE_PROBATION,
+	PLM_CACHE_PROTECTED,
+	PLM_CACHE_LISTS
+};
+
+/* a piece of a stored body */
+struct plm_http_cbuf {
+	struct plm_http_cbuf *cb_next;
+	size_t cb_len;
+	char cb_data[0];
+};
+
+struct plm_http_centry {
+	plm_dlist_node_t ce_node;
+
+	/* the list of the shard it is on, -1 if not in the cache */
+	int ce_list;
+	int ce_ref;
+	uint32_t ce_hash;
+
+	/* fresh until this monotonic time in ms */
+	uint64_t ce_expire;
+
+	/* wall clock ms when it was stored and the Age it came with */
+	uint64_t ce_stored;
+	uint64_t ce_age;
+
+	/* bytes charged to the shard */
+	size_t ce_size;
+
+	char *ce_key;
+	size_t ce_klen;
+
+	/* status line and end-to-end fields without Age, Connection and
+	 * the empty line
+	 */
+	char *ce_head;
+	size_t ce_hlen;
+
+	uint64_t ce_body_len;
+	uint64_t ce_filled;
+	struct plm_http_cbuf *ce_body;
+	struct plm_http_cbuf *ce_tail;
+
+	/* evicted ones waiting to be written to disk */
+	struct plm_http_centry *ce_next;
+
+	/* the fetch it is filled by, its waiters are fed as it grows */
+	struct plm_http_flight *ce_flight;
+};
+
+/* states of a fetch, it waits for the response header, then fills an
+ * entry until the body is complete or it fails
+ */
+enum {
+	PLM_FLIGHT_WAIT,
+	PLM_FLIGHT_FILL,
+	PLM_FLIGHT_DONE,
+	PLM_FLIGHT_FAIL
+};
+
+/* a miss fetched from a backend, the misses of the same key meanwhile
+ * wait for it instead of going to a backend too, the fields are
+ * guarded by the shard lock
+ */
+struct plm_http_flight {
+	struct plm_http_cache_shard *fl_shard;
+
+	/* held by the in-flight table, the entry filled and the waiters */
+	int fl_ref;
+	int fl_state;
+
+	/* the entry filled and the body bytes in it */
+	struct plm_http_centry *fl_entry;
+	uint64_t fl_filled;
+
+	struct plm_http_waiter *fl_waiters;
+	char *fl_key;
+	size_t fl_klen;
+};
+
+/* a request waiting on a fetch, woken by a task on its own thread */
+struct plm_http_waiter {
+	struct plm_task w_task;
+	struct plm_http_waiter *w_next;
+	struct plm_http_flight *w_flight;
+
+	/* NULL once the request is gone, the task frees the waiter then */
+	struct plm_http_req *w_req;
+	int w_slot;
+	int w_posted;
+
+	/* the entry once the header is queued, and the body queued so far,
+	 * a body buffer is full unless it is the last one
+	 */
+	struct plm_http_centry *w_entry;
+	struct plm_http_cbuf *w_buf;
+	size_t w_off;
+	uint64_t w_sent;
+};
+
+/* an entry evicted to the disk tier, holds a reference until the
+ * writer thread is done with it, the body iovecs follow
+ */
+struct plm_http_demote {
+	struct plm_http_disk_job dm_job;
+	struct plm_http_centry *dm_entry;
+};
+
+struct plm_http_cache_shard {
+	plm_lock_t cs_lock;
+	struct plm_oahash cs_index;
+
+	/* the fetches of misses by key */
+	struct plm_oahash cs_flights;
+	plm_dlist_t cs_lists[PLM_CACHE_LISTS];
+	size_t cs_bytes[PLM_CACHE_LISTS];
+};
+
+/* room of "Age: n\r\nConnection: keep-alive\r\n\r\n" */
+#define PLM_HTTP_AGE_MAX 64
+
+#define plm_http_centry_of(n) \
+	((struct plm_http_centry *)((char *)(n) \
+								- offsetof(struct plm_http_centry, ce_node)))
+
+static struct plm_http_cache_shard *cache_shards;
+static size_t cache_shard_max;
+static size_t cache_protected_max;
+static uint64_t cache_obj_max;
+static int cache_coalesce;
+
+static uint32_t plm_http_cache_hash(const char *s, size_t len);
+static size_t plm_http_cache_key(struct plm_http_req *r, char *buf);
+static long long plm_http_cc_get(const plm_string_t *v, const char *name,
+								 size_t len);
+static long long plm_http_date_parse(const plm_string_t *v);
+static long long plm_http_cache_lifetime(struct plm_http_resp *resp);
+static int plm_http_cache_req_ok(struct plm_http_req *r);
+static void plm_http_cache_unref(void *);
+static void plm_http_cache_unlink(struct plm_http_cache_shard *,
+								  struct plm_http_centry *);
+static void plm_http_cache_touch(struct plm_http_cache_shard *,
+								 struct plm_http_centry *);
+static void plm_http_cache_evict(struct plm_http_cache_shard *,
+								 struct plm_http_centry **);
+static void plm_http_cache_demote(struct plm_http_centry *);
+static void plm_http_cache_demoted(struct plm_http_disk_job *);
+static void plm_http_cache_seg(struct plm_http_req *, struct plm_http_seg *,
+							   char *, size_t);
+static struct plm_http_seg *
+plm_http_cache_head(struct plm_http_req *, char *, size_t, uint64_t, size_t);
+static int plm_http_cache_serve_disk(struct plm_http_req *, const char *,
+									 size_t);
+static struct plm_http_centry *
+plm_http_cache_entry(struct plm_http_req *, struct plm_http_resp *, uint64_t);
+static int plm_http_cache_lead(struct plm_http_req *,
+							   struct plm_http_cache_shard *, const char *,
+							   size_t);
+static int plm_http_cache_wait(struct plm_http_req *,
+							   struct plm_http_flight *);
+static void plm_http_cache_post(struct plm_http_flight *);
+static void plm_http_cache_resolve(struct plm_http_flight *, int);
+static void plm_http_cache_land(struct plm_http_centry *, int);
+static void plm_http_flight_unref(struct plm_http_flight *);
+static void plm_http_cache_detach(struct plm_http_waiter *);
+static void plm_http_cache_wake(void *);
+static int plm_http_cache_feed(struct plm_http_waiter *,
+							   struct plm_http_req *, uint64_t);
+static void plm_http_flight_free(struct plm_oahash_entry *, void *);
+
+/* allocate the shards with the budget of ctx->hc_cache_size
+ * return 0 on success, else -1
+ */
+int plm_http_cache_init(struct plm_http_ctx *ctx)
+{
+	int i, j;
+
+	if (ctx->hc_cache_size == 0)
+		return (0);
+
+	cache_shards = (struct plm_http_cache_shard *)
+		calloc(PLM_HTTP_CACHE_SHARDS, sizeof(*cache_shards));
+	if (!cache_shards)
+		return (-1);
+
+	for (i = 0; i < PLM_HTTP_CACHE_SHARDS; i++) {
+		if (plm_oahash_init(&cache_shards[i].cs_index, 64, 0, NULL)
+			|| plm_oahash_init(&cache_shards[i].cs_flights, 16, 0, NULL)) {
+			plm_oahash_destroy(&cache_shards[i].cs_index);
+			while (--i >= 0) {
+				plm_oahash_destroy(&cache_shards[i].cs_index);
+				plm_oahash_destroy(&cache_shards[i].cs_flights);
+				plm_lock_destroy(&cache_shards[i].cs_lock);
+			}
+			free(cache_shards);
+			cache_shards = NULL;
+			return (-1);
+		}
+
+		plm_lock_init(&cache_shards[i].cs_lock);
+		for (j = 0; j < PLM_CACHE_LISTS; j++)
+			PLM_DLIST_INIT(&cache_shards[i].cs_lists[j]);
+	}
+
+	cache_shard_max = ctx->hc_cache_size / PLM_HTTP_CACHE_SHARDS;
+	cache_protected_max = cache_shard_max / 100 * PLM_HTTP_CACHE_PROTECTED;
+	cache_obj_max = ctx->hc_cache_obj_max;
+	cache_coalesce = ctx->hc_cache_coalesce;
+
+	if (ctx->hc_cache_disk_size
+		&& plm_http_disk_init(ctx->hc_cache_disk.s_str,
+							  ctx->hc_cache_disk_size)) {
+		plm_http_cache_destroy();
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* drop all entries, the ones still being written are released by
+ * the last response
+ */
+void plm_http_cache_destroy()
+{
+	int i, j;
+	struct plm_http_cache_shard *cs;
+	struct plm_http_centry *e;
+
+	if (!cache_shards)
+		return;
+
+	for (i = 0; i < PLM_HTTP_CACHE_SHARDS; i++) {
+		cs = &cache_shards[i];
+		for (j = 0; j < PLM_CACHE_LISTS; j++) {
+			while (PLM_DLIST_LEN(&cs->cs_lists[j]) > 0) {
+				e = plm_http_centry_of(PLM_DLIST_FRONT(&cs->cs_lists[j]));
+				plm_http_cache_unlink(cs, e);
+			}
+		}
+
+		plm_oahash_foreach(&cs->cs_flights, NULL, plm_http_flight_free);
+		plm_oahash_destroy(&cs->cs_flights);
+		plm_oahash_destroy(&cs->cs_index);
+		plm_lock_destroy(&cs->cs_lock);
+	}
+
+	free(cache_shards);
+	cache_shards = NULL;
+	plm_http_disk_destroy();
+}
+
+/* FNV-1a, the shard is picked by it, the index hashes on its own */
+uint32_t plm_http_cache_hash(const char *s, size_t len)
+{
+	uint32_t h = 2166136261u;
+
+	while (len-- > 0) {
+		h ^= (uint8_t)*s++;
+		h *= 16777619u;
+	}
+
+	return (h);
+}
+
+/* write "method host url" into buf, plm_http_cache_key(r, NULL) gives
+ * the length
+ */
+size_t plm_http_cache_key(struct plm_http_req *r, char *buf)
+{
+	const plm_string_t *mthd;
+	size_t n;
+
+	mthd = plm_http_mthd_name(r->hr_mthd);
+	n = mthd->s_len + 1 + r->hr_host.s_len + 1 + r->hr_url.s_len;
+	if (buf) {
+		memcpy(buf, mthd->s_str, mthd->s_len);
+		buf += mthd->s_len;
+		*buf++ = ' ';
+		memcpy(buf, r->hr_host.s_str, r->hr_host.s_len);
+		buf += r->hr_host.s_len;
+		*buf++ = ' ';
+		memcpy(buf, r->hr_url.s_str, r->hr_url.s_len);
+	}
+
+	return (n);
+}
+
+/* find a directive of Cache-Control
+ * @v -- the field value
+ * @name -- the directive, case insensitive
+ * @len -- length of name
+ * return the value in seconds, 0 if it has none, or -1 if not found
+ */
+long long plm_http_cc_get(const plm_string_t *v, const char *name, size_t len)
+{
+	const char *p = v->s_str, *end = v->s_str + v->s_len, *e;
+	long long n;
+
+	while (p < end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+			p++;
+
+		e = p;
+		while (e < end && *e != ',' && *e != '=' && *e != ' ')
+			e++;
+
+		if ((size_t)(e - p) == len && !strncasecmp(p, name, len)) {
+			while (e < end && *e == ' ')
+				e++;
+			if (e == end || *e != '=')
+				return (0);
+
+			for (e++; e < end && (*e == ' ' || *e == '"'); e++)
+				;
+			for (n = 0; e < end && *e >= '0' && *e <= '9'; e++)
+				n = n * 10 + *e - '0';
+			return (n);
+		}
+
+		/* skip a quoted value which may hold commas */
+		while (p < end && *p != ',') {
+			if (*p++ == '"') {
+				while (p < end && *p != '"')
+					p++;
+				if (p < end)
+					p++;
+			}
+		}
+	}
+
+	return (-1);
+}
+
+/* parse an IMF-fixdate, "Sun, 06 Nov 1994 08:49:37 GMT"
+ * return seconds since the epoch or -1 if malformed
+ */
+long long plm_http_date_parse(const plm_string_t *v)
+{
+	static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+	const char *p = v->s_str;
+	int i, d, m, y, hh, mm, ss;
+	long long days;
+
+	if (v->s_len != 29 || p[3] != ',' || p[25] != ' ')
+		return (-1);
+
+	for (i = 0; i < 29; i++) {
+		if (i == 5 || i == 6 || (i >= 12 && i <= 15) || i == 17 || i == 18
+			|| i == 20 || i == 21 || i == 23 || i == 24) {
+			if (p[i] < '0' || p[i] > '9')
+				return (-1);
+		}
+	}
+
+	for (m = 0; m < 12; m++) {
+		if (!strncmp(p + 8, months + m * 3, 3))
+			break;
+	}
+	if (m == 12)
+		return (-1);
+
+	d = (p[5] - '0') * 10 + p[6] - '0';
+	y = (p[12] - '0') * 1000 + (p[13] - '0') * 100 + (p[14] - '0') * 10
+		+ p[15] - '0';
+	hh = (p[17] - '0') * 10 + p[18] - '0';
+	mm = (p[20] - '0') * 10 + p[21] - '0';
+	ss = (p[23] - '0') * 10 + p[24] - '0';
+
+	/* days from 1970-01-01 of the civil date, March based years */
+	m += 1;
+	if (m <= 2)
+		y--;
+	days = 365LL * y + y / 4 - y / 100 + y / 400
+		+ (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1 - 719468;
+	return (days * 86400 + hh * 3600 + mm * 60 + ss);
+}
+
+/* seconds the response stays fresh counted from when it was sent,
+ * from s-maxage, max-age or Expires
+ * return the seconds, or -1 if the response must not be stored
+ */
+long long plm_http_cache_lifetime(struct plm_http_resp *resp)
+{
+	const plm_string_t *v;
+	long long n, date;
+
+	switch (resp->hr_status) {
+	case 200:
+	case 203:
+	case 204:
+	case 301:
+	case 404:
+	case 410:
+		break;
+	default:
+		return (-1);
+	}
+
+	/* variants and per user responses are not kept by a shared cache */
+	if (plm_http_hdrs_has(&resp->hr_hdrs, PLM_HDR_VARY)
+		|| plm_http_hdrs_has(&resp->hr_hdrs, PLM_HDR_SET_COOKIE))
+		return (-1);
+
+	v = plm_http_hdrs_get(&resp->hr_hdrs, PLM_HDR_CACHE_CONTROL);
+	if (v) {
+		if (plm_http_cc_get(v, "no-store", 8) >= 0
+			|| plm_http_cc_get(v, "no-cache", 8) >= 0
+			|| plm_http_cc_get(v, "private", 7) >= 0)
+			return (-1);
+
+		if ((n = plm_http_cc_get(v, "s-maxage", 8)) >= 0
+			|| (n = plm_http_cc_get(v, "max-age", 7)) >= 0)
+			return (n);
+	}
+
+	v = plm_http_hdrs_get(&resp->hr_hdrs, PLM_HDR_EXPIRES);
+	if (!v)
+		return (-1);
+
+	n = plm_http_date_parse(v);
+	if (n < 0)
+		return (-1);
+
+	v = plm_http_hdrs_get(&resp->hr_hdrs, PLM_HDR_DATE);
+	date = v ? plm_http_date_parse(v) : -1;
+	if (date < 0)
+		date = plm_clock_real_ms() / 1000;
+
+	return (n > date ? n - date : -1);
+}
+
+/* the request may be served from and stored in the cache */
+int plm_http_cache_req_ok(struct plm_http_req *r)
+{
+	const plm_string_t *v;
+
+	if (r->hr_mthd != PLM_MTHD_GET && r->hr_mthd != PLM_MTHD_HEAD)
+		return (0);
+
+	if (r->hr_cntlen > 0 || r->hr_flags.hr_te
+		|| plm_http_hdrs_has(&r->hr_hdrs, PLM_HDR_AUTHORIZATION))
+		return (0);
+
+	v = plm_http_hdrs_get(&r->hr_hdrs, PLM_HDR_CACHE_CONTROL);
+	return (!v || plm_http_cc_get(v, "no-store", 8) < 0);
+}
+
+/* release a reference, the last one frees the entry */
+void plm_http_cache_unref(void *data)
+{
+	struct plm_http_centry *e;
+	struct plm_http_cbuf *b;
+
+	e = (struct plm_http_centry *)data;
+	if (plm_atomic_int_dec(&e->ce_ref) > 0)
+		return;
+
+	while (e->ce_body) {
+		b = e->ce_body;
+		e->ce_body = b->cb_next;
+		free(b);
+	}
+
+	free(e);
+}
+
+/* take the entry out of the shard and drop the reference of the cache,
+ * the shard is locked
+ */
+void plm_http_cache_unlink(struct plm_http_cache_shard *cs,
+						   struct plm_http_centry *e)
+{
+	PLM_DLIST_REMOVE(&cs->cs_lists[e->ce_list], &e->ce_node);
+	cs->cs_bytes[e->ce_list] -= e->ce_size;
+	e->ce_list = -1;
+	plm_oahash_delete(&cs->cs_index, e->ce_key, e->ce_klen);
+	plm_http_cache_unref(e);
+}
+
+/* an entry is hit, it goes to the front of the protected list, the
+ * protected ones beyond its share are put back on probation
+ */
+void plm_http_cache_touch(struct plm_http_cache_shard *cs,
+						  struct plm_http_centry *e)
+{
+	plm_dlist_t *prot = &cs->cs_lists[PLM_CACHE_PROTECTED];
+	plm_dlist_t *prob = &cs->cs_lists[PLM_CACHE_PROBATION];
+	struct plm_http_centry *old;
+
+	PLM_DLIST_REMOVE(&cs->cs_lists[e->ce_list], &e->ce_node);
+	cs->cs_bytes[e->ce_list] -= e->ce_size;
+	e->ce_list = PLM_CACHE_PROTECTED;
+	PLM_DLIST_ADD_FRONT(prot, &e->ce_node);
+	cs->cs_bytes[PLM_CACHE_PROTECTED] += e->ce_size;
+
+	while (cs->cs_bytes[PLM_CACHE_PROTECTED] > cache_protected_max
+		   && PLM_DLIST_LEN(prot) > 1) {
+		old = plm_http_centry_of(PLM_DLIST_TAIL(prot));
+		PLM_DLIST_DEL_BACK(prot);
+		cs->cs_bytes[PLM_CACHE_PROTECTED] -= old->ce_size;
+		old->ce_list = PLM_CACHE_PROBATION;
+		PLM_DLIST_ADD_FRONT(prob, &old->ce_node);
+		cs->cs_bytes[PLM_CACHE_PROBATION] += old->ce_size;
+	}
+}
+
+/* evict from the tail of probation, then of protected, until the shard
+ * is within its budget, the shard is locked
+ * @cs -- the shard
+ * @victims -- output the evicted entries, each with a reference, they
+ *             are written to disk once the shard is unlocked
+ */
+void plm_http_cache_evict(struct plm_http_cache_shard *cs,
+						  struct plm_http_centry **victims)
+{
+	plm_dlist_t *l;
+	struct plm_http_centry *e;
+
+	while (cs->cs_bytes[PLM_CACHE_PROBATION]
+		   + cs->cs_bytes[PLM_CACHE_PROTECTED] > cache_shard_max) {
+		l = &cs->cs_lists[PLM_CACHE_PROBATION];
+		if (PLM_DLIST_LEN(l) == 0)
+			l = &cs->cs_lists[PLM_CACHE_PROTECTED];
+
+		e = plm_http_centry_of(PLM_DLIST_TAIL(l));
+		plm_atomic_int_inc(&e->ce_ref);
+		plm_http_cache_unlink(cs, e);
+		e->ce_next = *victims;
+		*victims = e;
+	}
+}
+
+/* queue an entry evicted from memory to the disk tier if it is fresh,
+ * the reference of the caller is dropped once it is written
+ */
+void plm_http_cache_demote(struct plm_http_centry *e)
+{
+	int i, n;
+	uint64_t now;
+	struct plm_http_cbuf *b;
+	struct plm_http_demote *dm;
+	struct iovec *iov;
+
+	now = plm_clock_mono_ms();
+	if (e->ce_expire <= now + 1000) {
+		plm_http_cache_unref(e);
+		return;
+	}
+
+	for (n = 0, b = e->ce_body; b; b = b->cb_next)
+		n++;
+
+	dm = (struct plm_http_demote *)malloc(sizeof(*dm) + n * sizeof(*iov));
+	if (!dm) {
+		plm_http_cache_unref(e);
+		return;
+	}
+
+	iov = (struct iovec *)(dm + 1);
+	for (i = 0, b = e->ce_body; b; b = b->cb_next, i++) {
+		iov[i].iov_base = b->cb_data;
+		iov[i].iov_len = b->cb_len;
+	}
+
+	dm->dm_entry = e;
+	dm->dm_job.dj_key = e->ce_key;
+	dm->dm_job.dj_klen = e->ce_klen;
+	dm->dm_job.dj_head = e->ce_head;
+	dm->dm_job.dj_hlen = e->ce_hlen;
+	dm->dm_job.dj_body = iov;
+	dm->dm_job.dj_n = n;
+	dm->dm_job.dj_expire = plm_clock_real_ms() / 1000
+		+ (e->ce_expire - now) / 1000;
+	dm->dm_job.dj_born = e->ce_stored / 1000 - e->ce_age;
+	dm->dm_job.dj_done = plm_http_cache_demoted;
+	plm_http_disk_post(&dm->dm_job);
+}
+
+/* the entry is written to the disk tier or dropped, on the writer
+ * thread of the tier
+ */
+void plm_http_cache_demoted(struct plm_http_disk_job *j)
+{
+	struct plm_http_demote *dm;
+
+	dm = (struct plm_http_demote *)j;
+	plm_http_cache_unref(dm->dm_entry);
+	free(dm);
+}
+
+/* queue a segment of a hit, the data belongs to the entry */
+void plm_http_cache_seg(struct plm_http_req *r, struct plm_http_seg *s,
+						char *buf, size_t len)
+{
+	s->hs_buf = buf;
+	s->hs_len = len;
+	s->hs_off = 0;
+	s->hs_cap = 0;
+	s->hs_type = MEM_END;
+	plm_http_wrevt_append(plm_http_req_out(r), s);
+}
+
+/* queue the stored header of a hit followed by Age and Connection
+ * @r -- the request
+ * @head -- the stored header
+ * @hlen -- length of head
+ * @age -- seconds since the response was generated
+ * @n -- segments to allocate behind for the body
+ * return the last segment queued, the n ones for the body follow it,
+ *        or NULL if out of memory
+ */
+struct plm_http_seg *
+plm_http_cache_head(struct plm_http_req *r, char *head, size_t hlen,
+					uint64_t age, size_t n)
+{
+	static const char kpalv[] = "Connection: keep-alive\r\n\r\n";
+	static const char close[] = "Connection: close\r\n\r\n";
+	struct plm_http_conn *c;
+	struct plm_http_seg *s;
+	size_t len;
+	char *p;
+
+	/* all are allocated before any is queued */
+	c = r->hr_conn;
+	s = (struct plm_http_seg *)
+		plm_mempool_alloc(&c->hc_pool,
+						  (n + 2) * sizeof(*s) + PLM_HTTP_AGE_MAX);
+	if (!s)
+		return (NULL);
+
+	p = (char *)(s + n + 2);
+	len = snprintf(p, PLM_HTTP_AGE_MAX, "Age: %llu\r\n%s",
+				   (unsigned long long)age,
+				   r->hr_flags.hr_keepalive ? kpalv : close);
+
+	plm_http_cache_seg(r, s, head, hlen);
+	plm_http_cache_seg(r, s + 1, p, len);
+	return (s + 1);
+}
+
+/* a memory miss, queue the response from the disk tier
+ * @r -- the request, done on success
+ * @key -- the key of the request
+ * @klen -- length of key
+ * return 0 on a hit, else -1
+ */
+int plm_http_cache_serve_disk(struct plm_http_req *r, const char *key,
+							  size_t klen)
+{
+	struct plm_http_disk_obj o;
+	struct plm_http_seg *s;
+	char *buf;
+
+	if (plm_http_disk_lookup(key, klen, r->hr_conn->hc_fd, &o))
+		return (-1);
+
+	buf = (char *)plm_mempool_alloc(&r->hr_conn->hc_pool,
+									o.do_klen + o.do_hlen);
+	if (!buf || plm_http_disk_read_head(&o, key, buf)) {
+		plm_http_disk_release(o.do_pin);
+		return (-1);
+	}
+
+	s = plm_http_cache_head(r, buf + o.do_klen, o.do_hlen,
+							plm_clock_real_ms() / 1000 - o.do_born,
+							o.do_blen > 0);
+	if (!s || o.do_blen == 0) {
+		plm_http_disk_release(o.do_pin);
+		if (!s)
+			return (-1);
+	}
+
+	/* the body goes from the file with sendfile, the segment keeps the
+	 * record pinned until it is released
+	 */
+	if (o.do_blen > 0) {
+		s++;
+		s->hs_buf = NULL;
+		s->hs_len = o.do_blen;
+		s->hs_off = 0;
+		s->hs_cap = 0;
+		s->hs_type = PLM_HTTP_SEG_FILE;
+		s->hs_unref = plm_http_disk_release;
+		s->hs_ref = o.do_pin;
+		s->hs_fd = o.do_fd;
+		s->hs_foff = o.do_off + o.do_klen + o.do_hlen;
+		plm_http_wrevt_append(plm_http_req_out(r), s);
+	}
+
+	PLM_TRACE("disk cache hit: %.*s", (int)klen, key);
+	r->hr_flags.hr_head_sent = 1;
+	plm_http_req_done(r);
+	return (0);
+}
+
+/* queue the stored response of the request to the client, a miss of a
+ * key being fetched waits for that fetch, other misses lead a fetch
+ * @r -- the request, done on success
+ * return 0 on a hit, 1 if it waits, -1 if the response has to come
+ *        from the backend
+ */
+int plm_http_cache_serve(struct plm_http_req *r)
+{
+	struct plm_http_conn *c;
+	struct plm_http_cache_shard *cs;
+	struct plm_oahash_entry *oe;
+	struct plm_http_centry *e;
+	struct plm_http_cbuf *b;
+	struct plm_http_seg *s;
+	const plm_string_t *v;
+	uint64_t age;
+	size_t klen, n;
+	uint32_t hash;
+	char *key;
+	int rc;
+
+	c = r->hr_conn;
+	if (!cache_shards || !plm_http_cache_req_ok(r))
+		return (-1);
+
+	/* the client asks for a response validated by the backend */
+	v = plm_http_hdrs_get(&r->hr_hdrs, PLM_HDR_CACHE_CONTROL);
+	if (v && plm_http_cc_get(v, "no-cache", 8) >= 0)
+		return (-1);
+	v = plm_http_hdrs_get(&r->hr_hdrs, PLM_HDR_PRAGMA);
+	if (v && plm_http_hdr_has_token(v, "no-cache", 8))
+		return (-1);
+
+	/* partial and conditional responses are left to the backend */
+	if (plm_http_hdrs_has(&r->hr_hdrs, PLM_HDR_RANGE)
+		|| plm_http_hdrs_has(&r->hr_hdrs, PLM_HDR_IF_NONE_MATCH)
+		|| plm_http_hdrs_has(&r->hr_hdrs, PLM_HDR_IF_MODIFIED_SINCE))
+		return (-1);
+
+	klen = plm_http_cache_key(r, NULL);
+	key = (char *)plm_mempool_alloc(&c->hc_pool, klen);
+	if (!key)
+		return (-1);
+
+	plm_http_cache_key(r, key);
+	hash = plm_http_cache_hash(key, klen);
+	cs = &cache_shards[hash % PLM_HTTP_CACHE_SHARDS];
+
+	plm_lock_lock(&cs->cs_lock);
+	oe = plm_oahash_find(&cs->cs_index, key, klen);
+	e = oe ? (struct plm_http_centry *)oe->oe_value : NULL;
+	if (e && e->ce_expire <= plm_clock_mono_ms()) {
+		plm_http_cache_unlink(cs, e);
+		e = NULL;
+	}
+
+	if (e) {
+		plm_http_cache_touch(cs, e);
+		plm_atomic_int_inc(&e->ce_ref);
+	} else if (cache_coalesce
+			   && (oe = plm_oahash_find(&cs->cs_flights, key, klen))) {
+		rc = plm_http_cache_wait(r, (struct plm_http_flight *)oe->oe_value);
+		plm_lock_unlock(&cs->cs_lock);
+		return (rc);
+	}
+	plm_lock_unlock(&cs->cs_lock);
+
+	if (!e) {
+		if (!plm_http_cache_serve_disk(r, key, klen))
+			return (0);
+		return (plm_http_cache_lead(r, cs, key, klen));
+	}
+
+	/* the segments point into the entry and the last one holds the
+	 * reference
+	 */
+	for (n = 0, b = e->ce_body; b; b = b->cb_next)
+		n++;
+
+	age = e->ce_age + (plm_clock_real_ms() - e->ce_stored) / 1000;
+	s = plm_http_cache_head(r, e->ce_head, e->ce_hlen, age, n);
+	if (!s) {
+		plm_http_cache_unref(e);
+		return (-1);
+	}
+
+	for (b = e->ce_body; b; b = b->cb_next)
+		plm_http_cache_seg(r, ++s, b->cb_data, b->cb_len);
+
+	s->hs_type = PLM_HTTP_SEG_REF;
+	s->hs_unref = plm_http_cache_unref;
+	s->hs_ref = e;
+
+	PLM_TRACE("cache hit: %.*s", (int)klen, key);
+	r->hr_flags.hr_head_sent = 1;
+	plm_http_req_done(r);
+	return (0);
+}
+
+/* start storing a response from the backend, the requests waiting on
+ * the fetch led by r are fed from the entry, or go to the backend if
+ * the response is not stored
+ * @r -- the request
+ * @resp -- the parsed response header
+ * @len -- length of the body, PLM_HTTP_UNTIL_EOF if unknown
+ * return the entry to fill or NULL if the response is not stored
+ */
+struct plm_http_centry *
+plm_http_cache_fill_start(struct plm_http_req *r, struct plm_http_resp *resp,
+						  uint64_t len)
+{
+	struct plm_http_centry *e;
+	struct plm_http_flight *fl;
+	struct plm_http_cache_shard *cs;
+
+	e = plm_http_cache_entry(r, resp, len);
+	fl = r->hr_flight;
+	if (!fl)
+		return (e);
+
+	r->hr_flight = NULL;
+	cs = fl->fl_shard;
+	plm_lock_lock(&cs->cs_lock);
+	if (e) {
+		/* the flight holds the entry for the waiters and the entry
+		 * holds the flight until it is filled
+		 */
+		plm_atomic_int_inc(&e->ce_ref);
+		fl->fl_entry = e;
+		fl->fl_state = PLM_FLIGHT_FILL;
+		fl->fl_ref++;
+		e->ce_flight = fl;
+		plm_http_cache_post(fl);
+	} else {
+		plm_http_cache_resolve(fl, PLM_FLIGHT_FAIL);
+	}
+	plm_lock_unlock(&cs->cs_lock);
+	return (e);
+}
+
+/* build an entry of a response
+ * return the entry or NULL if the response is not stored
+ */
+struct plm_http_centry *
+plm_http_cache_entry(struct plm_http_req *r, struct plm_http_resp *resp,
+					 uint64_t len)
+{
+	struct plm_http_centry *e;
+	const plm_string_t *v;
+	plm_string_t age;
+	long long life, n;
+	size_t klen, hlen;
+	char *p;
+
+	if (!cache_shards || len > cache_obj_max || !plm_http_cache_req_ok(r))
+		return (NULL);
+
+	life = plm_http_cache_lifetime(resp);
+	v = plm_http_hdrs_get(&resp->hr_hdrs, PLM_HDR_AGE);
+	n = v ? plm_str2ll(v) : 0;
+	if (n < 0)
+		n = 0;
+	if (life <= n)
+		return (NULL);
+
+	/* Age is added when the entry is served, so it is left out */
+	age = resp->hr_hdrs.hh_known[PLM_HDR_AGE];
+	resp->hr_hdrs.hh_known[PLM_HDR_AGE].s_str = NULL;
+
+	/* "HTTP/1.1 200 " desc "\r\n" fields */
+	klen = plm_http_cache_key(r, NULL);
+	hlen = 13 + resp->hr_desc.s_len + 2 + plm_http_hdrs_size(&resp->hr_hdrs);
+	if (sizeof(*e) + klen + hlen + len > cache_shard_max
+		|| !(e = (struct plm_http_centry *)malloc(sizeof(*e) + klen + hlen))) {
+		resp->hr_hdrs.hh_known[PLM_HDR_AGE] = age;
+		return (NULL);
+	}
+
+	memset(e, 0, sizeof(*e));
+	e->ce_list = -1;
+	e->ce_ref = 1;
+	e->ce_key = (char *)(e + 1);
+	e->ce_klen = klen;
+	plm_http_cache_key(r, e->ce_key);
+	e->ce_hash = plm_http_cache_hash(e->ce_key, klen);
+
+	p = e->ce_head = e->ce_key + klen;
+	memcpy(p, "HTTP/1.1 ", 9);
+	p[9] = '0' + resp->hr_status / 100;
+	p[10] = '0' + resp->hr_status / 10 % 10;
+	p[11] = '0' + resp->hr_status % 10;
+	p[12] = ' ';
+	p += 13;
+	memcpy(p, resp->hr_desc.s_str, resp->hr_desc.s_len);
+	p += resp->hr_desc.s_len;
+	*p++ = '\r';
+	*p++ = '\n';
+	p = plm_http_hdrs_write(&resp->hr_hdrs, p);
+	e->ce_hlen = p - e->ce_head;
+	resp->hr_hdrs.hh_known[PLM_HDR_AGE] = age;
+
+	e->ce_stored = plm_clock_real_ms();
+	e->ce_age = n;
+	e->ce_expire = plm_clock_mono_ms() + (life - n) * 1000;
+	e->ce_body_len = len;
+	e->ce_size = sizeof(*e) + klen + hlen;
+	return (e);
+}
+
+/* append body bytes to an entry being filled
+ * return 0 on success, -1 if out of memory
+ */
+int plm_http_cache_fill(struct plm_http_centry *e, const char *buf, size_t n)
+{
+	struct plm_http_cbuf *b;
+	size_t room, want;
+
+	while (n > 0) {
+		b = e->ce_tail;
+		room = 0;
+		if (b) {
+			room = PLM_HTTP_CACHE_CHUNK - b->cb_len;
+			if (room > e->ce_body_len - e->ce_filled)
+				room = e->ce_body_len - e->ce_filled;
+		}
+
+		if (room == 0) {
+			/* more than the length, the entry is dropped at the end */
+			if (e->ce_filled >= e->ce_body_len)
+				return (-1);
+
+			want = e->ce_body_len - e->ce_filled;
+			if (want > PLM_HTTP_CACHE_CHUNK)
+				want = PLM_HTTP_CACHE_CHUNK;
+
+			b = (struct plm_http_cbuf *)malloc(sizeof(*b) + want);
+			if (!b)
+				return (-1);
+
+			b->cb_next = NULL;
+			b->cb_len = 0;
+			if (e->ce_tail)
+				e->ce_tail->cb_next = b;
+			else
+				e->ce_body = b;
+			e->ce_tail = b;
+			e->ce_size += sizeof(*b) + want;
+			room = want;
+		}
+
+		if (room > n)
+			room = n;
+
+		memcpy(b->cb_data + b->cb_len, buf, room);
+		b->cb_len += room;
+		e->ce_filled += room;
+		buf += room;
+		n -= room;
+	}
+
+	/* the bytes are published to the waiters with the lock */
+	if (e->ce_flight) {
+		plm_lock_lock(&e->ce_flight->fl_shard->cs_lock);
+		e->ce_flight->fl_filled = e->ce_filled;
+		plm_http_cache_post(e->ce_flight);
+		plm_lock_unlock(&e->ce_flight->fl_shard->cs_lock);
+	}
+
+	return (0);
+}
+
+/* store the entry if the whole body is filled, else drop it */
+void plm_http_cache_fill_end(struct plm_http_centry *e)
+{
+	struct plm_http_cache_shard *cs;
+	struct plm_oahash_entry *oe;
+	struct plm_http_centry *victims = NULL;
+
+	cs = &cache_shards[e->ce_hash % PLM_HTTP_CACHE_SHARDS];
+	if (e->ce_filled != e->ce_body_len) {
+		if (e->ce_flight) {
+			plm_lock_lock(&cs->cs_lock);
+			plm_http_cache_land(e, PLM_FLIGHT_FAIL);
+			plm_lock_unlock(&cs->cs_lock);
+		}
+		plm_http_cache_unref(e);
+		return;
+	}
+
+	plm_lock_lock(&cs->cs_lock);
+
+	/* the waiters are fed the whole body even if it is not kept, the
+	 * later misses find the entry once the flight is gone
+	 */
+	plm_http_cache_land(e, PLM_FLIGHT_DONE);
+
+	/* a newer response of the same key replaces the old one */
+	oe = plm_oahash_find(&cs->cs_index, e->ce_key, e->ce_klen);
+	if (oe)
+		plm_http_cache_unlink(cs, (struct plm_http_centry *)oe->oe_value);
+
+	if (!plm_oahash_insert(&cs->cs_index, e->ce_key, e->ce_klen, e)) {
+		plm_lock_unlock(&cs->cs_lock);
+		plm_http_cache_unref(e);
+		return;
+	}
+
+	e->ce_list = PLM_CACHE_PROBATION;
+	PLM_DLIST_ADD_FRONT(&cs->cs_lists[PLM_CACHE_PROBATION], &e->ce_node);
+	cs->cs_bytes[PLM_CACHE_PROBATION] += e->ce_size;
+	plm_http_cache_evict(cs, &victims);
+	plm_lock_unlock(&cs->cs_lock);
+
+	while (victims) {
+		e = victims;
+		victims = e->ce_next;
+		plm_http_cache_demote(e);
+	}
+}
+
+/* the request leaves the cache, the fetch it leads fails so that its
+ * waiters go to the backend themselves, or it stops waiting
+ * @r -- the request failed or closed
+ */
+void plm_http_cache_leave(struct plm_http_req *r)
+{
+	struct plm_http_flight *fl;
+	struct plm_http_waiter *w;
+	struct plm_http_cache_shard *cs;
+	struct plm_http_centry *e;
+	int posted;
+
+	fl = r->hr_flight;
+	if (fl) {
+		/* resolving may free the fetch */
+		r->hr_flight = NULL;
+		cs = fl->fl_shard;
+		plm_lock_lock(&cs->cs_lock);
+		plm_http_cache_resolve(fl, PLM_FLIGHT_FAIL);
+		plm_lock_unlock(&cs->cs_lock);
+	}
+
+	w = r->hr_wait;
+	if (!w)
+		return;
+
+	/* a queued task still refers to the waiter and frees it */
+	r->hr_wait = NULL;
+	cs = w->w_flight->fl_shard;
+	plm_lock_lock(&cs->cs_lock);
+	w->w_req = NULL;
+	e = w->w_entry;
+	w->w_entry = NULL;
+	posted = w->w_posted;
+	if (!posted)
+		plm_http_cache_detach(w);
+	plm_lock_unlock(&cs->cs_lock);
+
+	if (e)
+		plm_http_cache_unref(e);
+	if (!posted)
+		free(w);
+}
+
+/* a miss of the memory and the disk, lead the fetch of the key unless
+ * another request started one meanwhile
+ * @r -- the request
+ * @cs -- the shard of the key
+ * @key -- the key of the request
+ * @klen -- length of key
+ * return 1 if it waits, else -1 and the request goes to the backend
+ */
+int plm_http_cache_lead(struct plm_http_req *r,
+						struct plm_http_cache_shard *cs, const char *key,
+						size_t klen)
+{
+	struct plm_http_flight *fl;
+	struct plm_oahash_entry *oe;
+	int rc = -1;
+
+	if (!cache_coalesce)
+		return (-1);
+
+	plm_lock_lock(&cs->cs_lock);
+	oe = plm_oahash_find(&cs->cs_flights, key, klen);
+	if (oe) {
+		rc = plm_http_cache_wait(r, (struct plm_http_flight *)oe->oe_value);
+	} else {
+		fl = (struct plm_http_flight *)malloc(sizeof(*fl) + klen);
+		if (fl) {
+			memset(fl, 0, sizeof(*fl));
+			fl->fl_shard = cs;
+			fl->fl_ref = 1;
+			fl->fl_state = PLM_FLIGHT_WAIT;
+			fl->fl_key = (char *)(fl + 1);
+			fl->fl_klen = klen;
+			memcpy(fl->fl_key, key, klen);
+
+			if (plm_oahash_insert(&cs->cs_flights, fl->fl_key, klen, fl))
+				r->hr_flight = fl;
+			else
+				free(fl);
+		}
+	}
+	plm_lock_unlock(&cs->cs_lock);
+	return (rc);
+}
+
+/* wait on a fetch, the shard is locked
+ * @r -- the request
+ * @fl -- the fetch of its key
+ * return 1 if it waits, -1 if out of memory
+ */
+int plm_http_cache_wait(struct plm_http_req *r, struct plm_http_flight *fl)
+{
+	struct plm_http_waiter *w;
+
+	w = (struct plm_http_waiter *)calloc(1, sizeof(*w));
+	if (!w)
+		return (-1);
+
+	w->w_task.t_handler = plm_http_cache_wake;
+	w->w_task.t_data = w;
+	w->w_flight = fl;
+	w->w_req = r;
+	w->w_slot = plm_threads_curr();
+	w->w_next = fl->fl_waiters;
+	fl->fl_waiters = w;
+	fl->fl_ref++;
+	r->hr_wait = w;
+
+	/* the header is there already, it is queued from the task */
+	if (fl->fl_state != PLM_FLIGHT_WAIT) {
+		w->w_posted = 1;
+		plm_task_post(w->w_slot, &w->w_task);
+	}
+
+	PLM_TRACE("wait for the fetch: %.*s", (int)fl->fl_klen, fl->fl_key);
+	return (1);
+}
+
+/* wake the waiters of a fetch which are not woken yet, the shard is
+ * locked
+ */
+void plm_http_cache_post(struct plm_http_flight *fl)
+{
+	struct plm_http_waiter *w;
+
+	for (w = fl->fl_waiters; w; w = w->w_next) {
+		if (!w->w_posted) {
+			w->w_posted = 1;
+			plm_task_post(w->w_slot, &w->w_task);
+		}
+	}
+}
+
+/* the fetch is over, later misses don't find it, the shard is locked
+ * @fl -- the fetch
+ * @state -- PLM_FLIGHT_DONE or PLM_FLIGHT_FAIL
+ */
+void plm_http_cache_resolve(struct plm_http_flight *fl, int state)
+{
+	fl->fl_state = state;
+	plm_oahash_delete(&fl->fl_shard->cs_flights, fl->fl_key, fl->fl_klen);
+	plm_http_cache_post(fl);
+	plm_http_flight_unref(fl);
+}
+
+/* the entry is filled as far as it goes, the fetch it is filled by is
+ * over, the shard is locked
+ * @e -- the entry
+ * @state -- PLM_FLIGHT_DONE or PLM_FLIGHT_FAIL
+ */
+void plm_http_cache_land(struct plm_http_centry *e, int state)
+{
+	struct plm_http_flight *fl;
+
+	fl = e->ce_flight;
+	if (!fl)
+		return;
+
+	e->ce_flight = NULL;
+	fl->fl_filled = e->ce_filled;
+	plm_http_cache_resolve(fl, state);
+	plm_http_flight_unref(fl);
+}
+
+/* drop a reference of a fetch, the shard is locked */
+void plm_http_flight_unref(struct plm_http_flight *fl)
+{
+	if (--fl->fl_ref > 0)
+		return;
+
+	if (fl->fl_entry)
+		plm_http_cache_unref(fl->fl_entry);
+	free(fl);
+}
+
+/* take a waiter off its fetch, the shard is locked */
+void plm_http_cache_detach(struct plm_http_waiter *w)
+{
+	struct plm_http_waiter **p;
+
+	for (p = &w->w_flight->fl_waiters; *p; p = &(*p)->w_next) {
+		if (*p == w) {
+			*p = w->w_next;
+			plm_http_flight_unref(w->w_flight);
+			break;
+		}
+	}
+}
+
+/* task of a waiter on the thread of its request, queue what the fetch
+ * has to the client, or send the request to the backend if the fetch
+ * failed before any of it was queued
+ */
+void plm_http_cache_wake(void *data)
+{
+	struct plm_http_waiter *w;
+	struct plm_http_cache_shard *cs;
+	struct plm_http_req *r;
+	uint64_t filled;
+	int state;
+
+	w = (struct plm_http_waiter *)data;
+	cs = w->w_flight->fl_shard;
+
+	plm_lock_lock(&cs->cs_lock);
+	w->w_posted = 0;
+	r = w->w_req;
+	state = w->w_flight->fl_state;
+	filled = w->w_flight->fl_filled;
+	if (!r || state == PLM_FLIGHT_FAIL) {
+		plm_http_cache_detach(w);
+	} else if (state != PLM_FLIGHT_WAIT && !w->w_entry) {
+		w->w_entry = w->w_flight->fl_entry;
+		plm_atomic_int_inc(&w->w_entry->ce_ref);
+	}
+	plm_lock_unlock(&cs->cs_lock);
+
+	/* the request is gone */
+	if (!r) {
+		free(w);
+		return;
+	}
+
+	if (state == PLM_FLIGHT_WAIT)
+		return;
+
+	if (state == PLM_FLIGHT_FAIL) {
+		r->hr_wait = NULL;
+		if (!w->w_entry) {
+			free(w);
+			plm_http_req_fetch(r);
+			return;
+		}
+
+		/* the response is cut, the queued bytes refer to the entry */
+		plm_http_cache_unref(w->w_entry);
+		free(w);
+		plm_comm_close(r->hr_conn->hc_fd);
+		return;
+	}
+
+	if (plm_http_cache_feed(w, r, filled)) {
+		plm_http_cache_leave(r);
+		plm_comm_close(r->hr_conn->hc_fd);
+	}
+}
+
+/* queue the header and the body bytes filled to the client of a waiter
+ * @w -- the waiter, freed once the body is complete
+ * @r -- the request
+ * @filled -- body bytes in the entry
+ * return 0 on success, -1 if out of memory
+ */
+int plm_http_cache_feed(struct plm_http_waiter *w, struct plm_http_req *r,
+						uint64_t filled)
+{
+	struct plm_http_conn *c;
+	struct plm_http_cache_shard *cs;
+	struct plm_http_centry *e;
+	struct plm_http_seg *s = NULL;
+	uint64_t age;
+	size_t n;
+
+	c = r->hr_conn;
+	e = w->w_entry;
+	if (!r->hr_flags.hr_head_sent) {
+		age = e->ce_age + (plm_clock_real_ms() - e->ce_stored) / 1000;
+		s = plm_http_cache_head(r, e->ce_head, e->ce_hlen, age, 0);
+		if (!s)
+			return (-1);
+		r->hr_flags.hr_head_sent = 1;
+	}
+
+	/* the bytes up to filled are not written any more */
+	while (w->w_sent < filled) {
+		if (!w->w_buf) {
+			w->w_buf = e->ce_body;
+			w->w_off = 0;
+		} else if (w->w_off == PLM_HTTP_CACHE_CHUNK) {
+			w->w_buf = w->w_buf->cb_next;
+			w->w_off = 0;
+		}
+
+		n = PLM_HTTP_CACHE_CHUNK - w->w_off;
+		if (n > filled - w->w_sent)
+			n = filled - w->w_sent;
+
+		s = (struct plm_http_seg *)plm_mempool_alloc(&c->hc_pool, sizeof(*s));
+		if (!s)
+			return (-1);
+
+		plm_http_cache_seg(r, s, w->w_buf->cb_data + w->w_off, n);
+		w->w_off += n;
+		w->w_sent += n;
+	}
+
+	if (filled < e->ce_body_len) {
+		plm_http_req_flush(r);
+		return (0);
+	}
+
+	/* all was queued before, an empty segment holds the reference */
+	if (!s) {
+		s = (struct plm_http_seg *)plm_mempool_alloc(&c->hc_pool, sizeof(*s));
+		if (!s)
+			return (-1);
+		plm_http_cache_seg(r, s, NULL, 0);
+	}
+
+	/* the last segment holds the reference of the waiter, the flight
+	 * may be gone with the waiter
+	 */
+	cs = w->w_flight->fl_shard;
+	plm_lock_lock(&cs->cs_lock);
+	plm_http_cache_detach(w);
+	plm_lock_unlock(&cs->cs_lock);
+
+	s->hs_type = PLM_HTTP_SEG_REF;
+	s->hs_unref = plm_http_cache_unref;
+	s->hs_ref = e;
+	r->hr_wait = NULL;
+	free(w);
+
+	PLM_TRACE("fed from the fetch: %.*s", (int)e->ce_klen, e->ce_key);
+	plm_http_req_done(r);
+	return (0);
+}
+
+/* free a fetch left at exit with its waiters */
+void plm_http_flight_free(struct plm_oahash_entry *oe, void *data)
+{
+	struct plm_http_flight *fl;
+	struct plm_http_waiter *w;
+
+	fl = (struct plm_http_flight *)oe->oe_value;
+	while ((w = fl->fl_waiters) != NULL) {
+		fl->fl_waiters = w->w_next;
+		free(w);
+	}
+
+	if (fl->fl_entry)
+		plm_http_cache_unref(fl->fl_entry);
+	free(fl);
+}
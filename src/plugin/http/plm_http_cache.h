@@ -0,0 +1,103 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_HTTP_CACHE_H
+#define _PLM_HTTP_CACHE_H
+
+#include <stdint.h>
+
+#include "plm_http.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the cache is split in shards by the hash of the key, each with its
+ * own lock, index and lru, so threads rarely wait for each other
+ */
+#define PLM_HTTP_CACHE_SHARDS 16
+
+/* percent of a shard kept for entries hit more than once, the others
+ * are on probation and evicted first
+ */
+#define PLM_HTTP_CACHE_PROTECTED 80
+
+/* bytes of a body buffer at most */
+#define PLM_HTTP_CACHE_CHUNK (16 * 1024)
+
+/* a stored response, shared by the cache and the responses being
+ * written from it
+ */
+struct plm_http_centry;
+
+/* allocate the shards with the budget of ctx->hc_cache_size
+ * return 0 on success, else -1
+ */
+int plm_http_cache_init(struct plm_http_ctx *ctx);
+
+/* drop all entries, the ones still being written are released by
+ * the last response
+ */
+void plm_http_cache_destroy();
+
+/* queue the stored response of the request to the client, a miss of a
+ * key being fetched waits for that fetch, other misses lead a fetch
+ * @r -- the request, done on success
+ * return 0 on a hit, 1 if it waits, -1 if the response has to come
+ *        from the backend
+ */
+int plm_http_cache_serve(struct plm_http_req *r);
+
+/* start storing a response from the backend, the requests waiting on
+ * the fetch led by r are fed from the entry, or go to the backend if
+ * the response is not stored
+ * @r -- the request
+ * @resp -- the parsed response header
+ * @len -- length of the body, PLM_HTTP_UNTIL_EOF if unknown
+ * return the entry to fill or NULL if the response is not stored
+ */
+struct plm_http_centry *
+plm_http_cache_fill_start(struct plm_http_req *r, struct plm_http_resp *resp,
+						  uint64_t len);
+
+/* append body bytes to an entry being filled
+ * return 0 on success, -1 if out of memory
+ */
+int plm_http_cache_fill(struct plm_http_centry *e, const char *buf, size_t n);
+
+/* store the entry if the whole body is filled, else drop it */
+void plm_http_cache_fill_end(struct plm_http_centry *e);
+
+/* the request leaves the cache, the fetch it leads fails so that its
+ * waiters go to the backend themselves, or it stops waiting
+ * @r -- the request failed or closed
+ */
+void plm_http_cache_leave(struct plm_http_req *r);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,379 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include "plm_http_scan.h"
+#include "plm_http_chunked.h"
+
+enum plm_chunked_state {
+	/* the first hex digit of the chunk size and the others */
+	PLM_CHUNK_SIZE,
+	PLM_CHUNK_SIZE_MORE,
+
+	/* extensions are skipped until the end of line */
+	PLM_CHUNK_EXT,
+	PLM_CHUNK_SIZE_LF,
+	PLM_CHUNK_DATA,
+	PLM_CHUNK_DATA_CR,
+	PLM_CHUNK_DATA_LF,
+
+	/* the start of a trailer field or of the empty line */
+	PLM_CHUNK_TRAILER,
+	PLM_CHUNK_TRAILER_LINE,
+	PLM_CHUNK_TRAILER_LF,
+	PLM_CHUNK_END_LF,
+	PLM_CHUNK_DONE
+};
+
+/* "0\r\n\r\n", the shortest end of a body behind a chunk */
+#define PLM_CHUNK_LAST 5
+
+static int plm_http_chunked_hex(char c);
+static size_t plm_http_chunked_line(struct plm_http_chunked *, char *,
+									uint64_t);
+
+/* the last chunk and the trailer are decoded */
+int plm_http_chunked_done(const struct plm_http_chunked *k)
+{
+	return (k->hk_state == PLM_CHUNK_DONE);
+}
+
+int plm_http_chunked_hex(char c)
+{
+	if (c >= '0' && c <= '9')
+		return (c - '0');
+
+	c |= 0x20;
+	if (c >= 'a' && c <= 'f')
+		return (c - 'a' + 10);
+
+	return (-1);
+}
+
+/* decode coded bytes of a body
+ * @k -- the decoder
+ * @buf -- the bytes read
+ * @len -- length of buf
+ * return the bytes of buf in the body, less than len only if the body
+ *        ends in buf, or -1 if the coding is broken
+ */
+ssize_t plm_http_chunked_decode(struct plm_http_chunked *k, const char *buf,
+								size_t len)
+{
+	const char *p = buf, *end = buf + len;
+	uint64_t n;
+	int d;
+
+	/* the line ends are strict, a bare LF could split the message
+	 * differently in the backend
+	 */
+	while (p < end && k->hk_state != PLM_CHUNK_DONE) {
+		switch (k->hk_state) {
+		case PLM_CHUNK_SIZE:
+		case PLM_CHUNK_SIZE_MORE:
+			d = plm_http_chunked_hex(*p);
+			if (d >= 0) {
+				if (k->hk_size >> 59)
+					return (-1);
+				k->hk_size = k->hk_size << 4 | d;
+				k->hk_state = PLM_CHUNK_SIZE_MORE;
+			} else if (k->hk_state == PLM_CHUNK_SIZE) {
+				return (-1);
+			} else if (*p == '\r') {
+				k->hk_state = PLM_CHUNK_SIZE_LF;
+			} else if (*p == ';' || *p == ' ' || *p == '\t') {
+				k->hk_state = PLM_CHUNK_EXT;
+			} else {
+				return (-1);
+			}
+			p++;
+			break;
+
+		case PLM_CHUNK_EXT:
+			p = plm_http_scan(p, end, '\r', '\n');
+			if (p < end) {
+				if (*p++ != '\r')
+					return (-1);
+				k->hk_state = PLM_CHUNK_SIZE_LF;
+			}
+			break;
+
+		case PLM_CHUNK_SIZE_LF:
+			if (*p++ != '\n')
+				return (-1);
+			k->hk_state = k->hk_size ? PLM_CHUNK_DATA : PLM_CHUNK_TRAILER;
+			break;
+
+		case PLM_CHUNK_DATA:
+			n = end - p;
+			if (n > k->hk_size)
+				n = k->hk_size;
+			p += n;
+			k->hk_size -= n;
+			if (k->hk_size == 0)
+				k->hk_state = PLM_CHUNK_DATA_CR;
+			break;
+
+		case PLM_CHUNK_DATA_CR:
+			if (*p++ != '\r')
+				return (-1);
+			k->hk_state = PLM_CHUNK_DATA_LF;
+			break;
+
+		case PLM_CHUNK_DATA_LF:
+			if (*p++ != '\n')
+				return (-1);
+			k->hk_state = PLM_CHUNK_SIZE;
+			break;
+
+		case PLM_CHUNK_TRAILER:
+			if (*p == '\n')
+				return (-1);
+			if (*p == '\r') {
+				k->hk_state = PLM_CHUNK_END_LF;
+				p++;
+			} else {
+				k->hk_state = PLM_CHUNK_TRAILER_LINE;
+			}
+			break;
+
+		case PLM_CHUNK_TRAILER_LINE:
+			p = plm_http_scan(p, end, '\r', '\n');
+			if (p < end) {
+				if (*p++ != '\r')
+					return (-1);
+				k->hk_state = PLM_CHUNK_TRAILER_LF;
+			}
+			break;
+
+		case PLM_CHUNK_TRAILER_LF:
+			if (*p++ != '\n')
+				return (-1);
+			k->hk_state = PLM_CHUNK_TRAILER;
+			break;
+
+		case PLM_CHUNK_END_LF:
+			if (*p++ != '\n')
+				return (-1);
+			k->hk_state = PLM_CHUNK_DONE;
+			break;
+
+		default:
+			return (-1);
+		}
+	}
+
+	return (p - buf);
+}
+
+/* decode coded bytes of a body and keep only the data, for a client
+ * which can't take chunks
+ * @k -- the decoder
+ * @buf -- the bytes read, the data is moved to the front
+ * @len -- length of buf
+ * @data -- gets the data bytes at the front of buf
+ * return as plm_http_chunked_decode
+ */
+ssize_t plm_http_chunked_strip(struct plm_http_chunked *k, char *buf,
+							   size_t len, size_t *data)
+{
+	char *p = buf, *end = buf + len;
+	size_t out = 0;
+	uint64_t n;
+
+	/* the framing is decoded a byte at a time, it is short */
+	while (p < end && k->hk_state != PLM_CHUNK_DONE) {
+		if (k->hk_state != PLM_CHUNK_DATA) {
+			if (plm_http_chunked_decode(k, p, 1) != 1)
+				return (-1);
+			p++;
+			continue;
+		}
+
+		n = end - p;
+		if (n > k->hk_size)
+			n = k->hk_size;
+		memmove(buf + out, p, n);
+		out += n;
+		p += n;
+		k->hk_size -= n;
+		if (k->hk_size == 0)
+			k->hk_state = PLM_CHUNK_DATA_CR;
+	}
+
+	*data = out;
+	return (p - buf);
+}
+
+/* the fewest bytes the body can have behind the ones decoded, reading
+ * at most that many never takes the bytes of the next message
+ */
+uint64_t plm_http_chunked_rest(const struct plm_http_chunked *k)
+{
+	switch (k->hk_state) {
+	case PLM_CHUNK_SIZE:
+		return (PLM_CHUNK_LAST);
+
+	/* "\r\n" data "\r\n" and the last chunk, or the end of the last */
+	case PLM_CHUNK_SIZE_MORE:
+	case PLM_CHUNK_EXT:
+		return (k->hk_size ? 2 + k->hk_size + 2 + PLM_CHUNK_LAST : 4);
+
+	case PLM_CHUNK_SIZE_LF:
+		return (k->hk_size ? 1 + k->hk_size + 2 + PLM_CHUNK_LAST : 3);
+
+	case PLM_CHUNK_DATA:
+		return (k->hk_size + 2 + PLM_CHUNK_LAST);
+
+	case PLM_CHUNK_DATA_CR:
+		return (2 + PLM_CHUNK_LAST);
+
+	case PLM_CHUNK_DATA_LF:
+		return (1 + PLM_CHUNK_LAST);
+
+	case PLM_CHUNK_TRAILER:
+		return (2);
+
+	case PLM_CHUNK_TRAILER_LINE:
+		return (4);
+
+	case PLM_CHUNK_TRAILER_LF:
+		return (3);
+
+	case PLM_CHUNK_END_LF:
+		return (1);
+	}
+
+	return (0);
+}
+
+/* check if chunked is the last coding of a Transfer-Encoding value */
+int plm_http_chunked_last(const plm_string_t *v)
+{
+	const char *p = v->s_str, *end = v->s_str + v->s_len;
+
+	while (end > p && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == ','))
+		end--;
+
+	for (p = end; p > v->s_str && p[-1] != ','; p--)
+		/* none */ ;
+
+	while (p < end && (*p == ' ' || *p == '\t'))
+		p++;
+
+	return (end - p == 7 && !strncasecmp(p, "chunked", 7));
+}
+
+/* write the size line of a chunk, behind the end of the one before
+ * @k -- the encoder
+ * @end -- the line is written before it
+ * @n -- the size of the chunk
+ * return the length of the line
+ */
+size_t plm_http_chunked_line(struct plm_http_chunked *k, char *end,
+							 uint64_t n)
+{
+	static const char hex[] = "0123456789abcdef";
+	char *p = end;
+	uint64_t v = n;
+
+	*--p = '\n';
+	*--p = '\r';
+	do {
+		*--p = hex[v & 15];
+		v >>= 4;
+	} while (v);
+
+	if (k->hk_size > 0) {
+		*--p = '\n';
+		*--p = '\r';
+	}
+
+	k->hk_size += n;
+	return (end - p);
+}
+
+/* queue a segment of the body as one chunk
+ * @k -- the encoder
+ * @w -- the output
+ * @s -- the data from s->hs_off to s->hs_len, empty ones are freed
+ * @room -- nonzero if PLM_HTTP_CHUNKED_HEAD bytes before s->hs_off are
+ *          free for the size line, else it goes in a segment of its own
+ * return 0 on success, else -1 and s is freed
+ */
+int plm_http_chunked_append(struct plm_http_chunked *k,
+							struct plm_http_wrevt *w,
+							struct plm_http_seg *s, int room)
+{
+	struct plm_http_seg *h;
+	size_t n;
+
+	n = s->hs_len - s->hs_off;
+	if (n == 0) {
+		plm_http_seg_free(s);
+		return (0);
+	}
+
+	if (room) {
+		s->hs_off -= plm_http_chunked_line(k, s->hs_buf + s->hs_off, n);
+	} else {
+		h = plm_http_seg_alloc(PLM_HTTP_CHUNKED_HEAD);
+		if (!h) {
+			plm_http_seg_free(s);
+			return (-1);
+		}
+
+		h->hs_len = PLM_HTTP_CHUNKED_HEAD;
+		h->hs_off = h->hs_len
+			- plm_http_chunked_line(k, h->hs_buf + h->hs_len, n);
+		plm_http_wrevt_append(w, h);
+	}
+
+	plm_http_wrevt_append(w, s);
+	return (0);
+}
+
+/* queue the last chunk, the body has no trailer
+ * return 0 on success, else -1
+ */
+int plm_http_chunked_end(struct plm_http_chunked *k, struct plm_http_wrevt *w)
+{
+	static const char last[] = "\r\n0\r\n\r\n";
+	struct plm_http_seg *s;
+	size_t off;
+
+	s = plm_http_seg_alloc(sizeof(last) - 1);
+	if (!s)
+		return (-1);
+
+	/* no chunk to end before the last one if the body is empty */
+	off = k->hk_size > 0 ? 0 : 2;
+	memcpy(s->hs_buf, last + off, sizeof(last) - 1 - off);
+	s->hs_len = sizeof(last) - 1 - off;
+	plm_http_wrevt_append(w, s);
+	return (0);
+}
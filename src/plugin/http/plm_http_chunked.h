@@ -0,0 +1,110 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_HTTP_CHUNKED_H
+#define _PLM_HTTP_CHUNKED_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "plm_string.h"
+#include "plm_http_event_io.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the chunked transfer coding of a body, the decoder only finds where
+ * the chunks and the body end so the coded bytes are relayed as they
+ * arrive, the encoder frames a body of unknown length in place
+ */
+struct plm_http_chunked {
+	int hk_state;
+
+	/* data bytes left in the chunk being decoded, or the data bytes
+	 * framed so far by the encoder
+	 */
+	uint64_t hk_size;
+};
+
+/* bytes to leave in front of the data of a segment for the size line */
+#define PLM_HTTP_CHUNKED_HEAD 20
+
+#define plm_http_chunked_init(k) ((k)->hk_state = 0, (k)->hk_size = 0)
+
+/* the last chunk and the trailer are decoded */
+int plm_http_chunked_done(const struct plm_http_chunked *k);
+
+/* decode coded bytes of a body
+ * @k -- the decoder
+ * @buf -- the bytes read
+ * @len -- length of buf
+ * return the bytes of buf in the body, less than len only if the body
+ *        ends in buf, or -1 if the coding is broken
+ */
+ssize_t plm_http_chunked_decode(struct plm_http_chunked *k, const char *buf,
+								size_t len);
+
+/* decode coded bytes of a body and keep only the data, for a client
+ * which can't take chunks
+ * @k -- the decoder
+ * @buf -- the bytes read, the data is moved to the front
+ * @len -- length of buf
+ * @data -- gets the data bytes at the front of buf
+ * return as plm_http_chunked_decode
+ */
+ssize_t plm_http_chunked_strip(struct plm_http_chunked *k, char *buf,
+							   size_t len, size_t *data);
+
+/* the fewest bytes the body can have behind the ones decoded, reading
+ * at most that many never takes the bytes of the next message
+ */
+uint64_t plm_http_chunked_rest(const struct plm_http_chunked *k);
+
+/* check if chunked is the last coding of a Transfer-Encoding value */
+int plm_http_chunked_last(const plm_string_t *v);
+
+/* queue a segment of the body as one chunk
+ * @k -- the encoder
+ * @w -- the output
+ * @s -- the data from s->hs_off to s->hs_len, empty ones are freed
+ * @room -- nonzero if PLM_HTTP_CHUNKED_HEAD bytes before s->hs_off are
+ *          free for the size line, else it goes in a segment of its own
+ * return 0 on success, else -1 and s is freed
+ */
+int plm_http_chunked_append(struct plm_http_chunked *k,
+							struct plm_http_wrevt *w,
+							struct plm_http_seg *s, int room);
+
+/* queue the last chunk, the body has no trailer
+ * return 0 on success, else -1
+ */
+int plm_http_chunked_end(struct plm_http_chunked *k, struct plm_http_wrevt *w);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,665 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+
+#include "plm_comm.h"
+#include "plm_clock.h"
+#include "plm_log.h"
+#include "plm_sync_mech.h"
+#include "plm_dlist.h"
+#include "plm_timer.h"
+#include "plm_http_errlog.h"
+#include "plm_http_disk.h"
+
+#define PLM_HTTP_DISK_MAGIC 0x434d4c50
+#define PLM_HTTP_DISK_VERSION 1
+
+/* body buffers of one pwritev */
+#define PLM_HTTP_DISK_IOV 64
+
+/* the head of the index file */
+struct plm_http_disk_hdr {
+	uint32_t dh_magic;
+	uint32_t dh_version;
+	uint64_t dh_size;
+	uint64_t dh_slots;
+
+	/* log position of the next record, the file offset is it modulo
+	 * dh_size, a record at pos is intact while dh_head - pos <= dh_size
+	 */
+	uint64_t dh_head;
+};
+
+/* a slot of the index, empty if ds_hash is 0 */
+struct plm_http_disk_slot {
+	uint64_t ds_hash;
+	uint64_t ds_pos;
+	uint64_t ds_expire;
+	uint64_t ds_born;
+	uint64_t ds_blen;
+	uint32_t ds_klen;
+	uint32_t ds_hlen;
+};
+
+/* writes the responses posted, the data file is written out of the
+ * event loops
+ */
+struct plm_http_disk_writer {
+	pthread_t dw_thrd;
+	pthread_mutex_t dw_lock;
+	pthread_cond_t dw_cond;
+
+	/* the jobs in post order and their bytes, protected by dw_lock */
+	struct plm_http_disk_job *dw_head;
+	struct plm_http_disk_job *dw_tail;
+	uint64_t dw_bytes;
+
+	int dw_running;
+};
+
+static int disk_fd = -1;
+static struct plm_http_disk_hdr *disk_hdr;
+static struct plm_http_disk_slot *disk_slots;
+static size_t disk_map_len;
+static uint64_t disk_buckets;
+
+/* records this close to being overwritten are not served */
+static uint64_t disk_guard;
+
+/* a record a response is sent from, new records are placed around it */
+struct plm_http_disk_pin {
+	plm_dlist_node_t dp_node;
+	uint64_t dp_pos;
+	uint64_t dp_len;
+
+	/* the socket, a dup of it once released with bytes not acked */
+	int dp_fd;
+	uint64_t dp_release;
+};
+
+/* guards the index and the pins, the file is read and written without
+ * it
+ */
+static plm_lock_t disk_lock;
+static plm_dlist_t disk_pins;
+static struct plm_http_disk_writer disk_writer;
+
+static uint64_t plm_http_disk_hash(const char *s, size_t len);
+static int plm_http_disk_valid(struct plm_http_disk_slot *ds);
+static int plm_http_disk_place(uint64_t *pos, uint64_t total);
+static int plm_http_disk_unacked(int fd);
+static int plm_http_disk_drain(void *data);
+static void plm_http_disk_unpin(struct plm_http_disk_pin *p);
+static int plm_http_disk_writer_start();
+static void plm_http_disk_writer_stop();
+static void *plm_http_disk_writer_proc(void *arg);
+
+/* open or create the data file and its index
+ * @path -- the data file, the index is path.idx
+ * @size -- bytes of the data file
+ * return 0 on success, else -1
+ */
+int plm_http_disk_init(const char *path, uint64_t size)
+{
+	int fd;
+	char *ipath;
+	uint64_t slots;
+	struct stat st;
+	void *map;
+
+	disk_fd = plm_comm_open(PLM_COMM_FILE, path, O_RDWR | O_CREAT, 0644,
+							-1, NULL, 0, 0, 0);
+	if (disk_fd < 0) {
+		plm_log_syslog("can't open cache file %s: %s", path, strerror(errno));
+		return (-1);
+	}
+
+	/* the whole file is allocated up front so a write never fails for
+	 * the lack of space
+	 */
+	if (fstat(disk_fd, &st) || ((uint64_t)st.st_size != size
+								&& (ftruncate(disk_fd, size)
+									|| posix_fallocate(disk_fd, 0, size)))) {
+		plm_log_syslog("can't allocate cache file %s", path);
+		plm_http_disk_destroy();
+		return (-1);
+	}
+
+	slots = size / PLM_HTTP_DISK_AVG;
+	slots = (slots + PLM_HTTP_DISK_WAYS - 1) / PLM_HTTP_DISK_WAYS
+		* PLM_HTTP_DISK_WAYS;
+	if (slots < 64)
+		slots = 64;
+
+	ipath = (char *)malloc(strlen(path) + 5);
+	if (!ipath) {
+		plm_http_disk_destroy();
+		return (-1);
+	}
+
+	strcpy(ipath, path);
+	strcat(ipath, ".idx");
+	fd = plm_comm_open(PLM_COMM_FILE, ipath, O_RDWR | O_CREAT, 0644,
+					   -1, NULL, 0, 0, 0);
+	free(ipath);
+	if (fd < 0) {
+		plm_log_syslog("can't open cache index: %s", strerror(errno));
+		plm_http_disk_destroy();
+		return (-1);
+	}
+
+	disk_map_len = sizeof(*disk_hdr) + slots * sizeof(*disk_slots);
+	map = MAP_FAILED;
+	if (!fstat(fd, &st) && ((uint64_t)st.st_size == disk_map_len
+							|| !ftruncate(fd, disk_map_len)))
+		map = mmap(NULL, disk_map_len, PROT_READ | PROT_WRITE, MAP_SHARED,
+				   fd, 0);
+	plm_comm_close(fd);
+	if (map == MAP_FAILED) {
+		plm_log_syslog("can't map cache index: %s", strerror(errno));
+		plm_http_disk_destroy();
+		return (-1);
+	}
+
+	disk_hdr = (struct plm_http_disk_hdr *)map;
+	disk_slots = (struct plm_http_disk_slot *)(disk_hdr + 1);
+
+	/* the index of a previous run is kept if it is for this file */
+	if (disk_hdr->dh_magic != PLM_HTTP_DISK_MAGIC
+		|| disk_hdr->dh_version != PLM_HTTP_DISK_VERSION
+		|| disk_hdr->dh_size != size || disk_hdr->dh_slots != slots) {
+		memset(map, 0, disk_map_len);
+		disk_hdr->dh_magic = PLM_HTTP_DISK_MAGIC;
+		disk_hdr->dh_version = PLM_HTTP_DISK_VERSION;
+		disk_hdr->dh_size = size;
+		disk_hdr->dh_slots = slots;
+	}
+
+	disk_buckets = slots / PLM_HTTP_DISK_WAYS;
+	disk_guard = size / 8;
+	PLM_DLIST_INIT(&disk_pins);
+	plm_lock_init(&disk_lock);
+
+	if (plm_http_disk_writer_start()) {
+		plm_log_syslog("can't start cache writer thread");
+		plm_http_disk_destroy();
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* stop the writer thread after the queued responses are written,
+ * unmap the index and close the data file
+ */
+void plm_http_disk_destroy()
+{
+	plm_http_disk_writer_stop();
+
+	if (disk_hdr) {
+		munmap(disk_hdr, disk_map_len);
+		disk_hdr = NULL;
+		disk_slots = NULL;
+		plm_lock_destroy(&disk_lock);
+	}
+
+	if (disk_fd >= 0) {
+		plm_comm_close(disk_fd);
+		disk_fd = -1;
+	}
+}
+
+/* FNV-1a of 64 bits, 0 marks an empty slot */
+uint64_t plm_http_disk_hash(const char *s, size_t len)
+{
+	uint64_t h = 14695981039346656037ULL;
+
+	while (len-- > 0) {
+		h ^= (uint8_t)*s++;
+		h *= 1099511628211ULL;
+	}
+
+	return (h ? h : 1);
+}
+
+/* the record of the slot is not overwritten and out of the guard, the
+ * index is locked
+ */
+int plm_http_disk_valid(struct plm_http_disk_slot *ds)
+{
+	return (ds->ds_hash
+			&& disk_hdr->dh_head - ds->ds_pos + disk_guard <= disk_hdr->dh_size);
+}
+
+/* move the position of a new record of total bytes off the end of the
+ * file and past the pinned records, the index is locked
+ * @pos -- the log position, output the one to write at
+ * @total -- bytes of the record
+ * return 0 on success, -1 if the pins leave no room
+ */
+int plm_http_disk_place(uint64_t *pos, uint64_t total)
+{
+	uint64_t start, off, size;
+	plm_dlist_node_t *n;
+	struct plm_http_disk_pin *p;
+
+	size = disk_hdr->dh_size;
+	start = *pos;
+	for (;;) {
+		if (*pos % size + total > size)
+			*pos += size - *pos % size;
+		if (*pos - start >= size)
+			return (-1);
+
+		off = *pos % size;
+		for (n = PLM_DLIST_FRONT(&disk_pins); n; n = PLM_DLIST_NEXT(n)) {
+			p = (struct plm_http_disk_pin *)n;
+			if (p->dp_pos % size < off + total
+				&& p->dp_pos % size + p->dp_len > off)
+				break;
+		}
+
+		if (!n)
+			return (0);
+		*pos += p->dp_pos % size + p->dp_len - off;
+	}
+}
+
+/* find a fresh response, the record is pinned until it is released
+ * @key -- the key of the cache
+ * @klen -- length of key
+ * @fd -- the socket the response is sent to
+ * @o -- output the response
+ * return 0 if found, else -1
+ */
+int plm_http_disk_lookup(const char *key, size_t klen, int fd,
+						 struct plm_http_disk_obj *o)
+{
+	int i, rc = -1;
+	uint64_t hash, now;
+	struct plm_http_disk_slot *ds;
+	struct plm_http_disk_pin *p;
+
+	if (!disk_hdr)
+		return (-1);
+
+	p = (struct plm_http_disk_pin *)malloc(sizeof(*p));
+	if (!p)
+		return (-1);
+
+	hash = plm_http_disk_hash(key, klen);
+	now = plm_clock_real_ms() / 1000;
+	ds = &disk_slots[hash % disk_buckets * PLM_HTTP_DISK_WAYS];
+
+	plm_lock_lock(&disk_lock);
+	for (i = 0; i < PLM_HTTP_DISK_WAYS; i++, ds++) {
+		if (ds->ds_hash != hash || !plm_http_disk_valid(ds))
+			continue;
+
+		if (ds->ds_expire > now && ds->ds_klen == klen) {
+			o->do_fd = disk_fd;
+			o->do_off = ds->ds_pos % disk_hdr->dh_size;
+			o->do_klen = ds->ds_klen;
+			o->do_hlen = ds->ds_hlen;
+			o->do_blen = ds->ds_blen;
+			o->do_born = ds->ds_born;
+			o->do_pin = p;
+
+			p->dp_pos = ds->ds_pos;
+			p->dp_len = ds->ds_klen + ds->ds_hlen + ds->ds_blen;
+			p->dp_fd = fd;
+			PLM_DLIST_ADD_BACK(&disk_pins, &p->dp_node);
+			rc = 0;
+		}
+		break;
+	}
+	plm_lock_unlock(&disk_lock);
+
+	if (rc)
+		free(p);
+	return (rc);
+}
+
+/* release the record of a response found once nothing is sent from it,
+ * sendfile leaves its pages queued on the socket, the ring writes over
+ * it after the peer has acked them, called in the thread of the socket
+ * @pin -- do_pin of the response
+ */
+void plm_http_disk_release(void *pin)
+{
+	struct plm_http_disk_pin *p;
+
+	/* the dup keeps the socket to check after the connection closes */
+	p = (struct plm_http_disk_pin *)pin;
+	if (plm_http_disk_unacked(p->dp_fd)) {
+		p->dp_fd = dup(p->dp_fd);
+		p->dp_release = plm_clock_mono_ms();
+		if (p->dp_fd >= 0
+			&& plm_timer_add(plm_http_disk_drain, p, PLM_HTTP_DISK_DRAIN))
+			return;
+		if (p->dp_fd >= 0)
+			close(p->dp_fd);
+	}
+
+	plm_http_disk_unpin(p);
+}
+
+/* check a socket has bytes sent and not acked by the peer */
+int plm_http_disk_unacked(int fd)
+{
+	int n;
+
+	return (!ioctl(fd, SIOCOUTQ, &n) && n > 0);
+}
+
+/* the timer of a record released with bytes on the socket, it is given
+ * up after PLM_HTTP_DISK_DRAIN_MAX if the peer does not read
+ */
+int plm_http_disk_drain(void *data)
+{
+	struct plm_http_disk_pin *p;
+
+	p = (struct plm_http_disk_pin *)data;
+	if (plm_http_disk_unacked(p->dp_fd)
+		&& plm_clock_mono_ms() - p->dp_release < PLM_HTTP_DISK_DRAIN_MAX
+		&& plm_timer_add(plm_http_disk_drain, p, PLM_HTTP_DISK_DRAIN))
+		return (0);
+
+	close(p->dp_fd);
+	plm_http_disk_unpin(p);
+	return (0);
+}
+
+/* let the ring write over a record */
+void plm_http_disk_unpin(struct plm_http_disk_pin *p)
+{
+	plm_lock_lock(&disk_lock);
+	PLM_DLIST_REMOVE(&disk_pins, &p->dp_node);
+	plm_lock_unlock(&disk_lock);
+	free(p);
+}
+
+/* read the key and the header of a response found, a different key
+ * with the same hash is a miss
+ * @o -- the response
+ * @key -- the key looked up
+ * @buf -- room of do_klen + do_hlen bytes, the header is behind the key
+ * return 0 on success, else -1
+ */
+int plm_http_disk_read_head(struct plm_http_disk_obj *o, const char *key,
+							char *buf)
+{
+	ssize_t n;
+	size_t len;
+
+	len = o->do_klen + o->do_hlen;
+	n = pread(o->do_fd, buf, len, o->do_off);
+	if (n < 0 || (size_t)n != len) {
+		PLM_TRACE("read cache file failed: %s",
+				  n < 0 ? strerror(errno) : "short read");
+		return (-1);
+	}
+
+	return (memcmp(buf, key, o->do_klen) ? -1 : 0);
+}
+
+/* start the writer thread
+ * return 0 on success, else -1
+ */
+int plm_http_disk_writer_start()
+{
+	if (pthread_mutex_init(&disk_writer.dw_lock, NULL))
+		return (-1);
+
+	if (pthread_cond_init(&disk_writer.dw_cond, NULL)) {
+		pthread_mutex_destroy(&disk_writer.dw_lock);
+		return (-1);
+	}
+
+	disk_writer.dw_head = disk_writer.dw_tail = NULL;
+	disk_writer.dw_bytes = 0;
+	disk_writer.dw_running = 1;
+	if (pthread_create(&disk_writer.dw_thrd, NULL,
+					   plm_http_disk_writer_proc, NULL)) {
+		disk_writer.dw_running = 0;
+		pthread_cond_destroy(&disk_writer.dw_cond);
+		pthread_mutex_destroy(&disk_writer.dw_lock);
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* stop the writer thread once the queue is empty */
+void plm_http_disk_writer_stop()
+{
+	if (!disk_writer.dw_running)
+		return;
+
+	pthread_mutex_lock(&disk_writer.dw_lock);
+	disk_writer.dw_running = 0;
+	pthread_cond_signal(&disk_writer.dw_cond);
+	pthread_mutex_unlock(&disk_writer.dw_lock);
+
+	pthread_join(disk_writer.dw_thrd, NULL);
+	pthread_cond_destroy(&disk_writer.dw_cond);
+	pthread_mutex_destroy(&disk_writer.dw_lock);
+}
+
+void *plm_http_disk_writer_proc(void *arg)
+{
+	struct plm_http_disk_job *j;
+	uint64_t bytes;
+
+	pthread_mutex_lock(&disk_writer.dw_lock);
+	for (;;) {
+		j = disk_writer.dw_head;
+		if (!j) {
+			if (!disk_writer.dw_running)
+				break;
+			pthread_cond_wait(&disk_writer.dw_cond, &disk_writer.dw_lock);
+			continue;
+		}
+
+		disk_writer.dw_head = j->dj_next;
+		if (!disk_writer.dw_head)
+			disk_writer.dw_tail = NULL;
+		pthread_mutex_unlock(&disk_writer.dw_lock);
+
+		/* the clock is cached per thread */
+		plm_clock_update();
+		plm_http_disk_store(j->dj_key, j->dj_klen, j->dj_head, j->dj_hlen,
+							j->dj_body, j->dj_n, j->dj_expire, j->dj_born);
+
+		bytes = j->dj_bytes;
+		j->dj_done(j);
+
+		pthread_mutex_lock(&disk_writer.dw_lock);
+		disk_writer.dw_bytes -= bytes;
+	}
+	pthread_mutex_unlock(&disk_writer.dw_lock);
+
+	return (NULL);
+}
+
+/* queue a response to be stored by the writer thread, the event loop
+ * does not wait on the file
+ * @j -- the job, dj_done is called at once if the tier is off or the
+ *       queue is full
+ */
+void plm_http_disk_post(struct plm_http_disk_job *j)
+{
+	int i;
+
+	if (!disk_writer.dw_running) {
+		j->dj_done(j);
+		return;
+	}
+
+	j->dj_next = NULL;
+	j->dj_bytes = j->dj_klen + j->dj_hlen;
+	for (i = 0; i < j->dj_n; i++)
+		j->dj_bytes += j->dj_body[i].iov_len;
+
+	pthread_mutex_lock(&disk_writer.dw_lock);
+	if (disk_writer.dw_bytes + j->dj_bytes > PLM_HTTP_DISK_QUEUE_MAX) {
+		pthread_mutex_unlock(&disk_writer.dw_lock);
+		PLM_TRACE("cache writer queue is full, %.*s is dropped",
+				  (int)j->dj_klen, j->dj_key);
+		j->dj_done(j);
+		return;
+	}
+
+	if (disk_writer.dw_tail)
+		disk_writer.dw_tail->dj_next = j;
+	else
+		disk_writer.dw_head = j;
+	disk_writer.dw_tail = j;
+	disk_writer.dw_bytes += j->dj_bytes;
+	pthread_cond_signal(&disk_writer.dw_cond);
+	pthread_mutex_unlock(&disk_writer.dw_lock);
+}
+
+/* append a response to the data file and index it, an older response
+ * of the key is replaced, only the index is updated under the lock
+ * @key -- the key of the cache
+ * @klen -- length of key
+ * @head -- the stored header
+ * @hlen -- length of head
+ * @body -- the body buffers
+ * @n -- the number of body buffers
+ * @expire -- wall clock seconds the response is fresh until
+ * @born -- wall clock seconds the response was generated
+ * return 0 on success, else -1
+ */
+int plm_http_disk_store(const char *key, size_t klen, const char *head,
+						size_t hlen, const struct iovec *body, int n,
+						uint64_t expire, uint64_t born)
+{
+	int i, j, m;
+	uint64_t hash, pos, off, blen, total, size, now;
+	struct plm_http_disk_slot *ds, *same, *stale, *oldest;
+	struct iovec iov[2];
+	ssize_t nw;
+
+	if (!disk_hdr)
+		return (-1);
+
+	blen = 0;
+	for (i = 0; i < n; i++)
+		blen += body[i].iov_len;
+
+	/* records are 8 bytes aligned and never wrap around the end */
+	size = disk_hdr->dh_size;
+	total = (klen + hlen + blen + 7) & ~7ULL;
+	if (total > size - disk_guard)
+		return (-1);
+
+	/* a record a response is sent from is skipped, the ones before it
+	 * are given up as the head moves past
+	 */
+	plm_lock_lock(&disk_lock);
+	pos = disk_hdr->dh_head;
+	if (plm_http_disk_place(&pos, total)) {
+		plm_lock_unlock(&disk_lock);
+		return (-1);
+	}
+	disk_hdr->dh_head = pos + total;
+	plm_lock_unlock(&disk_lock);
+
+	/* the space is taken, nothing points to it until it is written */
+	off = pos % size;
+	iov[0].iov_base = (void *)key;
+	iov[0].iov_len = klen;
+	iov[1].iov_base = (void *)head;
+	iov[1].iov_len = hlen;
+	nw = pwritev(disk_fd, iov, 2, off);
+	if (nw < 0 || (size_t)nw != klen + hlen)
+		goto FAIL;
+
+	for (off += nw, i = 0; i < n; i += m, off += nw) {
+		m = n - i < PLM_HTTP_DISK_IOV ? n - i : PLM_HTTP_DISK_IOV;
+		for (total = 0, j = i; j < i + m; j++)
+			total += body[j].iov_len;
+
+		nw = pwritev(disk_fd, body + i, m, off);
+		if (nw < 0 || (uint64_t)nw != total)
+			goto FAIL;
+	}
+
+	hash = plm_http_disk_hash(key, klen);
+	now = plm_clock_real_ms() / 1000;
+	ds = &disk_slots[hash % disk_buckets * PLM_HTTP_DISK_WAYS];
+	same = stale = oldest = NULL;
+
+	/* the slot of the key, else an empty or stale one, else the one
+	 * overwritten first
+	 */
+	plm_lock_lock(&disk_lock);
+	for (i = 0; i < PLM_HTTP_DISK_WAYS; i++, ds++) {
+		if (ds->ds_hash == hash) {
+			same = ds;
+			break;
+		}
+
+		if (!stale && (!plm_http_disk_valid(ds) || ds->ds_expire <= now))
+			stale = ds;
+		if (!oldest || ds->ds_pos < oldest->ds_pos)
+			oldest = ds;
+	}
+
+	ds = same ? same : stale ? stale : oldest;
+
+	/* written around while it was written */
+	if (disk_hdr->dh_head - pos + disk_guard > size) {
+		plm_lock_unlock(&disk_lock);
+		return (-1);
+	}
+
+	ds->ds_hash = hash;
+	ds->ds_pos = pos;
+	ds->ds_expire = expire;
+	ds->ds_born = born;
+	ds->ds_blen = blen;
+	ds->ds_klen = klen;
+	ds->ds_hlen = hlen;
+	plm_lock_unlock(&disk_lock);
+	return (0);
+
+FAIL:
+	PLM_TRACE("write cache file failed: %s",
+			  nw < 0 ? strerror(errno) : "short write");
+	return (-1);
+}
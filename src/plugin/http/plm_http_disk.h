@@ -0,0 +1,170 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_HTTP_DISK_H
+#define _PLM_HTTP_DISK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the second tier of the cache, responses evicted from memory are
+ * appended to a preallocated data file used as a ring, and found by an
+ * index mmap'd from path.idx, bucket of slots keyed by the url hash
+ */
+
+/* slots of a bucket of the index */
+#define PLM_HTTP_DISK_WAYS 8
+
+/* expected bytes of a response, sizes the index to the data file */
+#define PLM_HTTP_DISK_AVG (8 * 1024)
+
+/* the smallest data file */
+#define PLM_HTTP_DISK_MIN (1024 * 1024)
+
+/* a response found on disk, the key, the header and the body follow
+ * each other in the data file
+ */
+struct plm_http_disk_obj {
+	int do_fd;
+	uint64_t do_off;
+	uint32_t do_klen;
+	uint32_t do_hlen;
+	uint64_t do_blen;
+
+	/* wall clock seconds the response was generated, for Age */
+	uint64_t do_born;
+
+	/* keeps the record from being overwritten, see
+	 * plm_http_disk_release
+	 */
+	void *do_pin;
+};
+
+/* a response to store, queued to the writer thread of the tier, the
+ * memory it points to stays valid until dj_done
+ */
+struct plm_http_disk_job {
+	struct plm_http_disk_job *dj_next;
+	const char *dj_key;
+	size_t dj_klen;
+	const char *dj_head;
+	size_t dj_hlen;
+	const struct iovec *dj_body;
+	int dj_n;
+	uint64_t dj_expire;
+	uint64_t dj_born;
+
+	/* bytes of the response, set by plm_http_disk_post */
+	uint64_t dj_bytes;
+
+	/* called once the job is written or dropped, on the writer thread
+	 * or in plm_http_disk_post
+	 */
+	void (*dj_done)(struct plm_http_disk_job *);
+};
+
+/* bytes of the responses queued to the writer thread at most, more
+ * are dropped
+ */
+#define PLM_HTTP_DISK_QUEUE_MAX (32 * 1024 * 1024)
+
+/* open or create the data file and its index
+ * @path -- the data file, the index is path.idx
+ * @size -- bytes of the data file
+ * return 0 on success, else -1
+ */
+int plm_http_disk_init(const char *path, uint64_t size);
+
+/* stop the writer thread after the queued responses are written,
+ * unmap the index and close the data file
+ */
+void plm_http_disk_destroy();
+
+/* the period in ms a released record is checked to be sent out, and
+ * the longest it is kept after release
+ */
+#define PLM_HTTP_DISK_DRAIN 50
+#define PLM_HTTP_DISK_DRAIN_MAX (60 * 1000)
+
+/* find a fresh response, the record is pinned until it is released
+ * @key -- the key of the cache
+ * @klen -- length of key
+ * @fd -- the socket the response is sent to
+ * @o -- output the response
+ * return 0 if found, else -1
+ */
+int plm_http_disk_lookup(const char *key, size_t klen, int fd,
+						 struct plm_http_disk_obj *o);
+
+/* release the record of a response found once nothing is sent from it,
+ * sendfile leaves its pages queued on the socket, the ring writes over
+ * it after the peer has acked them, called in the thread of the socket
+ * @pin -- do_pin of the response
+ */
+void plm_http_disk_release(void *pin);
+
+/* read the key and the header of a response found, a different key
+ * with the same hash is a miss
+ * @o -- the response
+ * @key -- the key looked up
+ * @buf -- room of do_klen + do_hlen bytes, the header is behind the key
+ * return 0 on success, else -1
+ */
+int plm_http_disk_read_head(struct plm_http_disk_obj *o, const char *key,
+							char *buf);
+
+/* queue a response to be stored by the writer thread, the event loop
+ * does not wait on the file
+ * @j -- the job, dj_done is called at once if the tier is off or the
+ *       queue is full
+ */
+void plm_http_disk_post(struct plm_http_disk_job *j);
+
+/* append a response to the data file and index it, an older response
+ * of the key is replaced, only the index is updated under the lock
+ * @key -- the key of the cache
+ * @klen -- length of key
+ * @head -- the stored header
+ * @hlen -- length of head
+ * @body -- the body buffers
+ * @n -- the number of body buffers
+ * @expire -- wall clock seconds the response is fresh until
+ * @born -- wall clock seconds the response was generated
+ * return 0 on success, else -1
+ */
+int plm_http_disk_store(const char *key, size_t klen, const char *head,
+						size_t hlen, const struct iovec *body, int n,
+						uint64_t expire, uint64_t born);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
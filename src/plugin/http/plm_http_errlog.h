@@ -35,17 +35,20 @@ extern "C" {
 
 extern int plm_http_log_level;
 
+/* the messages are recorded by format id and raw arguments when the
+ * log files are binary, see PLM_LOG_FMT
+ */
 #define PLM_DEBUG(fmt, args...)					\
 	if (plm_http_log_level >= PLM_LOG_DEBUG)	\
-		plm_log_write(PLM_LOG_DEBUG, "%s: "fmt, __FUNCTION__, ##args)
+		PLM_LOG_FMT(PLM_LOG_DEBUG, "%s: "fmt, __FUNCTION__, ##args)
 
 #define PLM_TRACE(fmt, args...)					\
 	if (plm_http_log_level >= PLM_LOG_TRACE)	\
-		plm_log_write(PLM_LOG_TRACE, "%s: "fmt, __FUNCTION__, ##args)
+		PLM_LOG_FMT(PLM_LOG_TRACE, "%s: "fmt, __FUNCTION__, ##args)
 
 #define PLM_FATAL(fmt, args...)					\
 	if (plm_http_log_level >= PLM_LOG_FATAL)	\
-		plm_log_write(PLM_LOG_FATAL, "%s: "fmt, __FUNCTION__, ##args)
+		PLM_LOG_FMT(PLM_LOG_FATAL, "%s: "fmt, __FUNCTION__, ##args)
 
 #ifdef __cplusplus
 }
@@ -23,45 +23,308 @@
  * SUCH DAMAGE.
  */
 
+#include <string.h>
+#include <sys/uio.h>
+
+#include "plm_comm.h"
 #include "plm_http_event_io.h"
 
-static void
-plm_http_event_write_cb(void *data, int fd)
+static void plm_http_event_write_cb(void *data, int fd);
+static void plm_http_wrevt_consume(struct plm_http_wrevt *we, size_t n);
+
+/* allocate a segment with room for size bytes from the slab
+ * @size -- bytes of data, no more than PLM_HTTP_SEG_MAX
+ * return the segment or NULL
+ */
+struct plm_http_seg *plm_http_seg_alloc(size_t size)
 {
-	int n;
-	struct plm_http_wrevt *we;
+	struct plm_http_seg *s;
+	size_t total;
+	int type;
 
-	we = (struct plm_http_wrevt *)data;
-	n = plm_comm_write(fd, we->hw_buf + we->hw_off, we->hw_len - we->hw_off);
-	if (n > 0) {
-		we->hw_off += n;
-		if (we->hw_len > we->hw_off)
-			PLM_EVT_DRV_WRITE(fd, we, plm_http_event_write_cb);
-		else
-			we->hw_fn(we->hw_data, we->hw_buf, we->hw_len, 0);
-	} else if (n <= 0) {
-		if (plm_comm_ignore(errno))
-			PLM_EVT_DRV_WRITE(fd, we, plm_http_event_write_cb);
-		else
-			we->hw_fn(we->hw_data, we->hw_buf, we->hw_off, -1);
+	total = sizeof(*s) + size;
+	if (total <= SIZE_1K)
+		type = MEM_1K;
+	else if (total <= SIZE_2K)
+		type = MEM_2K;
+	else if (total <= SIZE_4K)
+		type = MEM_4K;
+	else if (total <= SIZE_8K)
+		type = MEM_8K;
+	else
+		return (NULL);
+
+	s = (struct plm_http_seg *)plm_buffer_alloc(type);
+	if (s) {
+		s->hs_next = NULL;
+		s->hs_buf = (char *)(s + 1);
+		s->hs_len = 0;
+		s->hs_off = 0;
+		s->hs_type = type;
+		switch (type) {
+		case MEM_1K:
+			s->hs_cap = SIZE_1K - sizeof(*s);
+			break;
+		case MEM_2K:
+			s->hs_cap = SIZE_2K - sizeof(*s);
+			break;
+		case MEM_4K:
+			s->hs_cap = SIZE_4K - sizeof(*s);
+			break;
+		default:
+			s->hs_cap = SIZE_8K - sizeof(*s);
+			break;
+		}
+	}
+
+	return (s);
+}
+
+/* release a segment, slab segments are given back and the reference
+ * of a PLM_HTTP_SEG_REF or PLM_HTTP_SEG_FILE one is dropped, the others
+ * are not owned
+ */
+void plm_http_seg_free(struct plm_http_seg *s)
+{
+	if (s->hs_type == PLM_HTTP_SEG_REF
+		|| (s->hs_type == PLM_HTTP_SEG_FILE && s->hs_unref))
+		s->hs_unref(s->hs_ref);
+	else if (s->hs_type < MEM_END)
+		plm_buffer_free(s->hs_type, (char *)s);
+}
+
+/* init an empty chain
+ * @we -- the chain
+ * @fn -- called when drained or on error
+ * @data -- the first argument for fn
+ */
+void plm_http_wrevt_init(struct plm_http_wrevt *we,
+						 void (*fn)(void *, int), void *data)
+{
+	we->hw_fn = fn;
+	we->hw_data = data;
+	we->hw_head = NULL;
+	we->hw_tail = NULL;
+	we->hw_bytes = 0;
+	we->hw_wait = 0;
+}
+
+/* queue a segment at the end of chain, nothing is written until
+ * plm_http_event_write
+ */
+void plm_http_wrevt_append(struct plm_http_wrevt *we, struct plm_http_seg *s)
+{
+	s->hs_next = NULL;
+	if (we->hw_tail)
+		we->hw_tail->hs_next = s;
+	else
+		we->hw_head = s;
+	we->hw_tail = s;
+	we->hw_bytes += s->hs_len - s->hs_off;
+}
+
+/* move the segments of src to the end of dst, src is left empty */
+void plm_http_wrevt_move(struct plm_http_wrevt *dst,
+						 struct plm_http_wrevt *src)
+{
+	if (!src->hw_head)
+		return;
+
+	if (dst->hw_tail)
+		dst->hw_tail->hs_next = src->hw_head;
+	else
+		dst->hw_head = src->hw_head;
+	dst->hw_tail = src->hw_tail;
+	dst->hw_bytes += src->hw_bytes;
+
+	src->hw_head = NULL;
+	src->hw_tail = NULL;
+	src->hw_bytes = 0;
+}
+
+/* release all queued segments, the fd is going to be closed */
+void plm_http_wrevt_drop(struct plm_http_wrevt *we)
+{
+	struct plm_http_seg *s;
+
+	while (we->hw_head) {
+		s = we->hw_head;
+		we->hw_head = s->hs_next;
+		plm_http_seg_free(s);
 	}
+
+	we->hw_tail = NULL;
+	we->hw_bytes = 0;
 }
 
+/* write the queued segments, post a write event if fd would block
+ * @fd -- the fd
+ * @we -- the chain, hw_fn is called once it is empty
+ */
 void plm_http_event_write(int fd, struct plm_http_wrevt *we)
 {
-	int n;
+	struct iovec iov[PLM_HTTP_IOV_MAX];
+	struct plm_http_seg *s;
+	size_t total;
+	ssize_t n;
+	off_t off;
+	int i;
 
-	n = plm_comm_write(fd, we->hw_buf, we->hw_len);
-	if (n > 0) {
-		we->hw_off += n;
-		if (we->hw_len > we->hw_off)
-			PLM_EVT_DRV_WRITE(fd, we, plm_http_event_write_cb);
-		else
-			we->hw_fn(we->hw_data, we->hw_buf, we->hw_len, 0);
-	} else if (n <= 0) {
-		if (plm_comm_ignore(errno))
+	/* the write event flushes everything queued meanwhile */
+	if (we->hw_wait)
+		return;
+
+	while (we->hw_head) {
+		total = 0;
+		s = we->hw_head;
+		if (s->hs_type == PLM_HTTP_SEG_FILE) {
+			total = s->hs_len - s->hs_off;
+			off = s->hs_foff + s->hs_off;
+			n = plm_comm_sendfile(fd, s->hs_fd, &off, total);
+
+			/* the file is shorter than the segment */
+			if (n == 0 && total > 0) {
+				errno = EIO;
+				n = -1;
+			}
+		} else {
+			for (i = 0; s && i < PLM_HTTP_IOV_MAX
+					 && s->hs_type != PLM_HTTP_SEG_FILE;
+				 i++, s = s->hs_next) {
+				iov[i].iov_base = s->hs_buf + s->hs_off;
+				iov[i].iov_len = s->hs_len - s->hs_off;
+				total += iov[i].iov_len;
+			}
+
+			n = plm_comm_writev(fd, iov, i);
+		}
+
+		if (n < 0) {
+			if (!plm_comm_ignore(errno)) {
+				we->hw_fn(we->hw_data, -1);
+				return;
+			}
+			n = 0;
+		}
+
+		plm_http_wrevt_consume(we, n);
+
+		/* the socket buffer is full, wait until it is writable */
+		if ((size_t)n < total) {
+			we->hw_wait = 1;
 			PLM_EVT_DRV_WRITE(fd, we, plm_http_event_write_cb);
-		else
-			we->hw_fn(we->hw_data, we->hw_buf, we->hw_off, -1);
+			return;
+		}
+	}
+
+	we->hw_fn(we->hw_data, 0);
+}
+
+void plm_http_event_write_cb(void *data, int fd)
+{
+	struct plm_http_wrevt *we;
+
+	we = (struct plm_http_wrevt *)data;
+	we->hw_wait = 0;
+	plm_http_event_write(fd, we);
+}
+
+/* release the segments fully written, keep the offset of a partial one */
+void plm_http_wrevt_consume(struct plm_http_wrevt *we, size_t n)
+{
+	struct plm_http_seg *s;
+	size_t left;
+
+	we->hw_bytes -= n;
+	while ((s = we->hw_head) != NULL) {
+		left = s->hs_len - s->hs_off;
+
+		/* empty segments are released as well */
+		if (n < left) {
+			s->hs_off += n;
+			break;
+		}
+
+		n -= left;
+		we->hw_head = s->hs_next;
+		if (!we->hw_head)
+			we->hw_tail = NULL;
+		plm_http_seg_free(s);
+	}
+}
+
+/* take a pipe for relaying len bytes from in to out
+ * return 0 on success, -1 if no pipe is available
+ */
+int plm_http_relay_init(struct plm_http_relay *rl, int in, int out,
+						uint64_t len)
+{
+	rl->hl_pipe = plm_pipe_get();
+	if (!rl->hl_pipe)
+		return (-1);
+
+	rl->hl_in = in;
+	rl->hl_out = out;
+	rl->hl_rest = len;
+	return (0);
+}
+
+/* give the pipe back, bytes not relayed are dropped */
+void plm_http_relay_release(struct plm_http_relay *rl)
+{
+	if (rl->hl_pipe) {
+		plm_pipe_put(rl->hl_pipe);
+		rl->hl_pipe = NULL;
 	}
 }
+
+/* move bytes until done, blocked or out of budget, the pipe is
+ * released unless the result is PLM_HTTP_RELAY_RD or PLM_HTTP_RELAY_WR
+ */
+int plm_http_relay(struct plm_http_relay *rl)
+{
+	ssize_t n;
+	size_t moved = 0;
+	struct plm_pipe *p;
+	int rc = PLM_HTTP_RELAY_DONE;
+
+	p = rl->hl_pipe;
+	for (;;) {
+		if (p->pp_len > 0) {
+			n = plm_pipe_drain(p, rl->hl_out);
+			if (n < 0) {
+				rc = plm_comm_ignore(errno) ? PLM_HTTP_RELAY_WR
+					: PLM_HTTP_RELAY_ERR_OUT;
+				break;
+			}
+
+			moved += n;
+			continue;
+		}
+
+		if (rl->hl_rest == 0)
+			break;
+
+		/* out is writable most likely, come back on the next loop */
+		if (moved >= PLM_HTTP_RELAY_BUDGET) {
+			rc = PLM_HTTP_RELAY_WR;
+			break;
+		}
+
+		n = plm_pipe_fill(p, rl->hl_in, rl->hl_rest);
+		if (n <= 0) {
+			if (n < 0 && plm_comm_ignore(errno))
+				rc = PLM_HTTP_RELAY_RD;
+			else
+				rc = PLM_HTTP_RELAY_ERR_IN;
+			break;
+		}
+
+		rl->hl_rest -= n;
+	}
+
+	if (rc != PLM_HTTP_RELAY_RD && rc != PLM_HTTP_RELAY_WR)
+		plm_http_relay_release(rl);
+
+	return (rc);
+}
@@ -27,10 +27,14 @@
 #define _PLM_HTTP_EVENT_IO_H
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
 #include <errno.h>
 
 #include "plm_http_errlog.h"
+#include "plm_buffer.h"
 #include "plm_event.h"
+#include "plm_pipe.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -52,15 +56,144 @@ extern "C" {
 		}															\
 	} while (0)
 
+/* hs_type of a segment holding a reference on the memory of hs_buf,
+ * hs_unref is called with hs_ref on release
+ */
+#define PLM_HTTP_SEG_REF (MEM_END + 1)
+
+/* hs_type of a segment of hs_len bytes from offset hs_foff of the file
+ * hs_fd, written with sendfile, hs_buf is not used, hs_unref is called
+ * with hs_ref on release if set
+ */
+#define PLM_HTTP_SEG_FILE (MEM_END + 2)
+
+/* a piece of output, hs_buf must stay valid until the segment is
+ * released, a segment from plm_http_seg_alloc carries its data behind
+ * the header and is given back to the slab on release
+ */
+struct plm_http_seg {
+	struct plm_http_seg *hs_next;
+	char *hs_buf;
+	size_t hs_len;
+
+	/* bytes of hs_buf written */
+	size_t hs_off;
+
+	/* room behind the header, zero if hs_buf points elsewhere */
+	size_t hs_cap;
+
+	/* MEM_* of the slab buffer, MEM_END if not from the slab, or
+	 * PLM_HTTP_SEG_REF or PLM_HTTP_SEG_FILE
+	 */
+	int hs_type;
+	void (*hs_unref)(void *);
+	void *hs_ref;
+	int hs_fd;
+	uint64_t hs_foff;
+};
+
+/* the output chain of a fd, every write event flushes as many queued
+ * segments as possible with one writev, a file segment is written with
+ * sendfile on its own
+ */
 struct plm_http_wrevt {
-	void (*hw_fn)(void *, char *, size_t, int);
+	/* called when the chain is drained with 0, or -1 on write error */
+	void (*hw_fn)(void *, int);
 	void *hw_data;
-	char *hw_buf;
-	size_t hw_off;
-	size_t hw_len;
+
+	struct plm_http_seg *hw_head;
+	struct plm_http_seg *hw_tail;
+
+	/* bytes queued and not written */
+	size_t hw_bytes;
+
+	/* a write event is posted */
+	int hw_wait;
 };
 
-void plm_http_event_write(int fd, struct plm_http_wrevt *we);	
+/* max buffers of one writev */
+#define PLM_HTTP_IOV_MAX 64
+
+/* allocate a segment with room for size bytes from the slab
+ * @size -- bytes of data, no more than PLM_HTTP_SEG_MAX
+ * return the segment or NULL
+ */
+struct plm_http_seg *plm_http_seg_alloc(size_t size);
+
+#define PLM_HTTP_SEG_MAX (8192 - sizeof(struct plm_http_seg))
+
+/* release a segment, slab segments are given back and the reference
+ * of a PLM_HTTP_SEG_REF or PLM_HTTP_SEG_FILE one is dropped
+ */
+void plm_http_seg_free(struct plm_http_seg *s);
+
+/* init an empty chain
+ * @we -- the chain
+ * @fn -- called when drained or on error
+ * @data -- the first argument for fn
+ */
+void plm_http_wrevt_init(struct plm_http_wrevt *we,
+						 void (*fn)(void *, int), void *data);
+
+/* queue a segment at the end of chain, nothing is written until
+ * plm_http_event_write
+ */
+void plm_http_wrevt_append(struct plm_http_wrevt *we, struct plm_http_seg *s);
+
+/* move the segments of src to the end of dst, src is left empty */
+void plm_http_wrevt_move(struct plm_http_wrevt *dst,
+						 struct plm_http_wrevt *src);
+
+/* release all queued segments, the fd is going to be closed */
+void plm_http_wrevt_drop(struct plm_http_wrevt *we);
+
+/* write the queued segments, post a write event if fd would block
+ * @fd -- the fd
+ * @we -- the chain, hw_fn is called once it is empty
+ */
+void plm_http_event_write(int fd, struct plm_http_wrevt *we);
+
+/* a body moved from one socket to another with splice, the caller arms
+ * the events, so the handler data is whatever outlives the sockets
+ */
+struct plm_http_relay {
+	struct plm_pipe *hl_pipe;
+	int hl_in;
+	int hl_out;
+
+	/* bytes to read from hl_in */
+	uint64_t hl_rest;
+};
+
+/* results of plm_http_relay */
+enum {
+	PLM_HTTP_RELAY_DONE,
+
+	/* wait for hl_in to be readable or hl_out to be writable */
+	PLM_HTTP_RELAY_RD,
+	PLM_HTTP_RELAY_WR,
+
+	/* reading hl_in or writing hl_out failed */
+	PLM_HTTP_RELAY_ERR_IN,
+	PLM_HTTP_RELAY_ERR_OUT
+};
+
+/* bytes moved by one call at most, then the loop serves others */
+#define PLM_HTTP_RELAY_BUDGET (1024 * 1024)
+
+/* take a pipe for relaying len bytes from in to out
+ * return 0 on success, -1 if no pipe is available
+ */
+int plm_http_relay_init(struct plm_http_relay *rl, int in, int out,
+						uint64_t len);
+
+/* give the pipe back, bytes not relayed are dropped */
+void plm_http_relay_release(struct plm_http_relay *rl);
+
+/* move bytes until done, blocked or out of budget, the pipe is
+ * released unless the result is PLM_HTTP_RELAY_RD or PLM_HTTP_RELAY_WR
+ */
+int plm_http_relay(struct plm_http_relay *rl);
 
 #ifdef __cplusplus
 }
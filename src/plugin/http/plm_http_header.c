@@ -0,0 +1,327 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include "plm_http_header.h"
+
+static int plm_http_hdr_hop(int id);
+static int plm_http_hdrs_hop(struct plm_http_hdrs *h, int id,
+							 const plm_string_t *k);
+static char *plm_http_field_write(char *p, const plm_string_t *k,
+								  const plm_string_t *v);
+
+/* init an empty header set */
+void plm_http_hdrs_init(struct plm_http_hdrs *h)
+{
+	memset(h->hh_known, 0, sizeof(h->hh_known));
+	h->hh_other.fb_next = NULL;
+	h->hh_other.fb_num = 0;
+	h->hh_tail = &h->hh_other;
+}
+
+/* add a field, the strings are kept as they are, nothing is copied
+ * @h -- header set
+ * @id -- enum plm_http_hdr of the name
+ * @k -- name
+ * @v -- value
+ * @pool -- the blocks after the inline one come from the pool
+ * return 0 on success, else -1
+ */
+int plm_http_hdrs_add(struct plm_http_hdrs *h, int id, const plm_string_t *k,
+					  const plm_string_t *v, struct plm_mempool *pool)
+{
+	struct plm_http_field_blk *b;
+	struct plm_http_field *f;
+
+	if (id != PLM_HDR_OTHER && !h->hh_known[id].s_str) {
+		h->hh_known[id] = *v;
+		return (0);
+	}
+
+	b = h->hh_tail;
+	if (b->fb_num == PLM_HTTP_FIELD_BLK) {
+		b = (struct plm_http_field_blk *)
+			plm_mempool_alloc(pool, sizeof(*b));
+		if (!b)
+			return (-1);
+
+		b->fb_next = NULL;
+		b->fb_num = 0;
+		h->hh_tail->fb_next = b;
+		h->hh_tail = b;
+	}
+
+	f = &b->fb_fields[b->fb_num++];
+	f->hf_id = id;
+	f->hf_key = *k;
+	f->hf_value = *v;
+	return (0);
+}
+
+/* find the first value of a field
+ * @h -- header set
+ * @name -- field name, case insensitive
+ * @len -- length of name
+ * return the value or NULL
+ */
+const plm_string_t *
+plm_http_hdrs_find(struct plm_http_hdrs *h, const char *name, size_t len)
+{
+	int id, i;
+	struct plm_http_field_blk *b;
+	struct plm_http_field *f;
+
+	id = plm_http_hdr_id(name, len);
+	if (id != PLM_HDR_OTHER)
+		return (plm_http_hdrs_get(h, id));
+
+	for (b = &h->hh_other; b; b = b->fb_next) {
+		for (i = 0; i < b->fb_num; i++) {
+			f = &b->fb_fields[i];
+			if (f->hf_key.s_len == len
+				&& !strncasecmp(f->hf_key.s_str, name, len))
+				return (&f->hf_value);
+		}
+	}
+
+	return (NULL);
+}
+
+/* hop-by-hop fields are consumed by the proxy, RFC 7230 6.1 */
+int plm_http_hdr_hop(int id)
+{
+	switch (id) {
+	case PLM_HDR_CONNECTION:
+	case PLM_HDR_PROXY_CONNECTION:
+	case PLM_HDR_KEEP_ALIVE:
+	case PLM_HDR_TE:
+	case PLM_HDR_TRAILER:
+	case PLM_HDR_UPGRADE:
+		return (1);
+	}
+
+	return (0);
+}
+
+/* a field is hop-by-hop if its name is listed or a Connection token,
+ * the fields framing the message and Host are always forwarded
+ * @h -- header set
+ * @id -- enum plm_http_hdr of the name
+ * @k -- name
+ * return nonzero if the field is consumed by the proxy
+ */
+int plm_http_hdrs_hop(struct plm_http_hdrs *h, int id, const plm_string_t *k)
+{
+	int i;
+	struct plm_http_field_blk *b;
+	struct plm_http_field *f;
+
+	if (plm_http_hdr_hop(id))
+		return (1);
+
+	/* a repeat of a known field taken out of hh_known goes with it */
+	if (id != PLM_HDR_OTHER && !h->hh_known[id].s_str)
+		return (1);
+
+	if (!h->hh_known[PLM_HDR_CONNECTION].s_str
+		|| id == PLM_HDR_CONTENT_LENGTH || id == PLM_HDR_TRANSFER_ENCODING
+		|| id == PLM_HDR_HOST)
+		return (0);
+
+	if (plm_http_hdr_has_token(&h->hh_known[PLM_HDR_CONNECTION],
+							   k->s_str, k->s_len))
+		return (1);
+
+	/* Connection repeated */
+	for (b = &h->hh_other; b; b = b->fb_next) {
+		for (i = 0; i < b->fb_num; i++) {
+			f = &b->fb_fields[i];
+			if (f->hf_id == PLM_HDR_CONNECTION
+				&& plm_http_hdr_has_token(&f->hf_value, k->s_str, k->s_len))
+				return (1);
+		}
+	}
+
+	return (0);
+}
+
+/* bytes of the end-to-end fields in wire format, "name: value\r\n" */
+size_t plm_http_hdrs_size(struct plm_http_hdrs *h)
+{
+	int i;
+	size_t n = 0;
+	struct plm_http_field_blk *b;
+	struct plm_http_field *f;
+
+	for (i = 0; i < PLM_HDR_NUM; i++) {
+		if (h->hh_known[i].s_str
+			&& !plm_http_hdrs_hop(h, i, plm_http_hdr_name(i)))
+			n += plm_http_hdr_name(i)->s_len + h->hh_known[i].s_len + 4;
+	}
+
+	for (b = &h->hh_other; b; b = b->fb_next) {
+		for (i = 0; i < b->fb_num; i++) {
+			f = &b->fb_fields[i];
+			if (!plm_http_hdrs_hop(h, f->hf_id, &f->hf_key))
+				n += f->hf_key.s_len + f->hf_value.s_len + 4;
+		}
+	}
+
+	return (n);
+}
+
+char *plm_http_field_write(char *p, const plm_string_t *k,
+						   const plm_string_t *v)
+{
+	memcpy(p, k->s_str, k->s_len);
+	p += k->s_len;
+	*p++ = ':';
+	*p++ = ' ';
+	memcpy(p, v->s_str, v->s_len);
+	p += v->s_len;
+	*p++ = '\r';
+	*p++ = '\n';
+	return (p);
+}
+
+/* write the end-to-end fields in wire format, well known ones first
+ * with their canonical names, the others in arrival order
+ * @h -- header set
+ * @buf -- room of plm_http_hdrs_size bytes
+ * return the end of the written bytes
+ */
+char *plm_http_hdrs_write(struct plm_http_hdrs *h, char *buf)
+{
+	int i;
+	struct plm_http_field_blk *b;
+	struct plm_http_field *f;
+
+	for (i = 0; i < PLM_HDR_NUM; i++) {
+		if (h->hh_known[i].s_str
+			&& !plm_http_hdrs_hop(h, i, plm_http_hdr_name(i)))
+			buf = plm_http_field_write(buf, plm_http_hdr_name(i),
+									   &h->hh_known[i]);
+	}
+
+	for (b = &h->hh_other; b; b = b->fb_next) {
+		for (i = 0; i < b->fb_num; i++) {
+			f = &b->fb_fields[i];
+			if (!plm_http_hdrs_hop(h, f->hf_id, &f->hf_key))
+				buf = plm_http_field_write(buf, &f->hf_key, &f->hf_value);
+		}
+	}
+
+	return (buf);
+}
+
+/* check a Content-Length value against the one kept in a header set,
+ * only digits are a length, a repeat must agree with the first
+ * @h -- header set the field goes into
+ * @v -- field value
+ * @len -- gets the length
+ * return 0 to add the field, 1 if it repeats the value kept, -1 if it
+ *   is not a length or disagrees
+ */
+int plm_http_hdrs_cntlen(struct plm_http_hdrs *h, const plm_string_t *v,
+						 uint64_t *len)
+{
+	uint64_t kept;
+	const plm_string_t *k;
+
+	if (plm_http_cntlen(v, len))
+		return (-1);
+
+	k = plm_http_hdrs_get(h, PLM_HDR_CONTENT_LENGTH);
+	if (!k)
+		return (0);
+
+	if (plm_http_cntlen(k, &kept) || kept != *len)
+		return (-1);
+
+	return (1);
+}
+
+/* parse a Content-Length value, only digits and below INT64_MAX
+ * @v -- field value
+ * @len -- gets the length
+ * return 0 on success, else -1
+ */
+int plm_http_cntlen(const plm_string_t *v, uint64_t *len)
+{
+	size_t i;
+	uint64_t n = 0;
+	int d;
+
+	if (v->s_len == 0)
+		return (-1);
+
+	for (i = 0; i < v->s_len; i++) {
+		if (v->s_str[i] < '0' || v->s_str[i] > '9')
+			return (-1);
+
+		d = v->s_str[i] - '0';
+		if (n > (INT64_MAX - d) / 10)
+			return (-1);
+
+		n = n * 10 + d;
+	}
+
+	*len = n;
+	return (0);
+}
+
+/* check a comma separated field value for a token
+ * @v -- field value
+ * @tok -- token, case insensitive
+ * @len -- length of token
+ * return nonzero if found
+ */
+int plm_http_hdr_has_token(const plm_string_t *v, const char *tok, size_t len)
+{
+	const char *p = v->s_str, *end = v->s_str + v->s_len, *e;
+
+	while (p < end) {
+		while (p < end && (*p == ' ' || *p == '\t' || *p == ','))
+			p++;
+
+		e = p;
+		while (e < end && *e != ',')
+			e++;
+
+		/* trailing white space of the token */
+		while (e > p && (e[-1] == ' ' || e[-1] == '\t'))
+			e--;
+
+		if ((size_t)(e - p) == len && !strncasecmp(p, tok, len))
+			return (1);
+
+		while (p < end && *p != ',')
+			p++;
+	}
+
+	return (0);
+}
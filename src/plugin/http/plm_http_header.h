@@ -0,0 +1,100 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_HTTP_HEADER_H
+#define _PLM_HTTP_HEADER_H
+
+#include "plm_mempool.h"
+#include "plm_http.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* init an empty header set */
+void plm_http_hdrs_init(struct plm_http_hdrs *h);
+
+/* add a field, the strings are kept as they are, nothing is copied
+ * @h -- header set
+ * @id -- enum plm_http_hdr of the name
+ * @k -- name
+ * @v -- value
+ * @pool -- the blocks after the inline one come from the pool
+ * return 0 on success, else -1
+ */
+int plm_http_hdrs_add(struct plm_http_hdrs *h, int id, const plm_string_t *k,
+					  const plm_string_t *v, struct plm_mempool *pool);
+
+/* find the first value of a field
+ * @h -- header set
+ * @name -- field name, case insensitive
+ * @len -- length of name
+ * return the value or NULL
+ */
+const plm_string_t *
+plm_http_hdrs_find(struct plm_http_hdrs *h, const char *name, size_t len);
+
+/* bytes of the end-to-end fields in wire format, "name: value\r\n" */
+size_t plm_http_hdrs_size(struct plm_http_hdrs *h);
+
+/* write the end-to-end fields in wire format, well known ones first
+ * with their canonical names, the others in arrival order
+ * @h -- header set
+ * @buf -- room of plm_http_hdrs_size bytes
+ * return the end of the written bytes
+ */
+char *plm_http_hdrs_write(struct plm_http_hdrs *h, char *buf);
+
+/* check a Content-Length value against the one kept in a header set,
+ * only digits are a length, a repeat must agree with the first
+ * @h -- header set the field goes into
+ * @v -- field value
+ * @len -- gets the length
+ * return 0 to add the field, 1 if it repeats the value kept, -1 if it
+ *   is not a length or disagrees
+ */
+int plm_http_hdrs_cntlen(struct plm_http_hdrs *h, const plm_string_t *v,
+						 uint64_t *len);
+
+/* parse a Content-Length value, only digits and below INT64_MAX
+ * @v -- field value
+ * @len -- gets the length
+ * return 0 on success, else -1
+ */
+int plm_http_cntlen(const plm_string_t *v, uint64_t *len);
+
+/* check a comma separated field value for a token
+ * @v -- field value
+ * @tok -- token, case insensitive
+ * @len -- length of token
+ * return nonzero if found
+ */
+int plm_http_hdr_has_token(const plm_string_t *v, const char *tok, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,360 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <arpa/inet.h>
+
+#include "plm_http_lb.h"
+
+/* points of a backend with weight 1 on the hash ring */
+#define PLM_LB_VNODES 160
+
+struct plm_lb_point {
+	uint32_t lp_hash;
+	int lp_backend;
+};
+
+/* state of a thread, allocated at the first select */
+struct plm_lb_thrd {
+	/* current weights of smooth weighted round robin */
+	int *lt_cw;
+
+	/* requests in flight per backend */
+	int *lt_active;
+
+	/* xorshift state of random choices, and the start of scans so
+	 * ties don't always go to the first backend
+	 */
+	uint32_t lt_rand;
+	int lt_next;
+};
+
+static int lb_type;
+static int lb_key;
+static int lb_num;
+static int lb_total;
+static const int *lb_weights;
+
+static struct plm_lb_point *lb_ring;
+static int lb_ring_len;
+
+static __thread struct plm_lb_thrd *lb_thrd;
+
+static int plm_http_lb_rr(struct plm_http_req *);
+static int plm_http_lb_least(struct plm_http_req *);
+static int plm_http_lb_p2c(struct plm_http_req *);
+static int plm_http_lb_hash(struct plm_http_req *);
+static struct plm_lb_thrd *plm_http_lb_thrd();
+static uint32_t plm_http_lb_fnv(const char *s, size_t len);
+
+static struct plm_http_lb lb_strategies[] = {
+	{ "rr", plm_http_lb_rr },
+	{ "least_conn", plm_http_lb_least },
+	{ "p2c", plm_http_lb_p2c },
+	{ "hash", plm_http_lb_hash }
+};
+
+static int plm_http_lb_point_cmp(const void *a, const void *b)
+{
+	const struct plm_lb_point *pa = (const struct plm_lb_point *)a;
+	const struct plm_lb_point *pb = (const struct plm_lb_point *)b;
+
+	if (pa->lp_hash != pb->lp_hash)
+		return (pa->lp_hash < pb->lp_hash ? -1 : 1);
+	return (pa->lp_backend - pb->lp_backend);
+}
+
+/* build the shared tables of the strategy, the weights and addresses
+ * must stay valid until plm_http_lb_destroy
+ * @type -- enum plm_http_lb_type
+ * @key -- enum plm_http_lb_key, for PLM_LB_HASH
+ * @n -- the number of backends
+ * @addrs -- backend addresses, hashed to place them on the ring
+ * @weights -- backend weights, at least 1
+ * return 0 on success, else -1
+ */
+int plm_http_lb_init(int type, int key, int n,
+					 const struct sockaddr_in *addrs, const int *weights)
+{
+	int i, j, len;
+	char buf[64];
+
+	lb_type = type;
+	lb_key = key;
+	lb_num = n;
+	lb_weights = weights;
+	lb_total = 0;
+	for (i = 0; i < n; i++)
+		lb_total += weights[i];
+
+	if (type != PLM_LB_HASH)
+		return (0);
+
+	/* the points of a backend depend on its address only, so adding or
+	 * removing a backend moves the keys of its own points only
+	 */
+	lb_ring_len = lb_total * PLM_LB_VNODES;
+	lb_ring = (struct plm_lb_point *)
+		malloc(lb_ring_len * sizeof(struct plm_lb_point));
+	if (!lb_ring)
+		return (-1);
+
+	len = 0;
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < weights[i] * PLM_LB_VNODES; j++) {
+			int m = snprintf(buf, sizeof(buf), "%s:%d-%d",
+							 inet_ntoa(addrs[i].sin_addr),
+							 ntohs(addrs[i].sin_port), j);
+			lb_ring[len].lp_hash = plm_http_lb_fnv(buf, m);
+			lb_ring[len].lp_backend = i;
+			len++;
+		}
+	}
+
+	qsort(lb_ring, lb_ring_len, sizeof(struct plm_lb_point),
+		  plm_http_lb_point_cmp);
+	return (0);
+}
+
+/* release the shared tables */
+void plm_http_lb_destroy()
+{
+	free(lb_ring);
+	lb_ring = NULL;
+	lb_ring_len = 0;
+	lb_num = 0;
+}
+
+/* release the state of the current thread */
+void plm_http_lb_thrd_destroy()
+{
+	if (lb_thrd) {
+		free(lb_thrd->lt_cw);
+		free(lb_thrd->lt_active);
+		free(lb_thrd);
+		lb_thrd = NULL;
+	}
+}
+
+/* find a strategy by name
+ * return the enum plm_http_lb_type or -1
+ */
+int plm_http_lb_type(const plm_string_t *name)
+{
+	int i;
+
+	for (i = 0; i < sizeof(lb_strategies) / sizeof(lb_strategies[0]); i++) {
+		if (strlen(lb_strategies[i].lb_name) == name->s_len
+			&& !strncmp(lb_strategies[i].lb_name, name->s_str, name->s_len))
+			return (i);
+	}
+
+	return (-1);
+}
+
+/* pick a backend for the request with the configured strategy
+ * return the index of the backend, or -1 if out of memory
+ */
+int plm_http_lb_select(struct plm_http_req *r)
+{
+	if (lb_num == 1)
+		return (0);
+
+	return (lb_strategies[lb_type].lb_select(r));
+}
+
+/* a request is sent to or done with a backend, counts the requests in
+ * flight of the current thread
+ */
+void plm_http_lb_start(int backend)
+{
+	struct plm_lb_thrd *t;
+
+	t = plm_http_lb_thrd();
+	if (t)
+		t->lt_active[backend]++;
+}
+
+void plm_http_lb_done(int backend)
+{
+	if (lb_thrd && lb_thrd->lt_active[backend] > 0)
+		lb_thrd->lt_active[backend]--;
+}
+
+struct plm_lb_thrd *plm_http_lb_thrd()
+{
+	struct plm_lb_thrd *t;
+
+	if (lb_thrd)
+		return (lb_thrd);
+
+	t = (struct plm_lb_thrd *)malloc(sizeof(*t));
+	if (!t)
+		return (NULL);
+
+	t->lt_cw = (int *)calloc(lb_num, sizeof(int));
+	t->lt_active = (int *)calloc(lb_num, sizeof(int));
+	if (!t->lt_cw || !t->lt_active) {
+		free(t->lt_cw);
+		free(t->lt_active);
+		free(t);
+		return (NULL);
+	}
+
+	/* threads start at different points of the rotation */
+	t->lt_rand = 2463534242u ^ (uint32_t)(uintptr_t)t;
+	if (t->lt_rand == 0)
+		t->lt_rand = 1;
+	t->lt_next = (uintptr_t)t % lb_num;
+
+	lb_thrd = t;
+	return (t);
+}
+
+static uint32_t plm_http_lb_rand(struct plm_lb_thrd *t)
+{
+	uint32_t x = t->lt_rand;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	t->lt_rand = x;
+	return (x);
+}
+
+uint32_t plm_http_lb_fnv(const char *s, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h ^= (uint8_t)s[i];
+		h *= 16777619u;
+	}
+
+	/* spread the low entropy of short keys over all bits */
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	return (h);
+}
+
+/* smooth weighted round robin, every backend gains its weight per pick
+ * and the one picked gives back the total, so a heavy backend is
+ * interleaved with the others instead of picked in a burst
+ */
+int plm_http_lb_rr(struct plm_http_req *r)
+{
+	int i, best = 0;
+	struct plm_lb_thrd *t;
+
+	t = plm_http_lb_thrd();
+	if (!t)
+		return (-1);
+
+	for (i = 0; i < lb_num; i++) {
+		t->lt_cw[i] += lb_weights[i];
+		if (t->lt_cw[i] > t->lt_cw[best])
+			best = i;
+	}
+
+	t->lt_cw[best] -= lb_total;
+	return (best);
+}
+
+/* a has fewer requests in flight than b relative to the weights */
+#define PLM_LB_LESS(t, a, b) \
+	((t)->lt_active[a] * lb_weights[b] < (t)->lt_active[b] * lb_weights[a])
+
+/* fewest requests in flight of this thread relative to the weight, the
+ * scan starts after the last pick to spread ties
+ */
+int plm_http_lb_least(struct plm_http_req *r)
+{
+	int i, j, best;
+	struct plm_lb_thrd *t;
+
+	t = plm_http_lb_thrd();
+	if (!t)
+		return (-1);
+
+	best = t->lt_next;
+	for (i = 1; i < lb_num; i++) {
+		j = (t->lt_next + i) % lb_num;
+		if (PLM_LB_LESS(t, j, best))
+			best = j;
+	}
+
+	t->lt_next = (best + 1) % lb_num;
+	return (best);
+}
+
+/* the less loaded of two backends drawn at random by weight, close to
+ * least_conn without scanning all
+ */
+int plm_http_lb_p2c(struct plm_http_req *r)
+{
+	int a, b, w;
+	struct plm_lb_thrd *t;
+
+	t = plm_http_lb_thrd();
+	if (!t)
+		return (-1);
+
+	w = plm_http_lb_rand(t) % lb_total;
+	for (a = 0; w >= lb_weights[a]; a++)
+		w -= lb_weights[a];
+
+	/* the second one out of the others */
+	b = (a + 1 + plm_http_lb_rand(t) % (lb_num - 1)) % lb_num;
+	return (PLM_LB_LESS(t, b, a) ? b : a);
+}
+
+/* the first point on the ring clockwise of the hash of the key */
+int plm_http_lb_hash(struct plm_http_req *r)
+{
+	int lo, hi, mid;
+	uint32_t h;
+	const plm_string_t *k;
+
+	k = lb_key == PLM_LB_KEY_URL ? &r->hr_url : &r->hr_host;
+	h = plm_http_lb_fnv(k->s_str, k->s_len);
+
+	lo = 0;
+	hi = lb_ring_len;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (lb_ring[mid].lp_hash < h)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo == lb_ring_len)
+		lo = 0;
+	return (lb_ring[lo].lp_backend);
+}
@@ -0,0 +1,109 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_HTTP_LB_H
+#define _PLM_HTTP_LB_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "plm_http.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* load balancing strategies, selected by http_balance */
+enum plm_http_lb_type {
+	/* smooth weighted round robin */
+	PLM_LB_RR,
+
+	/* fewest requests in flight relative to weight */
+	PLM_LB_LEAST,
+
+	/* the less loaded of two random backends */
+	PLM_LB_P2C,
+
+	/* consistent hash of the Host or the url */
+	PLM_LB_HASH
+};
+
+/* the key of PLM_LB_HASH */
+enum plm_http_lb_key {
+	PLM_LB_KEY_HOST,
+	PLM_LB_KEY_URL
+};
+
+/* a strategy, the state is per thread so picking a backend never
+ * writes memory shared between threads
+ */
+struct plm_http_lb {
+	const char *lb_name;
+
+	/* pick a backend for the request
+	 * return the index of the backend
+	 */
+	int (*lb_select)(struct plm_http_req *r);
+};
+
+/* build the shared tables of the strategy, the weights and addresses
+ * must stay valid until plm_http_lb_destroy
+ * @type -- enum plm_http_lb_type
+ * @key -- enum plm_http_lb_key, for PLM_LB_HASH
+ * @n -- the number of backends
+ * @addrs -- backend addresses, hashed to place them on the ring
+ * @weights -- backend weights, at least 1
+ * return 0 on success, else -1
+ */
+int plm_http_lb_init(int type, int key, int n,
+					 const struct sockaddr_in *addrs, const int *weights);
+
+/* release the shared tables */
+void plm_http_lb_destroy();
+
+/* release the state of the current thread */
+void plm_http_lb_thrd_destroy();
+
+/* find a strategy by name
+ * return the enum plm_http_lb_type or -1
+ */
+int plm_http_lb_type(const plm_string_t *name);
+
+/* pick a backend for the request with the configured strategy
+ * return the index of the backend, or -1 if out of memory
+ */
+int plm_http_lb_select(struct plm_http_req *r);
+
+/* a request is sent to or done with a backend, counts the requests in
+ * flight of the current thread
+ */
+void plm_http_lb_start(int backend);
+void plm_http_lb_done(int backend);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -24,7 +24,9 @@
  */
 
 #include <assert.h>
+#include <strings.h>
 #include "plm_http_parser.h"
+#include "plm_http_scan.h"
 
 enum plm_parser_state {
 	PLM_PRS_NONE,
@@ -39,131 +41,283 @@ enum plm_parser_state {
 	PLM_PRS_HDR_DONE
 };
 
+#define HDR(s) { s, sizeof(s) - 1 }
+
+/* indexed by enum plm_http_mthd */
+static plm_string_t plm_http_mthd_names[] = {
+	HDR(""),
+	HDR("CONNECT"),
+	HDR("DELETE"),
+	HDR("GET"),
+	HDR("HEAD"),
+	HDR("POST"),
+	HDR("PUT"),
+	HDR("OPTIONS"),
+	HDR("TRACE")
+};
+
+/* indexed by enum plm_http_hdr */
+static plm_string_t plm_http_hdr_names[PLM_HDR_NUM] = {
+	HDR("Host"),
+	HDR("Connection"),
+	HDR("Proxy-Connection"),
+	HDR("Keep-Alive"),
+	HDR("Content-Length"),
+	HDR("Content-Type"),
+	HDR("Transfer-Encoding"),
+	HDR("TE"),
+	HDR("Trailer"),
+	HDR("Upgrade"),
+	HDR("Expect"),
+	HDR("Cache-Control"),
+	HDR("Pragma"),
+	HDR("Expires"),
+	HDR("Date"),
+	HDR("Age"),
+	HDR("ETag"),
+	HDR("Last-Modified"),
+	HDR("If-Modified-Since"),
+	HDR("If-None-Match"),
+	HDR("Vary"),
+	HDR("Authorization"),
+	HDR("Location"),
+	HDR("Range"),
+	HDR("Content-Encoding"),
+	HDR("Accept-Encoding"),
+	HDR("User-Agent"),
+	HDR("Cookie"),
+	HDR("Set-Cookie"),
+	HDR("Content-Range"),
+	HDR("Accept-Ranges"),
+	HDR("Server"),
+	HDR("X-Forwarded-For"),
+	HDR("Via")
+};
+
+/* perfect hash of the names above:
+ * (len + lower(first char) + lower(last char) * 23) & 127
+ * -1 means no well known name hashes to the slot
+ */
+#define PLM_HDR_HASH(l, f, e) (((l) + (f) + (e) * 23) & 127)
+
+static const int8_t plm_http_hdr_slots[128] = {
+	-1, -1,  5, 29, -1, -1, -1, -1,  3,  7, 23, -1, -1, 18, -1,  9,
+	28, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+	-1, -1, -1, -1, 11, -1, -1, -1, -1, -1, 16, -1, -1, 12, -1, -1,
+	33, 25, -1, -1, 24, -1, -1, 31, -1,  8, -1, -1, -1, -1, -1, -1,
+	-1, 13, -1, 30, -1, 32,  6, -1, -1,  4, -1, -1, -1, -1, 19,  1,
+	21, -1, -1, -1, -1, -1, 22, 10,  0, 20, -1, -1, -1, -1, -1, -1,
+	-1, -1,  2, -1, -1, -1, -1, -1, -1, -1, -1, 26, -1, -1, -1, -1,
+	-1, -1, -1, -1, -1, 17, -1, 15, -1, -1, -1, 14, 27, -1, -1, -1
+};
+
+/* the methods with the space behind them, and the versions, compared a
+ * word at a time, shorter ones are padded with zero
+ */
+union plm_http_word {
+	char hw_str[8];
+	uint64_t hw_val;
+};
+
+static const union plm_http_word plm_http_mthd_words[] = {
+	{ "" },
+	{ { 'C', 'O', 'N', 'N', 'E', 'C', 'T', ' ' } },
+	{ "DELETE " },
+	{ "GET " },
+	{ "HEAD " },
+	{ "POST " },
+	{ "PUT " },
+	{ { 'O', 'P', 'T', 'I', 'O', 'N', 'S', ' ' } },
+	{ "TRACE " }
+};
+
+static const union plm_http_word plm_http_ver_words[] = {
+	{ "" },
+	{ { 'H', 'T', 'T', 'P', '/', '0', '.', '9' } },
+	{ { 'H', 'T', 'T', 'P', '/', '1', '.', '0' } },
+	{ { 'H', 'T', 'T', 'P', '/', '1', '.', '1' } }
+};
+
+/* the first n bytes of a word loaded from memory, n is 1 to 8 */
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define PLM_WORD_HEAD(w, n) ((w) & ~(~0ULL >> ((n) * 8 - 1) >> 1))
+#else
+#define PLM_WORD_HEAD(w, n) ((w) & ~(~0ULL << ((n) * 8 - 1) << 1))
+#endif
+
+static enum plm_http_ver plm_http_parser_ver(const char *, size_t);
+static enum plm_http_mthd plm_http_parser_mthd(const char *, size_t);
+
+/* map a header field name to enum plm_http_hdr
+ * @name -- field name, case insensitive
+ * @len -- length of name
+ * return PLM_HDR_OTHER if it is not a well known name
+ */
+int plm_http_hdr_id(const char *name, size_t len)
+{
+	int id;
+	unsigned char f, e;
+
+	if (len == 0)
+		return (PLM_HDR_OTHER);
+
+	f = (unsigned char)name[0] | 0x20;
+	e = (unsigned char)name[len - 1] | 0x20;
+	id = plm_http_hdr_slots[PLM_HDR_HASH(len, f, e)];
+	if (id < 0 || plm_http_hdr_names[id].s_len != len
+		|| strncasecmp(plm_http_hdr_names[id].s_str, name, len))
+		return (PLM_HDR_OTHER);
+
+	return (id);
+}
+
+/* return the canonical name of a well known header */
+const plm_string_t *plm_http_hdr_name(int id)
+{
+	assert(id >= 0 && id < PLM_HDR_NUM);
+	return (&plm_http_hdr_names[id]);
+}
+
+/* return the name of a method */
+const plm_string_t *plm_http_mthd_name(enum plm_http_mthd mthd)
+{
+	assert(mthd >= PLM_MTHD_NONE && mthd <= PLM_MTHD_TRACE);
+	return (&plm_http_mthd_names[mthd]);
+}
+
+/* HTTP/x.y, compared as one word */
+static enum plm_http_ver plm_http_parser_ver(const char *s, size_t len)
+{
+	uint64_t w;
+
+	if (len != 8)
+		return (PLM_HTTP_VNONE);
+
+	w = plm_http_word(s);
+	if (w == plm_http_ver_words[PLM_HTTP_11].hw_val)
+		return (PLM_HTTP_11);
+	if (w == plm_http_ver_words[PLM_HTTP_10].hw_val)
+		return (PLM_HTTP_10);
+	if (w == plm_http_ver_words[PLM_HTTP_09].hw_val)
+		return (PLM_HTTP_09);
+
+	return (PLM_HTTP_VNONE);
+}
+
+/* the method and the space behind it compared as one word, the caller
+ * makes sure 8 bytes can be read at s
+ * @n -- length of the method
+ */
+static enum plm_http_mthd plm_http_parser_mthd(const char *s, size_t n)
+{
+	uint64_t w = PLM_WORD_HEAD(plm_http_word(s), n + 1);
+
+#define PLM_MTHD_IS(m) (w == plm_http_mthd_words[m].hw_val)
+
+	switch (n) {
+	case 3:
+		if (PLM_MTHD_IS(PLM_MTHD_GET))
+			return (PLM_MTHD_GET);
+		if (PLM_MTHD_IS(PLM_MTHD_PUT))
+			return (PLM_MTHD_PUT);
+		break;
+	case 4:
+		if (PLM_MTHD_IS(PLM_MTHD_POST))
+			return (PLM_MTHD_POST);
+		if (PLM_MTHD_IS(PLM_MTHD_HEAD))
+			return (PLM_MTHD_HEAD);
+		break;
+	case 5:
+		if (PLM_MTHD_IS(PLM_MTHD_TRACE))
+			return (PLM_MTHD_TRACE);
+		break;
+	case 6:
+		if (PLM_MTHD_IS(PLM_MTHD_DELETE))
+			return (PLM_MTHD_DELETE);
+		break;
+	case 7:
+		if (PLM_MTHD_IS(PLM_MTHD_CONNECT))
+			return (PLM_MTHD_CONNECT);
+		if (PLM_MTHD_IS(PLM_MTHD_OPTIONS))
+			return (PLM_MTHD_OPTIONS);
+		break;
+	}
+
+#undef PLM_MTHD_IS
+
+	return (PLM_MTHD_NONE);
+}
+
 static int
 plm_http_parser_req_line(plm_http_parser_t *psr, plm_string_t *s)
 {
-	enum plm_http_mthd mthd = PLM_MTHD_NONE;
-	char *str = s->s_str, *lf, *p;
-	size_t len = s->s_len, i;
-	plm_string_t url, verstr;
-	enum plm_http_ver ver = PLM_HTTP_VNONE;
+	enum plm_http_mthd mthd;
+	char *str = s->s_str, *lf, *end, *p;
+	size_t len = s->s_len, i, n;
+	plm_string_t url;
+	enum plm_http_ver ver;
 
+	/* the spaces before the line are parsed away */
 	for (i = 0; i < len && str[i] == ' '; i++) /* none */;
 
 	if (i > 0) {
+		psr->hp_parsed += i;
+		s->s_str += i;
+		s->s_len -= i;
 		len -= i;
 		str += i;
 	}
 
-	/* find the end of request line */
-	lf = memchr(str, '\n', len);
-	if (!lf)
+	/* find the end of request line from where the last call stopped */
+	lf = (char *)plm_http_scan(str + psr->hp_scan, str + len, '\n', '\n');
+	if (lf == str + len) {
+		psr->hp_scan = len;
 		return (PLM_HTTP_PARSE_AGAIN);
+	}
 
-	len = lf - 1 - str;
-	*(lf - 1) = '\0';
-	
-	/* split method, url, version */
-	p = memchr(str, ' ', len);
-	if (!p)
+	psr->hp_scan = 0;
+
+	end = (lf > str && *(lf - 1) == '\r') ? lf - 1 : lf;
+
+	/* the shortest line, "PUT * HTTP/1.1", holds the word of a method */
+	if (end - str < 14)
 		return (PLM_HTTP_PARSE_ERROR);
 
-	/* parse method */
-	*p = '\0';
-	switch (*str) {
-	case 'C':
-		if (0 == strcmp(str, "CONNECT"))
-			mthd = PLM_MTHD_CONNECT;
-		break;
-	case 'D':
-		if (0 == strcmp(str, "DELETE"))
-			mthd = PLM_MTHD_DELETE;
-		break;
-	case 'G':
-		if (0 == strcmp(str, "GET"))
-			mthd = PLM_MTHD_GET;
-		break;
-	case 'H':
-		if (0 == strcmp(str, "HEAD"))
-			mthd = PLM_MTHD_HEAD;
-		break;
-	case 'P':
-		if (0 == strcmp(str, "POST"))
-			mthd = PLM_MTHD_POST;
-		else if (0 == strcmp(str, "PUT"))
-			mthd = PLM_MTHD_PUT;
-		break;
-	case 'O':
-		if (0 == strcmp(str, "OPTIONS"))
-			mthd = PLM_MTHD_OPTIONS;
-		break;
-	case 'T':
-		if (0 == strcmp(str, "TRACE"))
-			mthd = PLM_MTHD_TRACE;
-		break;
-	}
+	/* split method, url, version, no method is longer than 7 bytes */
+	p = (char *)plm_http_scan(str, str + 8, ' ', ' ');
+	if (p == str + 8)
+		return (PLM_HTTP_PARSE_ERROR);
 
+	mthd = plm_http_parser_mthd(str, p - str);
 	if (mthd == PLM_MTHD_NONE)
 		return (PLM_HTTP_PARSE_ERROR);
 
 	/* find URL */
-	while (*(++p) == ' ');
-	len -= p - str;
+	while (p < end && *p == ' ')
+		p++;
 	str = p;
-	p = memchr(str, ' ', len);
-	if (!p)
+	p = (char *)plm_http_scan(str, end, ' ', ' ');
+	if (p == end || p == str)
 		return (PLM_HTTP_PARSE_ERROR);
 
-	*p = '\0';
 	url.s_str = str;
 	url.s_len = p - str;
 
 	/* parse HTTP VERSION */
-	while (*(++p) == ' ');
-	len -= p - str;
-	verstr.s_str = p;
-	verstr.s_len = len;
+	while (p < end && *p == ' ')
+		p++;
 
-	if (memcmp(verstr.s_str, "HTTP/", 5))
+	ver = plm_http_parser_ver(p, end - p);
+	if (ver == PLM_HTTP_VNONE)
 		return (PLM_HTTP_PARSE_ERROR);
 
-	do {
-		char *maj, *min;
-		int v1, v2;
-
-		min = maj = verstr.s_str + 5;
-		while (*min) {
-			if (*min == '.') {
-				*min++ = '\0';
-				break;
-			}
-			min++;
-		}
-
-		/* min reach the end means that version string is invalid */
-		if (*min == '\0')
-			return (PLM_HTTP_PARSE_ERROR);
-		
-		v1 = (uint8_t)atoi(maj);
-		v2 = (uint8_t)atoi(min);
-
-		if (v1 == 1) {
-			if (v2 == 1)
-				ver = PLM_HTTP_11;
-			else if (v2 == 0)
-				ver = PLM_HTTP_10;
-		} else if (v1 == 0 && v2 == 9) {
-			ver = PLM_HTTP_09;
-		}
-
-	} while (0);
-
 	assert(psr->hp_on_req_line);
-	psr->hp_parsed = lf + 1 - s->s_str;
+	n = lf + 1 - s->s_str;
+	psr->hp_parsed += n;
 	
-	assert(psr->hp_parsed <= s->s_len);
-	s->s_str += psr->hp_parsed;
-	s->s_len -= psr->hp_parsed;
+	assert(n <= s->s_len);
+	s->s_str += n;
+	s->s_len -= n;
 
 	psr->hp_state = PLM_PRS_RL_DONE;
 	return (psr->hp_on_req_line(mthd, &url, ver, psr->hp_data) ?
@@ -176,66 +330,108 @@ plm_http_parser_field(plm_http_parser_t *psr, plm_string_t *s)
 	int rc = PLM_HTTP_PARSE_AGAIN;
 	
 	for (;;) {
-		char *str = s->s_str, *lf, *p;
-		size_t len = s->s_len, i;
+		char *str = s->s_str, *lf, *end, *p, *k;
+		size_t len = s->s_len, n;
 		plm_string_t key, value;
 
-		for (i = 0; i < len && str[i] == ' '; i++) /* none */ ;
-		str += i;
-		len -= i;
+		if (len == 0)
+			break;
+
+		/* an empty line ends the header */
+		if (str[0] == '\r' || str[0] == '\n') {
+			if (str[0] == '\n') {
+				n = 1;
+			} else if (len > 1 && str[1] == '\n') {
+				n = 2;
+			} else if (len == 1) {
+				psr->hp_parsed++;
+				s->s_str++;
+				s->s_len--;
+				psr->hp_state = PLM_PRS_HDR_CR;
+				break;
+			} else {
+				rc = PLM_HTTP_PARSE_ERROR;
+				break;
+			}
 
-		lf = memchr(str, '\n', len);
-		if (!lf)
-			return (PLM_HTTP_PARSE_AGAIN);
+			psr->hp_parsed += n;
+			s->s_str += n;
+			s->s_len -= n;
 
-		if (*(lf - 1) != '\r')
-			return (PLM_HTTP_PARSE_ERROR);
+			rc = PLM_HTTP_PARSE_DONE;
+			psr->hp_state = PLM_PRS_HDR_DONE;
+			if (psr->hp_on_hdr_done)
+				psr->hp_on_hdr_done(psr->hp_data);
+			break;
+		}
+
+		/* the colon and the end of line in one pass, resumed where
+		 * the last call stopped
+		 */
+		k = str + psr->hp_scan;
+		if (psr->hp_colon == 0) {
+			p = (char *)plm_http_scan(k, str + len, ':', '\n');
+			if (p == str + len) {
+				psr->hp_scan = len;
+				break;
+			}
+
+			if (*p == '\n' || p == str) {
+				rc = PLM_HTTP_PARSE_ERROR;
+				break;
+			}
+
+			psr->hp_colon = p - str;
+			k = p + 1;
+		} else {
+			p = str + psr->hp_colon;
+		}
+
+		lf = (char *)plm_http_scan(k, str + len, '\n', '\n');
+		if (lf == str + len) {
+			psr->hp_scan = len;
+			break;
+		}
 
-		len = lf - 1 - str;
-		*(lf - 1) = '\0';
+		psr->hp_scan = psr->hp_colon = 0;
 
-		p = strchr(str, ':');
-		if (!p) {
+		if (*(lf - 1) != '\r') {
 			rc = PLM_HTTP_PARSE_ERROR;
 			break;
 		}
 
-		*p = '\0';
-		for (i = p - str - 1; i >= 0 && i == ' '; i--) /* none */ ;
+		end = lf - 1;
+
+		/* no white space between the name and colon, RFC 7230 3.2.4 */
+		if (*(p - 1) == ' ' || *(p - 1) == '\t' || str[0] == ' ') {
+			rc = PLM_HTTP_PARSE_ERROR;
+			break;
+		}
 
 		key.s_str = str;
-		key.s_len = i + 1;
+		key.s_len = p - str;
+
+		/* trim the optional white space around the value */
+		for (k = p + 1; k < end && (*k == ' ' || *k == '\t'); k++)
+			/* none */ ;
+		while (end > k && (*(end - 1) == ' ' || *(end - 1) == '\t'))
+			end--;
 
-		while (*(++p) == ' ') /* none */ ;
-		value.s_str = p;
-		value.s_len = len - (p - str);
+		value.s_str = k;
+		value.s_len = end - k;
+
+		n = lf + 1 - str;
+		psr->hp_parsed += n;
+		s->s_len -= n;
+		s->s_str += n;
 
-		psr->hp_parsed += lf + 1 - s->s_str;
 		if (psr->hp_on_field) {
-			if (psr->hp_on_field(&key, &value, psr->hp_data)) {
+			int id = plm_http_hdr_id(key.s_str, key.s_len);
+			if (psr->hp_on_field(id, &key, &value, psr->hp_data)) {
 				rc = PLM_HTTP_PARSE_BREAK;
 				break;
 			}
 		}
-
-		s->s_len -= psr->hp_parsed;
-		s->s_str += psr->hp_parsed;
-		if (s->s_len <= 0)
-			break;
-
-		if (s->s_str[0] == '\r') {
-			psr->hp_parsed++;
-			psr->hp_state = PLM_PRS_HDR_CR;
-			if (s->s_len - 1 > 0 && s->s_str[1] == '\n') {
-				rc = PLM_HTTP_PARSE_DONE;
-				psr->hp_state = PLM_PRS_HDR_DONE;
-				psr->hp_parsed++;
-
-				if (psr->hp_on_hdr_done)
-					psr->hp_on_hdr_done(psr->hp_data);
-			}
-			break;
-		}
 	}
 
 	return (rc);
@@ -244,96 +440,71 @@ plm_http_parser_field(plm_http_parser_t *psr, plm_string_t *s)
 static int
 plm_http_parser_status_line(plm_http_parser_t *psr, plm_string_t *s)
 {
-	char *str = s->s_str, *lf, *p;
-	size_t len = s->s_len, i;
-	plm_string_t verstr, desc;
-	enum plm_http_ver ver = PLM_HTTP_VNONE;
+	char *str = s->s_str, *lf, *end, *p;
+	size_t len = s->s_len, i, n;
+	plm_string_t desc;
+	enum plm_http_ver ver;
 	int code;
 
+	/* the spaces before the line are parsed away */
 	for (i = 0; i < len && str[i] == ' '; i++) /* none */;
 
 	if (i > 0) {
+		psr->hp_parsed += i;
+		s->s_str += i;
+		s->s_len -= i;
 		len -= i;
 		str += i;
 	}
 
-	/* find the end of status line */
-	lf = memchr(str, '\n', len);
-	if (!lf)
+	/* find the end of status line from where the last call stopped */
+	lf = (char *)plm_http_scan(str + psr->hp_scan, str + len, '\n', '\n');
+	if (lf == str + len) {
+		psr->hp_scan = len;
 		return (PLM_HTTP_PARSE_AGAIN);
+	}
+
+	psr->hp_scan = 0;
 	
-	if (*(lf - 1) != '\r')
+	if (lf == str || *(lf - 1) != '\r')
 		return (PLM_HTTP_PARSE_ERROR);
 
-	len = lf - 1 - str;
-	*(lf - 1) = '\0';
+	end = lf - 1;
 	
-	/* split version, code, description */
-	p = memchr(str, ' ', len);
-	if (!p)
+	/* split version, code, description, the version is one word */
+	if (end - str < 9 || str[8] != ' ')
 		return (PLM_HTTP_PARSE_ERROR);
-
-	*p = '\0';
+	p = str + 8;
 
 	/* HTTP VERSION */
-	verstr.s_str = str;
-	verstr.s_len = p - str;
-	if (memcmp(verstr.s_str, "HTTP/", 5))
+	ver = plm_http_parser_ver(str, 8);
+	if (ver == PLM_HTTP_VNONE)
 		return (PLM_HTTP_PARSE_ERROR);
 
-	do {
-		char *maj, *min;
-		int v1, v2;
-
-		min = maj = verstr.s_str + 5;
-		while (*min) {
-			if (*min == '.') {
-				*min++ = '\0';
-				break;
-			}
-			min++;
-		}
+	/* http response code, exactly three digits */
+	while (p < end && *p == ' ')
+		p++;
+	if (end - p < 3)
+		return (PLM_HTTP_PARSE_ERROR);
 
-		/* min reach the end means that version string is invalid */
-		if (*min == '\0')
+	for (code = 0, i = 0; i < 3; i++) {
+		if (p[i] < '0' || p[i] > '9')
 			return (PLM_HTTP_PARSE_ERROR);
-		
-		v1 = (uint8_t)atoi(maj);
-		v2 = (uint8_t)atoi(min);
-
-		if (v1 == 1) {
-			if (v2 == 1)
-				ver = PLM_HTTP_11;
-			else if (v2 == 0)
-				ver = PLM_HTTP_10;
-		} else if (v1 == 0 && v2 == 9) {
-			ver = PLM_HTTP_09;
-		}
-
-	} while (0);
-
-	/* http response code */
-	while (*(++p) == ' ');
-	len -= p - str;	
-	str = p;
-	p = memchr(str, ' ', len);
-	if (!p)
-		return (PLM_HTTP_PARSE_ERROR);
-	
-	*p = '\0';
-	code = atoi(str);
+		code = code * 10 + (p[i] - '0');
+	}
+	p += 3;
 
 	/* description */
-	while (*(++p) == ' ');
-	len -= p - str;
-	str = p;
-	desc.s_str = str;
-	desc.s_len = len;
-
-	psr->hp_parsed = lf + 1 - s->s_str;
-	assert(psr->hp_parsed <= s->s_len);
-	s->s_str += psr->hp_parsed;
-	s->s_len -= psr->hp_parsed;
+	while (p < end && *p == ' ')
+		p++;
+	desc.s_str = p;
+	desc.s_len = end - p;
+
+	n = lf + 1 - s->s_str;
+	psr->hp_parsed += n;
+	assert(n <= s->s_len);
+	s->s_str += n;
+	s->s_len -= n;
 	
 	assert(psr->hp_on_status_line);
 	psr->hp_state = PLM_PRS_SL_DONE;
@@ -385,6 +556,8 @@ RETRY:
 			s->s_str++;
 			s->s_len--;
 			rc = PLM_HTTP_PARSE_DONE;
+			if (psr->hp_on_hdr_done)
+				psr->hp_on_hdr_done(psr->hp_data);
 		} else {
 			rc = PLM_HTTP_PARSE_ERROR;
 		}
@@ -446,6 +619,8 @@ RETRY:
 			s->s_str++;
 			s->s_len--;
 			rc = PLM_HTTP_PARSE_DONE;
+			if (psr->hp_on_hdr_done)
+				psr->hp_on_hdr_done(psr->hp_data);
 		} else {
 			rc = PLM_HTTP_PARSE_ERROR;
 		}
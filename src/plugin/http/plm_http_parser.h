@@ -62,6 +62,49 @@ enum plm_http_mthd {
 	PLM_MTHD_TRACE
 };
 
+/* well known header fields, the parser maps a field name to one of
+ * these with a perfect hash so the caller can keep them in fixed slots,
+ * any other name is reported as PLM_HDR_OTHER
+ */
+enum plm_http_hdr {
+	PLM_HDR_HOST,
+	PLM_HDR_CONNECTION,
+	PLM_HDR_PROXY_CONNECTION,
+	PLM_HDR_KEEP_ALIVE,
+	PLM_HDR_CONTENT_LENGTH,
+	PLM_HDR_CONTENT_TYPE,
+	PLM_HDR_TRANSFER_ENCODING,
+	PLM_HDR_TE,
+	PLM_HDR_TRAILER,
+	PLM_HDR_UPGRADE,
+	PLM_HDR_EXPECT,
+	PLM_HDR_CACHE_CONTROL,
+	PLM_HDR_PRAGMA,
+	PLM_HDR_EXPIRES,
+	PLM_HDR_DATE,
+	PLM_HDR_AGE,
+	PLM_HDR_ETAG,
+	PLM_HDR_LAST_MODIFIED,
+	PLM_HDR_IF_MODIFIED_SINCE,
+	PLM_HDR_IF_NONE_MATCH,
+	PLM_HDR_VARY,
+	PLM_HDR_AUTHORIZATION,
+	PLM_HDR_LOCATION,
+	PLM_HDR_RANGE,
+	PLM_HDR_CONTENT_ENCODING,
+	PLM_HDR_ACCEPT_ENCODING,
+	PLM_HDR_USER_AGENT,
+	PLM_HDR_COOKIE,
+	PLM_HDR_SET_COOKIE,
+	PLM_HDR_CONTENT_RANGE,
+	PLM_HDR_ACCEPT_RANGES,
+	PLM_HDR_SERVER,
+	PLM_HDR_X_FORWARDED_FOR,
+	PLM_HDR_VIA,
+	PLM_HDR_NUM,
+	PLM_HDR_OTHER = PLM_HDR_NUM
+};
+
 typedef struct plm_http_parser {
 	/* parse state */
 	int hp_state;
@@ -69,17 +112,29 @@ typedef struct plm_http_parser {
 	/* bytes parsed every time */
 	size_t hp_parsed;
 
+	/* a line split over reads is scanned once, the bytes of it already
+	 * scanned and the colon of a field, both counted from the first byte
+	 * not parsed, which the caller passes again with more bytes behind
+	 */
+	size_t hp_scan;
+	size_t hp_colon;
+
 	/* user data */
 	void *hp_data;
 
-	/* return 0 indicate success, else -1 to break parse */
+	/* return 0 indicate success, else -1 to break parse,
+	 * the strings passed to the hooks point into the buffer being
+	 * parsed, the parser never modifies or copies the buffer
+	 */
 	
 	int (*hp_on_req_line)(enum plm_http_mthd, const plm_string_t *,
 						  enum plm_http_ver, void *);
 	
 	int (*hp_on_status_line)(enum plm_http_ver, int, plm_string_t *, void *);
 
-	int (*hp_on_field)(const plm_string_t *, const plm_string_t *, void *);
+	/* the first argument is the enum plm_http_hdr of the name */
+	int (*hp_on_field)(int, const plm_string_t *, const plm_string_t *,
+					   void *);
 	
 	void (*hp_on_hdr_done)(void *);
 	
@@ -92,7 +147,8 @@ struct plm_http_url {
 	plm_string_t hu_path;
 };
 
-#define plm_http_parser_init(p, v) ((p)->hp_state = 0, (p)->hp_data = (v))
+#define plm_http_parser_init(p, v) \
+	((p)->hp_state = 0, (p)->hp_scan = (p)->hp_colon = 0, (p)->hp_data = (v))
 
 int plm_http_parser_req(plm_http_parser_t *parser, plm_string_t *s);
 
@@ -100,6 +156,19 @@ int plm_http_parser_resp(plm_http_parser_t *parser, plm_string_t *s);
 
 int plm_http_parser_url(struct plm_http_url *out, const plm_string_t *url);
 
+/* map a header field name to enum plm_http_hdr
+ * @name -- field name, case insensitive
+ * @len -- length of name
+ * return PLM_HDR_OTHER if it is not a well known name
+ */
+int plm_http_hdr_id(const char *name, size_t len);
+
+/* return the canonical name of a well known header */
+const plm_string_t *plm_http_hdr_name(int id);
+
+/* return the name of a method */
+const plm_string_t *plm_http_mthd_name(enum plm_http_mthd mthd);
+
 #ifdef __cplusplus
 }
 #endif
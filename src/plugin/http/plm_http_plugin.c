@@ -32,16 +32,36 @@
 #include <sys/un.h>
 
 #include "plm_plugin.h"
+#include "plm_pipe.h"
 #include "plm_http.h"
 #include "plm_http_request.h"
+#include "plm_http_backend.h"
+#include "plm_http_lb.h"
+#include "plm_http_disk.h"
+#include "plm_http_scan.h"
 #include "plm_http_plugin.h"
 
 #define DEF_BACKLOG 5
+#define DEF_SPLICE_MIN (256 * 1024)
+#define DEF_KEEPALIVE_MAX 32
+#define DEF_KEEPALIVE_TIMEOUT 60000
+#define DEF_CACHE_OBJ_MAX (1024 * 1024)
+#define DEF_PIPELINE 8
+#define DEF_HEADER_MAX 8192
 
 static void *plm_http_ctx_create(void *);
 static void plm_http_ctx_destroy(void *);
 static int plm_http_listen_set(void *, plm_dlist_t *);
 static int plm_http_backend_set(void *, plm_dlist_t *);
+static int plm_http_header_copy_set(void *, plm_dlist_t *);
+static int plm_http_splice_set(void *, plm_dlist_t *);
+static int plm_http_backend_keepalive_set(void *, plm_dlist_t *);
+static int plm_http_balance_set(void *, plm_dlist_t *);
+static int plm_http_cache_set(void *, plm_dlist_t *);
+static int plm_http_cache_disk_set(void *, plm_dlist_t *);
+static int plm_http_cache_coalesce_set(void *, plm_dlist_t *);
+static int plm_http_pipeline_set(void *, plm_dlist_t *);
+static int plm_http_header_max_set(void *, plm_dlist_t *);
 
 /* shared from plume main context */
 static struct plm_share_param sp;
@@ -72,6 +92,78 @@ static struct plm_cmd http_cmds[] = {
 		NULL,
 		NULL
 	},
+	{
+		&http_plugin,
+		plm_string("http_header_copy"),
+		PLM_INSTRUCTION,
+		plm_http_header_copy_set,
+		NULL,
+		NULL
+	},
+	{
+		&http_plugin,
+		plm_string("http_splice"),
+		PLM_INSTRUCTION,
+		plm_http_splice_set,
+		NULL,
+		NULL
+	},
+	{
+		&http_plugin,
+		plm_string("http_backend_keepalive"),
+		PLM_INSTRUCTION,
+		plm_http_backend_keepalive_set,
+		NULL,
+		NULL
+	},
+	{
+		&http_plugin,
+		plm_string("http_balance"),
+		PLM_INSTRUCTION,
+		plm_http_balance_set,
+		NULL,
+		NULL
+	},
+	{
+		&http_plugin,
+		plm_string("http_cache"),
+		PLM_INSTRUCTION,
+		plm_http_cache_set,
+		NULL,
+		NULL
+	},
+	{
+		&http_plugin,
+		plm_string("http_cache_disk"),
+		PLM_INSTRUCTION,
+		plm_http_cache_disk_set,
+		NULL,
+		NULL
+	},
+	{
+		&http_plugin,
+		plm_string("http_cache_coalesce"),
+		PLM_INSTRUCTION,
+		plm_http_cache_coalesce_set,
+		NULL,
+		NULL
+	},
+	{
+		&http_plugin,
+		plm_string("http_pipeline"),
+		PLM_INSTRUCTION,
+		plm_http_pipeline_set,
+		NULL,
+		NULL
+	},
+	{
+		&http_plugin,
+		plm_string("http_header_max"),
+		PLM_INSTRUCTION,
+		plm_http_header_max_set,
+		NULL,
+		NULL
+	},
 	{0}
 };
 
@@ -98,6 +190,15 @@ void *plm_http_ctx_create(void *parent)
 	if (ctx) {
 		memset(ctx, 0, sizeof(struct plm_http_ctx));
 		ctx->hc_backlog = DEF_BACKLOG;
+		ctx->hc_splice_min = DEF_SPLICE_MIN;
+		ctx->hc_keepalive_max = DEF_KEEPALIVE_MAX;
+		ctx->hc_keepalive_timeout = DEF_KEEPALIVE_TIMEOUT;
+		ctx->hc_lb = PLM_LB_RR;
+		ctx->hc_lb_key = PLM_LB_KEY_HOST;
+		ctx->hc_cache_obj_max = DEF_CACHE_OBJ_MAX;
+		ctx->hc_cache_coalesce = 1;
+		ctx->hc_pipeline = DEF_PIPELINE;
+		ctx->hc_header_max = DEF_HEADER_MAX;
 
 		PLM_LIST_INIT(&ctx->hc_backends);
 	}
@@ -112,6 +213,8 @@ void plm_http_ctx_destroy(void *data)
 	ctx = (struct plm_http_ctx *)data;
 	if (ctx->hc_addr.s_str)
 		plm_strclear(&ctx->hc_addr);
+	if (ctx->hc_cache_disk.s_str)
+		plm_strclear(&ctx->hc_cache_disk);
 
 	/* free all backends */
 	do {
@@ -166,10 +269,12 @@ int plm_http_listen_set(void *ctx, plm_dlist_t *param_list)
 	return (0);
 }
 
-/* http_backend 192.168.1.102 80 */
+/* http_backend 192.168.1.102 80 1
+ * the weight, 1 if omitted, is the share of requests the backend gets
+ */
 int plm_http_backend_set(void *ctx, plm_dlist_t *param_list)
 {
-	int n;
+	int n, weight = 1;
 	unsigned short port;
 	struct plm_http_ctx *http_ctx;
 	struct plm_cmd_param *param;
@@ -179,7 +284,7 @@ int plm_http_backend_set(void *ctx, plm_dlist_t *param_list)
 
 	n = PLM_DLIST_LEN(param_list);
 	http_ctx = (struct plm_http_ctx *)ctx;
-	if (n != 3) {
+	if (n != 2 && n != 3) {
 		plm_log_syslog("the number of http_backend's param is wrong");
 		return (-1);
 	}
@@ -202,6 +307,15 @@ int plm_http_backend_set(void *ctx, plm_dlist_t *param_list)
 	port = plm_str2s(&param->cp_data);
 	tmp.sin_port = htons(port);
 
+	if (n == 3) {
+		param = (struct plm_cmd_param *)PLM_DLIST_NEXT(&param->cp_node);
+		weight = plm_str2i(&param->cp_data);
+		if (weight < 1) {
+			plm_log_syslog("invalid backend weight");
+			return (-1);
+		}
+	}
+
 	backend = (struct plm_http_backend *)malloc(sizeof(*backend));
 	if (!backend) {
 		plm_log_syslog("memory allocate failed: %s %d",
@@ -213,11 +327,315 @@ int plm_http_backend_set(void *ctx, plm_dlist_t *param_list)
 	backend->hb_addr.sin_family = tmp.sin_family;
 	backend->hb_addr.sin_addr = tmp.sin_addr;
 	backend->hb_addr.sin_port = tmp.sin_port;
+	backend->hb_weight = weight;
 
 	PLM_LIST_ADD_FRONT(&http_ctx->hc_backends, &backend->hb_node);
 	return (0);
 }
 
+/* http_header_copy on|off
+ * off, the default, indexes header fields where they are in the input
+ * buffer, on copies every field out of the buffer
+ */
+int plm_http_header_copy_set(void *ctx, plm_dlist_t *param_list)
+{
+	struct plm_http_ctx *http_ctx;
+	struct plm_cmd_param *param;
+	plm_string_t on = plm_string("on");
+
+	http_ctx = (struct plm_http_ctx *)ctx;
+	if (PLM_DLIST_LEN(param_list) != 1) {
+		plm_log_syslog("the number of http_header_copy's param is wrong");
+		return (-1);
+	}
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(param_list);
+	http_ctx->hc_hdr_copy = 0 == plm_strcmp(&param->cp_data, &on);
+	return (0);
+}
+
+/* http_splice 262144|off
+ * bodies with a known length of at least this many bytes are moved
+ * between the sockets with splice through a pipe and never copied to
+ * user space, off relays every body through buffers
+ */
+int plm_http_splice_set(void *ctx, plm_dlist_t *param_list)
+{
+	struct plm_http_ctx *http_ctx;
+	struct plm_cmd_param *param;
+	plm_string_t off = plm_string("off");
+	long long n;
+
+	http_ctx = (struct plm_http_ctx *)ctx;
+	if (PLM_DLIST_LEN(param_list) != 1) {
+		plm_log_syslog("the number of http_splice's param is wrong");
+		return (-1);
+	}
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(param_list);
+	if (0 == plm_strcmp(&param->cp_data, &off)) {
+		http_ctx->hc_splice_min = 0;
+		return (0);
+	}
+
+	n = plm_str2ll(&param->cp_data);
+	if (n <= 0) {
+		plm_log_syslog("invalid http_splice threshold");
+		return (-1);
+	}
+
+	http_ctx->hc_splice_min = n;
+	return (0);
+}
+
+/* http_backend_keepalive 32 60000|off
+ * keep at most 32 idle connections per backend and thread, and close
+ * one idle for 60000 ms, off opens a connection per request
+ */
+int plm_http_backend_keepalive_set(void *ctx, plm_dlist_t *param_list)
+{
+	int n;
+	struct plm_http_ctx *http_ctx;
+	struct plm_cmd_param *param;
+	plm_string_t off = plm_string("off");
+
+	n = PLM_DLIST_LEN(param_list);
+	http_ctx = (struct plm_http_ctx *)ctx;
+	if (n != 1 && n != 2) {
+		plm_log_syslog("the number of http_backend_keepalive's param "
+					   "is wrong");
+		return (-1);
+	}
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(param_list);
+	if (0 == plm_strcmp(&param->cp_data, &off)) {
+		http_ctx->hc_keepalive_max = 0;
+		return (0);
+	}
+
+	http_ctx->hc_keepalive_max = plm_str2i(&param->cp_data);
+	if (n == 2) {
+		param = (struct plm_cmd_param *)PLM_DLIST_NEXT(&param->cp_node);
+		http_ctx->hc_keepalive_timeout = plm_str2i(&param->cp_data);
+	}
+
+	if (http_ctx->hc_keepalive_max < 0
+		|| http_ctx->hc_keepalive_timeout <= 0) {
+		plm_log_syslog("invalid http_backend_keepalive param");
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* http_balance rr|least_conn|p2c|hash [host|url]
+ * rr, the default, is smooth weighted round robin, least_conn picks the
+ * backend with the fewest requests in flight per weight, p2c the less
+ * loaded of two random ones, hash maps the Host header or the url to a
+ * backend with a consistent hash ring
+ */
+int plm_http_balance_set(void *ctx, plm_dlist_t *param_list)
+{
+	int n;
+	struct plm_http_ctx *http_ctx;
+	struct plm_cmd_param *param;
+	plm_string_t host = plm_string("host");
+	plm_string_t url = plm_string("url");
+
+	n = PLM_DLIST_LEN(param_list);
+	http_ctx = (struct plm_http_ctx *)ctx;
+	if (n != 1 && n != 2) {
+		plm_log_syslog("the number of http_balance's param is wrong");
+		return (-1);
+	}
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(param_list);
+	http_ctx->hc_lb = plm_http_lb_type(&param->cp_data);
+	if (http_ctx->hc_lb < 0) {
+		plm_log_syslog("unknown http_balance strategy");
+		return (-1);
+	}
+
+	if (n == 2) {
+		param = (struct plm_cmd_param *)PLM_DLIST_NEXT(&param->cp_node);
+		if (0 == plm_strcmp(&param->cp_data, &host)) {
+			http_ctx->hc_lb_key = PLM_LB_KEY_HOST;
+		} else if (0 == plm_strcmp(&param->cp_data, &url)) {
+			http_ctx->hc_lb_key = PLM_LB_KEY_URL;
+		} else {
+			plm_log_syslog("invalid http_balance hash key");
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/* http_cache 67108864|off 1048576
+ * keep up to 67108864 bytes of responses in memory, bodies larger than
+ * 1048576 bytes are never kept, off, the default, caches nothing
+ */
+int plm_http_cache_set(void *ctx, plm_dlist_t *param_list)
+{
+	int n;
+	struct plm_http_ctx *http_ctx;
+	struct plm_cmd_param *param;
+	plm_string_t off = plm_string("off");
+	long long size, obj;
+
+	n = PLM_DLIST_LEN(param_list);
+	http_ctx = (struct plm_http_ctx *)ctx;
+	if (n != 1 && n != 2) {
+		plm_log_syslog("the number of http_cache's param is wrong");
+		return (-1);
+	}
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(param_list);
+	if (0 == plm_strcmp(&param->cp_data, &off)) {
+		http_ctx->hc_cache_size = 0;
+		return (0);
+	}
+
+	size = plm_str2ll(&param->cp_data);
+	obj = http_ctx->hc_cache_obj_max;
+	if (n == 2) {
+		param = (struct plm_cmd_param *)PLM_DLIST_NEXT(&param->cp_node);
+		obj = plm_str2ll(&param->cp_data);
+	}
+
+	if (size <= 0 || obj < 0) {
+		plm_log_syslog("invalid http_cache param");
+		return (-1);
+	}
+
+	http_ctx->hc_cache_size = size;
+	http_ctx->hc_cache_obj_max = obj;
+	return (0);
+}
+
+/* http_cache_disk /var/cache/plume 1073741824|off
+ * responses evicted from the memory cache are kept in the file
+ * /var/cache/plume of 1073741824 bytes, its index is in the file
+ * /var/cache/plume.idx, off, the default, keeps them nowhere
+ */
+int plm_http_cache_disk_set(void *ctx, plm_dlist_t *param_list)
+{
+	struct plm_http_ctx *http_ctx;
+	struct plm_cmd_param *param;
+	plm_string_t off = plm_string("off");
+	long long size;
+
+	http_ctx = (struct plm_http_ctx *)ctx;
+	if (PLM_DLIST_LEN(param_list) != 2) {
+		plm_log_syslog("the number of http_cache_disk's param is wrong");
+		return (-1);
+	}
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(param_list);
+	if (http_ctx->hc_cache_disk.s_str)
+		plm_strclear(&http_ctx->hc_cache_disk);
+
+	plm_strzdup(&http_ctx->hc_cache_disk, &param->cp_data);
+	if (!http_ctx->hc_cache_disk.s_str) {
+		plm_log_syslog("strdup failed, memory emergent");
+		return (-1);
+	}
+
+	param = (struct plm_cmd_param *)PLM_DLIST_NEXT(&param->cp_node);
+	if (0 == plm_strcmp(&param->cp_data, &off)) {
+		http_ctx->hc_cache_disk_size = 0;
+		return (0);
+	}
+
+	size = plm_str2ll(&param->cp_data);
+	if (size < PLM_HTTP_DISK_MIN) {
+		plm_log_syslog("invalid http_cache_disk size");
+		return (-1);
+	}
+
+	http_ctx->hc_cache_disk_size = size;
+	return (0);
+}
+
+/* http_cache_coalesce on|off
+ * on, the default, a miss of a key already fetched from a backend waits
+ * for that response and is fed from it, off sends every miss
+ */
+int plm_http_cache_coalesce_set(void *ctx, plm_dlist_t *param_list)
+{
+	struct plm_http_ctx *http_ctx;
+	struct plm_cmd_param *param;
+	plm_string_t on = plm_string("on");
+
+	http_ctx = (struct plm_http_ctx *)ctx;
+	if (PLM_DLIST_LEN(param_list) != 1) {
+		plm_log_syslog("the number of http_cache_coalesce's param is wrong");
+		return (-1);
+	}
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(param_list);
+	http_ctx->hc_cache_coalesce = 0 == plm_strcmp(&param->cp_data, &on);
+	return (0);
+}
+
+/* http_pipeline 8|off
+ * process at most 8 requests of a connection at once, the responses
+ * are written in the order of the requests, off one by one
+ */
+int plm_http_pipeline_set(void *ctx, plm_dlist_t *param_list)
+{
+	struct plm_http_ctx *http_ctx;
+	struct plm_cmd_param *param;
+	plm_string_t off = plm_string("off");
+
+	http_ctx = (struct plm_http_ctx *)ctx;
+	if (PLM_DLIST_LEN(param_list) != 1) {
+		plm_log_syslog("the number of http_pipeline's param is wrong");
+		return (-1);
+	}
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(param_list);
+	if (0 == plm_strcmp(&param->cp_data, &off)) {
+		http_ctx->hc_pipeline = 1;
+		return (0);
+	}
+
+	http_ctx->hc_pipeline = plm_str2i(&param->cp_data);
+	if (http_ctx->hc_pipeline <= 0) {
+		plm_log_syslog("invalid http_pipeline depth");
+		return (-1);
+	}
+
+	return (0);
+}
+
+/* http_header_max 8192
+ * requests whose request line and header take more bytes are answered
+ * with 400
+ */
+int plm_http_header_max_set(void *ctx, plm_dlist_t *param_list)
+{
+	struct plm_http_ctx *http_ctx;
+	struct plm_cmd_param *param;
+	long long size;
+
+	http_ctx = (struct plm_http_ctx *)ctx;
+	if (PLM_DLIST_LEN(param_list) != 1) {
+		plm_log_syslog("the number of http_header_max's param is wrong");
+		return (-1);
+	}
+
+	param = (struct plm_cmd_param *)PLM_DLIST_FRONT(param_list);
+	size = plm_str2ll(&param->cp_data);
+	if (size <= 0) {
+		plm_log_syslog("invalid http_header_max size");
+		return (-1);
+	}
+
+	http_ctx->hc_header_max = size;
+	return (0);
+}
+
 void plm_http_set_main_conf(struct plm_share_param *param)
 {
 	memcpy(&sp, param, sizeof(sp));
@@ -235,7 +653,19 @@ int plm_http_on_work_proc_start(struct plm_ctx_list *cl)
 	
 	plm_lookaside_list_enable(&ctx->hc_conn_pool,
 							  sp.sp_zeromem, sp.sp_tagcheck, sp.sp_thrdn > 1);
-	
+	if (sp.sp_thrdn > 1)
+		plm_lookaside_list_enable_lockfree(&ctx->hc_conn_pool);
+
+	plm_lookaside_list_init(&ctx->hc_up_pool, sp.sp_maxfd,
+							sizeof(struct plm_http_upstream), sp.sp_tag,
+							malloc, free);
+	plm_lookaside_list_enable(&ctx->hc_up_pool,
+							  sp.sp_zeromem, sp.sp_tagcheck, sp.sp_thrdn > 1);
+	if (sp.sp_thrdn > 1)
+		plm_lookaside_list_enable_lockfree(&ctx->hc_up_pool);
+
+	ctx->hc_reuseport = sp.sp_reuseport;
+	plm_http_scan_init();
 	return plm_http_open_server(ctx);
 }
 
@@ -246,9 +676,23 @@ void plm_http_on_work_proc_exit(struct plm_ctx_list *cl)
 
 int plm_http_on_work_thrd_start(struct plm_ctx_list *cl)
 {
+	struct plm_http_ctx *ctx;
+
+	ctx = (struct plm_http_ctx *)PLM_CTX_LIST_GET_POINTER(cl);
+	if (ctx->hc_reuseport)
+		return plm_http_open_thrd_server(ctx);
+
 	return (0);
 }
 
 void plm_http_on_work_thrd_exit(struct plm_ctx_list *cl)
-{	
+{
+	struct plm_http_ctx *ctx;
+
+	ctx = (struct plm_http_ctx *)PLM_CTX_LIST_GET_POINTER(cl);
+	if (ctx->hc_reuseport)
+		plm_http_close_thrd_server();
+
+	plm_http_backend_thrd_destroy();
+	plm_pipe_pool_clear();
 }
@@ -37,13 +37,54 @@ extern "C" {
 struct plm_http_backend {
 	plm_list_node_t hb_node;
 	struct sockaddr_in hb_addr;
+
+	/* share of the requests relative to the other backends */
+	int hb_weight;
 };	
 
 struct plm_http_ctx {
 	plm_string_t hc_addr;
 	int hc_port;
 	int hc_backlog;
+	uint8_t hc_reuseport : 1;
+
+	/* copy header fields instead of indexing them in place */
+	uint8_t hc_hdr_copy : 1;
+
+	/* bodies of this many bytes or more are spliced, 0 never */
+	uint64_t hc_splice_min;
+
+	/* requests of a connection in flight at once, 1 handles them one
+	 * by one
+	 */
+	int hc_pipeline;
+
+	/* bytes a request line and header may take */
+	size_t hc_header_max;
+
+	/* idle backend connections kept per backend and thread, 0 never,
+	 * and ms before an idle one is closed
+	 */
+	int hc_keepalive_max;
+	int hc_keepalive_timeout;
+
+	/* enum plm_http_lb_type and enum plm_http_lb_key */
+	int hc_lb;
+	int hc_lb_key;
+
+	/* bytes of responses cached, 0 never, and the largest body kept */
+	uint64_t hc_cache_size;
+	uint64_t hc_cache_obj_max;
+
+	/* concurrent misses of a key wait for one fetch from the backend */
+	uint8_t hc_cache_coalesce;
+
+	/* file of the disk tier and its size, 0 if there is none */
+	plm_string_t hc_cache_disk;
+	uint64_t hc_cache_disk_size;
+
 	struct plm_lookaside_list hc_conn_pool;
+	struct plm_lookaside_list hc_up_pool;
 
 	plm_list_t hc_backends;
 };
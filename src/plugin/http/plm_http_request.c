@@ -23,12 +23,15 @@
  * SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 
 #include "plm_comm.h"
-#include "plm_hash.h"
+#include "plm_clock.h"
+#include "plm_oahash.h"
 #include "plm_event.h"
 #include "plm_log.h"
 #include "plm_string.h"
@@ -36,49 +39,23 @@
 #include "plm_http_event_io.h"
 #include "plm_buffer.h"
 #include "plm_http.h"
+#include "plm_http_header.h"
 #include "plm_http_plugin.h"
 #include "plm_http_backend.h"
+#include "plm_http_cache.h"
 #include "plm_http_request.h"
 
-static int http_server;
+static int http_server = -1;
+static __thread int http_thrd_server = -1;
 static void plm_http_read_req(void *, int);
-
-static void
-plm_http_body_process(void *req, plm_string_t *cnt)
-{
-}
-
-static uint32_t
-plm_http_field_key(void *data, uint32_t max)
-{
-	uint32_t key;
-	plm_string_t *v;
-
-	v = (plm_string_t *)data;
-	return (v->s_str[0] % max);
-}
-
-static int
-plm_http_field_cmp(void *data1, void *data2)
-{
-	plm_string_t *v1, *v2;
-
-	v1 = (plm_string_t *)data1;
-	v2 = (plm_string_t *)data2;
-	return plm_strcasecmp(v1, v2);
-}
-
-static void *
-plm_http_palloc(size_t n, void *data)
-{
-	struct plm_mempool *p;
-
-	p = (struct plm_mempool *)data;
-	return plm_mempool_alloc(p, n);
-}
-
-static void
-plm_http_pfree(void *p, void *data) {}
+static void plm_http_read_body(void *, int);
+static void plm_http_relay_body(void *, int);
+static void plm_http_req_relay(struct plm_http_conn *);
+static int plm_http_parse_req(struct plm_http_conn *);
+static void plm_http_on_output(void *, int);
+static void plm_http_conn_destroy(struct plm_http_conn *);
+static int plm_http_conn_release(struct plm_http_conn *);
+static void plm_http_req_reply(struct plm_http_req *, int);
 
 static int
 plm_http_on_reqline(enum plm_http_mthd mthd, const plm_string_t *url,
@@ -86,121 +63,138 @@ plm_http_on_reqline(enum plm_http_mthd mthd, const plm_string_t *url,
 {
 	struct plm_http_req *r;
 	struct plm_http_conn *c;
+	struct plm_http_url u;
 
 	c = (struct plm_http_conn *)data;
 	r = (struct plm_http_req *)plm_mempool_alloc(&c->hc_pool, sizeof(*r));
-	if (r) {
-		memset(r, 0, sizeof(*r));
+	if (!r)
+		return (-1);
+
+	memset(r, 0, sizeof(*r));
+	if (c->hc_flags.hc_hdr_copy) {
 		plm_strzassign(&r->hr_url, url->s_str, url->s_len, &c->hc_pool);
-		if (r->hr_url.s_str) {
-			struct plm_http_url u;
-			
-			r->hr_conn = c;
-			r->hr_mthd = mthd;
-			r->hr_ver = ver;
-
-			plm_http_parser_url(&u, &r->hr_url);
-
-			if (u.hu_host.s_len > 0) {
-				plm_strzassign(&r->hr_host, u.hu_host.s_str,
-							   u.hu_host.s_len, &c->hc_pool);
-			}
-			
-			if (u.hu_port.s_len > 0)
-				r->hr_port = plm_str2s(&u.hu_port);
+		if (!r->hr_url.s_str)
+			return (-1);
 
-			plm_hash_init(&r->hr_fields, 26, plm_http_field_key,
-						  plm_http_field_cmp, plm_http_palloc, plm_http_pfree,
-						  &c->hc_pool);
+		/* header names are case insensitive */
+		if (plm_oahash_init(&r->hr_fields, 16, PLM_OAHASH_NOCASE,
+							&c->hc_pool))
+			return (-1);
+	} else {
+		r->hr_url = *url;
+	}
 
-			PLM_LIST_ADD_FRONT(&c->hc_reqs, &r->hr_node);
+	r->hr_conn = c;
+	r->hr_mthd = mthd;
+	r->hr_ver = ver;
+	plm_http_hdrs_init(&r->hr_hdrs);
+	plm_http_wrevt_init(&r->hr_out, NULL, NULL);
 
-			/* set the parser user data to request */
-			c->hc_parser.hp_data = r;
-			
-			return (0);
-		}
-	}
+	plm_http_parser_url(&u, &r->hr_url);
+	if (u.hu_host.s_len > 0)
+		r->hr_host = u.hu_host;
+	if (u.hu_port.s_len > 0)
+		r->hr_port = plm_str2s(&u.hu_port);
 
-	return (-1);
+	/* set the parser user data to request */
+	c->hc_parser.hp_data = r;
+	return (0);
 }
 
 static int
-plm_http_on_field(const plm_string_t *k, const plm_string_t *v, void *data)
+plm_http_on_field(int id, const plm_string_t *k, const plm_string_t *v,
+				  void *data)
 {
-	static plm_string_t cs = plm_string("Connection");
-	static plm_string_t kps = plm_string("keep-alive");
-	static plm_string_t pcs = plm_string("Proxy-Connection");
-	static plm_string_t cl = plm_string("Content-Length");
-
 	struct plm_http_req *r;
 	struct plm_mempool *p;
-	plm_string_t *nk, *nv;
-	struct plm_hash_node *node;
+	plm_string_t key, len;
+	plm_string_t *nv;
+	char *c;
+	int rc;
 
 	r = (struct plm_http_req *)data;
 	p = &r->hr_conn->hc_pool;
 
-	switch (k->s_str[0]) {
-	case 'C':
-	case 'c':
-		if (!plm_strcasecmp(k, &cs) && !plm_strcasecmp(v, &kps))
-			r->hr_flags.hr_hdr_kpalv_on = 1;
-		else if (!plm_strcasecmp(k, &cl))
-			r->hr_cntlen = plm_str2ll(v);
-		break;
-
-	case 'P':
-	case 'p':
-		if (!plm_strcasecmp(k, &pcs)) {
-			if (plm_strcasecmp(v, &kps))
-				r->hr_flags.hr_hdr_kpalv_on = 1;
-			k = &cs;
+	/* one length is forwarded, without leading zeros, lengths which
+	 * differ would frame the body differently in the backend
+	 */
+	if (id == PLM_HDR_CONTENT_LENGTH) {
+		rc = plm_http_hdrs_cntlen(&r->hr_hdrs, v, &r->hr_cntlen);
+		if (rc < 0) {
+			PLM_TRACE("bad Content-Length");
+			return (-1);
 		}
-		break;
 
-	case 'H':
-	case 'h':
-		if (r->hr_host.s_len == 0) {
-			char *c = memchr(v->s_str, ':', v->s_len);
-			if (c) {
-				plm_string_t port, host;
-				
-				port.s_str = ++c;
-				port.s_len = v->s_len - (c - v->s_str);
-				r->hr_port = plm_str2s(&port);
-
-				host.s_str = v->s_str;
-				host.s_len = v->s_len - port.s_len - 1;
-
-				plm_strzassign(&r->hr_host, host.s_str, host.s_len, p);
-			} else {
-				plm_strzassign(&r->hr_host, v->s_str, v->s_len, p);
-			}
+		if (rc > 0)
+			return (0);
+
+		len = *v;
+		while (len.s_len > 1 && len.s_str[0] == '0') {
+			len.s_str++;
+			len.s_len--;
 		}
-		break;
+		v = &len;
 	}
 
-	nk = nv = NULL;
-	plm_strzalloc(&nk, k->s_str, k->s_len, p);
-	plm_strzalloc(&nv, v->s_str, v->s_len, p);
+	if (r->hr_conn->hc_flags.hc_hdr_copy) {
+		struct plm_oahash_entry *e;
+
+		nv = NULL;
+		plm_strzalloc(&nv, v->s_str, v->s_len, p);
+		if (!nv) {
+			PLM_FATAL("strzalloc failed");
+			return (-1);
+		}
 
-	if (!nk || !nv) {
-		PLM_FATAL("strzalloc failed");
+		/* the name is copied into the entry */
+		e = plm_oahash_insert(&r->hr_fields, k->s_str, k->s_len, nv);
+		if (!e) {
+			PLM_FATAL("oahash insert failed");
+			return (-1);
+		}
+
+		key.s_str = e->oe_key;
+		key.s_len = e->oe_len;
+		k = &key;
+		v = nv;
+	}
+
+	if (plm_http_hdrs_add(&r->hr_hdrs, id, k, v, p)) {
+		PLM_FATAL("plm_http_hdrs_add failed");
 		return (-1);
 	}
 
-	node = (struct plm_hash_node *)plm_mempool_alloc(p, sizeof(*node));
+	switch (id) {
+	case PLM_HDR_CONNECTION:
+	case PLM_HDR_PROXY_CONNECTION:
+		if (plm_http_hdr_has_token(v, "keep-alive", 10))
+			r->hr_flags.hr_hdr_kpalv_on = 1;
+		if (plm_http_hdr_has_token(v, "close", 5))
+			r->hr_flags.hr_hdr_close = 1;
+		break;
 
-	if (!node) {
-		PLM_FATAL("mempool alloc failed");
-		return (-1);
+	case PLM_HDR_TRANSFER_ENCODING:
+		r->hr_flags.hr_te = 1;
+		r->hr_flags.hr_chunked = plm_http_chunked_last(v);
+		break;
+
+	case PLM_HDR_HOST:
+		if (r->hr_host.s_len > 0)
+			break;
+
+		r->hr_host = *v;
+		c = memchr(v->s_str, ':', v->s_len);
+		if (c) {
+			plm_string_t port;
+
+			port.s_str = ++c;
+			port.s_len = v->s_len - (c - v->s_str);
+			r->hr_port = plm_str2s(&port);
+			r->hr_host.s_len = v->s_len - port.s_len - 1;
+		}
+		break;
 	}
-	
-	node->hn_key = nk;
-	node->hn_value = nv;
 
-	plm_hash_insert(&r->hr_fields, node);
 	return (0);
 }
 
@@ -210,48 +204,239 @@ plm_http_on_hdr_done(void *data)
 	struct plm_http_req *r;
 	struct plm_http_conn *c;
 
+	r = (struct plm_http_req *)data;
 	if (r->hr_port == 0)
 		r->hr_port = 80;
 
+	/* HTTP/1.1 keeps the connection unless told to close,
+	 * HTTP/1.0 closes it unless told to keep
+	 */
+	if (r->hr_ver == PLM_HTTP_11)
+		r->hr_flags.hr_keepalive = !r->hr_flags.hr_hdr_close;
+	else
+		r->hr_flags.hr_keepalive = r->hr_flags.hr_hdr_kpalv_on
+			&& !r->hr_flags.hr_hdr_close;
+
+	/* the request joins the pipeline once the header is complete */
 	c = r->hr_conn;
+	if (c->hc_last)
+		PLM_LIST_INSERT_BACK(&c->hc_reqs, &c->hc_last->hr_node,
+							 &r->hr_node);
+	else
+		PLM_LIST_ADD_FRONT(&c->hc_reqs, &r->hr_node);
+	c->hc_last = r;
+	c->hc_served++;
+
 	plm_http_parser_init(&c->hc_parser, c);
+}
 
-	if (r->hr_cntlen > 0) {
-		c->hc_body.hb_data = r;
-		c->hc_body.hb_callback = plm_http_body_process;
+static int
+plm_http_buffer_type(size_t size)
+{
+	switch (size) {
+	case SIZE_1K:
+		return (MEM_1K);
+	case SIZE_2K:
+		return (MEM_2K);
+	case SIZE_4K:
+		return (MEM_4K);
+	case SIZE_8K:
+		return (MEM_8K);
 	}
+
+	PLM_FATAL("unknown buffer type");
+	return (MEM_END);
+}
+
+/* take an input buffer from the slab
+ * @size -- SIZE_1K to SIZE_8K, the header is in it
+ * return the room behind the header, or NULL
+ */
+static char *
+plm_http_inbuf_alloc(size_t size)
+{
+	struct plm_http_inbuf *b;
+	int type;
+
+	type = plm_http_buffer_type(size);
+	b = (struct plm_http_inbuf *)plm_buffer_alloc(type);
+	if (!b)
+		return (NULL);
+
+	b->hb_next = NULL;
+	b->hb_type = type;
+	return ((char *)(b + 1));
+}
+
+static void
+plm_http_inbuf_free(char *data)
+{
+	struct plm_http_inbuf *b;
+
+	b = plm_http_inbuf(data);
+	plm_buffer_free(b->hb_type, (char *)b);
+}
+
+/* release the buffers filled, no request points into them any more */
+static void
+plm_http_in_release(struct plm_http_conn *c)
+{
+	struct plm_http_inbuf *b;
+
+	while ((b = c->hc_in.hc_full) != NULL) {
+		c->hc_in.hc_full = b->hb_next;
+		plm_buffer_free(b->hb_type, (char *)b);
+	}
+}
+
+/* go back to a 1K buffer once a large one is empty */
+static void
+plm_http_in_shrink(struct plm_http_conn *c)
+{
+	char *data;
+
+	if (c->hc_in.hc_size <= SIZE_1K - sizeof(struct plm_http_inbuf))
+		return;
+
+	data = plm_http_inbuf_alloc(SIZE_1K);
+	if (!data)
+		return;
+
+	plm_http_inbuf_free(c->hc_in.hc_data);
+	c->hc_in.hc_data = data;
+	c->hc_in.hc_size = SIZE_1K - sizeof(struct plm_http_inbuf);
+}
+
+/* make room in hc_in for more input, the bytes not parsed are moved to
+ * the front if no header string points into the buffer, otherwise they
+ * go on in a new buffer large enough for twice as many, and the full
+ * one is kept in hc_full until the requests in flight are done
+ * return 0 on success, -1 if a line fills the largest buffer
+ */
+static int
+plm_http_in_expand(struct plm_http_conn *c)
+{
+	char *old, *new;
+	size_t pos, off, size, room;
+	int idle;
+
+	old = c->hc_in.hc_data;
+	pos = c->hc_in.hc_pos;
+	off = c->hc_in.hc_offset;
+
+	/* the request being parsed goes on from the front */
+	if (c->hc_parser.hp_data != c) {
+		c->hc_in.hc_prev += pos - c->hc_in.hc_start;
+		c->hc_in.hc_start = 0;
+	}
+
+	idle = c->hc_flags.hc_hdr_copy
+		|| (PLM_LIST_LEN(&c->hc_reqs) == 0 && c->hc_parser.hp_data == c);
+	if (pos > 0 && idle) {
+		memmove(old, old + pos, off - pos);
+		c->hc_in.hc_offset = off - pos;
+		c->hc_in.hc_pos = 0;
+		return (0);
+	}
+
+	for (size = SIZE_1K; size < SIZE_8K; size *= 2) {
+		if (size - sizeof(struct plm_http_inbuf) >= 2 * (off - pos))
+			break;
+	}
+
+	room = size - sizeof(struct plm_http_inbuf);
+	if (room <= off - pos)
+		return (-1);
+
+	new = plm_http_inbuf_alloc(size);
+	if (!new)
+		return (-1);
+
+	/* the parsed bytes stay where the header strings point */
+	memcpy(new, old + pos, off - pos);
+	if (idle || pos == 0) {
+		plm_http_inbuf_free(old);
+	} else {
+		plm_http_inbuf(old)->hb_next = c->hc_in.hc_full;
+		c->hc_in.hc_full = plm_http_inbuf(old);
+	}
+
+	c->hc_in.hc_data = new;
+	c->hc_in.hc_size = room;
+	c->hc_in.hc_offset = off - pos;
+	c->hc_in.hc_pos = 0;
+	return (0);
+}
+
+/* bytes of the request being parsed up to end of hc_in */
+static size_t
+plm_http_hdr_len(struct plm_http_conn *c, size_t end)
+{
+	return (c->hc_in.hc_prev + end - c->hc_in.hc_start);
 }
 
 static void plm_http_conn_free(void *data)
 {
 	struct plm_http_conn *conn;
+	struct plm_http_req *r;
+	plm_list_node_t *node;
 
 	conn = (struct plm_http_conn *)data;
-	if (conn->hc_in.hc_data) {
-		int pt;
-		
-		plm_mempool_destroy(&conn->hc_pool);		
 
-		switch (conn->hc_in.hc_size) {
-		case SIZE_1K:
-			pt = MEM_1K;
-			break;
-		case SIZE_2K:
-			pt = MEM_2K;
-			break;
-		case SIZE_4K:
-			pt = MEM_4K;
-			break;
-		case SIZE_8K:
-			pt = MEM_8K;
-			break;
-		default:
-			PLM_FATAL("unknown buffer type");
-			break;
+	/* the requests may lead or wait on a fetch of the cache, and their
+	 * backends go with the client
+	 */
+	for (node = PLM_LIST_FRONT(&conn->hc_reqs); node;
+		 node = PLM_LIST_NEXT(node)) {
+		r = (struct plm_http_req *)node;
+		plm_http_cache_leave(r);
+		if (r->hr_up) {
+			r->hr_up->hu_conn = NULL;
+			plm_comm_close(r->hr_up->hu_fd);
+			r->hr_up = NULL;
 		}
-		
-		plm_buffer_free(pt, conn->hc_in.hc_data);
+
+		plm_http_wrevt_drop(&r->hr_out);
 	}
+
+	plm_http_wrevt_drop(&conn->hc_wrevt);
+
+	/* a call up the stack still refers to the connection */
+	if (conn->hc_hold > 0) {
+		conn->hc_flags.hc_dead = 1;
+		return;
+	}
+
+	plm_http_conn_destroy(conn);
+}
+
+/* release the memory of a connection closed */
+static void plm_http_conn_destroy(struct plm_http_conn *conn)
+{
+	if (conn->hc_in.hc_data) {
+		plm_mempool_destroy(&conn->hc_pool);		
+		plm_http_in_release(conn);
+		plm_http_inbuf_free(conn->hc_in.hc_data);
+	}
+
+	plm_lookaside_list_free(&conn->hc_ctx->hc_conn_pool, conn, NULL);
+}
+
+/* keep the connection while a call may close it */
+#define plm_http_conn_hold(c) ((c)->hc_hold++)
+
+/* drop a hold, the connection is freed if it was closed meanwhile
+ * return -1 if the connection is closed, else 0
+ */
+static int plm_http_conn_release(struct plm_http_conn *c)
+{
+	c->hc_hold--;
+	if (!c->hc_flags.hc_dead)
+		return (0);
+
+	if (c->hc_hold == 0)
+		plm_http_conn_destroy(c);
+	return (-1);
 }
 
 static struct plm_http_conn *
@@ -263,16 +448,19 @@ plm_http_conn_alloc(struct plm_http_ctx *ctx)
 		plm_lookaside_list_alloc(&ctx->hc_conn_pool, NULL);
 	if (conn) {
 		memset(conn, 0, sizeof(*conn));
-		conn->hc_in.hc_data = plm_buffer_alloc(MEM_1K);
+		conn->hc_in.hc_data = plm_http_inbuf_alloc(SIZE_1K);
 		if (conn->hc_in.hc_data) {
 			conn->hc_ctx = ctx;
-			conn->hc_in.hc_size = SIZE_1K;
+			conn->hc_in.hc_size = SIZE_1K - sizeof(struct plm_http_inbuf);
+			conn->hc_flags.hc_hdr_copy = ctx->hc_hdr_copy;
 
 			plm_mempool_init(&conn->hc_pool, 512, malloc, free);
 
 			conn->hc_cch.cch_handler = plm_http_conn_free;
 			conn->hc_cch.cch_data = conn;
 
+			plm_http_wrevt_init(&conn->hc_wrevt, plm_http_on_output, conn);
+
 			/* init hooks */
 			conn->hc_parser.hp_on_req_line = plm_http_on_reqline;
 			conn->hc_parser.hp_on_status_line = NULL;
@@ -326,7 +514,10 @@ void plm_http_accept(void *data, int fd)
 		PLM_EVT_DRV_READ(clifd, conn, plm_http_read_req);
 	} while (1);
 
-	err = plm_event_io_read2(fd, data, plm_http_accept);
+	if (ctx->hc_reuseport)
+		err = plm_event_io_read(fd, data, plm_http_accept);
+	else
+		err = plm_event_io_read2(fd, data, plm_http_accept);
 	if (err) {
 		PLM_FATAL("plm_event_io_read on listen fd failed: %s",
 				  strerror(errno));
@@ -334,82 +525,424 @@ void plm_http_accept(void *data, int fd)
 	}   
 }
 
-static void
-plm_http_schedule_reply_done(void *data, char *buf, size_t n, int state)
+#define PLM_HTTP_REPLY_FMT												\
+	"HTTP/1.1 %s\r\nDate: %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n"
+#define PLM_HTTP_REPLY_MAX 128
+
+/* build an error reply
+ * @c -- the connection
+ * @err -- enum plm_http_err
+ * return the segment from the connection pool, or NULL
+ */
+static struct plm_http_seg *
+plm_http_reply_seg(struct plm_http_conn *c, int err)
 {
+	const char *status;
+	struct plm_http_seg *s;
+
+	switch (err) {
+	case PLM_ERR_BACKEND_SELECT:
+		c->hc_flags.hc_nobackend = 1;
+		status = "503 Service Unavailable";
+		break;
+	case PLM_ERR_BACKEND_FWD:
+		c->hc_flags.hc_errfwd = 1;
+		status = "502 Bad Gateway";
+		break;
+	case PLM_ERR_LENGTH:
+		c->hc_flags.hc_badreq = 1;
+		status = "411 Length Required";
+		break;
+	default:
+		c->hc_flags.hc_badreq = 1;
+		status = "400 Bad Request";
+		break;
+	}
+
+	/* the reply carries the date so it is built per connection */
+	s = (struct plm_http_seg *)
+		plm_mempool_alloc(&c->hc_pool, sizeof(*s) + PLM_HTTP_REPLY_MAX);
+	if (!s)
+		return (NULL);
+
+	s->hs_buf = (char *)(s + 1);
+	s->hs_off = 0;
+	s->hs_cap = PLM_HTTP_REPLY_MAX;
+	s->hs_type = MEM_END;
+	s->hs_len = snprintf(s->hs_buf, PLM_HTTP_REPLY_MAX, PLM_HTTP_REPLY_FMT,
+						 status, plm_clock_http_date(NULL));
+	return (s);
 }
 
+/* reply an error to the input which is no request and close the
+ * connection once it is written, the reply waits for the responses of
+ * the requests in flight
+ */
 static void
 plm_http_schedule_reply(struct plm_http_conn *c, int err)
 {
-	static plm_string_t badreq = plm_string("");
-	static plm_string_t errfwd = plm_string("");
-	static plm_string_t nobackend = plm_string("");
+	struct plm_http_seg *s;
 
-	if (err == PLM_ERR_BACKEND_SELECT)
-		c->hc_flags.hc_nobackend = 1;
-	else if (err == PLM_ERR_BACKEND_FWD)
-		c->hc_flags.hc_errfwd = 1;
-	else if (err == PLM_ERR_BADREQ)
-		c->hc_flags.hc_badreq = 1;
-	
-	if (PLM_LIST_LEN(&c->hc_resps) > 0)
+	if (PLM_LIST_LEN(&c->hc_reqs) > 0) {
+		c->hc_err = err;
 		return;
+	}
 
-	c->hc_wrevt.hw_fn = plm_http_schedule_reply_done;
-	c->hc_wrevt.hw_data = c;
-	c->hc_wrevt.hw_off = 0;
-	
-	if (c->hc_flags.hc_badreq) {
-		c->hc_wrevt.hw_buf = badreq.s_str;
-		c->hc_wrevt.hw_len = badreq.s_len;
-	} else if (c->hc_flags.hc_errfwd) {
-		c->hc_wrevt.hw_buf = errfwd.s_str;
-		c->hc_wrevt.hw_len = errfwd.s_len;		
-	} else if (c->hc_flags.hc_nobackend) {
-		c->hc_wrevt.hw_buf = nobackend.s_str;
-		c->hc_wrevt.hw_len = nobackend.s_len;				
+	s = plm_http_reply_seg(c, err);
+	if (!s) {
+		plm_comm_close(c->hc_fd);
+		return;
 	}
-		
-	return plm_http_event_write(c->hc_fd, &c->hc_wrevt);
+
+	c->hc_flags.hc_close = 1;
+	plm_http_wrevt_append(&c->hc_wrevt, s);
+	plm_http_event_write(c->hc_fd, &c->hc_wrevt);
 }
 
+/* reply an error to a request, the connection closes once it is written
+ * @r -- the request
+ * @err -- enum plm_http_err
+ */
 static void
-plm_http_req_process(struct plm_http_req *r)
+plm_http_req_reply(struct plm_http_req *r, int err)
 {
 	struct plm_http_conn *c;
-	int et = PLM_ERR_BACKEND_SELECT;
+	struct plm_http_seg *s;
 
 	c = r->hr_conn;
-	if (plm_http_backend_select(r)) {
-		if (plm_http_backend_forward(r))
+	shutdown(c->hc_fd, SHUT_RD);
+	s = plm_http_reply_seg(c, err);
+	if (!s) {
+		plm_comm_close(c->hc_fd);
+		return;
+	}
+
+	plm_http_wrevt_append(plm_http_req_out(r), s);
+	r->hr_flags.hr_keepalive = 0;
+	plm_http_req_done(r);
+}
+
+/* the client output is drained or failed, the request in front is
+ * popped once its response is written and the one behind goes on
+ */
+static void plm_http_on_output(void *data, int state)
+{
+	struct plm_http_conn *c;
+	struct plm_http_req *r;
+
+	c = (struct plm_http_conn *)data;
+	if (c->hc_flags.hc_dead)
+		return;
+
+	if (state < 0 || c->hc_flags.hc_close) {
+		plm_comm_close(c->hc_fd);
+		return;
+	}
+
+	r = (struct plm_http_req *)PLM_LIST_FRONT(&c->hc_reqs);
+	if (!r)
+		return;
+
+	if (!r->hr_flags.hr_done) {
+		if (r->hr_up)
+			plm_http_backend_resume(r->hr_up);
+		return;
+	}
+
+	PLM_LIST_DEL_FRONT(&c->hc_reqs);
+	if (!r->hr_flags.hr_keepalive) {
+		plm_comm_close(c->hc_fd);
+		return;
+	}
+
+	if (PLM_LIST_LEN(&c->hc_reqs) == 0) {
+		c->hc_last = NULL;
+		if (c->hc_err) {
+			plm_http_schedule_reply(c, c->hc_err);
 			return;
+		}
+
+		/* the client sends no more requests */
+		if (c->hc_flags.hc_eof) {
+			plm_comm_close(c->hc_fd);
+			return;
+		}
+
+		/* nothing refers to the pool once the connection is idle */
+		if (c->hc_parser.hp_data == c) {
+			plm_mempool_destroy(&c->hc_pool);
+			plm_mempool_init(&c->hc_pool, 512, malloc, free);
+			c->hc_served = 0;
+			plm_http_in_release(c);
+			if (c->hc_in.hc_pos == c->hc_in.hc_offset) {
+				c->hc_in.hc_pos = c->hc_in.hc_offset = 0;
+				plm_http_in_shrink(c);
+			}
+		}
+	} else {
+		/* the response queued behind goes out next */
+		r = (struct plm_http_req *)PLM_LIST_FRONT(&c->hc_reqs);
+		plm_http_wrevt_move(&c->hc_wrevt, &r->hr_out);
+	}
+
+	/* the requests pipelined behind are in hc_in already */
+	if (plm_http_parse_req(c))
+		return;
+
+	if (PLM_LIST_LEN(&c->hc_reqs) > 0)
+		plm_http_event_write(c->hc_fd, &c->hc_wrevt);
+}
+
+/* account request body bytes read, a chunked body is decoded to find
+ * its end, the bytes past the end of the body are not counted
+ * @c -- the connection
+ * @r -- the request
+ * @buf -- the bytes read
+ * @n -- length of buf
+ * return the bytes of buf in the body, or -1 if the coding is broken
+ */
+static ssize_t
+plm_http_body_count(struct plm_http_conn *c, struct plm_http_req *r,
+					const char *buf, size_t n)
+{
+	ssize_t m;
+
+	if (!r->hr_flags.hr_chunked) {
+		if (n > c->hc_body_rest)
+			n = c->hc_body_rest;
+		c->hc_body_rest -= n;
+		return (n);
+	}
+
+	m = plm_http_chunked_decode(&c->hc_chunked, buf, n);
+	if (m >= 0)
+		c->hc_body_rest = plm_http_chunked_done(&c->hc_chunked) ?
+			0 : plm_http_chunked_rest(&c->hc_chunked);
+	return (m);
+}
+
+/* queue the request body in hc_in and read the rest from the client */
+static void
+plm_http_req_body(struct plm_http_req *r)
+{
+	struct plm_http_conn *c;
+	struct plm_http_upstream *u;
+	struct plm_http_seg *s;
+	ssize_t n, m;
+
+	c = r->hr_conn;
+	u = r->hr_up;
+
+	/* a request without body may be fetched once the requests behind
+	 * it are parsed, the body state is of the last one
+	 */
+	if (r->hr_cntlen == 0 && !r->hr_flags.hr_chunked) {
+		plm_http_event_write(u->hu_fd, &u->hu_wrevt);
+		return;
+	}
+
+	c->hc_flags.hc_rd_paused = 0;
+	c->hc_body_rest = r->hr_cntlen;
+	plm_http_chunked_init(&c->hc_chunked);
+	n = plm_http_body_count(c, r, c->hc_in.hc_data + c->hc_in.hc_pos,
+							c->hc_in.hc_offset - c->hc_in.hc_pos);
+	if (n < 0) {
+		PLM_TRACE("bad chunked request body");
+		plm_http_req_error(r, PLM_ERR_BADREQ);
+		return;
+	}
+
+	/* the bytes are copied, hc_in moves for the requests behind */
+	while (n > 0) {
+		m = n < (ssize_t)PLM_HTTP_SEG_MAX ? n : (ssize_t)PLM_HTTP_SEG_MAX;
+		s = plm_http_seg_alloc(m);
+		if (!s) {
+			plm_http_req_error(r, PLM_ERR_BACKEND_FWD);
+			return;
+		}
+
+		memcpy(s->hs_buf, c->hc_in.hc_data + c->hc_in.hc_pos, m);
+		s->hs_len = m;
+		plm_http_wrevt_append(&u->hu_wrevt, s);
+		c->hc_in.hc_pos += m;
+		n -= m;
+	}
+
+	if (c->hc_body_rest > 0) {
+		/* a large body is spliced once the queued bytes are written,
+		 * plm_http_req_body_resume starts it, a chunked one is read
+		 * to find its end
+		 */
+		if (c->hc_ctx->hc_splice_min && !r->hr_flags.hr_chunked
+			&& c->hc_body_rest >= c->hc_ctx->hc_splice_min
+			&& !plm_http_relay_init(&u->hu_body_rl, c->hc_fd, u->hu_fd,
+									c->hc_body_rest))
+			c->hc_flags.hc_rd_paused = 1;
+		else
+			PLM_EVT_DRV_READ(c->hc_fd, c, plm_http_read_body);
+	}
+
+	/* the header and the body read so far go in one write */
+	plm_http_event_write(u->hu_fd, &u->hu_wrevt);
+}
+
+static void
+plm_http_req_process(struct plm_http_req *r)
+{
+	/* the end of a body in a coding other than chunked can't be found,
+	 * and a Content-Length beside the chunks could split the message
+	 * differently in the backend
+	 */
+	if (r->hr_flags.hr_te && !r->hr_flags.hr_chunked) {
+		plm_http_req_reply(r, PLM_ERR_LENGTH);
+		return;
+	}
+
+	if (r->hr_flags.hr_te
+		&& plm_http_hdrs_has(&r->hr_hdrs, PLM_HDR_CONTENT_LENGTH)) {
+		plm_http_req_reply(r, PLM_ERR_BADREQ);
+		return;
+	}
+
+	/* a hit, or a miss waiting for the same response */
+	if (plm_http_cache_serve(r) >= 0)
+		return;
+
+	plm_http_req_fetch(r);
+}
+
+/* relay the request to a backend, or reply an error if there is none
+ * @r -- the request
+ */
+void plm_http_req_fetch(struct plm_http_req *r)
+{
+	int et = PLM_ERR_BACKEND_SELECT;
+
+	if (!plm_http_backend_select(r)) {
+		if (!plm_http_backend_forward(r)) {
+			plm_http_req_body(r);
+			return;
+		}
 
 		et = PLM_ERR_BACKEND_FWD;
 	}
 
-	shutdown(c->hc_fd, SHUT_RD);
-	plm_http_schedule_reply(c, et);
+	plm_http_cache_leave(r);
+	plm_http_req_reply(r, et);
+}
+
+/* no request is parsed behind one closing the connection or reading
+ * its body, nor beyond http_pipeline requests in flight, and now and
+ * then the pipeline drains so the pool is reset
+ */
+static int
+plm_http_pipeline_held(struct plm_http_conn *c)
+{
+	struct plm_http_req *r;
+
+	if (c->hc_flags.hc_close || c->hc_err)
+		return (1);
+
+	r = c->hc_last;
+	if (r && (!r->hr_flags.hr_keepalive || c->hc_body_rest > 0))
+		return (1);
+
+	if (c->hc_served >= PLM_HTTP_POOL_REQS && PLM_LIST_LEN(&c->hc_reqs) > 0)
+		return (1);
+
+	return (PLM_LIST_LEN(&c->hc_reqs) >= c->hc_ctx->hc_pipeline);
+}
+
+/* parse the bytes in hc_in from hc_pos, every request complete is
+ * processed in turn until the input runs out or the pipeline is held
+ * return -1 if the connection is closed meanwhile, else 0
+ */
+static int
+plm_http_parse_req(struct plm_http_conn *conn)
+{
+	int rc;
+	plm_string_t s;
+
+	/* a request processed below may be written and get here */
+	if (conn->hc_flags.hc_parsing)
+		return (0);
+
+	conn->hc_flags.hc_parsing = 1;
+	plm_http_conn_hold(conn);
+	while (!plm_http_pipeline_held(conn)) {
+		s.s_str = conn->hc_in.hc_data + conn->hc_in.hc_pos;
+		s.s_len = conn->hc_in.hc_offset - conn->hc_in.hc_pos;
+		if (s.s_len == 0) {
+			if (!conn->hc_flags.hc_eof)
+				PLM_EVT_DRV_READ(conn->hc_fd, conn, plm_http_read_req);
+			break;
+		}
+
+		/* the strings of the next request point from here on */
+		if (conn->hc_parser.hp_data == conn) {
+			conn->hc_in.hc_start = conn->hc_in.hc_pos;
+			conn->hc_in.hc_prev = 0;
+		}
+
+		rc = plm_http_parser_req(&conn->hc_parser, &s);
+		if (rc == PLM_HTTP_PARSE_ERROR || rc == PLM_HTTP_PARSE_BREAK) {
+			PLM_TRACE("bad request");
+			shutdown(conn->hc_fd, SHUT_RD);
+			plm_http_schedule_reply(conn, PLM_ERR_BADREQ);
+			break;
+		}
+
+		conn->hc_in.hc_pos += conn->hc_parser.hp_parsed;
+		if (rc != PLM_HTTP_PARSE_DONE) {
+			if (plm_http_hdr_len(conn, conn->hc_in.hc_offset)
+				> conn->hc_ctx->hc_header_max) {
+				PLM_TRACE("request header too large");
+				shutdown(conn->hc_fd, SHUT_RD);
+				plm_http_schedule_reply(conn, PLM_ERR_BADREQ);
+				break;
+			}
+
+			if (!conn->hc_flags.hc_eof)
+				PLM_EVT_DRV_READ(conn->hc_fd, conn, plm_http_read_req);
+			break;
+		}
+
+		/* read at once, it is answered in its turn */
+		if (plm_http_hdr_len(conn, conn->hc_in.hc_pos)
+			> conn->hc_ctx->hc_header_max) {
+			PLM_TRACE("request header too large");
+			plm_http_req_reply(conn->hc_last, PLM_ERR_BADREQ);
+			break;
+		}
+
+		plm_http_req_process(conn->hc_last);
+		if (conn->hc_flags.hc_dead)
+			break;
+	}
+
+	conn->hc_flags.hc_parsing = 0;
+	return (plm_http_conn_release(conn));
 }
 
 void plm_http_read_req(void *data, int fd)
 {
-	int rc, n;
-	char *buf;
-	size_t size, off, parsed;
+	int n;
 	struct plm_http_conn *conn;
-	struct plm_http_req *req;
-	plm_string_t s;
 
 	conn = (struct plm_http_conn *)data;
-	off = conn->hc_in.hc_offset;
-	size = conn->hc_in.hc_size;
-	buf = conn->hc_in.hc_data;
+	if (conn->hc_in.hc_offset == conn->hc_in.hc_size
+		&& plm_http_in_expand(conn)) {
+		PLM_TRACE("request header line too large");
+		shutdown(fd, SHUT_RD);
+		plm_http_schedule_reply(conn, PLM_ERR_BADREQ);
+		return;
+	}
 
-	n = plm_comm_read(fd, buf + off, size - off);
+	n = plm_comm_read(fd, conn->hc_in.hc_data + conn->hc_in.hc_offset,
+					  conn->hc_in.hc_size - conn->hc_in.hc_offset);
 	if (n < 0) {
 		if (plm_comm_ignore(errno)) {
-			plm_event_io_read(fd, data, plm_http_read_req);
+			PLM_EVT_DRV_READ(fd, data, plm_http_read_req);
 		} else {
 			PLM_FATAL("plm_comm_read failed: %s", strerror(errno));
 			plm_comm_close(fd);
@@ -417,42 +950,248 @@ void plm_http_read_req(void *data, int fd)
 		return;
 	}
 
+	/* the responses of the requests read still go out, a request not
+	 * complete is dropped
+	 */
 	if (n == 0) {
 		PLM_TRACE("connection closed");
-		if (PLM_LIST_LEN(&conn->hc_reqs) == 0)
-			plm_comm_close(fd);
-		else
+		if (PLM_LIST_LEN(&conn->hc_reqs) > 0)
 			conn->hc_flags.hc_eof = 1;
+		else
+			plm_comm_close(fd);
 		return;
 	}
 
-	s.s_str = buf;
-	s.s_len = n;
+	/* parse from where the last call stopped, the header strings point
+	 * into hc_in and hc_full, so the parsed bytes stay where they are
+	 */
+	conn->hc_in.hc_offset += n;
+	plm_http_parse_req(conn);
+}
+
+/* read the request body into segments and queue them to the backend */
+void plm_http_read_body(void *data, int fd)
+{
+	int n;
+	size_t want;
+	struct plm_http_conn *c;
+	struct plm_http_upstream *u;
+	struct plm_http_req *r;
+	struct plm_http_seg *s;
+
+	c = (struct plm_http_conn *)data;
+	r = c->hc_last;
 
-	if (conn->hc_body.hb_callback) {
-		conn->hc_body.hb_callback(conn->hc_body.hb_data, &s);
+	/* the request failed, an error reply is on the way */
+	if (!r || !r->hr_up)
 		return;
+
+	u = r->hr_up;
+	while (c->hc_body_rest > 0) {
+		if (u->hu_wrevt.hw_bytes >= PLM_HTTP_OUT_HIGH) {
+			c->hc_flags.hc_rd_paused = 1;
+			break;
+		}
+
+		s = plm_http_seg_alloc(PLM_HTTP_SEG_MAX);
+		if (!s) {
+			plm_comm_close(fd);
+			return;
+		}
+
+		want = s->hs_cap;
+		if (want > c->hc_body_rest)
+			want = c->hc_body_rest;
+
+		n = plm_comm_read(fd, s->hs_buf, want);
+		if (n <= 0) {
+			plm_http_seg_free(s);
+			if (n < 0 && plm_comm_ignore(errno)) {
+				PLM_EVT_DRV_READ(fd, c, plm_http_read_body);
+				break;
+			}
+
+			PLM_TRACE("connection closed in request body");
+			plm_comm_close(fd);
+			return;
+		}
+
+		/* the reads never go past the end of the body */
+		if (plm_http_body_count(c, r, s->hs_buf, n) != n) {
+			PLM_TRACE("bad chunked request body");
+			plm_http_seg_free(s);
+			plm_comm_close(fd);
+			return;
+		}
+
+		s->hs_len = n;
+		plm_http_wrevt_append(&u->hu_wrevt, s);
+
+		/* the socket is drained most likely, save a read */
+		if ((size_t)n < want) {
+			PLM_EVT_DRV_READ(fd, c, plm_http_read_body);
+			break;
+		}
 	}
-	
-	rc = plm_http_parser_req(&conn->hc_parser, &s);
-	if (rc == PLM_HTTP_PARSE_ERROR) {
-		PLM_TRACE("bad request");
-		shutdown(fd, SHUT_RD);
-		plm_http_schedule_reply(conn, PLM_ERR_BADREQ);
+
+	if (c->hc_body_rest > 0) {
+		plm_http_event_write(u->hu_fd, &u->hu_wrevt);
 		return;
 	}
 
-	parsed = conn->hc_parser.hp_parsed;
-	conn->hc_in.hc_offset = n - parsed;
-	if (conn->hc_in.hc_offset > 0)
-		memmove(buf, buf + parsed, conn->hc_in.hc_offset);
+	/* the body is read, the requests pipelined behind it are next */
+	plm_http_conn_hold(c);
+	plm_http_event_write(u->hu_fd, &u->hu_wrevt);
+	if (!plm_http_conn_release(c))
+		plm_http_parse_req(c);
+}
+
+/* splice the request body from the client to the backend */
+void plm_http_req_relay(struct plm_http_conn *c)
+{
+	struct plm_http_upstream *u;
+	struct plm_http_req *r;
+
+	u = c->hc_last->hr_up;
+	switch (plm_http_relay(&u->hu_body_rl)) {
+	case PLM_HTTP_RELAY_DONE:
+		/* the requests pipelined behind the body are next */
+		c->hc_body_rest = 0;
+		plm_http_parse_req(c);
+		break;
+
+	case PLM_HTTP_RELAY_RD:
+		PLM_EVT_DRV_READ(c->hc_fd, c, plm_http_relay_body);
+		break;
+
+	case PLM_HTTP_RELAY_WR:
+		PLM_EVT_DRV_WRITE(u->hu_fd, c, plm_http_relay_body);
+		break;
+
+	case PLM_HTTP_RELAY_ERR_IN:
+		PLM_TRACE("connection closed in request body");
+		plm_comm_close(c->hc_fd);
+		break;
+
+	default:
+		PLM_TRACE("write backend failed: %s", strerror(errno));
+		r = u->hu_req;
+		plm_comm_close(u->hu_fd);
+		plm_http_req_error(r, PLM_ERR_BACKEND_FWD);
+		break;
+	}
+}
+
+/* the client or the backend side of a spliced body is ready, the
+ * events are on the conn as the upstream may be gone
+ */
+void plm_http_relay_body(void *data, int fd)
+{
+	struct plm_http_conn *c;
+	struct plm_http_req *r;
+
+	c = (struct plm_http_conn *)data;
+	r = c->hc_last;
+	if (r && r->hr_up && r->hr_up->hu_body_rl.hl_pipe)
+		plm_http_req_relay(c);
+}
+
+/* the backend output is drained, go on reading the request body
+ * @r -- the request, only the last one of the connection reads it
+ */
+void plm_http_req_body_resume(struct plm_http_req *r)
+{
+	struct plm_http_conn *c;
+
+	c = r->hr_conn;
+	if (r == c->hc_last && c->hc_flags.hc_rd_paused) {
+		c->hc_flags.hc_rd_paused = 0;
+		if (r->hr_up->hu_body_rl.hl_pipe)
+			plm_http_req_relay(c);
+		else
+			PLM_EVT_DRV_READ(c->hc_fd, c, plm_http_read_body);
+	}
+}
+
+/* the output of a request, the one in front of the connection writes
+ * to the client, the ones behind queue until it is done
+ * @r -- the request
+ */
+struct plm_http_wrevt *plm_http_req_out(struct plm_http_req *r)
+{
+	if (plm_http_req_front(r))
+		return (&r->hr_conn->hc_wrevt);
+	return (&r->hr_out);
+}
+
+/* write the output queued if the request is in front
+ * @r -- the request
+ */
+void plm_http_req_flush(struct plm_http_req *r)
+{
+	struct plm_http_conn *c;
+
+	c = r->hr_conn;
+	if (plm_http_req_front(r))
+		plm_http_event_write(c->hc_fd, &c->hc_wrevt);
+}
+
+/* the whole response is queued, the request is done once it is written
+ * @r -- the request
+ */
+void plm_http_req_done(struct plm_http_req *r)
+{
+	struct plm_http_conn *c;
 
-	if (rc == PLM_HTTP_PARSE_DONE) {
-		req = (struct plm_http_req *)PLM_LIST_FRONT(&conn->hc_reqs);
-		plm_http_req_process(req);
+	c = r->hr_conn;
+	r->hr_flags.hr_done = 1;
+
+	/* the next request can't be found behind a body not read */
+	if (r == c->hc_last && c->hc_body_rest > 0)
+		r->hr_flags.hr_keepalive = 0;
+
+	plm_http_req_flush(r);
+}
+
+/* relaying the request failed, the client gets an error reply if no
+ * response header was sent, otherwise what was queued and a close
+ * @r -- the request
+ * @err -- enum plm_http_err
+ */
+void plm_http_req_error(struct plm_http_req *r, int err)
+{
+	plm_http_cache_leave(r);
+
+	/* the backend is not heard any more */
+	if (r->hr_up)
+		plm_comm_close(r->hr_up->hu_fd);
+
+	if (r->hr_flags.hr_head_sent) {
+		r->hr_flags.hr_keepalive = 0;
+		plm_http_req_done(r);
+		return;
 	}
 
-	PLM_EVT_DRV_READ(fd, data, plm_http_read_req);
+	plm_http_req_reply(r, err);
+}
+
+/* find the first value of a request header field
+ * @r -- request
+ * @name -- field name, case insensitive
+ * @len -- length of name
+ * return the value or NULL
+ */
+const plm_string_t *
+plm_http_req_field(struct plm_http_req *r, const char *name, size_t len)
+{
+	struct plm_oahash_entry *e;
+
+	if (!r->hr_conn->hc_flags.hc_hdr_copy
+		|| plm_http_hdr_id(name, len) != PLM_HDR_OTHER)
+		return (plm_http_hdrs_find(&r->hr_hdrs, name, len));
+
+	e = plm_oahash_find(&r->hr_fields, name, len);
+	return (e ? (const plm_string_t *)e->oe_value : NULL);
 }
 
 int plm_http_open_server(struct plm_http_ctx *ctx)
@@ -466,9 +1205,18 @@ int plm_http_open_server(struct plm_http_ctx *ctx)
 		plm_log_syslog("backend init failed");
 		return (err);
 	}
+
+	if (plm_http_cache_init(ctx)) {
+		plm_log_syslog("cache init failed");
+		return (err);
+	}
+
+	/* every work thread opens its own listen fd */
+	if (ctx->hc_reuseport)
+		return (0);
 	
 	http_server = plm_comm_open(PLM_COMM_TCP, NULL, 0, 0, port, ip,
-								backlog, 1, 1);
+								backlog, 1, PLM_COMM_REUSEADDR);
 	if (http_server < 0) {
 		plm_log_syslog("can't open http plugin listen fd: %s:%d", ip, port);
 	} else {
@@ -490,6 +1238,44 @@ int plm_http_close_server()
 	}
 
 	plm_http_backend_destroy();
+	plm_http_cache_destroy();
+	return (err);
+}
+
+int plm_http_open_thrd_server(struct plm_http_ctx *ctx)
+{
+	int fd;
+	int port = ctx->hc_port;
+	int backlog = ctx->hc_backlog;
+	const char *ip = ctx->hc_addr.s_str;
+
+	fd = plm_comm_open(PLM_COMM_TCP, NULL, 0, 0, port, ip, backlog, 1,
+					   PLM_COMM_REUSEADDR | PLM_COMM_REUSEPORT);
+	if (fd < 0) {
+		PLM_FATAL("can't open http plugin listen fd: %s:%d", ip, port);
+		return (-1);
+	}
+
+	if (plm_event_io_read(fd, ctx, plm_http_accept)) {
+		PLM_FATAL("plm_event_io_read failed on listen fd: %s",
+				  strerror(errno));
+		plm_comm_close(fd);
+		return (-1);
+	}
+
+	http_thrd_server = fd;
+	return (0);
+}
+
+int plm_http_close_thrd_server()
+{
+	int err = 0;
+
+	if (http_thrd_server > 0) {
+		err = plm_comm_close(http_thrd_server);
+		http_thrd_server = -1;
+	}
+
 	return (err);
 }
 
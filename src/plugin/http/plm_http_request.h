@@ -26,6 +26,7 @@
 #ifndef _PLM_HTTP_REQUEST_H
 #define _PLM_HTTP_REQUEST_H
 
+#include "plm_http.h"
 #include "plm_http_plugin.h"
 
 #ifdef __cplusplus
@@ -36,6 +37,57 @@ int plm_http_open_server(struct plm_http_ctx *ctx);
 
 int plm_http_close_server();
 
+/* open the listen fd of the current work thread with SO_REUSEPORT */
+int plm_http_open_thrd_server(struct plm_http_ctx *ctx);
+
+int plm_http_close_thrd_server();
+
+/* find the first value of a request header field
+ * @r -- request
+ * @name -- field name, case insensitive
+ * @len -- length of name
+ * return the value or NULL
+ */
+const plm_string_t *
+plm_http_req_field(struct plm_http_req *r, const char *name, size_t len);
+
+/* the request writes to the client, the ones behind it queue */
+#define plm_http_req_front(r) \
+	(PLM_LIST_FRONT(&(r)->hr_conn->hc_reqs) == &(r)->hr_node)
+
+/* the output of a request, the one in front of the connection writes
+ * to the client, the ones behind queue until it is done
+ * @r -- the request
+ */
+struct plm_http_wrevt *plm_http_req_out(struct plm_http_req *r);
+
+/* write the output queued if the request is in front
+ * @r -- the request
+ */
+void plm_http_req_flush(struct plm_http_req *r);
+
+/* the whole response is queued, the request is done once it is written
+ * @r -- the request
+ */
+void plm_http_req_done(struct plm_http_req *r);
+
+/* relaying the request failed, the client gets an error reply if no
+ * response header was sent, otherwise what was queued and a close
+ * @r -- the request
+ * @err -- enum plm_http_err
+ */
+void plm_http_req_error(struct plm_http_req *r, int err);
+
+/* relay the request to a backend, or reply an error if there is none
+ * @r -- the request
+ */
+void plm_http_req_fetch(struct plm_http_req *r);
+
+/* the backend output is drained, go on reading the request body
+ * @r -- the request, only the last one of the connection reads it
+ */
+void plm_http_req_body_resume(struct plm_http_req *r);
+
 #ifdef __cplusplus
 }
 #endif
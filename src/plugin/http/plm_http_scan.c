@@ -0,0 +1,159 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include "plm_http_scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define PLM_HTTP_SCAN_X86
+#include <immintrin.h>
+#endif
+
+#define PLM_SCAN_ONES 0x0101010101010101ULL
+#define PLM_SCAN_HIGHS 0x8080808080808080ULL
+
+/* nonzero if a byte of w is zero, the borrow only spreads above the
+ * first zero byte so the test itself is exact
+ */
+#define PLM_SCAN_ZERO(w) (((w) - PLM_SCAN_ONES) & ~(w) & PLM_SCAN_HIGHS)
+
+enum plm_scan_type {
+	PLM_SCAN_WORD,
+	PLM_SCAN_SSE42,
+	PLM_SCAN_AVX2
+};
+
+static const char *plm_http_scan_word(const char *, const char *, char, char);
+#ifdef PLM_HTTP_SCAN_X86
+static const char *plm_http_scan_sse42(const char *, const char *, char, char);
+static const char *plm_http_scan_avx2(const char *, const char *, char, char);
+#endif
+
+static const struct plm_http_scanner scanners[] = {
+	{ "word", plm_http_scan_word },
+#ifdef PLM_HTTP_SCAN_X86
+	{ "sse4.2", plm_http_scan_sse42 },
+	{ "avx2", plm_http_scan_avx2 }
+#endif
+};
+
+const struct plm_http_scanner *plm_http_scanner = &scanners[PLM_SCAN_WORD];
+
+/* pick the widest scanner the cpu supports, falls back to the word at
+ * a time one on other architectures
+ */
+void plm_http_scan_init()
+{
+#ifdef PLM_HTTP_SCAN_X86
+	/* cpuid, and xgetbv for the ymm state of avx2 */
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		plm_http_scanner = &scanners[PLM_SCAN_AVX2];
+	else if (__builtin_cpu_supports("sse4.2"))
+		plm_http_scanner = &scanners[PLM_SCAN_SSE42];
+	else
+#endif
+		plm_http_scanner = &scanners[PLM_SCAN_WORD];
+}
+
+/* 8 bytes a time, also scans the tails shorter than a vector */
+static const char *
+plm_http_scan_word(const char *p, const char *end, char a, char b)
+{
+	uint64_t ma = PLM_SCAN_ONES * (uint8_t)a;
+	uint64_t mb = PLM_SCAN_ONES * (uint8_t)b;
+
+	for (; end - p >= 8; p += 8) {
+		uint64_t w = plm_http_word(p);
+
+		if (PLM_SCAN_ZERO(w ^ ma) | PLM_SCAN_ZERO(w ^ mb))
+			break;
+	}
+
+	for (; p < end; p++) {
+		if (*p == a || *p == b)
+			return (p);
+	}
+
+	return (end);
+}
+
+#ifdef PLM_HTTP_SCAN_X86
+
+#define PLM_SCAN_SIDD \
+	(_SIDD_UBYTE_OPS | _SIDD_CMP_EQUAL_ANY | _SIDD_LEAST_SIGNIFICANT)
+
+/* 16 bytes a time, the set of a and b is compared with every byte by
+ * one pcmpestri
+ */
+__attribute__((target("sse4.2"))) static const char *
+plm_http_scan_sse42(const char *p, const char *end, char a, char b)
+{
+	__m128i set = _mm_setr_epi8(a, b, 0, 0, 0, 0, 0, 0,
+								0, 0, 0, 0, 0, 0, 0, 0);
+	int i;
+
+	for (; end - p >= 16; p += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+
+		i = _mm_cmpestri(set, 2, v, 16, PLM_SCAN_SIDD);
+		if (i < 16)
+			return (p + i);
+	}
+
+	return (plm_http_scan_word(p, end, a, b));
+}
+
+/* 32 bytes a time, then one 16 bytes step before the tail */
+__attribute__((target("avx2"))) static const char *
+plm_http_scan_avx2(const char *p, const char *end, char a, char b)
+{
+	__m256i va = _mm256_set1_epi8(a);
+	__m256i vb = _mm256_set1_epi8(b);
+	uint32_t m;
+
+	for (; end - p >= 32; p += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)p);
+
+		m = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, va),
+												 _mm256_cmpeq_epi8(v, vb)));
+		if (m)
+			return (p + __builtin_ctz(m));
+	}
+
+	if (end - p >= 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+
+		m = _mm_movemask_epi8(
+			_mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(va)),
+						 _mm_cmpeq_epi8(v, _mm256_castsi256_si128(vb))));
+		if (m)
+			return (p + __builtin_ctz(m));
+		p += 16;
+	}
+
+	return (plm_http_scan_word(p, end, a, b));
+}
+
+#endif
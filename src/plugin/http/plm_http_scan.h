@@ -0,0 +1,69 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef _PLM_HTTP_SCAN_H
+#define _PLM_HTTP_SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* a delimiter scanner of the parser, the vector ones are picked at
+ * startup when the cpu has them
+ */
+struct plm_http_scanner {
+	const char *sc_name;
+
+	/* find the first byte equal to a or b in [p, end)
+	 * return its position, or end if there is none
+	 */
+	const char *(*sc_find)(const char *p, const char *end, char a, char b);
+};
+
+/* an unaligned load of 8 bytes, the parser matches methods and versions
+ * by comparing words
+ */
+typedef uint64_t plm_http_word_t __attribute__((__may_alias__, __aligned__(1)));
+
+#define plm_http_word(p) (*(const plm_http_word_t *)(p))
+
+extern const struct plm_http_scanner *plm_http_scanner;
+
+#define plm_http_scan(p, end, a, b) \
+	plm_http_scanner->sc_find(p, end, a, b)
+
+/* pick the widest scanner the cpu supports, falls back to the word at
+ * a time one on other architectures
+ */
+void plm_http_scan_init();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,291 @@
+/* Copyright (c) 2013 Xingxing Ke <yykxx@hotmail.com>
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHORS OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/* plm_logdump file ...
+ * render the log files written with "log_format binary" as text, the
+ * output is the same as the text format
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "plm_log.h"
+
+#define PLM_LOGDUMP_FMT_MAX 4096
+#define PLM_LOGDUMP_LINE_MAX 8192
+
+struct plm_logdump_fmt {
+	char *lf_fmt;
+	int lf_nargs;
+	uint8_t lf_types[PLM_LOG_ARG_MAX];
+};
+
+/* formats defined in the current file */
+static struct plm_logdump_fmt fmts[PLM_LOGDUMP_FMT_MAX];
+
+static void plm_logdump_reset();
+static void plm_logdump_date(char *out, size_t size, uint64_t ms);
+static int plm_logdump_msg(char *out, size_t size,
+						   struct plm_logdump_fmt *f,
+						   const char *p, size_t len);
+static int plm_logdump_file(const char *path);
+
+int main(int argc, char **argv)
+{
+	int i, err = 0;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s file ...\n", argv[0]);
+		return (1);
+	}
+
+	for (i = 1; i < argc; i++)
+		err |= plm_logdump_file(argv[i]);
+
+	return (err ? 1 : 0);
+}
+
+static void plm_logdump_reset()
+{
+	int i;
+
+	for (i = 0; i < PLM_LOGDUMP_FMT_MAX; i++) {
+		free(fmts[i].lf_fmt);
+		fmts[i].lf_fmt = NULL;
+	}
+}
+
+static void plm_logdump_date(char *out, size_t size, uint64_t ms)
+{
+	struct tm t;
+	time_t sec = ms / 1000;
+	size_t n = 0;
+
+	if (localtime_r(&sec, &t))
+		n = strftime(out, size, "%Y/%m/%d %X", &t);
+	snprintf(out + n, size - n, ".%03d", (int)(ms % 1000));
+}
+
+/* format one conversion with its width and precision arguments */
+#define PLM_LOGDUMP_ONE(value)											\
+	do {																\
+		if (nstar == 0)													\
+			n = snprintf(out, size, spec, value);						\
+		else if (nstar == 1)											\
+			n = snprintf(out, size, spec, stars[0], value);				\
+		else															\
+			n = snprintf(out, size, spec, stars[0], stars[1], value);	\
+	} while (0)
+
+/* render a PLM_LOG_REC_MSG payload
+ * return the length of the message, -1 if the payload is broken
+ */
+static int
+plm_logdump_msg(char *out, size_t size, struct plm_logdump_fmt *f,
+				const char *p, size_t len)
+{
+	const char *s, *end = p + len;
+	char spec[32], str[PLM_LOGDUMP_LINE_MAX];
+	int arg = 0, nstar, stars[2], n;
+	size_t used = 0, k;
+	uint64_t v;
+	uint16_t slen;
+	double d;
+
+	for (s = f->lf_fmt; *s && used + 1 < size; s++) {
+		if (*s != '%') {
+			out[used++] = *s;
+			continue;
+		}
+
+		if (s[1] == '%') {
+			out[used++] = '%';
+			s++;
+			continue;
+		}
+
+		/* copy the conversion, take the '*' arguments first */
+		k = 0;
+		nstar = 0;
+		spec[k++] = *s++;
+		for (; *s && strchr("-+ #0123456789.*hlzjtL", *s); s++) {
+			if (k + 2 >= sizeof(spec))
+				return (-1);
+			if (*s == '*') {
+				if (nstar == 2 || arg >= f->lf_nargs || p + 8 > end)
+					return (-1);
+				memcpy(&v, p, sizeof(v));
+				p += sizeof(v);
+				arg++;
+				stars[nstar++] = (int)v;
+			}
+			spec[k++] = *s;
+		}
+		spec[k++] = *s;
+		spec[k] = '\0';
+
+		if (arg >= f->lf_nargs)
+			return (-1);
+
+		if (f->lf_types[arg] == PLM_LOG_ARG_STR) {
+			if (p + sizeof(slen) > end)
+				return (-1);
+			memcpy(&slen, p, sizeof(slen));
+			p += sizeof(slen);
+			if (p + slen > end || slen >= sizeof(str))
+				return (-1);
+			memcpy(str, p, slen);
+			str[slen] = '\0';
+			p += slen;
+			v = 0;
+		} else {
+			if (p + sizeof(v) > end)
+				return (-1);
+			memcpy(&v, p, sizeof(v));
+			p += sizeof(v);
+		}
+
+		out += used;
+		size -= used;
+		used = 0;
+
+		switch (f->lf_types[arg++]) {
+		case PLM_LOG_ARG_INT:
+			PLM_LOGDUMP_ONE((int)v);
+			break;
+		case PLM_LOG_ARG_LONG:
+			PLM_LOGDUMP_ONE((long)v);
+			break;
+		case PLM_LOG_ARG_LLONG:
+			PLM_LOGDUMP_ONE((long long)v);
+			break;
+		case PLM_LOG_ARG_SIZE:
+			PLM_LOGDUMP_ONE((size_t)v);
+			break;
+		case PLM_LOG_ARG_DOUBLE:
+			memcpy(&d, &v, sizeof(d));
+			PLM_LOGDUMP_ONE(d);
+			break;
+		case PLM_LOG_ARG_PTR:
+			PLM_LOGDUMP_ONE((void *)(uintptr_t)v);
+			break;
+		case PLM_LOG_ARG_STR:
+			PLM_LOGDUMP_ONE(str);
+			break;
+		default:
+			return (-1);
+		}
+
+		if (n < 0)
+			return (-1);
+		if ((size_t)n >= size)
+			n = size - 1;
+		out += n;
+		size -= n;
+
+		if (!*s)
+			break;
+	}
+
+	out[used] = '\0';
+	return (0);
+}
+
+static int plm_logdump_file(const char *path)
+{
+	FILE *fp;
+	struct plm_log_rec rec;
+	struct plm_logdump_fmt *f;
+	char magic[PLM_LOG_MAGIC_LEN];
+	char date[64], payload[UINT16_MAX + 1], msg[PLM_LOGDUMP_LINE_MAX];
+	size_t len;
+	uint64_t dropped;
+	int err = 0;
+
+	fp = fopen(path, "rb");
+	if (!fp) {
+		perror(path);
+		return (-1);
+	}
+
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic)
+		|| memcmp(magic, PLM_LOG_MAGIC, PLM_LOG_MAGIC_LEN)) {
+		fprintf(stderr, "%s: not a binary log file\n", path);
+		fclose(fp);
+		return (-1);
+	}
+
+	plm_logdump_reset();
+	while (fread(&rec, 1, sizeof(rec), fp) == sizeof(rec)) {
+		if (rec.lr_len < sizeof(rec)) {
+			fprintf(stderr, "%s: broken record\n", path);
+			err = -1;
+			break;
+		}
+
+		/* the last record could be cut if plume was killed */
+		len = rec.lr_len - sizeof(rec);
+		if (fread(payload, 1, len, fp) != len)
+			break;
+		payload[len] = '\0';
+
+		plm_logdump_date(date, sizeof(date), rec.lr_ms);
+		switch (rec.lr_type) {
+		case PLM_LOG_REC_DEF:
+			f = &fmts[rec.lr_fmt % PLM_LOGDUMP_FMT_MAX];
+			free(f->lf_fmt);
+			f->lf_fmt = strdup(payload);
+			f->lf_nargs = plm_log_fmt_args(payload, f->lf_types, NULL,
+										   PLM_LOG_ARG_MAX);
+			break;
+
+		case PLM_LOG_REC_MSG:
+			f = &fmts[rec.lr_fmt % PLM_LOGDUMP_FMT_MAX];
+			if (!f->lf_fmt || f->lf_nargs != rec.lr_nargs
+				|| plm_logdump_msg(msg, sizeof(msg), f, payload, len)) {
+				snprintf(msg, sizeof(msg), "<undecodable format %d>",
+						 rec.lr_fmt);
+			}
+			printf("%s %s: %s\n", date, plm_log_tag(rec.lr_level), msg);
+			break;
+
+		case PLM_LOG_REC_TEXT:
+			printf("%s %s: %s\n", date, plm_log_tag(rec.lr_level), payload);
+			break;
+
+		case PLM_LOG_REC_DROP:
+			memcpy(&dropped, payload, sizeof(dropped));
+			printf("%s %s: %llu log messages dropped\n", date,
+				   plm_log_tag(rec.lr_level), (unsigned long long)dropped);
+			break;
+		}
+	}
+
+	fclose(fp);
+	return (err);
+}